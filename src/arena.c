@@ -0,0 +1,69 @@
+#include "arena.h"
+#include "common.h"
+#include <assert.h>
+#include <stdint.h>
+#include <sys/mman.h>
+
+void Arena_init(Arena *a, uint8_t *base, size_t reserve) {
+  *a = (Arena){
+    .base = base,
+    .reserved = reserve,
+  };
+}
+
+void Arena_reserve(Arena *a, size_t reserve) {
+  uint8_t *base = mmap(0, reserve, PROT_NONE,
+      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  assert(base != MAP_FAILED);
+  Arena_init(a, base, reserve);
+}
+
+void Arena_release(Arena *a) {
+  int err = munmap(a->base, a->reserved);
+  assert(!err);
+  *a = (Arena){0};
+}
+
+// note: The arrays of a single type are never padded,
+// so they can still be indexed across the pushes
+void *Arena_push(Arena *a, size_t size, size_t align) {
+  size_t start = (a->size + align - 1) & ~(align - 1);
+  size_t end = start + size;
+  if (end > a->committed) {
+    assert(end <= a->reserved);
+    size_t commit = (end + ARENA_CHUNK - 1) & ~(ARENA_CHUNK - 1);
+    commit = MIN(commit, a->reserved);
+    int err = mprotect(a->base + a->committed, commit - a->committed,
+        PROT_READ | PROT_WRITE);
+    assert(!err);
+    a->committed = commit;
+  }
+  void *ptr = a->base + start;
+  a->size = end;
+  return ptr;
+}
+
+// note: Keeps the pages committed, they're gonna be reused
+void Arena_reset(Arena *a) {
+  a->size = 0;
+}
+
+void Arenas_init(Arenas *a) {
+  size_t total = ARENA_RESERVE * ARENA_COUNT;
+  a->base = mmap(0, total, PROT_NONE,
+      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  assert(a->base != MAP_FAILED);
+  for (int i = 0; i < ARENA_COUNT; ++i) {
+    Arena_init(&a->arenas[i], a->base + ARENA_RESERVE * i, ARENA_RESERVE);
+  }
+}
+
+void Arenas_reset(Arenas *a) {
+  for (int i = 0; i < ARENA_COUNT; ++i) Arena_reset(&a->arenas[i]);
+}
+
+void Arenas_free(Arenas *a) {
+  int err = munmap(a->base, ARENA_RESERVE * ARENA_COUNT);
+  assert(!err);
+  *a = (Arenas){0};
+}
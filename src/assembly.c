@@ -1,62 +1,587 @@
 #include "assembly.h"
+#include "common.h"
 #include "inst.h"
+#include "arena.h"
+#include "intern.h"
+#include "regalloc.h"
+#include "x86.h"
 #include <assert.h>
 #include <stdint.h>
 #include <stdio.h>
 
-#define REGISTER_COUNT 8
-const char *REGISTERS[REGISTER_COUNT] = { "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15" };
+#define ARG_REGISTER_COUNT 6
+static const uint8_t ARG_REGISTERS[ARG_REGISTER_COUNT] = {
+  REG_RDI, REG_RSI, REG_RDX, REG_RCX, REG_R8, REG_R9,
+};
 
+// in the order of the comparisons
+static const uint8_t SETCC_SIGNED[] = { CC_E, CC_NE, CC_L, CC_LE, CC_G, CC_GE };
+static const uint8_t SETCC_UNSIGNED[] = { CC_E, CC_NE, CC_B, CC_BE, CC_A, CC_AE };
+// the same ones, with the operands swapped
+static const uint8_t COMPARE_SWAPPED[] = { INST_EQ, INST_NE, INST_GT, INST_GE, INST_LT, INST_LE };
+
+// note: The values live where the register allocator put them, the
+// constants are put into the instructions. A result is computed in
+// its own register, or in rax, when it's spilled. The values are
+// kept extended to the 64 bits, by their signedness, so only the
+// result has to be fixed up. Rax, rcx and rdx are never allocated,
+// they hold the temporaries.
 typedef struct {
-  const Inst *insts;
-  uint16_t pos;
-  uint8_t free_registers[REGISTER_COUNT];
-  uint8_t free_registers_len;
-  uint8_t inst2reg[MAX_INSTRUCTIONS];
-  // TODO: what's a good name for this?
+  Arena *code; // of the instructions, nothing else is pushed there
+  const Ir *ir;
+  const RegAlloc *ra;
+  BlockId block;
+  // of every value, the number of the instructions, that use it
+  uint32_t *uses;
+  // the values, that the tile of their user computes, see Generator_select
+  bool *folded;
+  uint32_t saved; // the number of the callee saved registers
+  uint32_t frame; // the size of the spill slots, aligned
 } Generator;
 
-uint8_t alloc_register(Generator *g) {
-  assert(g->free_registers_len);
-  return g->free_registers[--g->free_registers_len];
+static void Generator_emit(Generator *g, X86Op op, X86Operand a, X86Operand b) {
+  *ARENA_PUSH(g->code, X86Inst, 1) = (X86Inst){ .op = op, .a = a, .b = b };
+}
+
+static void Generator_cond(Generator *g, X86Op op, uint32_t cc, X86Operand a) {
+  *ARENA_PUSH(g->code, X86Inst, 1) = (X86Inst){ .op = op, .cc = cc, .a = a };
+}
+
+static inline X86Operand Generator_none(void) {
+  return (X86Operand){0};
+}
+
+static inline X86Operand Generator_reg(uint32_t reg) {
+  return X86_reg(reg, 8);
+}
+
+static int64_t Generator_const(Generator *g, ValueId value) {
+  const Inst *inst = &g->ir->insts[value];
+  return inst->type == INST_CONST ? Inst_const(*inst) : 0;
+}
+
+// Of the constants, that don't fit an immediate
+static bool Generator_wide(Generator *g, ValueId value) {
+  if (g->ra->locs[value] != LOC_CONST) return false;
+  int64_t c = Generator_const(g, value);
+  return c != (int32_t)c;
+}
+
+// The value at the location, which is its own one,
+// or the register, that it was loaded to
+static X86Operand Generator_operand(Generator *g, ValueId value, uint32_t loc) {
+  if (loc < LOC_SLOT) return Generator_reg(loc);
+  if (loc == LOC_CONST) return X86_imm(Generator_const(g, value));
+  return X86_mem(REG_RBP, -(int32_t)(g->saved + 1 + loc - LOC_SLOT) * 8, 8);
+}
+
+// Loads the constants, that don't fit an immediate, to the register
+static uint32_t Generator_source(Generator *g, ValueId value, uint32_t reg) {
+  if (!Generator_wide(g, value)) return g->ra->locs[value];
+  Generator_emit(g, X86_MOV, Generator_reg(reg), X86_imm(Generator_const(g, value)));
+  return reg;
+}
+
+static void Generator_mov(Generator *g, uint32_t reg, ValueId value) {
+  uint32_t loc = g->ra->locs[value];
+  if (loc == reg) return;
+  int64_t c = Generator_const(g, value);
+  if (loc == LOC_CONST && !c) {
+    Generator_emit(g, X86_XOR, X86_reg(reg, 4), X86_reg(reg, 4));
+  } else if (loc == LOC_CONST && c > 0 && c <= UINT32_MAX) {
+    // the upper half is cleared anyway
+    Generator_emit(g, X86_MOV, X86_reg(reg, 4), X86_imm(c));
+  } else {
+    Generator_emit(g, X86_MOV, Generator_reg(reg), Generator_operand(g, value, loc));
+  }
+}
+
+// The register, that the result is computed in
+static uint32_t Generator_target(Generator *g, ValueId value) {
+  uint32_t loc = g->ra->locs[value];
+  return loc < LOC_SLOT ? loc : REG_RAX;
+}
+
+static void Generator_result(Generator *g, ValueId value, uint32_t reg) {
+  uint32_t loc = g->ra->locs[value];
+  if (loc == LOC_NONE || loc == reg) return;
+  Generator_emit(g, X86_MOV, Generator_operand(g, value, loc), Generator_reg(reg));
 }
 
-void free_register(Generator *g, uint8_t reg) {
-  assert(g->free_registers_len < REGISTER_COUNT);
-  g->free_registers[g->free_registers_len++] = reg;
+static void Generator_push(Generator *g, ValueId value) {
+  uint32_t loc = Generator_source(g, value, REG_RAX);
+  Generator_emit(g, X86_PUSH, Generator_operand(g, value, loc), Generator_none());
 }
 
-uint8_t generate_inst(Generator *g) {
-  Inst inst = g->insts[g->pos];
-  switch (inst.type) {
-    case INST_INT:
-      uint8_t reg = alloc_register(g);
-      printf("  mov %s, %d\n", REGISTERS[reg], inst.a | (inst.b << 16));
-      g->inst2reg[g->pos] = reg;
-      g->pos++;
+// Extends the low bits of the register by the type
+static void Generator_extend(Generator *g, uint32_t reg, DataType type) {
+  X86Operand r64 = X86_reg(reg, 8), r32 = X86_reg(reg, 4);
+  X86Operand r16 = X86_reg(reg, 2), r8 = X86_reg(reg, 1);
+  switch (type) {
+    case DATA_CHAR: Generator_emit(g, X86_MOVSX, r64, r8); break;
+    case DATA_UCHAR: case DATA_BOOL: Generator_emit(g, X86_MOVZX, r32, r8); break;
+    case DATA_SHORT_INT: Generator_emit(g, X86_MOVSX, r64, r16); break;
+    case DATA_SHORT_UINT: Generator_emit(g, X86_MOVZX, r32, r16); break;
+    case DATA_INT: Generator_emit(g, X86_MOVSXD, r64, r32); break;
+    case DATA_UINT: Generator_emit(g, X86_MOV, r32, r32); break;
+    default: break;
+  }
+}
+
+static void Generator_label(Generator *g, uint32_t label) {
+  Generator_emit(g, X86_LABEL, X86_label(label), Generator_none());
+}
+
+// The phis of the block, and the index of the current one in its preds
+static ValueId Generator_phis(Generator *g, BlockId to, uint32_t *index) {
+  const Ir *ir = g->ir;
+  const Block *b = &ir->blocks[to];
+  *index = 0;
+  while (ir->preds[b->preds + *index] != g->block) (*index)++;
+  ValueId end = b->start;
+  while (end < b->start + b->len && ir->insts[end].type == INST_PHI) end++;
+  return end;
+}
+
+// Of the phis, that aren't in the place of their operand
+static bool Generator_copies(Generator *g, BlockId to) {
+  const uint32_t *locs = g->ra->locs;
+  uint32_t index;
+  ValueId end = Generator_phis(g, to, &index);
+  for (ValueId phi = g->ir->blocks[to].start; phi < end; ++phi) {
+    ValueId arg = g->ir->args[g->ir->insts[phi].b + index];
+    if (locs[phi] != LOC_NONE && locs[phi] != locs[arg]) return true;
+  }
+  return false;
+}
+
+static void Generator_copy(Generator *g, ValueId phi, ValueId arg) {
+  uint32_t loc = g->ra->locs[phi];
+  if (loc < LOC_SLOT) {
+    Generator_mov(g, loc, arg);
+    return;
+  }
+  uint32_t source = g->ra->locs[arg];
+  // there's no move from memory to memory
+  if (source == LOC_CONST ? Generator_wide(g, arg) : source >= LOC_SLOT) {
+    Generator_mov(g, REG_RAX, arg);
+    source = REG_RAX;
+  }
+  Generator_emit(g, X86_MOV, Generator_operand(g, phi, loc), Generator_operand(g, arg, source));
+}
+
+static void Generator_pop(Generator *g, ValueId phi) {
+  Generator_emit(g, X86_POP, Generator_operand(g, phi, g->ra->locs[phi]), Generator_none());
+}
+
+// note: The copies of the phis are parallel, one can be the operand
+// of another one. A copy goes, when no other one reads its place,
+// the ones in a cycle go through the stack, and all of them, when
+// there are too many to order. Only the last edge of the block can
+// fall through.
+#define EDGE_COPIES 32
+static void Generator_edge(Generator *g, BlockId to, bool last) {
+  const Ir *ir = g->ir;
+  const uint32_t *locs = g->ra->locs;
+  uint32_t index;
+  ValueId start = ir->blocks[to].start, end = Generator_phis(g, to, &index);
+  ValueId phis[EDGE_COPIES], args[EDGE_COPIES];
+  uint32_t count = 0;
+  bool all = false;
+  for (ValueId phi = start; phi < end; ++phi) {
+    ValueId arg = ir->args[ir->insts[phi].b + index];
+    if (locs[phi] == LOC_NONE || locs[phi] == locs[arg]) continue;
+    if (count == EDGE_COPIES) {
+      all = true;
       break;
-    case INST_ADD:
-      uint8_t left = g->inst2reg[inst.a];
-      uint8_t right = g->inst2reg[inst.b];
-      free_register(g, right);
-      printf("  add %s, %s\n", REGISTERS[left], REGISTERS[right]);
-      g->inst2reg[g->pos] = left;
-      g->pos++;
-    default:
+    }
+    phis[count] = phi;
+    args[count++] = arg;
+  }
+  if (all) {
+    for (ValueId phi = start; phi < end; ++phi) {
+      ValueId arg = ir->args[ir->insts[phi].b + index];
+      if (locs[phi] != LOC_NONE && locs[phi] != locs[arg]) Generator_push(g, arg);
+    }
+    for (ValueId phi = end; phi-- > start;) {
+      ValueId arg = ir->args[ir->insts[phi].b + index];
+      if (locs[phi] != LOC_NONE && locs[phi] != locs[arg]) Generator_pop(g, phi);
+    }
+    count = 0;
+  }
+  while (count) {
+    uint32_t i = 0, j = 0;
+    for (; i < count; ++i) {
+      for (j = 0; j < count && (j == i || locs[args[j]] != locs[phis[i]]); ++j);
+      if (j == count) break;
+    }
+    if (i == count) break;
+    Generator_copy(g, phis[i], args[i]);
+    phis[i] = phis[--count];
+    args[i] = args[count];
+  }
+  for (uint32_t i = 0; i < count; ++i) Generator_push(g, args[i]);
+  for (uint32_t i = count; i-- > 0;) Generator_pop(g, phis[i]);
+  // the next block follows anyway
+  if (last && to == g->block + 1) return;
+  Generator_emit(g, X86_JMP, X86_label(to << 1), Generator_none());
+}
+
+static void Generator_return(Generator *g) {
+  if (!g->saved) {
+    if (g->frame) Generator_emit(g, X86_LEAVE, Generator_none(), Generator_none());
+    else Generator_emit(g, X86_POP, Generator_reg(REG_RBP), Generator_none());
+    Generator_emit(g, X86_RET, Generator_none(), Generator_none());
+    return;
+  }
+  if (g->frame) {
+    Generator_emit(g, X86_LEA, Generator_reg(REG_RSP), X86_mem(REG_RBP, -(int32_t)g->saved * 8, 8));
+  }
+  for (uint32_t reg = REG_COUNT; reg-- > 0;) {
+    if (g->ra->callee_saved >> reg & 1) Generator_emit(g, X86_POP, Generator_reg(reg), Generator_none());
+  }
+  Generator_emit(g, X86_POP, Generator_reg(REG_RBP), Generator_none());
+  Generator_emit(g, X86_RET, Generator_none(), Generator_none());
+}
+
+static void Generator_call(Generator *g, const Inst *inst, SymId callee) {
+  const ValueId *args = g->ir->args + inst->b;
+  const uint32_t *locs = g->ra->locs;
+  uint32_t stack = inst->count > ARG_REGISTER_COUNT ? inst->count - ARG_REGISTER_COUNT : 0;
+  // the stack is aligned to 16 bytes at the call
+  if (stack & 1) Generator_emit(g, X86_SUB, Generator_reg(REG_RSP), X86_imm(8));
+  for (uint32_t i = inst->count; i > ARG_REGISTER_COUNT; --i) Generator_push(g, args[i - 1]);
+  uint32_t count = inst->count - stack;
+  // an argument can be in the register of an earlier one
+  bool parallel = false;
+  for (uint32_t i = 0; i < count; ++i) {
+    for (uint32_t j = i + 1; j < count; ++j) parallel |= locs[args[j]] == ARG_REGISTERS[i];
+  }
+  for (uint32_t i = 0; i < count; ++i) {
+    if (parallel) Generator_push(g, args[i]);
+    else Generator_mov(g, ARG_REGISTERS[i], args[i]);
+  }
+  for (uint32_t i = count; parallel && i-- > 0;) {
+    Generator_emit(g, X86_POP, Generator_reg(ARG_REGISTERS[i]), Generator_none());
+  }
+  // no vector registers for the variadic ones
+  Generator_emit(g, X86_XOR, X86_reg(REG_RAX, 4), X86_reg(REG_RAX, 4));
+  Generator_emit(g, X86_CALL, X86_symbol(callee), Generator_none());
+  if (stack) Generator_emit(g, X86_ADD, Generator_reg(REG_RSP), X86_imm((stack + (stack & 1)) * 8));
+}
+
+// The log of the scale, when the value is a register times 2, 4 or
+// 8, that fits the index of an address, zero otherwise
+static uint32_t Generator_scale(Generator *g, ValueId value, ValueId *index) {
+  const Inst *inst = &g->ir->insts[value];
+  const uint32_t *locs = g->ra->locs;
+  if ((inst->type != INST_SHL && inst->type != INST_MUL)
+      || locs[inst->a] >= LOC_SLOT || locs[inst->b] != LOC_CONST) {
+    return 0;
+  }
+  int64_t c = Generator_const(g, inst->b);
+  *index = inst->a;
+  if (inst->type == INST_SHL) return c >= 1 && c <= 3 ? c : 0;
+  return c == 2 ? 1 : c == 4 ? 2 : c == 8 ? 3 : 0;
+}
+
+// note: The lea adds without touching its operands, so it saves the
+// move to the register of the result, and it takes the scaled one
+// of the shift or the multiplication right before it. The values
+// are fixed up to their type afterwards, like the other results.
+static bool Generator_lea(Generator *g, ValueId value, uint32_t reg) {
+  const Inst *inst = &g->ir->insts[value];
+  const uint32_t *locs = g->ra->locs;
+  ValueId a = inst->a, b = inst->b, index;
+  if (inst->type == INST_ADD && (g->folded[a] || g->folded[b])) {
+    if (g->folded[a]) {
+      a = inst->b;
+      b = inst->a;
+    }
+    uint32_t scale = Generator_scale(g, b, &index);
+    Generator_emit(g, X86_LEA, Generator_reg(reg), X86_indexed(locs[a], locs[index], scale, 0, 8));
+    return true;
+  }
+  if (locs[a] >= LOC_SLOT) return false;
+  int64_t c = Generator_const(g, b);
+  if (inst->type == INST_MUL && locs[b] == LOC_CONST && (c == 2 || c == 3 || c == 5 || c == 9)) {
+    // a plus a times 1, 2, 4 or 8
+    uint32_t scale = c == 2 ? 0 : c == 3 ? 1 : c == 5 ? 2 : 3;
+    Generator_emit(g, X86_LEA, Generator_reg(reg), X86_indexed(locs[a], locs[a], scale, 0, 8));
+    return true;
+  }
+  if (locs[a] == reg || locs[b] == reg) return false;
+  if (inst->type == INST_SUB) c = -(uint64_t)c;
+  if (locs[b] == LOC_CONST && (inst->type == INST_ADD || inst->type == INST_SUB) && c == (int32_t)c) {
+    Generator_emit(g, X86_LEA, Generator_reg(reg), X86_mem(locs[a], c, 8));
+    return true;
+  }
+  if (locs[b] < LOC_SLOT && inst->type == INST_ADD) {
+    Generator_emit(g, X86_LEA, Generator_reg(reg), X86_indexed(locs[a], locs[b], 0, 0, 8));
+    return true;
+  }
+  return false;
+}
+
+static void Generator_binary(Generator *g, ValueId value) {
+  const Inst *inst = &g->ir->insts[value];
+  const uint32_t *locs = g->ra->locs;
+  ValueId a = inst->a, b = inst->b;
+  uint32_t reg = Generator_target(g, value);
+  if (Generator_lea(g, value, reg)) {
+    Generator_extend(g, reg, inst->data_type);
+    Generator_result(g, value, reg);
+    return;
+  }
+  if (inst->type != INST_SUB && locs[b] == reg && locs[a] != reg) {
+    a = inst->b;
+    b = inst->a;
+  }
+  // it would be overwritten, before it's read
+  if (locs[b] == reg && locs[a] != reg) reg = REG_RAX;
+  uint32_t source = Generator_source(g, b, REG_RCX);
+  Generator_mov(g, reg, a);
+  X86Op op = inst->type == INST_ADD ? X86_ADD : inst->type == INST_SUB ? X86_SUB
+    : inst->type == INST_MUL ? X86_IMUL : inst->type == INST_AND ? X86_AND
+    : inst->type == INST_OR ? X86_OR : X86_XOR;
+  Generator_emit(g, op, Generator_reg(reg), Generator_operand(g, b, source));
+  Generator_extend(g, reg, inst->data_type);
+  Generator_result(g, value, reg);
+}
+
+// Sets the flags by the comparison and returns the condition, that
+// holds, when it's true. The constant goes to the right, as the
+// immediate, the comparison with zero is a test.
+static uint32_t Generator_compare(Generator *g, const Inst *inst) {
+  const uint32_t *locs = g->ra->locs;
+  const uint8_t *conds = DataType_unsigned(g->ir->insts[inst->a].data_type)
+    ? SETCC_UNSIGNED : SETCC_SIGNED;
+  ValueId a = inst->a, b = inst->b;
+  uint32_t type = inst->type;
+  if (locs[a] == LOC_CONST && locs[b] != LOC_CONST) {
+    a = inst->b;
+    b = inst->a;
+    type = COMPARE_SWAPPED[type - INST_EQ];
+  }
+  uint32_t reg = locs[a];
+  if (reg < LOC_SLOT && locs[b] == LOC_CONST && !Generator_const(g, b)) {
+    Generator_emit(g, X86_TEST, Generator_reg(reg), Generator_reg(reg));
+    return conds[type - INST_EQ];
+  }
+  uint32_t source = Generator_source(g, b, REG_RCX);
+  // one of them has to be a register
+  if (reg == LOC_CONST || (reg >= LOC_SLOT && source >= LOC_SLOT && source != LOC_CONST)) {
+    Generator_mov(g, REG_RAX, a);
+    reg = REG_RAX;
+  }
+  Generator_emit(g, X86_CMP, Generator_operand(g, a, reg), Generator_operand(g, b, source));
+  return conds[type - INST_EQ];
+}
+
+static void generate_inst(Generator *g, ValueId value) {
+  const Ir *ir = g->ir;
+  const Inst *inst = &ir->insts[value];
+  const uint32_t *locs = g->ra->locs;
+  DataType type = inst->data_type;
+  X86Op op;
+  uint32_t size, reg, source;
+  SymId var = 0;
+  if (g->folded[value]) return;
+  if (inst->type == INST_LOAD || inst->type == INST_STORE || inst->type == INST_CALL) {
+    var = ir->file->vars[inst->a].name;
+  }
+  switch (inst->type) {
+    case INST_CONST:
+    case INST_UNDEF:
+    case INST_PHI:
+      return;
+    case INST_ADD: case INST_SUB: case INST_MUL: case INST_AND: case INST_OR: case INST_XOR:
+      Generator_binary(g, value);
+      return;
+    case INST_DIV: case INST_MOD:
+      // there's no immediate divisor
+      source = locs[inst->b];
+      if (source == LOC_CONST) {
+        Generator_mov(g, REG_RCX, inst->b);
+        source = REG_RCX;
+      }
+      Generator_mov(g, REG_RAX, inst->a);
+      if (DataType_unsigned(type)) {
+        Generator_emit(g, X86_XOR, X86_reg(REG_RDX, 4), X86_reg(REG_RDX, 4));
+        Generator_emit(g, X86_DIV, Generator_operand(g, inst->b, source), Generator_none());
+      } else {
+        Generator_emit(g, X86_CQO, Generator_none(), Generator_none());
+        Generator_emit(g, X86_IDIV, Generator_operand(g, inst->b, source), Generator_none());
+      }
+      reg = inst->type == INST_MOD ? REG_RDX : REG_RAX;
+      break;
+    case INST_SHL: case INST_SHR:
+      reg = Generator_target(g, value);
+      op = inst->type == INST_SHL ? X86_SHL : DataType_unsigned(type) ? X86_SHR : X86_SAR;
+      if (locs[inst->b] == LOC_CONST) {
+        Generator_mov(g, reg, inst->a);
+        Generator_emit(g, op, Generator_reg(reg), X86_imm(Generator_const(g, inst->b) & 63));
+      } else {
+        Generator_mov(g, REG_RCX, inst->b);
+        Generator_mov(g, reg, inst->a);
+        Generator_emit(g, op, Generator_reg(reg), X86_reg(REG_RCX, 1));
+      }
+      break;
+    case INST_EQ: case INST_NE: case INST_LT: case INST_LE: case INST_GT: case INST_GE:
+      source = Generator_compare(g, inst);
+      reg = Generator_target(g, value);
+      Generator_cond(g, X86_SETCC, source, X86_reg(reg, 1));
+      type = DATA_BOOL;
+      break;
+    case INST_NEG: case INST_NOT:
+      reg = Generator_target(g, value);
+      Generator_mov(g, reg, inst->a);
+      Generator_emit(g, inst->type == INST_NEG ? X86_NEG : X86_NOT, Generator_reg(reg), Generator_none());
       break;
+    case INST_CAST:
+      reg = Generator_target(g, value);
+      Generator_mov(g, reg, inst->a);
+      if (type == DATA_BOOL) {
+        Generator_emit(g, X86_TEST, Generator_reg(reg), Generator_reg(reg));
+        Generator_cond(g, X86_SETCC, CC_NE, X86_reg(reg, 1));
+      }
+      break;
+    case INST_LOAD:
+      reg = Generator_target(g, value);
+      size = DataType_size(type);
+      if (size == 8 || (size == 4 && DataType_unsigned(type))) {
+        Generator_emit(g, X86_MOV, X86_reg(reg, size), X86_global(var, size));
+      } else {
+        op = size == 4 ? X86_MOVSXD : DataType_unsigned(type) ? X86_MOVZX : X86_MOVSX;
+        Generator_emit(g, op, X86_reg(reg, size == 4 || !DataType_unsigned(type) ? 8 : 4),
+            X86_global(var, size));
+      }
+      Generator_result(g, value, reg);
+      return;
+    case INST_STORE:
+      size = DataType_size(ir->file->vars[inst->a].type);
+      source = locs[inst->b];
+      if (source == LOC_CONST ? Generator_wide(g, inst->b) : source >= LOC_SLOT) {
+        Generator_mov(g, REG_RAX, inst->b);
+        source = REG_RAX;
+      }
+      Generator_emit(g, X86_MOV, X86_global(var, size), source < LOC_SLOT
+          ? X86_reg(source, size) : X86_imm(Generator_const(g, inst->b)));
+      return;
+    case INST_CALL:
+      Generator_call(g, inst, var);
+      if (locs[value] == LOC_NONE) return;
+      reg = REG_RAX;
+      break;
+    case INST_JUMP:
+      Generator_edge(g, ir->blocks[g->block].succs[0], true);
+      return;
+    case INST_BRANCH: {
+      const Block *b = &ir->blocks[g->block];
+      bool copies;
+      uint32_t cc = CC_NE;
+      if (locs[inst->a] == LOC_CONST) {
+        Generator_edge(g, b->succs[Generator_const(g, inst->a) ? 0 : 1], true);
+        return;
+      }
+      if (g->folded[inst->a]) {
+        cc = Generator_compare(g, &ir->insts[inst->a]);
+      } else if (locs[inst->a] < LOC_SLOT) {
+        X86Operand r = Generator_reg(locs[inst->a]);
+        Generator_emit(g, X86_TEST, r, r);
+      } else {
+        Generator_emit(g, X86_CMP, Generator_operand(g, inst->a, locs[inst->a]), X86_imm(0));
+      }
+      // an edge without copies jumps straight to its block
+      copies = Generator_copies(g, b->succs[1]);
+      if (!Generator_copies(g, b->succs[0]) && (copies || b->succs[1] == g->block + 1)) {
+        Generator_cond(g, X86_JCC, cc, X86_label(b->succs[0] << 1));
+        Generator_edge(g, b->succs[1], true);
+      } else if (!copies) {
+        // the conditions come in pairs, the odd one is the negation
+        Generator_cond(g, X86_JCC, cc ^ 1, X86_label(b->succs[1] << 1));
+        Generator_edge(g, b->succs[0], true);
+      } else {
+        Generator_cond(g, X86_JCC, cc ^ 1, X86_label(g->block << 1 | 1));
+        Generator_edge(g, b->succs[0], false);
+        Generator_label(g, g->block << 1 | 1);
+        Generator_edge(g, b->succs[1], true);
+      }
+      return;
+    }
+    case INST_RET:
+      if (inst->count) Generator_mov(g, REG_RAX, inst->a);
+      Generator_return(g);
+      return;
+    default:
+      assert(0);
+  }
+  Generator_extend(g, reg, type);
+  Generator_result(g, value, reg);
+}
+
+// note: The tiles, that cover more than one instruction. An operand
+// is folded into its user, only when it's the instruction right
+// before it and has no other use, so nothing could have taken the
+// registers of its own operands, when the user reads them. The
+// comparison goes into the branch, the scaled index into the add.
+static void Generator_select(Generator *g) {
+  const Ir *ir = g->ir;
+  const uint32_t *locs = g->ra->locs;
+  ValueId buffer[2];
+  const ValueId *operands;
+  for (ValueId v = 0; v < ir->inst_count; ++v) g->uses[v] = 0;
+  for (ValueId v = 1; v < ir->inst_count; ++v) {
+    g->folded[v] = false;
+    uint32_t count = Ir_operands(ir, &ir->insts[v], buffer, &operands);
+    for (uint32_t i = 0; i < count; ++i) g->uses[operands[i]]++;
+  }
+  for (ValueId v = 1; v + 1 < ir->inst_count; ++v) {
+    const Inst *inst = &ir->insts[v], *user = &ir->insts[v + 1];
+    if (g->uses[v] != 1 || user->block != inst->block) continue;
+    ValueId index;
+    if (inst->type >= INST_EQ && inst->type <= INST_GE) {
+      g->folded[v] = user->type == INST_BRANCH && user->a == v;
+    } else if (user->type == INST_ADD && Generator_scale(g, v, &index)) {
+      // the scaled value is only the same, when it's not extended
+      ValueId base = user->a == v ? user->b : user->a;
+      g->folded[v] = base != v && locs[base] < LOC_SLOT
+        && DataType_size(inst->data_type) == DataType_size(user->data_type);
+    }
   }
 }
 
-void generate_assembly(const Inst *insts) {
+void generate_assembly(X86Code *code, Str name, const Ir *ir, const RegAlloc *ra, Arena *scratch) {
+  uint32_t n = ir->inst_count;
   Generator g = {
-    .free_registers_len = REGISTER_COUNT,
-    .insts = insts,
+    .code = scratch,
+    .ir = ir,
+    .ra = ra,
+    .uses = ARENA_PUSH(scratch, uint32_t, (n + 1) & ~1u),
+    .folded = ARENA_PUSH(scratch, bool, (n + 7) & ~7u),
+    .saved = __builtin_popcount(ra->callee_saved),
+    .frame = ra->slot_count * 8,
+  };
+  g.folded[0] = false;
+  Generator_select(&g);
+  *code = (X86Code){
+    .interner = ir->file->interner,
+    .name = name,
+    .insts = ARENA_PUSH(scratch, X86Inst, 0),
+    .label_count = ir->block_count * 2,
   };
-  for (int i = 0; i < REGISTER_COUNT; ++i) g.free_registers[i] = i;
-  printf(".intel_syntax noprefix\n.global main\n\nmain:\n");
-  for (int i = 0; insts[i].type; ++i) {
-    generate_inst(&g);
+  // aligned for the calls, with the saved ones
+  if ((g.saved * 8 + g.frame) & 15) g.frame += 8;
+  Generator_emit(&g, X86_PUSH, Generator_reg(REG_RBP), Generator_none());
+  Generator_emit(&g, X86_MOV, Generator_reg(REG_RBP), Generator_reg(REG_RSP));
+  for (uint32_t reg = 0; reg < REG_COUNT; ++reg) {
+    if (ra->callee_saved >> reg & 1) Generator_emit(&g, X86_PUSH, Generator_reg(reg), Generator_none());
   }
-  printf("  ret\n");
+  if (g.frame) Generator_emit(&g, X86_SUB, Generator_reg(REG_RSP), X86_imm(g.frame));
+  for (g.block = 0; g.block < ir->block_count; ++g.block) {
+    const Block *b = &ir->blocks[g.block];
+    if (g.block) Generator_label(&g, g.block << 1);
+    for (ValueId v = b->start; v < b->start + b->len; ++v) generate_inst(&g, v);
+  }
+  code->count = (X86Inst *)(scratch->base + scratch->size) - code->insts;
 }
-
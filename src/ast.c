@@ -0,0 +1,120 @@
+#include "ast.h"
+#include "arena.h"
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+// Header and the largest payload, the declaration
+#define AST_NODE_MAX (1 + 4 + 5 + 5 + 4 + 3)
+
+void Ast_init(Ast *a, Arena *arena) {
+  *a = (Ast){
+    .data = arena->base,
+    .arena = arena,
+  };
+  // leave the first empty, to use zero for no children
+  Ast_push(a, (AstNode){0});
+}
+
+static inline uint8_t *Ast_write_varint(uint8_t *ptr, uint64_t value) {
+  while (value >= 0x80) {
+    *ptr++ = value | 0x80;
+    value >>= 7;
+  }
+  *ptr++ = value;
+  return ptr;
+}
+
+static inline uint32_t Ast_child_delta(AstId id, AstId child) {
+  if (!child) return 0;
+  assert(child < id);
+  return id - child;
+}
+
+AstId Ast_push(Ast *a, AstNode node) {
+  AstId id = a->size;
+  uint8_t buffer[AST_NODE_MAX];
+  uint8_t *ptr = buffer;
+  *ptr++ = node.type;
+  memcpy(ptr, &node.next_sibling, sizeof(AstId));
+  ptr += sizeof(AstId);
+  switch (AST_PAYLOAD[node.type]) {
+    case PAYLOAD_CHILD:
+      ptr = Ast_write_varint(ptr, Ast_child_delta(id, node.value.first_child));
+      break;
+    case PAYLOAD_NONE:
+      assert(!node.value.first_child);
+      break;
+    case PAYLOAD_INDEX:
+      ptr = Ast_write_varint(ptr, node.value.sym);
+      break;
+    case PAYLOAD_REF:
+      memcpy(ptr, &node.value.var, 4);
+      ptr += 4;
+      break;
+    case PAYLOAD_INT:
+      ptr = Ast_write_varint(ptr,
+          ((uint64_t)node.value.i64 << 1) ^ (uint64_t)(node.value.i64 >> 63));
+      break;
+    case PAYLOAD_DECL:
+      ptr = Ast_write_varint(ptr, Ast_child_delta(id, node.value.decl.first_child));
+      memcpy(ptr, &node.value.decl.var_start, 4);
+      ptr += 4;
+      ptr = Ast_write_varint(ptr, node.value.decl.var_count);
+      break;
+  }
+  ptr = Ast_write_varint(ptr, node.start);
+  uint32_t len = ptr - buffer;
+  assert(a->size + len > a->size);
+  memcpy(ARENA_PUSH(a->arena, uint8_t, len), buffer, len);
+  a->size += len;
+  a->count++;
+  return id;
+}
+
+// Returns the id of the node after this one
+static inline AstId Ast_next(const Ast *a, AstId id) {
+  const uint8_t *payload = a->data + id + 1 + sizeof(AstId);
+  return Ast_skip_varint(Ast_skip_payload(a->data[id], payload)) - a->data;
+}
+
+AstId Ast_first(const Ast *a) {
+  return Ast_next(a, 0);
+}
+
+// note: The children are stored as deltas, so they don't change
+AstId Ast_append(Ast *a, const Ast *src, AstRelocation r) {
+  AstId first = Ast_first(src);
+  uint32_t len = src->size - first;
+  AstId shift = a->size - first;
+  assert(a->size + len >= a->size);
+  memcpy(ARENA_PUSH(a->arena, uint8_t, len), src->data + first, len);
+  a->size += len;
+  a->count += src->count - 1;
+
+  for (AstId id = first + shift; id < a->size;) {
+    uint8_t *node = a->data + id;
+    AstType kind = node[0];
+    AstId sibling = Ast_read_sibling(node + 1);
+    if (sibling) Ast_set_sibling(a, id, sibling + shift);
+    uint8_t *payload = node + 1 + sizeof(AstId);
+    uint32_t ref;
+    switch (AST_PAYLOAD[kind]) {
+      case PAYLOAD_REF:
+        ref = Ast_read_u32(payload);
+        if (kind != AST_VAR) ref += r.label_shift;
+        else if (ref >= r.var_base) ref += r.var_shift;
+        memcpy(payload, &ref, 4);
+        break;
+      case PAYLOAD_DECL:
+        payload = (uint8_t *)Ast_skip_varint(payload);
+        ref = Ast_read_u32(payload) + r.var_shift;
+        memcpy(payload, &ref, 4);
+        break;
+      default:
+        break;
+    }
+    id = Ast_next(a, id);
+  }
+  return shift;
+}
@@ -0,0 +1,317 @@
+#include "backend.h"
+#include "arena.h"
+#include "assembly.h"
+#include "inst.h"
+#include "intern.h"
+#include "jit.h"
+#include "object.h"
+#include "parser.h"
+#include "peephole.h"
+#include "preprocessor.h"
+#include "queue.h"
+#include "regalloc.h"
+#include "writer.h"
+#include "x86.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+
+// Tells a worker, that there are no more functions
+#define BACKEND_DONE UINT32_MAX
+
+// The arenas of a function, the rest isn't used by the back end
+static void Backend_reset(Arena *arenas) {
+  Arena_reset(&arenas[ARENA_INSTS]);
+  Arena_reset(&arenas[ARENA_BLOCKS]);
+  Arena_reset(&arenas[ARENA_ARGS]);
+  Arena_reset(&arenas[ARENA_SCRATCH]);
+}
+
+static void Backend_function(Backend *b, uint32_t index, Arena *arenas) {
+  const Function *f = &b->functions[index];
+  BackendOutput *output = &b->outputs[index];
+  if (b->cache && Cache_load(b->cache, b->keys[index], &output->data, &output->len)) return;
+  Arena *scratch = &arenas[ARENA_SCRATCH];
+  const Interner *in = b->file->interner;
+  Str name = Interner_str(in, b->file->vars[f->var].name);
+  Ir ir;
+  X86Code code;
+  output->unsupported = codegen(b->file, f, arenas, &ir, &output->loc);
+  if (output->unsupported) {
+    Backend_reset(arenas);
+    return;
+  }
+  Writer out;
+  Writer_memory(&out);
+  if (b->dump_ir) {
+    // it's only for debugging, so it's left to the stdio
+    char *dump;
+    size_t len;
+    FILE *file = open_memstream(&dump, &len);
+    assert(file);
+    print_ir(file, &ir, name);
+    int err = fclose(file);
+    assert(!err);
+    Writer_bytes(&out, dump, len);
+    free(dump);
+  }
+  RegAlloc ra;
+  Ir_allocate(&ir, scratch, &ra, b->regalloc);
+  generate_assembly(&code, name, &ir, &ra, scratch);
+  X86_peephole(&code, b->peephole);
+  if (!b->object) {
+    X86_print(&out, &code);
+    output->data = Writer_take(&out, &output->len);
+  } else {
+    X86Machine m;
+    X86_encode(&code, scratch, &m);
+    Object_pack(&m, in, &output->data, &output->len);
+  }
+  if (b->cache) Cache_store(b->cache, b->keys[index], output->data, output->len);
+  Backend_reset(arenas);
+}
+
+static void *Backend_worker(void *arg) {
+  Backend *b = arg;
+  // note: Only the ones of the back end are used
+  Arenas arenas;
+  Arenas_init(&arenas);
+  uint32_t index;
+  while ((index = Queue_pop(&b->queue)) != BACKEND_DONE) {
+    Backend_function(b, index, arenas.arenas);
+  }
+  Arenas_free(&arenas);
+  return 0;
+}
+
+void Backend_start(Backend *b, const Parser *p) {
+  b->file = p;
+  b->functions = (Function *)p->arenas[ARENA_FUNCTIONS].base;
+  Arena_reserve(&b->output_arena, ARENA_RESERVE);
+  b->outputs = (BackendOutput *)b->output_arena.base;
+  if (b->cache) {
+    Arena_reserve(&b->key_arena, ARENA_RESERVE);
+    b->keys = (CacheKey *)b->key_arena.base;
+  }
+  if (!b->threads) return;
+  Queue_init(&b->queue, &p->arenas[ARENA_SCRATCH], BACKEND_QUEUE);
+  b->workers = malloc(sizeof(pthread_t) * b->threads);
+  assert(b->workers);
+  for (uint32_t i = 0; i < b->threads; ++i) {
+    int err = pthread_create(&b->workers[i], 0, Backend_worker, b);
+    assert(!err);
+  }
+}
+
+void Backend_extend(Backend *b) {
+  uint32_t start = ARENA_LEN(&b->output_arena, BackendOutput);
+  uint32_t count = ARENA_LEN(&b->file->arenas[ARENA_FUNCTIONS], Function) - start;
+  memset(ARENA_PUSH(&b->output_arena, BackendOutput, count), 0, sizeof(BackendOutput) * count);
+  if (!b->cache) return;
+  // note: Here the file scope is complete up to the window and nothing
+  // of it is merged yet, later the workers would race with the merges.
+  // The tokens of the bodies are only kept until then.
+  CacheKey *keys = ARENA_PUSH(&b->key_arena, CacheKey, count);
+  for (uint32_t i = 0; i < count; ++i) {
+    keys[i] = Cache_key(b->file, &b->functions[start + i], b->object);
+  }
+}
+
+void Backend_submit(Backend *b, uint32_t function) {
+  if (b->threads) {
+    Queue_push(&b->queue, function);
+    return;
+  }
+  Backend_function(b, function, b->file->arenas);
+}
+
+static void Backend_error(const Backend *b, AstType type, uint32_t loc, VarId var) {
+  SourcePosition pos = SourceMap_position(b->file->sources, loc);
+  Str name = Interner_str(b->file->interner, b->file->vars[var].name);
+  fprintf(stderr, "%.*s:%u:%u: error: %s isn't supported yet, in '%.*s'\n",
+      pos.file.len, pos.file.ptr, pos.line, pos.column, AST_TYPE_STR[type], name.len, name.ptr);
+}
+
+// note: A var of the file scope is defined, when it's declared without
+// the extern, or with a value. The parser doesn't take the declarations
+// again, in the same scope, so every one is its own global. The values
+// are folded with the codegen, in the arenas of the file, as the back
+// end is done with them.
+static bool Backend_globals(Backend *b) {
+  const Parser *p = b->file;
+  const AstId *items = (const AstId *)p->arenas[ARENA_ITEMS].base;
+  uint32_t item_count = ARENA_LEN(&p->arenas[ARENA_ITEMS], AstId);
+  uint32_t capacity = 0;
+  for (uint32_t i = 0; i < item_count; ++i) {
+    AstCursor node = Ast_cursor(&p->ast, items[i]);
+    if (node.kind == AST_DECL) capacity += AstCursor_decl(&node).var_count;
+  }
+  b->globals = malloc(sizeof(ObjectGlobal) * (capacity + 1));
+  assert(b->globals);
+  bool ok = true;
+  for (uint32_t i = 0; i < item_count; ++i) {
+    AstCursor node = Ast_cursor(&p->ast, items[i]);
+    if (node.kind != AST_DECL) continue;
+    struct AstValueDecl decl = AstCursor_decl(&node);
+    AstId init = decl.first_child;
+    for (uint32_t j = 0; j < decl.var_count; ++j, init = Ast_sibling(&p->ast, init)) {
+      VarId var = decl.var_start + j;
+      const Var *v = &p->vars[var];
+      bool empty = Ast_kind(&p->ast, init) == AST_EMPTY;
+      if (!(v->flags & FLAG_DEFINED) && empty) continue;
+      uint32_t size = DataType_size(v->type);
+      if (!size) {
+        Backend_error(b, AST_DECL, Ast_start(&p->ast, items[i]), var);
+        ok = false;
+        continue;
+      }
+      int64_t value = 0;
+      if (!empty) {
+        uint32_t loc;
+        AstType unsupported = codegen_initializer(p, init, v->type, p->arenas, &value, &loc);
+        Backend_reset(p->arenas);
+        if (unsupported) {
+          Backend_error(b, unsupported, loc, var);
+          ok = false;
+          continue;
+        }
+      }
+      b->globals[b->global_count++] = (ObjectGlobal){
+        .name = Interner_str(p->interner, v->name),
+        .size = size,
+        .local = v->storage == STORAGE_STATIC,
+        .value = value,
+      };
+    }
+  }
+  return ok;
+}
+
+bool Backend_join(Backend *b) {
+  for (uint32_t i = 0; i < b->threads; ++i) Queue_push(&b->queue, BACKEND_DONE);
+  for (uint32_t i = 0; i < b->threads; ++i) {
+    int err = pthread_join(b->workers[i], 0);
+    assert(!err);
+  }
+  free(b->workers);
+  b->workers = 0;
+  // note: In the source order, whatever finished first
+  bool ok = true;
+  uint32_t count = ARENA_LEN(&b->output_arena, BackendOutput);
+  for (uint32_t i = 0; i < count; ++i) {
+    const BackendOutput *output = &b->outputs[i];
+    if (!output->unsupported) continue;
+    Backend_error(b, output->unsupported, output->loc, b->functions[i].var);
+    ok = false;
+  }
+  return Backend_globals(b) && ok;
+}
+
+// Of the machine code, the array is malloc'd
+static ObjectFunction *Backend_objects(const Backend *b, uint32_t count) {
+  ObjectFunction *functions = calloc(count, sizeof(ObjectFunction));
+  assert(functions || !count);
+  for (uint32_t i = 0; i < count; ++i) {
+    functions[i] = (ObjectFunction){
+      .name = Interner_str(b->file->interner, b->file->vars[b->functions[i].var].name),
+      .data = b->outputs[i].data,
+      .len = b->outputs[i].len,
+    };
+  }
+  return functions;
+}
+
+void Backend_free(Backend *b) {
+  uint32_t count = ARENA_LEN(&b->output_arena, BackendOutput);
+  for (uint32_t i = 0; i < count; ++i) free(b->outputs[i].data);
+  Arena_release(&b->output_arena);
+  if (b->keys) Arena_release(&b->key_arena);
+  free(b->globals);
+  *b = (Backend){0};
+}
+
+// The data, then the bss, like the object has them
+static void Backend_print_globals(const Backend *b, Writer *out) {
+  static const char *const DIRECTIVES[] = {
+    [1] = ".byte", [2] = ".short", [4] = ".long", [8] = ".quad",
+  };
+  for (int bss = 0; bss < 2; ++bss) {
+    bool section = false;
+    for (uint32_t i = 0; i < b->global_count; ++i) {
+      const ObjectGlobal *g = &b->globals[i];
+      if ((g->value == 0) != bss) continue;
+      if (!section) Writer_cstr(out, bss ? "\n.bss\n" : "\n.data\n");
+      section = true;
+      if (!g->local) {
+        Writer_cstr(out, ".global ");
+        Writer_str(out, g->name);
+        Writer_char(out, '\n');
+      }
+      Writer_cstr(out, ".align ");
+      Writer_u64(out, g->size);
+      Writer_char(out, '\n');
+      Writer_str(out, g->name);
+      Writer_cstr(out, ":\n  ");
+      if (bss) {
+        Writer_cstr(out, ".zero ");
+        Writer_u64(out, g->size);
+      } else {
+        Writer_cstr(out, DIRECTIVES[g->size]);
+        Writer_char(out, ' ');
+        Writer_i64(out, g->value);
+      }
+      Writer_char(out, '\n');
+    }
+  }
+}
+
+void Backend_finish(Backend *b, Writer *out) {
+  uint32_t count = ARENA_LEN(&b->output_arena, BackendOutput);
+  if (b->object) {
+    ObjectFunction *functions = Backend_objects(b, count);
+    Object_write(out, b->file->interner, functions, count, b->globals, b->global_count);
+    free(functions);
+  } else {
+    // note: The functions are written from their own buffers
+    struct iovec *chunks = calloc(count, sizeof(struct iovec));
+    assert(chunks || !count);
+    for (uint32_t i = 0; i < count; ++i) {
+      chunks[i] = (struct iovec){ b->outputs[i].data, b->outputs[i].len };
+    }
+    Writer_cstr(out, ".intel_syntax noprefix\n");
+    Writer_gather(out, chunks, count);
+    Backend_print_globals(b, out);
+    Writer_cstr(out, "\n.section .note.GNU-stack,\"\",@progbits\n");
+    free(chunks);
+  }
+  Backend_free(b);
+}
+
+int Backend_run(Backend *b, int argc, const char **argv) {
+  assert(b->object);
+  uint32_t count = ARENA_LEN(&b->output_arena, BackendOutput);
+  ObjectFunction *functions = Backend_objects(b, count);
+  int status = 1;
+  Jit jit;
+  if (Jit_load(&jit, b->file->interner, functions, count, b->globals, b->global_count)) {
+    int (*entry)(int, const char **) = (int (*)(int, const char **))Jit_find(&jit, "main");
+    if (entry) {
+      Jit_perf_map(&jit);
+      // the program shares the stdio with the compiler
+      fflush(stdout);
+      fflush(stderr);
+      status = entry(argc, argv);
+      fflush(stdout);
+    } else {
+      fprintf(stderr, "no main function\n");
+    }
+  }
+  Jit_free(&jit);
+  free(functions);
+  Backend_free(b);
+  return status;
+}
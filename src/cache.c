@@ -0,0 +1,234 @@
+#include "cache.h"
+#include "common.h"
+#include "intern.h"
+#include "parser.h"
+#include "preprocessor.h"
+#include "symtab.h"
+#include "tokens.h"
+#include <assert.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// note: The whole compiler is a single translation unit,
+// so a new build of it never reuses the old entries
+const char CACHE_VERSION[] = "mcc " __DATE__ " " __TIME__;
+
+static inline void CacheKey_add(CacheKey *k, const void *data, size_t len) {
+  const uint8_t *bytes = data;
+  for (size_t i = 0; i < len; ++i) {
+    // FNV-1a and a rotate-multiply one
+    k->a = (k->a ^ bytes[i]) * 1099511628211u;
+    k->b = (((k->b << 5) | (k->b >> 59)) ^ bytes[i]) * 0x9e3779b97f4a7c15u;
+  }
+}
+
+static inline void CacheKey_u32(CacheKey *k, uint32_t value) {
+  CacheKey_add(k, &value, sizeof(value));
+}
+
+static inline void CacheKey_sym(CacheKey *k, const Parser *p, SymId sym) {
+  Str s = Interner_str(p->interner, sym);
+  CacheKey_u32(k, s.len);
+  CacheKey_add(k, s.ptr, s.len);
+}
+
+static void CacheKey_struct(CacheKey *k, const Parser *p, StructId id, uint32_t depth) {
+  const Struct *s = &p->structs[id];
+  CacheKey_u32(k, s->type);
+  CacheKey_u32(k, s->fields_len);
+  if (depth == CACHE_MAX_STRUCT_DEPTH) return;
+  for (uint32_t i = 0; i < s->fields_len; ++i) {
+    const Field *f = &p->fields[s->fields_start + i];
+    CacheKey_sym(k, p, f->name);
+    CacheKey_u32(k, f->type);
+    CacheKey_u32(k, f->flags);
+    if (f->type >= DATA_STRUCT) CacheKey_struct(k, p, f->struct_index, depth + 1);
+  }
+}
+
+// Whatever the name can refer to at the start of the function
+static void CacheKey_name(CacheKey *k, const Parser *p, const Function *f,
+    SymId name, bool tag) {
+  if (tag) {
+    uint32_t index = SymTab_peek(&p->struct_index, name);
+    if (index && index <= f->visible.structs) CacheKey_struct(k, p, index - 1, 0);
+    return;
+  }
+  VarId var = SymTab_peek(&p->var_index, name);
+  if (var && var < f->visible.vars) {
+    const Var *v = &p->vars[var];
+    CacheKey_u32(k, v->storage);
+    CacheKey_u32(k, v->type);
+    CacheKey_u32(k, v->flags);
+    if (v->type >= DATA_STRUCT) CacheKey_struct(k, p, v->struct_index, 0);
+  }
+  TypedefId td = SymTab_peek(&p->typedef_index, name);
+  if (td && td < f->visible.typedefs) {
+    const Typedef *t = &p->typedefs[td];
+    CacheKey_u32(k, t->type);
+    CacheKey_u32(k, t->flags);
+    if (t->type >= DATA_STRUCT) CacheKey_struct(k, p, t->struct_index, 0);
+  }
+}
+
+CacheKey Cache_key(const Parser *p, const Function *f, bool object) {
+  CacheKey k = { 14695981039346656037u, 0 };
+  CacheKey_add(&k, CACHE_VERSION, sizeof(CACHE_VERSION));
+  CacheKey_u32(&k, object);
+  const Var *v = &p->vars[f->var];
+  CacheKey_sym(&k, p, v->name);
+  CacheKey_u32(&k, v->storage);
+  CacheKey_u32(&k, v->type);
+  CacheKey_u32(&k, v->flags);
+
+  // note: The locations change with every edit before the
+  // function, only the types and the text of the tokens count
+  const Token *tok = (const Token *)p->arenas[ARENA_TOKENS].base + f->tokens;
+  bool tag = false;
+  for (; tok->type; ++tok) {
+    CacheKey_u32(&k, tok->type);
+    if (tok->type == TOK_IDENT) {
+      CacheKey_sym(&k, p, tok->sym);
+      CacheKey_name(&k, p, f, tok->sym, tag);
+    } else if (tok->type == TOK_DECIMAL || tok->type == TOK_STRING) {
+      CacheKey_u32(&k, tok->len);
+      CacheKey_add(&k, SourceMap_text(p->sources, tok->start), tok->len);
+    }
+    tag = tok->type == TOK_STRUCT || tok->type == TOK_UNION || tok->type == TOK_ENUM;
+  }
+  return k;
+}
+
+static void Cache_path(const Cache *c, CacheKey key, char *path, bool dir) {
+  int len = dir
+    ? snprintf(path, PATH_MAX, "%s/%02x", c->dir, (uint8_t)(key.a >> 56))
+    : snprintf(path, PATH_MAX, "%s/%02x/%014llx%016llx", c->dir, (uint8_t)(key.a >> 56),
+        (unsigned long long)(key.a & 0xffffffffffffffu), (unsigned long long)key.b);
+  assert(len < PATH_MAX);
+}
+
+bool Cache_load(Cache *c, CacheKey key, char **data, size_t *len) {
+  char path[PATH_MAX];
+  Cache_path(c, key, path, false);
+  int fd = open(path, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) < 0) {
+    if (fd >= 0) close(fd);
+    __atomic_fetch_add(&c->misses, 1, __ATOMIC_RELAXED);
+    return false;
+  }
+  *len = st.st_size;
+  *data = malloc(*len + 1);
+  assert(*data);
+  for (size_t done = 0; done < *len;) {
+    ssize_t n = read(fd, *data + done, *len - done);
+    assert(n > 0); // TODO: error for a failed read
+    done += n;
+  }
+  // note: The time of the last use, for the eviction. It doesn't
+  // have to be exact, so it's not updated on every hit.
+  if (time(0) - st.st_mtim.tv_sec > CACHE_TOUCH_SECONDS) futimens(fd, 0);
+  close(fd);
+  __atomic_fetch_add(&c->hits, 1, __ATOMIC_RELAXED);
+  return true;
+}
+
+void Cache_store(Cache *c, CacheKey key, const char *data, size_t len) {
+  char path[PATH_MAX], tmp[PATH_MAX + 32];
+  Cache_path(c, key, path, false);
+  // note: Renamed in place, so another process
+  // never reads a partially written entry
+  snprintf(tmp, sizeof(tmp), "%s.%d.%lx", path, getpid(), (unsigned long)pthread_self());
+  int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0 && errno == ENOENT) {
+    // the directories are made, when the first entry goes there
+    Cache_path(c, key, path, true);
+    if (mkdir(c->dir, 0755) < 0) assert(errno == EEXIST);
+    if (mkdir(path, 0755) < 0) assert(errno == EEXIST);
+    Cache_path(c, key, path, false);
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  }
+  if (fd < 0) return; // the cache is only an optimization
+  for (size_t done = 0; done < len;) {
+    ssize_t n = write(fd, data + done, len - done);
+    assert(n > 0); // TODO: error for a failed write
+    done += n;
+  }
+  int err = close(fd);
+  assert(!err);
+  err = rename(tmp, path);
+  assert(!err);
+  __atomic_fetch_add(&c->stores, 1, __ATOMIC_RELAXED);
+}
+
+typedef struct {
+  struct timespec used;
+  uint64_t size;
+  char name[32];
+  uint8_t dir;
+} CacheEntry;
+
+static int CacheEntry_compare(const void *a, const void *b) {
+  const CacheEntry *x = a, *y = b;
+  if (x->used.tv_sec != y->used.tv_sec) return x->used.tv_sec < y->used.tv_sec ? -1 : 1;
+  if (x->used.tv_nsec != y->used.tv_nsec) return x->used.tv_nsec < y->used.tv_nsec ? -1 : 1;
+  return 0;
+}
+
+void Cache_trim(Cache *c, FILE *out) {
+  CacheEntry *entries = 0;
+  uint32_t count = 0, capacity = 0;
+  uint64_t total = 0;
+  char path[PATH_MAX + 64];
+  for (uint32_t d = 0; d < 256; ++d) {
+    snprintf(path, sizeof(path), "%s/%02x", c->dir, d);
+    DIR *dir = opendir(path);
+    if (!dir) continue;
+    struct dirent *e;
+    while ((e = readdir(dir))) {
+      // the temporary ones have a suffix, they're left alone
+      if (strlen(e->d_name) != 30) continue;
+      struct stat st;
+      snprintf(path, sizeof(path), "%s/%02x/%s", c->dir, d, e->d_name);
+      if (stat(path, &st) < 0) continue;
+      if (count == capacity) {
+        capacity = capacity ? capacity * 2 : 256;
+        entries = realloc(entries, sizeof(CacheEntry) * capacity);
+        assert(entries);
+      }
+      CacheEntry *entry = &entries[count++];
+      // the space on the disk, not the length
+      *entry = (CacheEntry){ st.st_mtim, (uint64_t)st.st_blocks * 512, {0}, d };
+      memcpy(entry->name, e->d_name, 31);
+      total += entry->size;
+    }
+    closedir(dir);
+  }
+
+  uint32_t evicted = 0;
+  if (total > c->max_size) {
+    qsort(entries, count, sizeof(CacheEntry), CacheEntry_compare);
+    for (uint32_t i = 0; i < count && total > c->max_size; ++i) {
+      snprintf(path, sizeof(path), "%s/%02x/%s", c->dir, entries[i].dir, entries[i].name);
+      if (unlink(path) < 0) continue;
+      total -= entries[i].size;
+      evicted++;
+    }
+  }
+  if (out) {
+    fprintf(out, "cache: %u hits, %u misses, %u stored, %u entries, %.1f KiB "
+        "of %.1f KiB, %u evicted\n", c->hits, c->misses, c->stores, count - evicted,
+        total / 1024.0, c->max_size / 1024.0, evicted);
+  }
+  free(entries);
+}
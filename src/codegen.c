@@ -1,66 +1,1330 @@
-
 #include "ast.h"
 #include "inst.h"
+#include "arena.h"
+#include "parser.h"
+#include <stdbool.h>
 #include <stdint.h>
+#include <string.h>
 #include <assert.h>
 
+// note: The SSA form is built straight from the tree, as in "Simple
+// and Efficient Construction of Static Single Assignment Form" by
+// Braun et al. The locals are never stored, a read looks up the
+// definition in the block and goes up through the predecessors,
+// placing phis, where they meet. A block is sealed, once all its
+// predecessors are known, until then the phis in it are incomplete
+// and get their operands at the sealing. The blocks get their
+// instructions in the order they're made, except for the phis, so
+// the result is put in order at the end, see Codegen_finish.
+
+typedef struct CodegenEdge {
+  BlockId from;
+  struct CodegenEdge *next;
+} CodegenEdge;
+
+typedef struct CodegenPhi {
+  ValueId phi;
+  uint32_t local;
+  struct CodegenPhi *next;
+} CodegenPhi;
+
 typedef struct {
-  const AstNode *ast;
+  // in the order they were added
+  CodegenEdge *preds;
+  CodegenEdge *last_pred;
+  CodegenPhi *incomplete;
+  uint32_t pred_count;
+  BlockId succs[2];
+  uint8_t succ_count;
+  bool sealed;
+} CodegenBlock;
+
+// The current value of a local in a block
+typedef struct {
+  uint64_t key; // zero if empty
+  ValueId value;
+} CodegenDef;
+
+typedef struct {
+  AstId node; // case or default
+  BlockId block;
+} CodegenCase;
+
+// Block zero is a placeholder, the entry is the first one
+#define CODEGEN_ENTRY 1
+#define CODEGEN_DEF_MIN_BITS 6
+
+typedef struct {
+  const Parser *p;
+  const Function *f;
+  const Ast *ast;
+  Arena *arenas;
+  Arena *scratch;
   Inst *insts;
-  uint16_t inst_len;
+  CodegenBlock *blocks;
+  CodegenDef *defs;
+  BlockId *label_blocks;
+  // of the innermost switch, in the order of the body
+  CodegenCase *cases;
+  uint32_t next_case;
+  BlockId block;
+  BlockId break_to;
+  BlockId continue_to;
+  uint32_t inst_count;
+  uint32_t block_count;
+  uint32_t def_bits;
+  uint32_t def_count;
+  // the labels of the current expression, from its first node to its root
+  uint8_t *needs;
+  AstId needs_start;
+  AstId needs_end;
+  // the first node, that we can't generate yet, and where it is
+  AstType unsupported;
+  uint32_t unsupported_loc;
+  // of the innermost expression or statement
+  AstId node;
+  // only the constants can be made, for the values of the globals
+  bool constant;
 } Codegen;
 
-static inline uint16_t Codegen_inst(Codegen *c, Inst inst) {
-  assert(c->inst_len < MAX_INSTRUCTIONS);
-  uint16_t index = c->inst_len++;
-  c->insts[index] = inst;
-  return index;
+static const uint8_t AST_TO_INST[AST_ASS] = {
+  [AST_MUL] = INST_MUL, [AST_DIV] = INST_DIV, [AST_MOD] = INST_MOD,
+  [AST_ADD] = INST_ADD, [AST_SUB] = INST_SUB, [AST_LSFT] = INST_SHL,
+  [AST_RSFT] = INST_SHR, [AST_LT] = INST_LT, [AST_LE] = INST_LE,
+  [AST_GT] = INST_GT, [AST_GE] = INST_GE, [AST_EQ] = INST_EQ,
+  [AST_NE] = INST_NE, [AST_BAND] = INST_AND, [AST_BXOR] = INST_XOR,
+  [AST_BOR] = INST_OR,
+};
+
+// The operation of the compound assignments
+static const uint8_t ASSIGN_TO_AST[AST_INDEX] = {
+  [AST_ASS_MUL] = AST_MUL, [AST_ASS_DIV] = AST_DIV, [AST_ASS_MOD] = AST_MOD,
+  [AST_ASS_ADD] = AST_ADD, [AST_ASS_SUB] = AST_SUB, [AST_ASS_LSFT] = AST_LSFT,
+  [AST_ASS_RSFT] = AST_RSFT, [AST_ASS_AND] = AST_BAND, [AST_ASS_XOR] = AST_BXOR,
+  [AST_ASS_OR] = AST_BOR,
+};
+
+static inline void Codegen_unsupported(Codegen *c, AstType type) {
+  if (c->unsupported) return;
+  c->unsupported = type;
+  c->unsupported_loc = Ast_start(c->ast, c->node);
+}
+
+// The integer promotions, the other types stay
+static inline DataType DataType_promote(DataType type) {
+  uint32_t size = DataType_size(type);
+  return size && size < 4 ? DATA_INT : type;
+}
+
+// The usual arithmetic conversions, of the integer types only
+static DataType DataType_common(DataType a, DataType b) {
+  a = DataType_promote(a);
+  b = DataType_promote(b);
+  if (a == b) return a;
+  uint32_t size_a = DataType_size(a), size_b = DataType_size(b);
+  if (size_a != size_b) return size_a > size_b ? a : b;
+  if (DataType_unsigned(a)) return a;
+  if (DataType_unsigned(b)) return b;
+  return MAX(a, b);
+}
+
+static inline ValueId Codegen_push(Codegen *c, BlockId block, Inst inst) {
+  inst.block = block;
+  *ARENA_PUSH(&c->arenas[ARENA_INSTS], Inst, 1) = inst;
+  return c->inst_count++;
+}
+
+static inline ValueId Codegen_inst(Codegen *c, Inst inst) {
+  return Codegen_push(c, c->block, inst);
+}
+
+static inline DataType Codegen_type(const Codegen *c, ValueId value) {
+  return c->insts[value].data_type;
+}
+
+static ValueId Codegen_const(Codegen *c, DataType type, int64_t value) {
+  value = DataType_wrap(type, value);
+  return Codegen_inst(c, (Inst){
+    .type = INST_CONST,
+    .data_type = type,
+    .a = (uint32_t)value,
+    .b = (uint64_t)value >> 32,
+  });
+}
+
+// The operands of a phi or a call, they're stored together
+static void Codegen_args(Codegen *c, ValueId inst, const ValueId *args, uint32_t count) {
+  assert(count <= UINT16_MAX);
+  Arena *arena = &c->arenas[ARENA_ARGS];
+  c->insts[inst].b = ARENA_LEN(arena, ValueId);
+  c->insts[inst].count = count;
+  memcpy(ARENA_PUSH(arena, ValueId, count), args, sizeof(ValueId) * count);
+}
+
+static inline bool Codegen_is_const(const Codegen *c, ValueId value, int64_t *constant) {
+  if (c->insts[value].type != INST_CONST) return false;
+  *constant = Inst_const(c->insts[value]);
+  return true;
+}
+
+static ValueId Codegen_convert(Codegen *c, ValueId value, DataType type) {
+  DataType from = Codegen_type(c, value);
+  if (from == type) return value;
+  // the value of a void call or a void function
+  if (!DataType_size(from) || !DataType_size(type)) {
+    Codegen_unsupported(c, AST_CALL);
+    return value;
+  }
+  int64_t constant;
+  if (Codegen_is_const(c, value, &constant)) return Codegen_const(c, type, constant);
+  return Codegen_inst(c, (Inst){ .type = INST_CAST, .data_type = type, .a = value });
+}
+
+static BlockId Codegen_block(Codegen *c) {
+  *ARENA_PUSH(&c->arenas[ARENA_BLOCKS], CodegenBlock, 1) = (CodegenBlock){0};
+  return c->block_count++;
+}
+
+// For the code after a jump, it has no predecessors
+// until a label, so it's dropped at the end
+static void Codegen_unreachable(Codegen *c) {
+  c->block = Codegen_block(c);
+  c->blocks[c->block].sealed = true;
+}
+
+// note: Sealed without predecessors, it never gets any, so
+// it's unreachable, like the code after a constant condition
+static inline bool Codegen_dead(const Codegen *c, BlockId block) {
+  const CodegenBlock *b = &c->blocks[block];
+  return block != CODEGEN_ENTRY && b->sealed && !b->pred_count;
+}
+
+static void Codegen_edge(Codegen *c, BlockId from, BlockId to) {
+  // so the blocks after it can be found dead as well
+  if (Codegen_dead(c, from)) return;
+  CodegenBlock *b = &c->blocks[to];
+  assert(!b->sealed);
+  CodegenEdge *edge = ARENA_PUSH(c->scratch, CodegenEdge, 1);
+  *edge = (CodegenEdge){ from, 0 };
+  if (b->last_pred) b->last_pred->next = edge;
+  else b->preds = edge;
+  b->last_pred = edge;
+  b->pred_count++;
+  CodegenBlock *f = &c->blocks[from];
+  assert(f->succ_count < 2);
+  f->succs[f->succ_count++] = to;
+}
+
+static void Codegen_jump(Codegen *c, BlockId to) {
+  Codegen_inst(c, (Inst){ .type = INST_JUMP });
+  Codegen_edge(c, c->block, to);
+}
+
+static void Codegen_branch(Codegen *c, ValueId cond, BlockId then, BlockId els) {
+  int64_t constant;
+  if (Codegen_is_const(c, cond, &constant)) {
+    Codegen_jump(c, constant ? then : els);
+    return;
+  }
+  Codegen_inst(c, (Inst){ .type = INST_BRANCH, .a = cond });
+  Codegen_edge(c, c->block, then);
+  Codegen_edge(c, c->block, els);
+}
+
+// Returns the slot of the local in the block, the value is zero,
+// if it's not defined there. The slots move, when the table grows.
+static CodegenDef *Codegen_def(Codegen *c, BlockId block, uint32_t local) {
+  uint64_t key = (uint64_t)block << 32 | (local + 1);
+  if (2 * (c->def_count + 1) > (1u << c->def_bits)) {
+    // note: The old table is left behind in the scratch
+    CodegenDef *old = c->defs;
+    uint32_t old_capacity = old ? 1u << c->def_bits : 0;
+    c->def_bits = old ? c->def_bits + 1 : CODEGEN_DEF_MIN_BITS;
+    c->defs = ARENA_PUSH(c->scratch, CodegenDef, 1u << c->def_bits);
+    memset(c->defs, 0, sizeof(CodegenDef) << c->def_bits);
+    c->def_count = 0;
+    for (uint32_t i = 0; i < old_capacity; ++i) {
+      if (!old[i].key) continue;
+      *Codegen_def(c, old[i].key >> 32, (uint32_t)old[i].key - 1) = old[i];
+    }
+  }
+  uint32_t mask = (1u << c->def_bits) - 1;
+  uint32_t index = (key * 0x9e3779b97f4a7c15u) >> (64 - c->def_bits);
+  for (;; index = (index + 1) & mask) {
+    CodegenDef *def = &c->defs[index];
+    if (def->key == key) return def;
+    if (def->key) continue;
+    c->def_count++;
+    *def = (CodegenDef){ key, 0 };
+    return def;
+  }
+}
+
+static inline void Codegen_write(Codegen *c, BlockId block, uint32_t local, ValueId value) {
+  Codegen_def(c, block, local)->value = value;
+}
+
+static inline DataType Codegen_local_type(const Codegen *c, uint32_t local) {
+  return c->p->vars[c->f->locals + local].type;
+}
+
+static ValueId Codegen_read(Codegen *c, BlockId block, uint32_t local);
+
+static void Codegen_phi_operands(Codegen *c, ValueId phi, BlockId block, uint32_t local) {
+  CodegenBlock *b = &c->blocks[block];
+  ValueId args[b->pred_count + 1];
+  uint32_t count = 0;
+  for (CodegenEdge *e = b->preds; e; e = e->next) args[count++] = Codegen_read(c, e->from, local);
+  Codegen_args(c, phi, args, count);
+}
+
+static ValueId Codegen_read(Codegen *c, BlockId block, uint32_t local) {
+  ValueId value = Codegen_def(c, block, local)->value;
+  if (value) return value;
+  CodegenBlock *b = &c->blocks[block];
+  Inst phi = { .type = INST_PHI, .data_type = Codegen_local_type(c, local) };
+  if (!b->sealed) {
+    value = Codegen_push(c, block, phi);
+    CodegenPhi *incomplete = ARENA_PUSH(c->scratch, CodegenPhi, 1);
+    *incomplete = (CodegenPhi){ value, local, b->incomplete };
+    b->incomplete = incomplete;
+  } else if (!b->pred_count) {
+    value = Codegen_push(c, block, (Inst){ .type = INST_UNDEF, .data_type = phi.data_type });
+  } else if (b->pred_count == 1) {
+    // note: The chain of the only predecessors is followed up to the first
+    // block, that isn't one. It can go around in a loop, that's never
+    // entered, like the one under an if (0), there it's an undef.
+    BlockId from = b->preds->from;
+    uint32_t steps = 0;
+    for (; steps < c->block_count; ++steps) {
+      const CodegenBlock *pred = &c->blocks[from];
+      if (Codegen_def(c, from, local)->value || !pred->sealed || pred->pred_count != 1) break;
+      from = pred->preds->from;
+    }
+    if (steps == c->block_count) {
+      value = Codegen_push(c, block, (Inst){ .type = INST_UNDEF, .data_type = phi.data_type });
+    } else {
+      value = Codegen_read(c, from, local);
+      for (BlockId i = b->preds->from; i != from; i = c->blocks[i].preds->from) {
+        Codegen_write(c, i, local, value);
+      }
+    }
+  } else {
+    // note: Written before the operands, so a loop back
+    // to this block finds it and doesn't make another one
+    value = Codegen_push(c, block, phi);
+    Codegen_write(c, block, local, value);
+    Codegen_phi_operands(c, value, block, local);
+  }
+  Codegen_write(c, block, local, value);
+  return value;
+}
+
+static void Codegen_seal(Codegen *c, BlockId block) {
+  CodegenBlock *b = &c->blocks[block];
+  // reading the operands can add more of them
+  while (b->incomplete) {
+    CodegenPhi *phi = b->incomplete;
+    b->incomplete = phi->next;
+    Codegen_phi_operands(c, phi->phi, block, phi->local);
+  }
+  b->sealed = true;
+}
+
+// The join of two paths, that end in the blocks with the values,
+// they're converted to the type there. Continues after the join.
+static ValueId Codegen_join(Codegen *c, DataType type, BlockId ends[2], ValueId values[2]) {
+  BlockId join = Codegen_block(c);
+  for (uint32_t i = 0; i < 2; ++i) {
+    c->block = ends[i];
+    values[i] = Codegen_convert(c, values[i], type);
+    Codegen_jump(c, join);
+  }
+  Codegen_seal(c, join);
+  c->block = join;
+  // only one of them, when the condition was a constant
+  if (Codegen_dead(c, ends[0])) return values[1];
+  if (Codegen_dead(c, ends[1]) || values[0] == values[1]) return values[0];
+  ValueId phi = Codegen_inst(c, (Inst){ .type = INST_PHI, .data_type = type });
+  Codegen_args(c, phi, values, 2);
+  return phi;
 }
 
-uint16_t Codegen_value(Codegen *c, uint16_t start) {
-  AstNode expr = c->ast[start];
-  uint16_t a, b;
-  switch (expr.type) {
+// Zero, if the var isn't a local of the function
+static bool Codegen_local(Codegen *c, VarId var, uint32_t *local) {
+  if (var < c->f->locals || var - c->f->locals >= c->f->local_count) return false;
+  *local = var - c->f->locals;
+  return true;
+}
+
+static bool Codegen_supported_var(Codegen *c, VarId var) {
+  const Var *v = &c->p->vars[var];
+  uint32_t local;
+  bool ok = DataType_size(v->type);
+  // TODO: the static locals, they need a symbol
+  if (Codegen_local(c, var, &local)) {
+    ok = ok && (v->storage == STORAGE_AUTO || v->storage == STORAGE_REGISTER);
+  }
+  // note: The operand of a sizeof isn't run, it's in a dead block
+  if (c->constant && !Codegen_dead(c, c->block)) ok = false;
+  if (!ok) Codegen_unsupported(c, AST_VAR);
+  return ok;
+}
+
+static ValueId Codegen_load(Codegen *c, VarId var) {
+  if (!Codegen_supported_var(c, var)) return 0;
+  uint32_t local;
+  if (Codegen_local(c, var, &local)) return Codegen_read(c, c->block, local);
+  return Codegen_inst(c, (Inst){
+    .type = INST_LOAD,
+    .data_type = c->p->vars[var].type,
+    .a = var,
+  });
+}
+
+// Returns the value converted to the type of the var
+static ValueId Codegen_store(Codegen *c, VarId var, ValueId value) {
+  if (!Codegen_supported_var(c, var)) return 0;
+  value = Codegen_convert(c, value, c->p->vars[var].type);
+  uint32_t local;
+  if (Codegen_local(c, var, &local)) {
+    Codegen_write(c, c->block, local, value);
+  } else {
+    Codegen_inst(c, (Inst){ .type = INST_STORE, .a = var, .b = value });
+  }
+  return value;
+}
+
+// Of the operation on the values of the type, when it's known without
+// the values of both operands, or zero. The operands are constants,
+// or one of them is an identity or absorbing element, or they're same.
+static ValueId Codegen_simplify(Codegen *c, InstType op, DataType type, ValueId a, ValueId b) {
+  int64_t x, y, result;
+  bool const_a = Codegen_is_const(c, a, &x), const_b = Codegen_is_const(c, b, &y);
+  bool compare = op >= INST_EQ && op <= INST_GE;
+  if (const_a && const_b) {
+    if (!Ir_fold(op, type, x, y, &result)) return 0;
+    return Codegen_const(c, compare ? DATA_INT : type, result);
+  }
+  if (a == b) {
+    switch (op) {
+      case INST_SUB: case INST_XOR: return Codegen_const(c, type, 0);
+      case INST_AND: case INST_OR: return a;
+      case INST_EQ: case INST_LE: case INST_GE: return Codegen_const(c, DATA_INT, 1);
+      case INST_NE: case INST_LT: case INST_GT: return Codegen_const(c, DATA_INT, 0);
+      default: return 0;
+    }
+  }
+  if (const_b) {
+    switch (op) {
+      case INST_ADD: case INST_SUB: case INST_SHL: case INST_SHR: case INST_OR: case INST_XOR:
+        return y ? 0 : a;
+      case INST_MUL:
+        return y == 1 ? a : y ? 0 : b;
+      case INST_DIV:
+        return y == 1 ? a : 0;
+      case INST_MOD:
+        return y == 1 ? Codegen_const(c, type, 0) : 0;
+      case INST_AND:
+        return !y ? b : y == DataType_wrap(type, -1) ? a : 0;
+      default:
+        return 0;
+    }
+  }
+  if (const_a) {
+    switch (op) {
+      case INST_ADD: case INST_OR: case INST_XOR:
+        return x ? 0 : b;
+      case INST_MUL:
+        return x == 1 ? b : x ? 0 : a;
+      case INST_AND:
+        return !x ? a : x == DataType_wrap(type, -1) ? b : 0;
+      case INST_SHL: case INST_SHR:
+        return x ? 0 : a;
+      default:
+        return 0;
+    }
+  }
+  return 0;
+}
+
+static ValueId Codegen_binary(Codegen *c, AstType op, ValueId a, ValueId b) {
+  InstType type = AST_TO_INST[op];
+  DataType data_type;
+  if (type == INST_SHL || type == INST_SHR) {
+    data_type = DataType_promote(Codegen_type(c, a));
+    b = Codegen_convert(c, b, DataType_promote(Codegen_type(c, b)));
+  } else {
+    data_type = DataType_common(Codegen_type(c, a), Codegen_type(c, b));
+    b = Codegen_convert(c, b, data_type);
+  }
+  a = Codegen_convert(c, a, data_type);
+  if (!DataType_size(data_type)) {
+    Codegen_unsupported(c, AST_CALL);
+    return a;
+  }
+  ValueId simple = Codegen_simplify(c, type, data_type, a, b);
+  if (simple) return simple;
+  // note: The constant goes to the right, where the back end can use it as is
+  int64_t constant;
+  bool commutative = type == INST_ADD || type == INST_MUL || type == INST_AND
+    || type == INST_OR || type == INST_XOR || type == INST_EQ || type == INST_NE;
+  if (commutative && Codegen_is_const(c, a, &constant)) {
+    ValueId tmp = a;
+    a = b;
+    b = tmp;
+  }
+  if (type >= INST_EQ && type <= INST_GE) data_type = DATA_INT;
+  return Codegen_inst(c, (Inst){ .type = type, .data_type = data_type, .a = a, .b = b });
+}
+
+ValueId Codegen_value(Codegen *c, AstId start);
+
+// note: The order of the operands, as in "The Generation of Optimal
+// Code for Arithmetic Expressions" by Sethi and Ullman. A node is
+// labeled with the number of the registers it needs, and the operand,
+// that needs more, is made first, so only its result is held, while
+// the other one is made. The operands aren't sequenced in C, but they
+// are swapped only when it can't be seen, neither of them may write
+// what the other one reads or writes. An expression is labeled once,
+// when the codegen gets to its root, its nodes are made after its first
+// leaf and before it, so they're a range of the ids.
+#define NEED_MASK 0x0f
+#define NEED_READ_LOCAL 0x10
+#define NEED_READ_MEMORY 0x20
+#define NEED_WRITE_LOCAL 0x40
+#define NEED_WRITE_MEMORY 0x80
+// of the nodes, that aren't in the expression, they stay in place
+#define NEED_UNKNOWN 0xff
+
+static inline bool Codegen_independent(uint8_t a, uint8_t b) {
+  if (a & NEED_WRITE_LOCAL && b & (NEED_READ_LOCAL | NEED_WRITE_LOCAL)) return false;
+  if (a & NEED_WRITE_MEMORY && b & (NEED_READ_MEMORY | NEED_WRITE_MEMORY)) return false;
+  return true;
+}
+
+static inline bool Codegen_swappable(uint8_t a, uint8_t b) {
+  return Codegen_independent(a, b) && Codegen_independent(b, a);
+}
+
+static uint8_t Codegen_measure(Codegen *c, AstId id) {
+  AstCursor node = Ast_cursor(c->ast, id);
+  uint32_t need = 0, flags = 0, i = 0, local;
+  uint8_t first = 0;
+  for (AstId child = AstCursor_child_id(&node); child; child = Ast_sibling(c->ast, child), ++i) {
+    uint8_t label = Codegen_measure(c, child);
+    // the earlier results are held, while it's made
+    if (need < (label & NEED_MASK) + i) need = (label & NEED_MASK) + i;
+    flags |= label & ~NEED_MASK;
+    if (!i) first = label;
+    // the better order of the two, when they can go in any
+    if (i == 1 && node.kind <= AST_BOR && Codegen_swappable(first, label)) {
+      uint32_t a = first & NEED_MASK, b = label & NEED_MASK;
+      need = a == b ? a + 1 : a > b ? a : b;
+    }
+  }
+  switch (node.kind) {
     case AST_INT:
-      assert(expr.value.i64 <= INT32_MAX);
-      uint16_t low = expr.value.i64;
-      uint16_t high = expr.value.i64 >> 16;
-      // TODO: a quick fix, think about a better way, maybe variable length?
-      return Codegen_inst(c, (Inst){ INST_INT, low, high, 0 });
-    case AST_ADD:
-      uint16_t left = expr.value.first_child;
-      a = Codegen_value(c, left);
-      b = Codegen_value(c, c->ast[left].next_sibling);
-      return Codegen_inst(c, (Inst){ INST_ADD, a, b, 0 });
+      break;
+    case AST_VAR:
+      need = 1;
+      flags = Codegen_local(c, AstCursor_payload(&node), &local) ? NEED_READ_LOCAL : NEED_READ_MEMORY;
+      break;
+    case AST_ASS: case AST_ASS_MUL: case AST_ASS_DIV: case AST_ASS_MOD:
+    case AST_ASS_ADD: case AST_ASS_SUB: case AST_ASS_LSFT: case AST_ASS_RSFT:
+    case AST_ASS_AND: case AST_ASS_XOR: case AST_ASS_OR:
+    case AST_PRE_INC: case AST_PRE_DEC: case AST_POST_INC: case AST_POST_DEC:
+      // the target is the first one
+      flags |= first & NEED_READ_LOCAL ? NEED_WRITE_LOCAL : NEED_WRITE_MEMORY;
+      break;
+    case AST_CALL:
+      flags |= NEED_READ_MEMORY | NEED_WRITE_MEMORY;
+      break;
+    case AST_SIZEOF:
+      // not evaluated
+      need = flags = 0;
+      break;
     default:
-      assert(0);
+      break;
   }
+  if (need < 1 && node.kind != AST_INT && node.kind != AST_SIZEOF) need = 1;
+  if (need > NEED_MASK) need = NEED_MASK;
+  c->needs[id - c->needs_start] = need | flags;
+  return need | flags;
 }
 
-void codegen(const AstNode *ast, uint16_t ast_start, Inst insts[MAX_INSTRUCTIONS]) {
-  Codegen c = {
-    .ast = ast,
-    .insts = insts,
-  };
-  Codegen_value(&c, ast_start);
+// Whether the second operand of the binary node goes first
+static bool Codegen_second_first(Codegen *c, AstId id, AstCursor *first) {
+  if (id < c->needs_start || id > c->needs_end) {
+    AstCursor leaf = *first;
+    while (AstCursor_child_id(&leaf)) leaf = AstCursor_child(&leaf);
+    c->needs_start = leaf.id;
+    c->needs_end = id;
+    uint32_t count = id - leaf.id + 1;
+    c->needs = ARENA_PUSH(c->scratch, uint8_t, (count + 7) & ~7u);
+    memset(c->needs, NEED_UNKNOWN, count);
+    Codegen_measure(c, id);
+  }
+  uint8_t a = c->needs[first->id - c->needs_start], b = c->needs[first->sibling - c->needs_start];
+  return (b & NEED_MASK) > (a & NEED_MASK) && Codegen_swappable(a, b);
+}
+
+// Branches on the value, the logical operators jump straight
+// to the targets, without making the value
+static void Codegen_condition(Codegen *c, AstId start, BlockId then, BlockId els) {
+  AstCursor node = Ast_cursor(c->ast, start);
+  AstCursor left;
+  BlockId right;
+  switch (node.kind) {
+    case AST_LAND:
+    case AST_LOR:
+      left = AstCursor_child(&node);
+      right = Codegen_block(c);
+      if (node.kind == AST_LAND) Codegen_condition(c, left.id, right, els);
+      else Codegen_condition(c, left.id, then, right);
+      Codegen_seal(c, right);
+      c->block = right;
+      Codegen_condition(c, left.sibling, then, els);
+      break;
+    case AST_NOT:
+      Codegen_condition(c, AstCursor_child_id(&node), els, then);
+      break;
+    default:
+      Codegen_branch(c, Codegen_value(c, start), then, els);
+  }
+}
+
+// Zero or one, of the comparisons and the logical operators
+static ValueId Codegen_bool(Codegen *c, AstId start) {
+  BlockId ends[2] = { Codegen_block(c), Codegen_block(c) };
+  Codegen_condition(c, start, ends[0], ends[1]);
+  ValueId values[2];
+  for (uint32_t i = 0; i < 2; ++i) {
+    Codegen_seal(c, ends[i]);
+    c->block = ends[i];
+    values[i] = Codegen_const(c, DATA_INT, !i);
+  }
+  return Codegen_join(c, DATA_INT, ends, values);
+}
+
+static ValueId Codegen_conditional(Codegen *c, AstCursor *node) {
+  AstCursor cond = AstCursor_child(node);
+  AstId second = Ast_sibling(c->ast, cond.sibling);
+  BlockId ends[2] = { Codegen_block(c), Codegen_block(c) };
+  Codegen_condition(c, cond.id, ends[0], ends[1]);
+  ValueId values[2];
+  // note: The type is known only after both of them, so the ends
+  // of the branches are finished by the join. The one after a
+  // constant condition is made anyway, in a dead block, for its type.
+  for (uint32_t i = 0; i < 2; ++i) {
+    Codegen_seal(c, ends[i]);
+    c->block = ends[i];
+    values[i] = Codegen_value(c, i ? second : cond.sibling);
+    ends[i] = c->block;
+  }
+  DataType type = DataType_common(Codegen_type(c, values[0]), Codegen_type(c, values[1]));
+  return Codegen_join(c, type, ends, values);
 }
 
-void print_insts(const Inst *insts) {
-  int i = 0;
-  while (insts->type) {
-    printf("% 3d %s ", i, INST_TYPE_NAME[insts->type]);
-    switch(insts->type) {
-      case INST_INT:
-        printf("%d\n", insts->a | (insts->b << 16));
+static ValueId Codegen_call(Codegen *c, AstCursor *node) {
+  AstCursor callee = AstCursor_child(node);
+  // TODO: calls through pointers
+  if (callee.kind != AST_VAR || (c->constant && !Codegen_dead(c, c->block))) {
+    Codegen_unsupported(c, AST_CALL);
+    return 0;
+  }
+  uint32_t count = 0;
+  for (AstId arg = callee.sibling; arg; arg = Ast_sibling(c->ast, arg)) count++;
+  ValueId args[count + 1];
+  count = 0;
+  for (AstId arg = callee.sibling; arg; arg = Ast_sibling(c->ast, arg)) {
+    // without prototypes, every argument is promoted
+    ValueId value = Codegen_value(c, arg);
+    args[count++] = Codegen_convert(c, value, DataType_promote(Codegen_type(c, value)));
+  }
+  VarId var = AstCursor_payload(&callee);
+  ValueId call = Codegen_inst(c, (Inst){
+    .type = INST_CALL,
+    .data_type = c->p->vars[var].type,
+    .a = var,
+  });
+  Codegen_args(c, call, args, count);
+  return call;
+}
+
+// The increments and decrements, of a var only
+static ValueId Codegen_step(Codegen *c, AstCursor *node) {
+  AstCursor target = AstCursor_child(node);
+  // TODO: the other lvalues
+  if (target.kind != AST_VAR) {
+    Codegen_unsupported(c, node->kind);
+    return 0;
+  }
+  VarId var = AstCursor_payload(&target);
+  ValueId old = Codegen_load(c, var);
+  ValueId one = Codegen_const(c, DATA_INT, 1);
+  bool inc = node->kind == AST_PRE_INC || node->kind == AST_POST_INC;
+  ValueId value = Codegen_store(c, var, Codegen_binary(c, inc ? AST_ADD : AST_SUB, old, one));
+  return node->kind == AST_PRE_INC || node->kind == AST_PRE_DEC ? value : old;
+}
+
+static ValueId Codegen_expression(Codegen *c, AstId start) {
+  AstCursor node = Ast_cursor(c->ast, start);
+  AstCursor left;
+  ValueId a, b;
+  switch (node.kind) {
+    case AST_INT:
+      int64_t value = AstCursor_int(&node);
+      return Codegen_const(c, value <= INT32_MAX ? DATA_INT : DATA_LONG_INT, value);
+    case AST_VAR:
+      return Codegen_load(c, AstCursor_payload(&node));
+    case AST_MUL: case AST_DIV: case AST_MOD: case AST_ADD: case AST_SUB:
+    case AST_LSFT: case AST_RSFT: case AST_LT: case AST_LE: case AST_GT:
+    case AST_GE: case AST_EQ: case AST_NE: case AST_BAND: case AST_BXOR:
+    case AST_BOR:
+      left = AstCursor_child(&node);
+      if (Codegen_second_first(c, start, &left)) {
+        b = Codegen_value(c, left.sibling);
+        a = Codegen_value(c, left.id);
+      } else {
+        a = Codegen_value(c, left.id);
+        b = Codegen_value(c, left.sibling);
+      }
+      return Codegen_binary(c, node.kind, a, b);
+    case AST_LAND: case AST_LOR:
+      return Codegen_bool(c, start);
+    case AST_NOT:
+      a = Codegen_value(c, AstCursor_child_id(&node));
+      return Codegen_binary(c, AST_EQ, a, Codegen_const(c, DATA_INT, 0));
+    case AST_CONDITIONAL:
+      return Codegen_conditional(c, &node);
+    case AST_COMMA:
+      // the ones before the last are only for their side effects
+      left = AstCursor_child(&node);
+      for (; left.sibling; left = Ast_cursor(c->ast, left.sibling)) Codegen_value(c, left.id);
+      return Codegen_value(c, left.id);
+    case AST_ASS:
+      left = AstCursor_child(&node);
+      if (left.kind != AST_VAR) break;
+      return Codegen_store(c, AstCursor_payload(&left), Codegen_value(c, left.sibling));
+    case AST_ASS_MUL: case AST_ASS_DIV: case AST_ASS_MOD: case AST_ASS_ADD:
+    case AST_ASS_SUB: case AST_ASS_LSFT: case AST_ASS_RSFT: case AST_ASS_AND:
+    case AST_ASS_XOR: case AST_ASS_OR:
+      left = AstCursor_child(&node);
+      if (left.kind != AST_VAR) break;
+      VarId var = AstCursor_payload(&left);
+      a = Codegen_load(c, var);
+      b = Codegen_value(c, left.sibling);
+      return Codegen_store(c, var, Codegen_binary(c, ASSIGN_TO_AST[node.kind], a, b));
+    case AST_PRE_INC: case AST_PRE_DEC: case AST_POST_INC: case AST_POST_DEC:
+      return Codegen_step(c, &node);
+    case AST_PLUS: case AST_MINUS: case AST_NEG:
+      a = Codegen_value(c, AstCursor_child_id(&node));
+      a = Codegen_convert(c, a, DataType_promote(Codegen_type(c, a)));
+      if (node.kind == AST_PLUS) return a;
+      InstType op = node.kind == AST_MINUS ? INST_NEG : INST_NOT;
+      int64_t constant;
+      if (Codegen_is_const(c, a, &constant)) {
+        Ir_fold(op, Codegen_type(c, a), constant, 0, &constant);
+        return Codegen_const(c, Codegen_type(c, a), constant);
+      }
+      return Codegen_inst(c, (Inst){ .type = op, .data_type = Codegen_type(c, a), .a = a });
+    case AST_CALL:
+      return Codegen_call(c, &node);
+    case AST_SIZEOF:
+      // note: The operand isn't evaluated, it's made in a dead block for its type
+      BlockId block = c->block;
+      Codegen_unreachable(c);
+      a = Codegen_value(c, AstCursor_child_id(&node));
+      c->block = block;
+      if (!DataType_size(Codegen_type(c, a))) break;
+      return Codegen_const(c, DATA_LONG_UINT, DataType_size(Codegen_type(c, a)));
+    default:
+      break;
+  }
+  Codegen_unsupported(c, node.kind);
+  return 0;
+}
+
+// The case and default labels of the switch body, not the nested ones
+static void Codegen_collect_cases(Codegen *c, AstId start) {
+  AstCursor node = Ast_cursor(c->ast, start);
+  switch (node.kind) {
+    case AST_CASE:
+    case AST_DEFAULT:
+      *ARENA_PUSH(c->scratch, CodegenCase, 1) = (CodegenCase){ start, 0 };
+      // fallthrough
+    case AST_COMPOUND: case AST_IF: case AST_WHILE: case AST_DO_WHILE: case AST_FOR:
+      for (AstId child = AstCursor_child_id(&node); child; child = Ast_sibling(c->ast, child)) {
+        Codegen_collect_cases(c, child);
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+static BlockId Codegen_label(Codegen *c, LabelId label) {
+  uint32_t index = label - c->f->labels;
+  assert(index < c->f->label_count);
+  if (!c->label_blocks[index]) c->label_blocks[index] = Codegen_block(c);
+  return c->label_blocks[index];
+}
+
+void Codegen_statement(Codegen *c, AstId start);
+
+// The body of a loop, with its break and continue targets
+static void Codegen_loop_body(Codegen *c, AstId body, BlockId exit, BlockId next) {
+  BlockId break_to = c->break_to, continue_to = c->continue_to;
+  c->break_to = exit;
+  c->continue_to = next;
+  Codegen_statement(c, body);
+  c->break_to = break_to;
+  c->continue_to = continue_to;
+}
+
+static void Codegen_switch(Codegen *c, AstCursor *node) {
+  AstCursor cond = AstCursor_child(node);
+  ValueId value = Codegen_value(c, cond.id);
+  DataType type = DataType_promote(Codegen_type(c, value));
+  value = Codegen_convert(c, value, type);
+
+  // note: Nothing else goes to the scratch while they're collected
+  CodegenCase *cases = (CodegenCase *)(c->scratch->base + c->scratch->size);
+  Codegen_collect_cases(c, cond.sibling);
+  uint32_t count = (CodegenCase *)(c->scratch->base + c->scratch->size) - cases;
+  BlockId exit = Codegen_block(c), default_to = exit;
+  // TODO: a jump table, when they're dense
+  for (uint32_t i = 0; i < count; ++i) {
+    cases[i].block = Codegen_block(c);
+    AstCursor label = Ast_cursor(c->ast, cases[i].node);
+    if (label.kind == AST_DEFAULT) {
+      default_to = cases[i].block;
+      continue;
+    }
+    // note: Folded to a constant, like any other expression
+    ValueId constant = Codegen_value(c, AstCursor_child_id(&label));
+    if (c->insts[constant].type != INST_CONST) {
+      Codegen_unsupported(c, AST_CASE);
+      continue;
+    }
+    ValueId eq = Codegen_binary(c, AST_EQ, value, Codegen_convert(c, constant, type));
+    BlockId next = Codegen_block(c);
+    Codegen_branch(c, eq, cases[i].block, next);
+    Codegen_seal(c, next);
+    c->block = next;
+  }
+  Codegen_jump(c, default_to);
+  Codegen_unreachable(c);
+
+  CodegenCase *outer = c->cases;
+  uint32_t next_case = c->next_case;
+  BlockId break_to = c->break_to;
+  c->cases = cases;
+  c->next_case = 0;
+  c->break_to = exit;
+  Codegen_statement(c, cond.sibling);
+  Codegen_jump(c, exit);
+  // every case block is sealed at its label
+  assert(c->next_case == count);
+  c->cases = outer;
+  c->next_case = next_case;
+  c->break_to = break_to;
+  Codegen_seal(c, exit);
+  c->block = exit;
+}
+
+ValueId Codegen_value(Codegen *c, AstId start) {
+  AstId outer = c->node;
+  c->node = start;
+  ValueId value = Codegen_expression(c, start);
+  c->node = outer;
+  return value;
+}
+
+static void Codegen_node(Codegen *c, AstId start) {
+  AstCursor node = Ast_cursor(c->ast, start);
+  AstCursor child;
+  BlockId then, els, exit, head, next;
+  switch (node.kind) {
+    case AST_COMPOUND:
+      for (AstId id = AstCursor_child_id(&node); id; id = Ast_sibling(c->ast, id)) {
+        Codegen_statement(c, id);
+      }
+      break;
+    case AST_RETURN:
+      AstId expr = AstCursor_child_id(&node);
+      ValueId value = 0;
+      if (expr) {
+        value = Codegen_value(c, expr);
+        value = Codegen_convert(c, value, c->p->vars[c->f->var].type);
+      }
+      Codegen_inst(c, (Inst){ .type = INST_RET, .a = value, .count = expr != 0 });
+      Codegen_unreachable(c);
+      break;
+    case AST_DECL:
+      struct AstValueDecl decl = AstCursor_decl(&node);
+      AstId init = decl.first_child;
+      for (uint32_t i = 0; i < decl.var_count; ++i, init = Ast_sibling(c->ast, init)) {
+        if (Ast_kind(c->ast, init) == AST_EMPTY) continue;
+        Codegen_store(c, decl.var_start + i, Codegen_value(c, init));
+      }
+      break;
+    case AST_EMPTY:
+      break;
+    case AST_IF:
+      child = AstCursor_child(&node);
+      AstId second = Ast_sibling(c->ast, child.sibling);
+      then = Codegen_block(c);
+      els = Codegen_block(c);
+      exit = second ? Codegen_block(c) : els;
+      Codegen_condition(c, child.id, then, els);
+      Codegen_seal(c, then);
+      c->block = then;
+      Codegen_statement(c, child.sibling);
+      Codegen_jump(c, exit);
+      if (second) {
+        Codegen_seal(c, els);
+        c->block = els;
+        Codegen_statement(c, second);
+        Codegen_jump(c, exit);
+      }
+      Codegen_seal(c, exit);
+      c->block = exit;
+      break;
+    case AST_WHILE:
+      child = AstCursor_child(&node);
+      head = Codegen_block(c);
+      then = Codegen_block(c);
+      exit = Codegen_block(c);
+      Codegen_jump(c, head);
+      c->block = head;
+      Codegen_condition(c, child.id, then, exit);
+      Codegen_seal(c, then);
+      c->block = then;
+      Codegen_loop_body(c, child.sibling, exit, head);
+      Codegen_jump(c, head);
+      Codegen_seal(c, head);
+      Codegen_seal(c, exit);
+      c->block = exit;
+      break;
+    case AST_DO_WHILE:
+      child = AstCursor_child(&node);
+      head = Codegen_block(c);
+      next = Codegen_block(c);
+      exit = Codegen_block(c);
+      Codegen_jump(c, head);
+      c->block = head;
+      Codegen_loop_body(c, child.id, exit, next);
+      Codegen_jump(c, next);
+      Codegen_seal(c, next);
+      c->block = next;
+      Codegen_condition(c, child.sibling, head, exit);
+      Codegen_seal(c, head);
+      Codegen_seal(c, exit);
+      c->block = exit;
+      break;
+    case AST_FOR:
+      child = AstCursor_child(&node);
+      AstId cond = child.sibling;
+      AstId step = Ast_sibling(c->ast, cond);
+      AstId body = Ast_sibling(c->ast, step);
+      if (child.kind != AST_EMPTY) Codegen_value(c, child.id);
+      head = Codegen_block(c);
+      then = Codegen_block(c);
+      next = Codegen_block(c);
+      exit = Codegen_block(c);
+      Codegen_jump(c, head);
+      c->block = head;
+      if (Ast_kind(c->ast, cond) != AST_EMPTY) Codegen_condition(c, cond, then, exit);
+      else Codegen_jump(c, then);
+      Codegen_seal(c, then);
+      c->block = then;
+      Codegen_loop_body(c, body, exit, next);
+      Codegen_jump(c, next);
+      Codegen_seal(c, next);
+      c->block = next;
+      if (Ast_kind(c->ast, step) != AST_EMPTY) Codegen_value(c, step);
+      Codegen_jump(c, head);
+      Codegen_seal(c, head);
+      Codegen_seal(c, exit);
+      c->block = exit;
+      break;
+    case AST_SWITCH:
+      Codegen_switch(c, &node);
+      break;
+    case AST_CASE:
+    case AST_DEFAULT:
+      if (!c->cases) {
+        Codegen_unsupported(c, node.kind);
         break;
-      case INST_ADD:
-        printf("t%d, t%d\n", insts->a, insts->b);
+      }
+      CodegenCase *label = &c->cases[c->next_case++];
+      assert(label->node == start);
+      // falling through from the one before, the
+      // compare chain of the switch is done already
+      Codegen_jump(c, label->block);
+      Codegen_seal(c, label->block);
+      c->block = label->block;
+      child = AstCursor_child(&node);
+      Codegen_statement(c, node.kind == AST_CASE ? child.sibling : child.id);
+      break;
+    case AST_LABEL:
+      next = Codegen_label(c, AstCursor_payload(&node));
+      Codegen_jump(c, next);
+      c->block = next;
+      break;
+    case AST_GOTO:
+      Codegen_jump(c, Codegen_label(c, AstCursor_payload(&node)));
+      Codegen_unreachable(c);
+      break;
+    case AST_BREAK:
+    case AST_CONTINUE:
+      next = node.kind == AST_BREAK ? c->break_to : c->continue_to;
+      if (!next) {
+        Codegen_unsupported(c, node.kind);
+        break;
+      }
+      Codegen_jump(c, next);
+      Codegen_unreachable(c);
+      break;
+    default:
+      if (node.kind < AST_LABEL) Codegen_value(c, start);
+      else Codegen_unsupported(c, node.kind);
+  }
+}
+
+void Codegen_statement(Codegen *c, AstId start) {
+  AstId outer = c->node;
+  c->node = start;
+  Codegen_node(c, start);
+  c->node = outer;
+}
+
+// The new id of the value, through the removed phis
+static inline ValueId Codegen_resolve(const ValueId *forward, const ValueId *renumber, ValueId value) {
+  while (forward[value] != value) value = forward[value];
+  return renumber[value];
+}
+
+// Drops the unreachable blocks, the trivial phis and the unused values,
+// puts the blocks in the reverse postorder and the instructions in the
+// order of them
+static void Codegen_finish(Codegen *c, Ir *ir) {
+  Arena *scratch = c->scratch;
+  uint32_t block_count = c->block_count;
+  // of the old blocks, the new index + 1, zero for the unreachable ones
+  BlockId *renumber = ARENA_PUSH(scratch, BlockId, block_count);
+  BlockId *order = ARENA_PUSH(scratch, BlockId, block_count);
+  BlockId *stack = ARENA_PUSH(scratch, BlockId, block_count * 2);
+  memset(renumber, 0, sizeof(BlockId) * block_count);
+  uint32_t count = 0, top = 0;
+  stack[top++] = CODEGEN_ENTRY;
+  stack[top++] = 0;
+  renumber[CODEGEN_ENTRY] = 1;
+  while (top) {
+    const CodegenBlock *b = &c->blocks[stack[top - 2]];
+    if (stack[top - 1] < b->succ_count) {
+      BlockId succ = b->succs[stack[top - 1]++];
+      if (renumber[succ]) continue;
+      renumber[succ] = 1;
+      stack[top++] = succ;
+      stack[top++] = 0;
+    } else {
+      order[count++] = stack[top - 2];
+      top -= 2;
+    }
+  }
+  for (uint32_t i = 0; i < count / 2; ++i) {
+    BlockId tmp = order[i];
+    order[i] = order[count - 1 - i];
+    order[count - 1 - i] = tmp;
+  }
+  for (uint32_t i = 0; i < count; ++i) renumber[order[i]] = i + 1;
+
+  // note: Only the operands from the reachable predecessors
+  // count, a phi with a single other value is replaced by it
+  ValueId *forward = ARENA_PUSH(scratch, ValueId, c->inst_count);
+  const ValueId *args = (ValueId *)c->arenas[ARENA_ARGS].base;
+  for (ValueId i = 0; i < c->inst_count; ++i) forward[i] = i;
+  for (bool changed = true; changed;) {
+    changed = false;
+    for (ValueId i = 1; i < c->inst_count; ++i) {
+      const Inst *phi = &c->insts[i];
+      if (phi->type != INST_PHI || forward[i] != i || !renumber[phi->block]) continue;
+      ValueId same = 0;
+      uint32_t j = 0;
+      bool trivial = true;
+      for (CodegenEdge *e = c->blocks[phi->block].preds; e && trivial; e = e->next, ++j) {
+        if (!renumber[e->from]) continue;
+        ValueId value = args[phi->b + j];
+        while (forward[value] != value) value = forward[value];
+        if (value == i || value == same) continue;
+        trivial = !same;
+        same = value;
+      }
+      if (!trivial || !same) continue;
+      forward[i] = same;
+      changed = true;
+    }
+  }
+
+  // note: The values, that nothing with an effect depends on, are
+  // dropped, like the operands of the folded instructions
+  uint8_t *live = ARENA_PUSH(scratch, uint8_t, (c->inst_count + 7) & ~7u);
+  ValueId *work = ARENA_PUSH(scratch, ValueId, c->inst_count);
+  memset(live, 0, c->inst_count);
+  top = 0;
+  for (ValueId i = 1; i < c->inst_count; ++i) {
+    InstType type = c->insts[i].type;
+    if (!renumber[c->insts[i].block] || forward[i] != i) continue;
+    if (type != INST_STORE && type != INST_CALL && type < INST_JUMP) continue;
+    live[i] = true;
+    work[top++] = i;
+  }
+  while (top) {
+    const Inst *inst = &c->insts[work[--top]];
+    ValueId operands[2];
+    uint32_t count = 0;
+    const ValueId *list = operands;
+    const CodegenEdge *e = 0;
+    switch (inst->type) {
+      case INST_CONST: case INST_UNDEF: case INST_LOAD: case INST_JUMP:
+        break;
+      case INST_PHI:
+        e = c->blocks[inst->block].preds;
+        // fallthrough
+      case INST_CALL:
+        list = args + inst->b;
+        count = inst->count;
+        break;
+      case INST_STORE:
+        operands[count++] = inst->b;
+        break;
+      case INST_RET:
+        if (inst->count) operands[count++] = inst->a;
+        break;
+      case INST_BRANCH: case INST_NEG: case INST_NOT: case INST_CAST:
+        operands[count++] = inst->a;
+        break;
+      default:
+        operands[count++] = inst->a;
+        operands[count++] = inst->b;
+    }
+    for (uint32_t j = 0; j < count; ++j) {
+      if (e) {
+        bool reachable = renumber[e->from];
+        e = e->next;
+        if (!reachable) continue;
+      }
+      ValueId value = list[j];
+      while (forward[value] != value) value = forward[value];
+      if (live[value]) continue;
+      live[value] = true;
+      work[top++] = value;
+    }
+  }
+
+  // note: A block, that's the only successor of its only predecessor,
+  // is merged into it, like the chains left by the constant conditions.
+  // The new blocks are the heads of the chains, in the same order.
+  BlockId *chain = ARENA_PUSH(scratch, BlockId, block_count);
+  BlockId *head = ARENA_PUSH(scratch, BlockId, block_count);
+  memset(chain, 0, sizeof(BlockId) * block_count);
+  uint32_t new_count = 0;
+  for (uint32_t i = 0; i < count; ++i) {
+    BlockId block = order[i], pred = 0;
+    uint32_t pred_count = 0;
+    for (CodegenEdge *e = c->blocks[block].preds; e; e = e->next) {
+      if (!renumber[e->from]) continue;
+      pred = e->from;
+      pred_count++;
+    }
+    // the predecessor is the end of its chain, it comes first in the order
+    if (block != CODEGEN_ENTRY && pred_count == 1 && c->blocks[pred].succ_count == 1) {
+      chain[pred] = block;
+      head[block] = head[pred];
+      continue;
+    }
+    head[block] = block;
+    order[new_count++] = block;
+  }
+  BlockId *head_index = stack;
+  for (uint32_t i = 0; i < new_count; ++i) head_index[order[i]] = i + 1;
+  for (BlockId i = 0; i < block_count; ++i) {
+    if (renumber[i]) renumber[i] = head_index[head[i]];
+  }
+  count = new_count;
+
+  // The instructions of every old block, in the order they were made
+  ValueId *first = ARENA_PUSH(scratch, ValueId, block_count);
+  ValueId *next = ARENA_PUSH(scratch, ValueId, c->inst_count);
+  memset(first, 0, sizeof(ValueId) * block_count);
+  for (ValueId i = c->inst_count - 1; i > 0; --i) {
+    BlockId block = c->insts[i].block;
+    if (!renumber[block] || !live[i]) continue;
+    // the jumps inside of a chain are gone
+    if (c->insts[i].type == INST_JUMP && chain[block]) {
+      live[i] = false;
+      continue;
+    }
+    next[i] = first[block];
+    first[block] = i;
+  }
+
+  // The phis and undefs go first, then the rest in the order of the chain
+  uint32_t *starts = ARENA_PUSH(scratch, uint32_t, count + 1);
+  ValueId *renumber_inst = ARENA_PUSH(scratch, ValueId, c->inst_count);
+  uint32_t inst_count = 1;
+  renumber_inst[0] = 0;
+  for (uint32_t i = 0; i < count; ++i) {
+    starts[i] = inst_count;
+    for (int pass = 0; pass < 2; ++pass) {
+      for (BlockId block = order[i]; block; block = chain[block]) {
+        for (ValueId v = first[block]; v; v = next[v]) {
+          InstType type = c->insts[v].type;
+          bool early = type == INST_PHI || type == INST_UNDEF;
+          if (early == !pass) renumber_inst[v] = inst_count++;
+        }
+      }
+    }
+  }
+  starts[count] = inst_count;
+
+  Inst *insts = ARENA_PUSH(&c->arenas[ARENA_INSTS], Inst, inst_count);
+  Block *blocks = ARENA_PUSH(&c->arenas[ARENA_BLOCKS], Block, count);
+  Arena *args_arena = &c->arenas[ARENA_ARGS];
+  uint32_t args_start = ARENA_LEN(args_arena, ValueId);
+  uint32_t pred_total = 0;
+  for (uint32_t i = 0; i < count; ++i) {
+    BlockId tail = order[i];
+    while (chain[tail]) tail = chain[tail];
+    const CodegenBlock *b = &c->blocks[tail];
+    Block *block = &blocks[i];
+    *block = (Block){
+      .start = starts[i],
+      .len = starts[i + 1] - starts[i],
+      .succ_count = b->succ_count,
+    };
+    for (uint32_t j = 0; j < b->succ_count; ++j) block->succs[j] = renumber[b->succs[j]] - 1;
+    for (CodegenEdge *e = c->blocks[order[i]].preds; e; e = e->next) {
+      block->pred_count += renumber[e->from] != 0;
+    }
+    block->preds = pred_total;
+    pred_total += block->pred_count;
+  }
+  BlockId *preds = ARENA_PUSH(&c->arenas[ARENA_BLOCKS], BlockId, pred_total);
+  for (uint32_t i = 0; i < count; ++i) {
+    BlockId *pred = preds + blocks[i].preds;
+    for (CodegenEdge *e = c->blocks[order[i]].preds; e; e = e->next) {
+      if (renumber[e->from]) *pred++ = renumber[e->from] - 1;
+    }
+  }
+
+  insts[0] = (Inst){0};
+  for (ValueId i = 1; i < c->inst_count; ++i) {
+    BlockId block = renumber[c->insts[i].block];
+    if (!block || !live[i]) continue;
+    Inst inst = c->insts[i];
+    inst.block = block - 1;
+    switch (inst.type) {
+      case INST_CONST: case INST_UNDEF: case INST_LOAD: case INST_JUMP:
+        break;
+      case INST_STORE:
+        inst.b = Codegen_resolve(forward, renumber_inst, inst.b);
+        break;
+      case INST_PHI:
+      case INST_CALL:
+        uint32_t start = ARENA_LEN(args_arena, ValueId);
+        const CodegenEdge *e = c->blocks[c->insts[i].block].preds;
+        for (uint32_t j = 0; j < inst.count; ++j) {
+          if (inst.type == INST_PHI) {
+            bool reachable = renumber[e->from];
+            e = e->next;
+            if (!reachable) continue;
+          }
+          *ARENA_PUSH(args_arena, ValueId, 1) =
+            Codegen_resolve(forward, renumber_inst, args[inst.b + j]);
+        }
+        inst.b = start - args_start;
+        inst.count = ARENA_LEN(args_arena, ValueId) - start;
         break;
       default:
-        putchar(10);
+        inst.a = Codegen_resolve(forward, renumber_inst, inst.a);
+        inst.b = Codegen_resolve(forward, renumber_inst, inst.b);
     }
-    insts++;
-    i++;
+    insts[renumber_inst[i]] = inst;
   }
+
+  *ir = (Ir){
+    .file = c->p,
+    .insts = insts,
+    .blocks = blocks,
+    .args = (ValueId *)args_arena->base + args_start,
+    .preds = preds,
+    .inst_count = inst_count,
+    .block_count = count,
+  };
+}
+
+// Up to the sealed entry
+static void Codegen_init(Codegen *c, const Parser *p, const Function *f, AstId node, Arena *arenas) {
+  *c = (Codegen){
+    .p = p,
+    .f = f,
+    .ast = &p->ast,
+    .node = node,
+    .arenas = arenas,
+    .scratch = &arenas[ARENA_SCRATCH],
+    .insts = (Inst *)arenas[ARENA_INSTS].base,
+    .blocks = (CodegenBlock *)arenas[ARENA_BLOCKS].base,
+  };
+  Codegen_push(c, 0, (Inst){0});
+  Codegen_block(c);
+  c->block = Codegen_block(c);
+  Codegen_seal(c, c->block);
+}
+
+AstType codegen(const Parser *p, const Function *f, Arena *arenas, Ir *ir, uint32_t *loc) {
+  Codegen c;
+  Codegen_init(&c, p, f, f->body, arenas);
+  // note: Padded, so the scratch stays aligned for the pointers
+  c.label_blocks = ARENA_PUSH(c.scratch, BlockId, (f->label_count + 1) & ~1u);
+  memset(c.label_blocks, 0, sizeof(BlockId) * f->label_count);
+
+  Codegen_statement(&c, f->body);
+  // falling off the end, main returns zero
+  const Var *var = &p->vars[f->var];
+  Str name = Interner_str(p->interner, var->name);
+  if (name.len == 4 && !memcmp(name.ptr, "main", 4) && DataType_size(var->type)) {
+    ValueId zero = Codegen_const(&c, DATA_INT, 0);
+    Codegen_inst(&c, (Inst){ .type = INST_RET, .a = zero, .count = 1 });
+  } else {
+    Codegen_inst(&c, (Inst){ .type = INST_RET });
+  }
+  for (uint32_t i = 0; i < f->label_count; ++i) {
+    if (c.label_blocks[i]) Codegen_seal(&c, c.label_blocks[i]);
+  }
+  if (c.unsupported) {
+    *loc = c.unsupported_loc;
+    return c.unsupported;
+  }
+  Codegen_finish(&c, ir);
+  Ir_dominators(ir, c.scratch);
+  Ir_verify(ir);
+  return AST_NONE;
 }
 
+// note: The value is made like the one of a local, it has to be folded
+// into a constant. There are no locals, the vars are all loaded.
+AstType codegen_initializer(const Parser *p, AstId value, DataType type, Arena *arenas,
+    int64_t *result, uint32_t *loc) {
+  const Function f = {0};
+  Codegen c;
+  Codegen_init(&c, p, &f, value, arenas);
+  c.constant = true;
+  ValueId v = Codegen_convert(&c, Codegen_value(&c, value), type);
+  if (!Codegen_is_const(&c, v, result)) Codegen_unsupported(&c, Ast_kind(c.ast, value));
+  *loc = c.unsupported_loc;
+  return c.unsupported;
+}
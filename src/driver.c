@@ -0,0 +1,391 @@
+#include "driver.h"
+#include "arena.h"
+#include "backend.h"
+#include "cache.h"
+#include "preprocessor.h"
+#include "intern.h"
+#include "pch.h"
+#include "parser.h"
+#include "peephole.h"
+#include "symtab.h"
+#include "tokens.h"
+#include "writer.h"
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// Maps the file followed by at least a page of zeroes, so the
+// source is always zero terminated, returns zero if it can't be opened
+Source map_source(const char *filename) {
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) return (Source){0};
+
+  struct stat st;
+  int err = fstat(fd, &st);
+  assert(err >= 0);
+
+  size_t page = sysconf(_SC_PAGESIZE);
+  size_t size = (st.st_size + page - 1) / page * page + page;
+  char *file = mmap(0, size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  assert(file != MAP_FAILED);
+  if (st.st_size) {
+    void *mapped = mmap(file, st.st_size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0);
+    assert(mapped != MAP_FAILED);
+  }
+  close(fd);
+  return (Source){ file, size };
+}
+
+void unmap_source(Source source) {
+  int err = munmap((void *)source.data, source.size);
+  assert(!err);
+}
+
+double time_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// The name of the file with the extension replaced, in the
+// current directory, like the other compilers do it
+static void output_path(const char *filename, const char *ext, char path[PATH_MAX]) {
+  const char *name = strrchr(filename, '/');
+  name = name ? name + 1 : filename;
+  const char *dot = strrchr(name, '.');
+  int len = dot && dot != name ? dot - name : (int)strlen(name);
+  int n = snprintf(path, PATH_MAX, "%.*s.%s", len, name, ext);
+  assert(n < PATH_MAX);
+}
+
+// With the output on the stdout, or a program running, the rest goes to the stderr
+static FILE *Driver_log(const Driver *d) {
+  return d->run || (d->output && !strcmp(d->output, "-")) ? stderr : stdout;
+}
+
+// Sets up the unit for reading the main file, from
+// the state of the precompiled header, if there's one
+static void compile_begin(const Driver *d, Interner *in, Preprocessor *pp,
+    Parser *p, Arenas *arenas, Source source, const char *filename) {
+  Preprocessor_init(pp, in, arenas->arenas, d->include_dirs, d->include_dir_count);
+  Parser_init(p, in, pp, arenas->arenas, 0);
+  if (d->pch) Pch_load(d->pch, in, pp, p);
+  Preprocessor_begin(pp, source, filename, 0);
+}
+
+int compile(FILE *out, const Driver *d, const char *filename, Workspace *w) {
+  fprintf(out, "Reading file '%s'\n", filename);
+  Source source = map_source(filename);
+  assert(source.data); // TODO: error for missing file
+
+  Arenas *arenas = &w->arenas;
+  Interner *interner = &w->interner;
+  Interner_reset(interner);
+
+  Preprocessor pp;
+  Parser p;
+  compile_begin(d, interner, &pp, &p, arenas, source, filename);
+  // note: The tokens aren't kept, the parser pulls them from
+  // the preprocessor, so the printing takes the place of it
+  if (d->dump_tokens) {
+    fprintf(out, "\nTokenizing:\n");
+    print_tokens(out, &pp);
+    unmap_source(source);
+    return 0;
+  }
+  // note: Half of the threads run the back end, while the others
+  // are still parsing, with one there's no pipeline
+  PeepholeStats peephole = {0};
+  RegAllocStats regalloc = {0};
+  Backend backend = {
+    .threads = d->parse_threads / 2,
+    .cache = d->dump_ir ? 0 : d->cache,
+    .dump_ir = d->dump_ir,
+    .object = !d->assembly || d->run,
+    .peephole = &peephole,
+    .regalloc = &regalloc,
+  };
+  AstId index = parse(&p, d->parse_threads - backend.threads, &backend);
+  if (d->dump_ast) {
+    fprintf(out, "\nParsing:\n");
+    print_ast(out, &p, index, 0);
+  }
+
+  if (d->stats) {
+    fprintf(out, "\nStats:\n");
+    if (d->pch) {
+      Str prefix = Pch_prefix(d->pch);
+      fprintf(out, "pch: '%.*s', %u files\n", prefix.len, prefix.ptr,
+          d->pch->header->file_count);
+    }
+    Preprocessor_print_stats(out, &pp);
+    fprintf(out, "ast: %u nodes, %u bytes, %.1f bytes/node\n", p.ast.count,
+        p.ast.size, (double)p.ast.size / p.ast.count);
+    SymTab_print_stats(out, &p.var_index, "vars");
+    SymTab_print_stats(out, &p.typedef_index, "typedefs");
+    SymTab_print_stats(out, &p.struct_index, "structs");
+    SymTab_print_stats(out, &p.label_index, "labels");
+  }
+
+  // note: The back end is joined either way, it runs on the workers
+  if (!Backend_join(&backend) || p.errors) {
+    Backend_free(&backend);
+    unmap_source(source);
+    return 1;
+  }
+  if (d->run) {
+    fprintf(out, "\nRunning '%s'\n", filename);
+    fflush(out);
+    int status = Backend_run(&backend, d->run_argc, d->run_argv);
+    if (d->stats) {
+      Peephole_print_stats(out, &peephole);
+      RegAlloc_print_stats(out, &regalloc);
+    }
+    unmap_source(source);
+    return status;
+  }
+  char path[PATH_MAX];
+  if (d->output) {
+    int n = snprintf(path, PATH_MAX, "%s", d->output);
+    assert(n < PATH_MAX);
+  } else output_path(filename, d->assembly ? "s" : "o", path);
+  fprintf(out, "\nWriting '%s'\n", path);
+  // note: Read and write, so the object can be mapped
+  int fd = strcmp(path, "-") ? open(path, O_RDWR | O_CREAT | O_TRUNC, 0644) : STDOUT_FILENO;
+  assert(fd >= 0); // TODO: error for an unwritable output
+  Writer writer;
+  Writer_file(&writer, fd);
+  Backend_finish(&backend, &writer);
+  Writer_close(&writer);
+  // note: Only known, once the back end is done
+  if (d->stats) {
+    Peephole_print_stats(out, &peephole);
+    RegAlloc_print_stats(out, &regalloc);
+  }
+  if (fd != STDOUT_FILENO) {
+    int err = close(fd);
+    assert(!err);
+  }
+  unmap_source(source);
+  return 0;
+}
+
+static void *Driver_worker(void *arg) {
+  Driver *d = arg;
+  uint32_t index = __atomic_fetch_add(&d->next_workspace, 1, __ATOMIC_RELAXED);
+  Workspace *w = &d->workspaces[index];
+  if (!w->ready) {
+    Arenas_init(&w->arenas);
+    Interner_init(&w->interner);
+    w->ready = true;
+  }
+  while (1) {
+    uint32_t i = __atomic_fetch_add(&d->next_job, 1, __ATOMIC_RELAXED);
+    if (i >= d->job_count) break;
+    Job *job = &d->jobs[i];
+    FILE *log = Driver_log(d), *out = log;
+    // note: The stderr isn't buffered, so it's written at the end
+    // too, but not for a run, as the program can exit on its own
+    if (d->threads > 1 || (log != stdout && !d->run)) {
+      out = open_memstream(&job->output, &job->output_len);
+      assert(out);
+    }
+    double start = time_now();
+    job->status = compile(out, d, job->filename, w);
+    job->seconds = time_now() - start;
+    if (out != log) {
+      int err = fclose(out);
+      assert(!err);
+    }
+    Arenas_reset(&w->arenas);
+  }
+  return 0;
+}
+
+void Driver_init(Driver *d, Cache *cache, int argc, const char **argv) {
+  *d = (Driver){0};
+  d->jobs = calloc(argc, sizeof(Job));
+  d->include_dirs = calloc(argc, sizeof(const char *));
+  assert(d->jobs && d->include_dirs);
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i], "--stats")) d->stats = true;
+    else if (!strcmp(argv[i], "-S")) d->assembly = true;
+    else if (!strcmp(argv[i], "--run")) d->run = true;
+    else if (!strcmp(argv[i], "-o")) {
+      assert(i + 1 < argc);
+      d->output = argv[++i];
+    }
+    // the ir goes with the assembly
+    else if (!strcmp(argv[i], "--ir")) d->dump_ir = d->assembly = true;
+    else if (!strcmp(argv[i], "--tokens")) d->dump_tokens = true;
+    else if (!strcmp(argv[i], "--ast")) d->dump_ast = true;
+    else if (!strcmp(argv[i], "-j")) {
+      assert(i + 1 < argc);
+      d->threads = atoi(argv[++i]);
+      assert(d->threads > 0);
+    } else if (!strcmp(argv[i], "--emit-pch")) {
+      assert(i + 1 < argc);
+      d->pch_out = argv[++i];
+    } else if (!strcmp(argv[i], "--pch")) {
+      assert(i + 1 < argc);
+      d->pch_path = argv[++i];
+    } else if (!strcmp(argv[i], "--cache")) {
+      assert(i + 1 < argc);
+      cache->dir = argv[++i];
+      d->cache = cache;
+    } else if (!strcmp(argv[i], "--cache-size")) {
+      assert(i + 1 < argc);
+      // in MiB
+      cache->max_size = strtoull(argv[++i], 0, 10) << 20;
+    } else if (!strcmp(argv[i], "-I")) {
+      assert(i + 1 < argc);
+      d->include_dirs[d->include_dir_count++] = argv[++i];
+    } else {
+      d->jobs[d->job_count++].filename = argv[i];
+      if (!d->run) continue;
+      // the rest is for the program, the file is its argv[0]
+      d->run_argc = argc - i;
+      d->run_argv = argv + i;
+      break;
+    }
+  }
+}
+
+void Driver_free(Driver *d) {
+  free(d->jobs);
+  free(d->include_dirs);
+  *d = (Driver){0};
+}
+
+void Driver_run(Driver *d) {
+  if (!d->threads) d->threads = sysconf(_SC_NPROCESSORS_ONLN);
+  // A single file gets the threads for its function bodies
+  d->parse_threads = d->job_count == 1 ? d->threads : 1;
+  if (d->threads > d->job_count) d->threads = d->job_count;
+  if (d->workspaces && d->threads > d->workspace_count) d->threads = d->workspace_count;
+  if (!d->threads) d->threads = 1;
+  // note: Has to be done before the workers start, the lexers
+  // only select it lazily, when it's not set yet
+  if (!scan.space) scan_select(scan_detect());
+
+  if (d->pch_out) {
+    assert(d->job_count == 1);
+    Arenas arenas;
+    Arenas_init(&arenas);
+    Pch_build(d, d->pch_out, d->jobs[0].filename, &arenas);
+    Arenas_free(&arenas);
+    return;
+  }
+  Workspace *own = 0;
+  if (!d->workspaces) {
+    own = d->workspaces = calloc(d->threads, sizeof(Workspace));
+    assert(own);
+    d->workspace_count = d->threads;
+  }
+  d->next_workspace = 0;
+
+  // note: Opened once, it's checked against the headers only here
+  Pch pch;
+  if (d->pch_path && Pch_open(&pch, d->pch_path)) d->pch = &pch;
+
+  pthread_t *workers = malloc(sizeof(pthread_t) * d->threads);
+  assert(workers);
+  for (uint32_t i = 1; i < d->threads; ++i) {
+    int err = pthread_create(&workers[i], 0, Driver_worker, d);
+    assert(!err);
+  }
+  // the main thread is the first worker
+  Driver_worker(d);
+  for (uint32_t i = 1; i < d->threads; ++i) {
+    int err = pthread_join(workers[i], 0);
+    assert(!err);
+  }
+  free(workers);
+  if (d->pch) {
+    Pch_close(&pch);
+    d->pch = 0;
+  }
+  // note: Once for the process, not after every file
+  if (d->cache) Cache_trim(d->cache, d->stats ? stderr : 0);
+  if (own) {
+    for (uint32_t i = 0; i < d->workspace_count; ++i) {
+      if (!own[i].ready) continue;
+      Arenas_free(&own[i].arenas);
+      Interner_free(&own[i].interner);
+    }
+    free(own);
+    d->workspaces = 0;
+  }
+
+  FILE *log = Driver_log(d);
+  for (uint32_t i = 0; i < d->job_count; ++i) {
+    Job *job = &d->jobs[i];
+    if (!job->output) continue;
+    fwrite(job->output, 1, job->output_len, log);
+    free(job->output);
+    job->output = 0;
+  }
+  fflush(log);
+}
+
+int Driver_main(int argc, const char **argv, Workspace *workspaces, uint32_t count) {
+  Cache cache = { .max_size = (uint64_t)CACHE_DEFAULT_SIZE << 20 };
+  Driver d;
+  Driver_init(&d, &cache, argc, argv);
+  // note: Checked before anything runs, so a mistyped
+  // name doesn't take down a server in the middle of a compile
+  bool ok = d.job_count;
+  if (!ok) fprintf(stderr, "no input files\n");
+  if (d.run && (d.output || d.assembly || d.pch_out)) {
+    fprintf(stderr, "--run doesn't write an output\n");
+    ok = false;
+  }
+  if (d.dump_tokens && (d.run || d.output || d.assembly || d.pch_out)) {
+    fprintf(stderr, "--tokens doesn't compile\n");
+    ok = false;
+  }
+  if (d.output && d.job_count > 1) {
+    fprintf(stderr, "-o with more than one input file\n");
+    ok = false;
+  }
+  for (uint32_t i = 0; i < d.job_count; ++i) {
+    if (!access(d.jobs[i].filename, R_OK)) continue;
+    fprintf(stderr, "can't read '%s': %s\n", d.jobs[i].filename, strerror(errno));
+    ok = false;
+  }
+  if (!ok) {
+    Driver_free(&d);
+    return 1;
+  }
+  d.workspaces = workspaces;
+  d.workspace_count = count;
+  double start = time_now();
+  Driver_run(&d);
+  double wall = time_now() - start;
+  if (d.job_count > 1) Driver_print_timings(&d, stderr, wall);
+  int status = 0;
+  for (uint32_t i = 0; i < d.job_count && !status; ++i) status = d.jobs[i].status;
+  Driver_free(&d);
+  return status;
+}
+
+void Driver_print_timings(const Driver *d, FILE *out, double wall) {
+  double total = 0;
+  fprintf(out, "Timings:\n");
+  for (uint32_t i = 0; i < d->job_count; ++i) {
+    const Job *job = &d->jobs[i];
+    total += job->seconds;
+    fprintf(out, "%10.3f ms  %s\n", job->seconds * 1e3, job->filename);
+  }
+  fprintf(out, "%u files, %u threads, %.3f ms wall, %.3f ms in files\n",
+      d->job_count, d->threads, wall * 1e3, total * 1e3);
+}
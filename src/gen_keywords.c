@@ -0,0 +1,57 @@
+// Generates the perfect hash table for the keyword lookup
+// in the tokenizer, the output is written to stdout
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "common.h"
+#include "tokens.h"
+#include "keywords.h"
+
+#define MIN_BITS 5
+#define MAX_BITS 10
+#define MAX_MUL 256
+
+// returns zero on collision
+int try_hash(uint32_t mul_first, uint32_t mul_last, uint32_t bits, uint8_t *slots) {
+  memset(slots, 0, 1 << bits);
+  for (uint32_t i = 0; i < KEYWORD_COUNT; ++i) {
+    Str kw = keywords[i];
+    if (!kw.len) continue;
+    uint32_t h = KEYWORD_HASH(kw.ptr[0], kw.ptr[kw.len - 1], kw.len,
+        mul_first, mul_last, bits);
+    if (slots[h]) return 0;
+    slots[h] = KEYWORDS_START + i;
+  }
+  return 1;
+}
+
+int main(void) {
+  uint8_t slots[1 << MAX_BITS];
+  for (uint32_t bits = MIN_BITS; bits <= MAX_BITS; ++bits) {
+    for (uint32_t mul_first = 1; mul_first < MAX_MUL; ++mul_first) {
+      for (uint32_t mul_last = 1; mul_last < MAX_MUL; ++mul_last) {
+        if (!try_hash(mul_first, mul_last, bits, slots)) continue;
+
+        printf("// Generated by gen_keywords.c from keywords.h, do not edit\n");
+        printf("#ifndef INCLUDE_KEYWORD_HASH\n#define INCLUDE_KEYWORD_HASH\n\n");
+        printf("#include \"tokens.h\"\n#include <stdint.h>\n\n");
+        printf("#define KEYWORD_HASH_MUL_FIRST %u\n", mul_first);
+        printf("#define KEYWORD_HASH_MUL_LAST %u\n", mul_last);
+        printf("#define KEYWORD_HASH_BITS %u\n\n", bits);
+        printf("// TOK_NONE marks an empty slot\n");
+        printf("const uint8_t keyword_slots[1 << KEYWORD_HASH_BITS] = {\n");
+        for (uint32_t i = 0; i < (1u << bits); ++i) {
+          if (!slots[i]) continue;
+          printf("  [%u] = %s,\n", i, TOKEN_TYPE_STR[slots[i]]);
+        }
+        printf("};\n\n#endif\n");
+        return 0;
+      }
+    }
+  }
+  fprintf(stderr, "gen_keywords: no perfect hash found\n");
+  return 1;
+}
@@ -0,0 +1,75 @@
+#ifndef INCLUDE_ARENA
+#define INCLUDE_ARENA
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Address space reserved for a single arena, only the
+// pages that are actually used get committed, so it
+// costs nothing until we write there
+#define ARENA_RESERVE ((size_t)1 << 32)
+// Granularity in which the memory is committed
+#define ARENA_CHUNK ((size_t)1 << 16)
+
+// note: The arena never moves, so the pointers and
+// indices into it stay valid while it grows. That's
+// why we can keep indexing the tables as plain arrays.
+typedef struct {
+  uint8_t *base;
+  size_t size;
+  size_t committed;
+  size_t reserved;
+} Arena;
+
+typedef enum {
+  ARENA_AST,
+  ARENA_VARS,
+  ARENA_BINDINGS,
+  ARENA_FIELDS,
+  ARENA_FIELD_BUFFER,
+  ARENA_STRUCTS,
+  ARENA_TYPEDEFS,
+  ARENA_LABELS,
+  ARENA_FUNCTIONS,
+  ARENA_ITEMS,
+  ARENA_TOKENS,
+  ARENA_SOURCES,
+  ARENA_MACROS,
+  ARENA_MACRO_TOKENS,
+  ARENA_MACRO_INDEX,
+  ARENA_EXPANSION,
+  ARENA_MACRO_ARGS,
+  ARENA_SYMTAB,
+  ARENA_INSTS,
+  ARENA_BLOCKS,
+  ARENA_ARGS,
+  ARENA_SCRATCH,
+
+  ARENA_COUNT,
+} ArenaType;
+
+// All the storage of a single compilation, it's
+// one reservation split into ARENA_COUNT arenas,
+// so it can be released in one go
+typedef struct {
+  uint8_t *base;
+  Arena arenas[ARENA_COUNT];
+} Arenas;
+
+void Arena_init(Arena *a, uint8_t *base, size_t reserve);
+// For arenas that outlive a compilation, with their own reservation
+void Arena_reserve(Arena *a, size_t reserve);
+void Arena_release(Arena *a);
+// The start is rounded up to the alignment, a power of two
+void *Arena_push(Arena *a, size_t size, size_t align);
+void Arena_reset(Arena *a);
+
+void Arenas_init(Arenas *a);
+void Arenas_reset(Arenas *a);
+void Arenas_free(Arenas *a);
+
+#define ARENA_PUSH(arena, type, count) \
+  ((type *)Arena_push(arena, sizeof(type) * (count), _Alignof(type)))
+#define ARENA_LEN(arena, type) ((arena)->size / sizeof(type))
+
+#endif
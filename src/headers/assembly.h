@@ -1,8 +1,13 @@
 #ifndef INCLUDE_ASSEMBLY
 #define INCLUDE_ASSEMBLY
 
+#include "common.h"
 #include "inst.h"
+#include "arena.h"
+#include "regalloc.h"
+#include "x86.h"
 
-void generate_assembly(const Inst *insts);
+// The instructions are pushed to the scratch
+void generate_assembly(X86Code *code, Str name, const Ir *ir, const RegAlloc *ra, Arena *scratch);
 
 #endif
@@ -1,9 +1,14 @@
 #ifndef INCLUDE_AST
 #define INCLUDE_AST
 
+#include <assert.h>
+#include <stdbool.h>
 #include <stdint.h>
+#include <string.h>
 #include "common.h"
 #include "tokens.h"
+#include "intern.h"
+#include "arena.h"
 
 typedef enum {
   AST_NONE,
@@ -28,7 +33,7 @@ typedef enum {
   AST_PLUS, AST_MINUS, AST_NEG, AST_NOT, AST_SIZEOF,
 
   // Other expressions
-  AST_IDENT, AST_INT, AST_CONDITIONAL, AST_VAR,
+  AST_IDENT, AST_INT, AST_CONDITIONAL, AST_VAR, AST_COMMA,
 
   // Statements
   AST_LABEL, AST_CASE, AST_DEFAULT, AST_COMPOUND,
@@ -37,7 +42,7 @@ typedef enum {
   AST_BREAK, AST_RETURN,
 
   // Declarations
-  AST_DECL,
+  AST_DECL, AST_FUNCTION,
 
   AST_COUNT,
 } AstType;
@@ -52,32 +57,250 @@ const char *AST_TYPE_STR[AST_COUNT] = {
   "AST_INDEX", "AST_CALL", "AST_DOT", "AST_ARROW", "AST_POST_INC",
   "AST_POST_DEC", "AST_PRE_INC", "AST_PRE_DEC", "AST_ADDR", "AST_DEREF",
   "AST_PLUS", "AST_MINUS", "AST_NEG", "AST_NOT", "AST_SIZEOF",
-  "AST_IDENT", "AST_INT", "AST_CONDITIONAL", "AST_VAR", "AST_LABEL",
+  "AST_IDENT", "AST_INT", "AST_CONDITIONAL", "AST_VAR", "AST_COMMA", "AST_LABEL",
   "AST_CASE", "AST_DEFAULT", "AST_COMPOUND", "AST_EMPTY", "AST_IF",
   "AST_SWITCH", "AST_WHILE", "AST_DO_WHILE", "AST_FOR", "AST_GOTO",
   "AST_CONTINUE", "AST_BREAK", "AST_RETURN", "AST_DECL",
+  "AST_FUNCTION",
 };
 
-// TODO: consider doing variable length instead
+typedef uint32_t AstId;
+
 typedef union {
   int64_t i64;
   double f64;
-  uint16_t len; // ident, string
-  uint16_t first_child;
-  uint16_t var;
-  uint16_t label;
+  SymId sym; // ident
+  AstId first_child;
+  uint32_t var;
+  uint32_t label;
   struct AstValueDecl {
-    uint16_t first_child, var_start, var_count;
+    AstId first_child;
+    uint32_t var_start;
+    uint16_t var_count;
   } decl;
 } AstValue;
 
+// The unpacked node, only used for creating them
 typedef struct {
   AstType type;
-  uint16_t next_sibling;
+  AstId next_sibling;
   uint32_t start;
   AstValue value;
 } AstNode;
 
+// What follows the header of a node, decided by its type
+typedef enum {
+  PAYLOAD_CHILD, // backward delta to the first child, zero for none
+  PAYLOAD_NONE,
+  PAYLOAD_INDEX, // symbol
+  PAYLOAD_REF, // var or label, fixed 4 bytes
+  PAYLOAD_INT, // zigzag encoded
+  PAYLOAD_DECL, // child delta, var_start (fixed 4 bytes), var_count
+} AstPayload;
+
+const uint8_t AST_PAYLOAD[AST_COUNT] = {
+  [AST_NONE] = PAYLOAD_NONE,
+  [AST_EMPTY] = PAYLOAD_NONE,
+  [AST_CONTINUE] = PAYLOAD_NONE,
+  [AST_BREAK] = PAYLOAD_NONE,
+  [AST_IDENT] = PAYLOAD_INDEX,
+  [AST_VAR] = PAYLOAD_REF,
+  [AST_LABEL] = PAYLOAD_REF,
+  [AST_GOTO] = PAYLOAD_REF,
+  [AST_INT] = PAYLOAD_INT,
+  [AST_DECL] = PAYLOAD_DECL,
+};
+
+// note: The nodes are byte-packed into a single buffer and the id
+// of a node is its offset. Every node starts with the type byte
+// and a fixed 4-byte sibling, because that one gets patched after
+// the node is written. Then comes the payload and the start, mostly
+// as LEB128. The start is last, because only the parser and
+// the diagnostics need it, so walking the tree can skip it.
+// The children are always created before the parent, so the child
+// is stored as a small backward delta. The var and label ids have
+// fixed size, so they can be relocated in place, see Ast_append.
+typedef struct {
+  uint8_t *data;
+  Arena *arena;
+  uint32_t size;
+  uint32_t count;
+} Ast;
+
+// A decoded node header, for walking the tree without
+// decoding the same bytes again for every field
+typedef struct {
+  const Ast *ast;
+  AstId id;
+  AstType kind;
+  AstId sibling;
+  const uint8_t *payload;
+} AstCursor;
+
+void Ast_init(Ast *a, Arena *arena);
+AstId Ast_push(Ast *a, AstNode node);
+// The first node after the reserved zero one
+AstId Ast_first(const Ast *a);
+
+// Added to the var and label ids of the appended nodes,
+// only the vars from var_base up are relocated
+typedef struct {
+  uint32_t var_base;
+  uint32_t var_shift;
+  uint32_t label_shift;
+} AstRelocation;
+
+// Copies all the nodes of src to the end and relocates them,
+// returns what was added to their ids
+AstId Ast_append(Ast *a, const Ast *src, AstRelocation r);
+
+static inline uint64_t Ast_read_varint(const uint8_t **ptr) {
+  const uint8_t *p = *ptr;
+  // most of the values fit into one byte
+  if (!(*p & 0x80)) {
+    *ptr = p + 1;
+    return *p;
+  }
+  uint64_t value = *p & 0x7f;
+  for (int shift = 7; *p++ & 0x80; shift += 7) {
+    value |= (uint64_t)(*p & 0x7f) << shift;
+  }
+  *ptr = p;
+  return value;
+}
+
+static inline const uint8_t *Ast_skip_varint(const uint8_t *ptr) {
+  while (*ptr++ & 0x80);
+  return ptr;
+}
+
+static inline uint32_t Ast_read_u32(const uint8_t *ptr) {
+  uint32_t value;
+  memcpy(&value, ptr, sizeof(value));
+  return value;
+}
+
+static inline AstId Ast_read_sibling(const uint8_t *ptr) {
+  return Ast_read_u32(ptr);
+}
+
+// Returns the start of the payload
+static inline const uint8_t *Ast_skip_payload(AstType kind, const uint8_t *ptr) {
+  switch (AST_PAYLOAD[kind]) {
+    case PAYLOAD_NONE:
+      return ptr;
+    case PAYLOAD_REF:
+      return ptr + 4;
+    case PAYLOAD_DECL:
+      return Ast_skip_varint(Ast_skip_varint(ptr) + 4);
+    default:
+      return Ast_skip_varint(ptr);
+  }
+}
+
+static inline AstCursor Ast_cursor(const Ast *a, AstId id) {
+  const uint8_t *ptr = a->data + id;
+  return (AstCursor){
+    .ast = a,
+    .id = id,
+    .kind = ptr[0],
+    .sibling = Ast_read_sibling(ptr + 1),
+    .payload = ptr + 1 + sizeof(AstId),
+  };
+}
+
+// Moves to the next sibling, returns false at the end
+static inline bool AstCursor_next(AstCursor *c) {
+  if (!c->sibling) return false;
+  *c = Ast_cursor(c->ast, c->sibling);
+  return true;
+}
+
+// Zero for no children
+static inline AstId AstCursor_child_id(const AstCursor *c) {
+  uint8_t payload = AST_PAYLOAD[c->kind];
+  if (payload != PAYLOAD_CHILD && payload != PAYLOAD_DECL) return 0;
+  const uint8_t *ptr = c->payload;
+  AstId delta = Ast_read_varint(&ptr);
+  return delta ? c->id - delta : 0;
+}
+
+// The node has to have children
+static inline AstCursor AstCursor_child(const AstCursor *c) {
+  AstId child = AstCursor_child_id(c);
+  assert(child);
+  return Ast_cursor(c->ast, child);
+}
+
+static inline uint32_t AstCursor_start(const AstCursor *c) {
+  const uint8_t *ptr = Ast_skip_payload(c->kind, c->payload);
+  return Ast_read_varint(&ptr);
+}
+
+static inline int64_t AstCursor_int(const AstCursor *c) {
+  assert(AST_PAYLOAD[c->kind] == PAYLOAD_INT);
+  const uint8_t *ptr = c->payload;
+  uint64_t value = Ast_read_varint(&ptr);
+  return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+static inline struct AstValueDecl AstCursor_decl(const AstCursor *c) {
+  assert(c->kind == AST_DECL);
+  const uint8_t *ptr = c->payload;
+  struct AstValueDecl decl;
+  AstId delta = Ast_read_varint(&ptr);
+  decl.first_child = delta ? c->id - delta : 0;
+  decl.var_start = Ast_read_u32(ptr);
+  ptr += 4;
+  decl.var_count = Ast_read_varint(&ptr);
+  return decl;
+}
+
+// var, label or symbol of the leaves
+static inline uint32_t AstCursor_payload(const AstCursor *c) {
+  if (AST_PAYLOAD[c->kind] == PAYLOAD_REF) return Ast_read_u32(c->payload);
+  assert(AST_PAYLOAD[c->kind] == PAYLOAD_INDEX);
+  const uint8_t *ptr = c->payload;
+  return Ast_read_varint(&ptr);
+}
+
+static inline AstType Ast_kind(const Ast *a, AstId id) {
+  return a->data[id];
+}
+
+static inline AstId Ast_sibling(const Ast *a, AstId id) {
+  return Ast_read_sibling(a->data + id + 1);
+}
+
+static inline void Ast_set_sibling(Ast *a, AstId id, AstId sibling) {
+  memcpy(a->data + id + 1, &sibling, sizeof(sibling));
+}
+
+static inline uint32_t Ast_start(const Ast *a, AstId id) {
+  AstCursor c = Ast_cursor(a, id);
+  return AstCursor_start(&c);
+}
+
+static inline AstId Ast_child(const Ast *a, AstId id) {
+  AstCursor c = Ast_cursor(a, id);
+  return AstCursor_child_id(&c);
+}
+
+static inline int64_t Ast_int(const Ast *a, AstId id) {
+  AstCursor c = Ast_cursor(a, id);
+  return AstCursor_int(&c);
+}
+
+static inline struct AstValueDecl Ast_decl(const Ast *a, AstId id) {
+  AstCursor c = Ast_cursor(a, id);
+  return AstCursor_decl(&c);
+}
+
+static inline uint32_t Ast_payload(const Ast *a, AstId id) {
+  AstCursor c = Ast_cursor(a, id);
+  return AstCursor_payload(&c);
+}
+
 // TODO: use one byte for data type and flags, where possible
 typedef enum {
   DATA_NONE,
@@ -139,7 +362,7 @@ AstType tok2operation[TOK_IDENT] = {
   [TOK_DMINUS] = AST_POST_DEC,
 
   // For binary operators
-  [TOK_STAR] = AST_MUL, [TOK_SLASH] = AST_DIV, [TOK_PERCENT] = AST_MUL,
+  [TOK_STAR] = AST_MUL, [TOK_SLASH] = AST_DIV, [TOK_PERCENT] = AST_MOD,
   [TOK_PLUS] = AST_ADD, [TOK_MINUS] = AST_SUB, [TOK_LSFT] = AST_LSFT,
   [TOK_RSFT] = AST_RSFT, [TOK_LT] = AST_LT, [TOK_LE] = AST_LE,
   [TOK_GT] = AST_GT, [TOK_GE] = AST_GE, [TOK_DEQ] = AST_EQ,
@@ -0,0 +1,82 @@
+#ifndef INCLUDE_BACKEND
+#define INCLUDE_BACKEND
+
+#include "arena.h"
+#include "cache.h"
+#include "object.h"
+#include "parser.h"
+#include "peephole.h"
+#include "queue.h"
+#include "regalloc.h"
+#include "writer.h"
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Functions waiting for the back end, when it's
+// full, the parser waits for it to catch up
+#define BACKEND_QUEUE 64
+
+// The assembly of a function, or its packed machine code
+typedef struct {
+  char *data;
+  size_t len;
+  // the first node, that can't be compiled yet, and its location,
+  // there's no output then
+  AstType unsupported;
+  uint32_t loc;
+} BackendOutput;
+
+// note: The parser hands over every function as soon as it's
+// merged, through the queue, to the back end workers, that run
+// codegen and assembly on it, while the parser continues with
+// the next one. Each function is written to its own buffer
+// and they are put back together in the source order at the end.
+// Without threads the parser runs the back end itself.
+typedef struct Backend {
+  const Parser *file;
+  const Function *functions;
+  // note: The parser finds the functions a window at a time, these
+  // grow with them in their own arenas, so they never move, while
+  // the workers are using them
+  Arena output_arena, key_arena;
+  BackendOutput *outputs;
+  // the vars defined at the file scope, found by the join, malloc'd
+  ObjectGlobal *globals;
+  uint32_t global_count;
+  Queue queue;
+  pthread_t *workers;
+  uint32_t threads;
+  // With the cache, the functions, that are found
+  // in it, don't go through codegen and assembly
+  Cache *cache;
+  CacheKey *keys;
+  // the ir of every function goes before its assembly
+  bool dump_ir;
+  // The machine code of the functions is written as an ELF
+  // object, instead of the assembly, that's for debugging
+  bool object;
+  // of the functions, that went through the back end, zero for none
+  PeepholeStats *peephole;
+  RegAllocStats *regalloc;
+} Backend;
+
+void Backend_start(Backend *b, const Parser *p);
+// Once a window of the file scope is parsed, its functions are known
+void Backend_extend(Backend *b);
+// The body of the function has to be merged already
+void Backend_submit(Backend *b, uint32_t function);
+// Waits for the workers and finds the globals, then reports the functions
+// and the globals, that can't be compiled, to the stderr. Returns false,
+// if there are any.
+bool Backend_join(Backend *b);
+// After the join, writes out the functions
+void Backend_finish(Backend *b, Writer *out);
+// Instead of the finish, the machine code is loaded into the memory
+// and its main is called, returns its exit status
+int Backend_run(Backend *b, int argc, const char **argv);
+// Instead of both, once the join failed
+void Backend_free(Backend *b);
+
+#endif
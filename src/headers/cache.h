@@ -0,0 +1,48 @@
+#ifndef INCLUDE_CACHE
+#define INCLUDE_CACHE
+
+#include "parser.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// In MiB, when --cache-size isn't given
+#define CACHE_DEFAULT_SIZE 256
+// A hit updates the time of the entry only, if it's older
+#define CACHE_TOUCH_SECONDS 60
+// How deep the struct fields are followed for the key
+#define CACHE_MAX_STRUCT_DEPTH 8
+
+// Two independent 64 bit hashes, the name of the entry
+typedef struct {
+  uint64_t a;
+  uint64_t b;
+} CacheKey;
+
+// note: The output of the back end for a single function, stored
+// under the hash of everything it's made from, in files named by
+// the key, under a directory per its first byte. The entries are
+// immutable, a changed function gets a new key, the stale ones
+// are dropped by the size limit, the least recently used first.
+// A hit sets the modification time of the entry, for that.
+typedef struct Cache {
+  const char *dir;
+  uint64_t max_size; // in bytes
+  // for the whole process
+  uint32_t hits;
+  uint32_t misses;
+  uint32_t stores;
+} Cache;
+
+// The token range of the body, the signature and the file scope
+// declarations, that its names refer to, and the form of the
+// output. The file scope can't change, while it's running.
+CacheKey Cache_key(const Parser *p, const Function *f, bool object);
+// Returns false on a miss, the data is malloc'd
+bool Cache_load(Cache *c, CacheKey key, char **data, size_t *len);
+void Cache_store(Cache *c, CacheKey key, const char *data, size_t len);
+// Evicts the entries over the limit, prints what it did, if out isn't zero
+void Cache_trim(Cache *c, FILE *out);
+
+#endif
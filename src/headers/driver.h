@@ -0,0 +1,94 @@
+#ifndef INCLUDE_DRIVER
+#define INCLUDE_DRIVER
+
+#include "arena.h"
+#include "intern.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+typedef struct {
+  const char *data;
+  size_t size; // of the mapping
+} Source;
+
+typedef struct {
+  const char *filename;
+  // Everything printed for the file, written out in the
+  // order of the inputs, after all the jobs are done
+  char *output;
+  size_t output_len;
+  double seconds;
+  int status; // of the program, with --run, non-zero for errors otherwise
+} Job;
+
+// Storage of a worker, reset between the files, but the memory
+// stays committed. The server keeps them for the next requests.
+typedef struct {
+  Arenas arenas;
+  Interner interner;
+  bool ready;
+} Workspace;
+
+// note: The workers take the next job with an atomic increment,
+// each one has its own arenas, that get reset between files.
+// With a single thread the log goes straight to stdout, the
+// output of the compiler goes to its file either way.
+typedef struct {
+  Job *jobs;
+  uint32_t job_count;
+  uint32_t next_job;
+  uint32_t threads;
+  uint32_t parse_threads;
+  // searched by #include
+  const char **include_dirs;
+  uint32_t include_dir_count;
+  // --emit-pch, the only input is the header
+  const char *pch_out;
+  // --pch, the main files still include the header,
+  // it's skipped, as its guard is defined already
+  const char *pch_path;
+  const struct Pch *pch;
+  // --cache, of the back end output for every function
+  struct Cache *cache;
+  // one for every thread, made by the run, if it's zero
+  Workspace *workspaces;
+  uint32_t workspace_count;
+  uint32_t next_workspace;
+  bool stats;
+  // --ir, the output of the back end isn't cached then
+  bool dump_ir;
+  // --tokens, the preprocessed ones are printed, instead of compiling
+  bool dump_tokens;
+  // --ast, of the file, once it's parsed
+  bool dump_ast;
+  // -S, the assembly is written, instead of the object
+  bool assembly;
+  // -o, of the only input, "-" for the stdout, the output
+  // goes next to the source otherwise, named after it
+  const char *output;
+  // --run, the only input is compiled into the memory and its main
+  // is called with the arguments after it, instead of writing it
+  bool run;
+  int run_argc;
+  const char **run_argv;
+} Driver;
+
+Source map_source(const char *filename);
+void unmap_source(Source source);
+// Returns the exit status of the program with --run, non-zero for
+// the errors otherwise
+int compile(FILE *out, const Driver *d, const char *filename, Workspace *w);
+double time_now(void);
+
+// The options and the inputs, the strings aren't copied
+void Driver_init(Driver *d, struct Cache *cache, int argc, const char **argv);
+void Driver_free(Driver *d);
+void Driver_run(Driver *d);
+void Driver_print_timings(const Driver *d, FILE *out, double wall);
+// A whole run with the arguments, the workspaces can be zero,
+// returns the exit status
+int Driver_main(int argc, const char **argv, Workspace *workspaces, uint32_t count);
+
+#endif
@@ -1,28 +1,180 @@
-#ifndef INCLUDE_ISNT
-#define INCLUDE_ISNT
+#ifndef INCLUDE_INST
+#define INCLUDE_INST
 
 #include "ast.h"
+#include "arena.h"
+#include "parser.h"
+#include <stdbool.h>
 #include <stdint.h>
+#include <stdio.h>
 
-#define MAX_INSTRUCTIONS 512
+// Index of the instruction, that defines the value, zero for none
+typedef uint32_t ValueId;
+typedef uint32_t BlockId;
 
 typedef enum {
   INST_NONE,
-  INST_INT,
-  INST_ADD,
+  // no operands
+  INST_CONST, // the value is a | b << 32
+  INST_UNDEF, // a local read before it's written
+  INST_PHI, // count args at b, one for each predecessor, in their order
+  // a op b, both of the type of the instruction
+  INST_ADD, INST_SUB, INST_MUL, INST_DIV, INST_MOD,
+  INST_SHL, INST_SHR, INST_AND, INST_OR, INST_XOR,
+  // a op b, both of the same type, the result is an int
+  INST_EQ, INST_NE, INST_LT, INST_LE, INST_GT, INST_GE,
+  // op a
+  INST_NEG, INST_NOT,
+  INST_CAST, // a converted to the type
+  // a is the var, only the ones, that aren't locals
+  INST_LOAD,
+  INST_STORE, // of b
+  INST_CALL, // of the function a, count args at b
+  // the last one of every block, the targets are its successors
+  INST_JUMP,
+  INST_BRANCH, // to the first one, if a isn't zero
+  INST_RET, // count is set, when it returns the value a
+
+  INST_COUNT,
 } InstType;
 
-const char *INST_TYPE_NAME[] = {
-  "none",
-  "int",
-  "add",
+const char *INST_TYPE_NAME[INST_COUNT] = {
+  "none", "const", "undef", "phi", "add", "sub", "mul", "div", "mod",
+  "shl", "shr", "and", "or", "xor", "eq", "ne", "lt", "le", "gt", "ge",
+  "neg", "not", "cast", "load", "store", "call", "jump", "branch", "ret",
 };
 
 typedef struct {
-  uint16_t type, a, b, c;
+  uint8_t type;
+  uint8_t data_type; // of the result
+  uint16_t count;
+  ValueId a;
+  uint32_t b;
+  BlockId block;
 } Inst;
 
-void codegen(const AstNode *ast, uint16_t ast_start, Inst insts[MAX_INSTRUCTIONS]);
-void print_insts(const Inst *insts);
+typedef struct {
+  // the instructions, the phis come first
+  uint32_t start;
+  uint32_t len;
+  uint32_t preds; // into the preds of the ir
+  uint32_t pred_count;
+  BlockId succs[2];
+  uint32_t succ_count;
+  // the dominator tree, the entry is its own idom
+  BlockId idom;
+  BlockId dom_child; // zero for none
+  BlockId dom_sibling;
+  // of the walk of the tree, for the dominance checks
+  uint32_t dom_pre;
+  uint32_t dom_post;
+} Block;
+
+// note: The blocks are in the reverse postorder, starting with the
+// entry, and the instructions are in the order of the blocks, so
+// a forward walk over the arrays sees every definition before its
+// uses, except for the phis. Instruction zero is a placeholder.
+typedef struct {
+  const Parser *file; // for the names of the vars
+  Inst *insts;
+  Block *blocks;
+  ValueId *args;
+  BlockId *preds;
+  uint32_t inst_count;
+  uint32_t block_count;
+} Ir;
+
+// Returns the first node type, that can't be generated yet, with
+// its location, or AST_NONE, when the whole body went through
+AstType codegen(const Parser *p, const Function *f, Arena *arenas, Ir *ir, uint32_t *loc);
+// Of a var of the file scope, the constant converted to its type,
+// or the node, that can't be folded, with its location
+AstType codegen_initializer(const Parser *p, AstId value, DataType type, Arena *arenas,
+    int64_t *result, uint32_t *loc);
+void Ir_dominators(Ir *ir, Arena *scratch);
+// Asserts, that every value is defined before its uses, in the block or
+// in one, that dominates it, for the phis at the end of the predecessor
+void Ir_verify(const Ir *ir);
+// Every line is an assembly comment
+void print_ir(FILE *out, const Ir *ir, Str name);
+// Evaluates the operation on the constants of the type, the one of
+// the operands for the comparisons, b is unused by the unary ones.
+// Returns false, if it's undefined, like a division by zero.
+bool Ir_fold(InstType op, DataType type, int64_t a, int64_t b, int64_t *result);
+
+static inline int64_t Inst_const(Inst inst) {
+  return (int64_t)((uint64_t)inst.b << 32 | inst.a);
+}
+
+static inline bool Ir_dominates(const Ir *ir, BlockId a, BlockId b) {
+  const Block *x = &ir->blocks[a], *y = &ir->blocks[b];
+  return x->dom_pre <= y->dom_pre && y->dom_post <= x->dom_post;
+}
+
+// Of the integer types, zero for the others
+static inline uint32_t DataType_size(DataType type) {
+  switch (type) {
+    case DATA_CHAR: case DATA_UCHAR: case DATA_BOOL:
+      return 1;
+    case DATA_SHORT_INT: case DATA_SHORT_UINT:
+      return 2;
+    case DATA_INT: case DATA_UINT:
+      return 4;
+    case DATA_LONG_INT: case DATA_LONG_UINT:
+    case DATA_LONG_LONG_INT: case DATA_LONG_LONG_UINT:
+      return 8;
+    default:
+      return 0;
+  }
+}
+
+static inline bool DataType_unsigned(DataType type) {
+  return type == DATA_BOOL || type == DATA_UCHAR || type == DATA_UINT
+    || type == DATA_SHORT_UINT || type == DATA_LONG_UINT || type == DATA_LONG_LONG_UINT;
+}
+
+// The value converted to the integer type, extended back to 64 bits
+static inline int64_t DataType_wrap(DataType type, int64_t value) {
+  uint32_t bits = DataType_size(type) * 8;
+  if (type == DATA_BOOL) return value != 0;
+  if (!bits || bits == 64) return value;
+  uint64_t low = (uint64_t)value & ((UINT64_C(1) << bits) - 1);
+  if (DataType_unsigned(type)) return (int64_t)low;
+  uint64_t sign = UINT64_C(1) << (bits - 1);
+  return (int64_t)((low ^ sign) - sign);
+}
+
+// The values used by the instruction, the ones of the phis and
+// the calls are in the args, the others are put in the buffer
+static inline uint32_t Ir_operands(const Ir *ir, const Inst *inst,
+    ValueId buffer[2], const ValueId **operands) {
+  *operands = buffer;
+  switch (inst->type) {
+    case INST_CONST: case INST_UNDEF: case INST_LOAD: case INST_JUMP:
+      return 0;
+    case INST_PHI: case INST_CALL:
+      *operands = ir->args + inst->b;
+      return inst->count;
+    case INST_STORE:
+      buffer[0] = inst->b;
+      return 1;
+    case INST_RET:
+      buffer[0] = inst->a;
+      return inst->count != 0;
+    case INST_BRANCH: case INST_NEG: case INST_NOT: case INST_CAST:
+      buffer[0] = inst->a;
+      return 1;
+    default:
+      buffer[0] = inst->a;
+      buffer[1] = inst->b;
+      return 2;
+  }
+}
+
+// Of the instructions, that make a value
+static inline bool Inst_has_value(const Inst *inst) {
+  if (inst->type == INST_CALL) return DataType_size(inst->data_type) != 0;
+  return inst->type > INST_NONE && inst->type < INST_STORE;
+}
 
 #endif
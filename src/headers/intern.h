@@ -0,0 +1,46 @@
+#ifndef INCLUDE_INTERN
+#define INCLUDE_INTERN
+
+#include "arena.h"
+#include "common.h"
+#include <stdint.h>
+
+#define INTERNER_MIN_CAPACITY 1024
+
+// Dense id of an interned identifier, zero means no symbol
+typedef uint32_t SymId;
+
+typedef struct {
+  uint32_t offset; // into the chars
+  uint32_t len;
+} Symbol;
+
+typedef struct {
+  uint32_t hash;
+  SymId sym; // zero if empty
+} InternSlot;
+
+// note: Every identifier is stored once, so the names
+// can be compared by the id, instead of the string
+typedef struct {
+  Arena chars;
+  Arena symbols;
+  // note: Like the symbol tables, a grown table leaves the
+  // old one behind in the arena. All three arenas hold only
+  // offsets, so they can be written out and mapped back as is.
+  Arena tables;
+  // open addressing, linear probing, points into the tables
+  InternSlot *table;
+  uint32_t capacity;
+  uint32_t count; // including the reserved zero
+} Interner;
+
+void Interner_init(Interner *in);
+void Interner_reset(Interner *in);
+void Interner_free(Interner *in);
+SymId Interner_intern(Interner *in, const char *str, uint32_t len);
+// Doesn't modify the interner, returns zero if it's not there
+SymId Interner_find(const Interner *in, const char *str, uint32_t len);
+Str Interner_str(const Interner *in, SymId sym);
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef INCLUDE_JIT
+#define INCLUDE_JIT
+
+#include "intern.h"
+#include "object.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// An indirect jump and its target, padded
+#define JIT_STUB 16
+
+// note: The functions are loaded the way the linker would put them
+// in the text, one after another, followed by a stub for every
+// function, that comes from the process, as the libc is too far for
+// the 32-bit calls. The globals go to the pages after them, so they
+// are in reach too. The rest of the symbols have to be in reach.
+typedef struct {
+  uint8_t *code; // the mapping, executable once it's loaded
+  size_t size;
+  size_t data; // where the writable pages start
+  const Interner *interner;
+  const ObjectFunction *functions;
+  uint32_t count;
+  // the offset plus one of every function and global, by the symbol
+  uint32_t *offsets;
+} Jit;
+
+// Prints the symbol, that can't be resolved, and returns false then
+bool Jit_load(Jit *jit, const Interner *in, const ObjectFunction *functions, uint32_t count,
+    const ObjectGlobal *globals, uint32_t global_count);
+// Of the functions and the globals of the file, zero if it's not there
+void *Jit_find(const Jit *jit, const char *name);
+// The /tmp/perf-<pid>.map, so the perf can name the functions
+void Jit_perf_map(const Jit *jit);
+void Jit_free(Jit *jit);
+
+#endif
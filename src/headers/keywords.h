@@ -0,0 +1,60 @@
+#ifndef INCLUDE_KEYWORDS
+#define INCLUDE_KEYWORDS
+
+#include "common.h"
+#include "tokens.h"
+#include <stdint.h>
+
+// note: This is the only place the keywords are listed,
+// the hash table is generated from it by gen_keywords.c
+// A very simple solution for now 
+// https://rgambord.github.io/c99-doc/sections/8/1/2/index.html
+Str keywords[] = {
+  [TOK_AUTO - KEYWORDS_START] = STR("auto"),
+  [TOK_ENUM - KEYWORDS_START] = STR("enum"),
+  [TOK_RESTRICT - KEYWORDS_START] = STR("restrict"),
+  [TOK_UNSIGNED - KEYWORDS_START] = STR("unsigned"),
+  [TOK_BREAK - KEYWORDS_START] = STR("break"),
+  [TOK_EXTERN - KEYWORDS_START] = STR("extern"),
+  [TOK_RETURN - KEYWORDS_START] = STR("return"),
+  [TOK_VOID - KEYWORDS_START] = STR("void"),
+  [TOK_CASE - KEYWORDS_START] = STR("case"),
+  [TOK_FLOAT - KEYWORDS_START] = STR("float"),
+  [TOK_SHORT - KEYWORDS_START] = STR("short"),
+  [TOK_VOLATILE - KEYWORDS_START] = STR("volatile"),
+  [TOK_CHAR - KEYWORDS_START] = STR("char"),
+  [TOK_FOR - KEYWORDS_START] = STR("for"),
+  [TOK_SIGNED - KEYWORDS_START] = STR("signed"),
+  [TOK_WHILE - KEYWORDS_START] = STR("while"),
+  [TOK_CONST - KEYWORDS_START] = STR("const"),
+  [TOK_GOTO - KEYWORDS_START] = STR("goto"),
+  [TOK_SIZEOF - KEYWORDS_START] = STR("sizeof"),
+  [TOK_BOOL - KEYWORDS_START] = STR("_Bool"),
+  [TOK_CONTINUE - KEYWORDS_START] = STR("continue"),
+  [TOK_IF - KEYWORDS_START] = STR("if"),
+  [TOK_STATIC - KEYWORDS_START] = STR("static"),
+  [TOK_COMPLEX - KEYWORDS_START] = STR("_Complex"),
+  [TOK_DEFAULT - KEYWORDS_START] = STR("default"),
+  [TOK_INLINE - KEYWORDS_START] = STR("inline"),
+  [TOK_STRUCT - KEYWORDS_START] = STR("struct"),
+  [TOK_IMAGINARY - KEYWORDS_START] = STR("_Imaginary"),
+  [TOK_DO - KEYWORDS_START] = STR("do"),
+  [TOK_INT - KEYWORDS_START] = STR("int"),
+  [TOK_SWITCH - KEYWORDS_START] = STR("switch"),
+  [TOK_DOUBLE - KEYWORDS_START] = STR("double"),
+  [TOK_LONG - KEYWORDS_START] = STR("long"),
+  [TOK_TYPEDEF - KEYWORDS_START] = STR("typedef"),
+  [TOK_ELSE - KEYWORDS_START] = STR("else"),
+  [TOK_REGISTER - KEYWORDS_START] = STR("register"),
+  [TOK_UNION - KEYWORDS_START] = STR("union"),
+};
+const uint32_t KEYWORD_COUNT = sizeof(keywords) / sizeof(*keywords);
+
+// Lookup by the first and the last character and the length,
+// the multipliers are picked by the generator, so there
+// are no collisions between the keywords
+#define KEYWORD_HASH(first, last, len, mul_first, mul_last, bits) \
+  (((uint32_t)(uint8_t)(first) * (mul_first) + \
+    (uint32_t)(uint8_t)(last) * (mul_last) + (len)) & ((1u << (bits)) - 1))
+
+#endif
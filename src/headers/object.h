@@ -0,0 +1,51 @@
+#ifndef INCLUDE_OBJECT
+#define INCLUDE_OBJECT
+
+#include "common.h"
+#include "intern.h"
+#include "writer.h"
+#include "x86.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// note: The machine code of a function, the way it's cached. It's
+// the header, the relocations, the code and the names of the symbols
+// of the relocations, one after another. The relocations name their
+// symbols, as the ids of the interner differ between the files.
+typedef struct {
+  uint32_t code_len;
+  uint32_t reloc_count;
+} ObjectHeader;
+
+typedef struct {
+  uint32_t offset; // in the code of the function
+  uint32_t type;
+  int32_t addend;
+  uint32_t name_len;
+} ObjectReloc;
+
+typedef struct {
+  Str name;
+  const char *data; // as Object_pack made it
+  size_t len;
+} ObjectFunction;
+
+// A var defined at the file scope, the ones, that are zero, go to
+// the bss and the others to the data
+typedef struct {
+  Str name;
+  uint32_t size; // the alignment too
+  bool local; // a static one
+  int64_t value;
+} ObjectGlobal;
+
+// The data is malloc'd
+void Object_pack(const X86Machine *m, const Interner *in, char **data, size_t *len);
+// The ELF64 relocatable with the functions in the text, one after another,
+// and the globals after them, the symbols, that aren't defined there, are
+// left to the linker. It's made in place, in the mapping of the output.
+void Object_write(Writer *out, const Interner *in, const ObjectFunction *functions,
+    uint32_t count, const ObjectGlobal *globals, uint32_t global_count);
+
+#endif
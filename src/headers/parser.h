@@ -3,28 +3,31 @@
 
 #include "common.h"
 #include "ast.h"
+#include "arena.h"
+#include "intern.h"
+#include "preprocessor.h"
+#include "symtab.h"
+#include "tokens.h"
+#include <assert.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
 
-#define MAX_AST_SIZE 512
-#define MAX_VARIABLES 256
 #define MAX_SCOPES 64
-#define MAX_LABELS 64
-#define MAX_TYPEDEFS 128
-#define MAX_FIELDS 256
-#define FIELD_BUFFER_SIZE 64
-#define MAX_STRUCTS 64
+// Lookahead of the parser, has to be a power of two
+#define TOKEN_RING 4
 
 #define STRUCT_NOT_FOUND UINT16_MAX
 
-typedef uint16_t AstId;
-typedef uint16_t VarId;
-typedef uint16_t LabelId;
+typedef uint32_t VarId;
+typedef uint32_t LabelId;
 typedef uint16_t TypedefId;
 typedef uint16_t StructId;
 
 typedef struct {
-  VarId start;
-  uint16_t len;
+  // into the binding stack, that holds
+  // the vars declared in the scope
+  uint32_t start;
 } Scope;
 
 typedef enum {
@@ -32,11 +35,16 @@ typedef enum {
   FLAG_RESTRICT = 1 << 1,
   FLAG_VOLATILE = 1 << 2,
   FLAG_INLINE = 1 << 3, // only functions
+  // the vars of the file scope without the extern, they're defined
+  // there, even without a value
+  FLAG_DEFINED = 1 << 4,
 } VarFlags;
 
 typedef struct {
-  // TODO: change into start and len
-  Str name;
+  SymId name;
+  // the var with the same name, that this one hides
+  VarId shadow;
+  uint8_t scope;
   uint16_t usage;
   uint16_t struct_index;
   StorageType storage;
@@ -54,30 +62,40 @@ typedef enum {
 } StructType;
 
 typedef struct {
-  uint32_t start;
-  uint16_t len; // if zero, then anonymous
+  SymId name; // if zero, then anonymous
   uint16_t fields_start;
   uint16_t fields_len; // zero fields is valid
   StructType type;
 } Struct;
 
 typedef struct {
-  uint32_t start;
-  uint16_t len;
+  SymId name;
   uint16_t struct_index;
   DataType type;
   VarFlags flags;
 } Field;
 
 typedef struct {
-  uint32_t start;
-  uint16_t len;
+  SymId name;
   uint16_t struct_index;
   DataType type;
   VarFlags flags;
 } Typedef;
 
 typedef struct {
+  SymId name;
+  // goto can come before the label
+  bool defined;
+} Label;
+
+// Number of the file scope entries
+typedef struct {
+  VarId vars;
+  TypedefId typedefs;
+  StructId structs;
+} Visible;
+
+typedef struct Parser {
   // note: We need a separate buffer, because
   // struct or union definitons can nest, but we
   // need the fields to be contigious. Not to
@@ -88,53 +106,162 @@ typedef struct {
   // there should be no problem with copying,
   // After we collect all the fields in the buffer,
   // we're gonna copy them to the fields array.
-  Field field_buffer[FIELD_BUFFER_SIZE];
-  Field fields[MAX_FIELDS];
+  Field *field_buffer;
+  Field *fields;
   // TODO: move the name into a separate lookup array,
   // as not all structs are gonna have name and it's
   // justa a waste of space, also we're gonna
   // use it for pointers and arrays later
-  Struct structs[MAX_STRUCTS];
-  Typedef typedefs[MAX_TYPEDEFS];
-  Str labels[MAX_LABELS];
-  Var vars[MAX_VARIABLES];
+  Struct *structs;
+  Typedef *typedefs;
+  Label *labels;
+  Var *vars;
   Scope scopes[MAX_SCOPES];
-  const char *source;
-  const Token *tokens;
-  AstNode *ast_out;
-  uint16_t pos;
-  uint16_t ast_size;
-  uint16_t var_size;
-  uint16_t labels_size;
+  // name to the innermost visible var
+  SymTab var_index;
+  // note: One for each namespace. The struct one
+  // holds index + 1, as zero is a valid struct.
+  SymTab typedef_index;
+  SymTab struct_index;
+  // only the labels of the current function
+  SymTab label_index;
+  // The tables above are views into these
+  Arena *arenas;
+  Interner *interner;
+  const SourceMap *sources;
+  // note: The ring holds the tokens from pos up to lexed,
+  // the rest of the source hasn't been tokenized yet
+  Preprocessor *pp;
+  // Tokens recorded by the first pass, for the function bodies
+  const Token *replay;
+  Token ring[TOKEN_RING];
+  Ast ast;
+  // note: Set for the parsers of the function bodies. The file
+  // scope is frozen while they run, the ids below the bases
+  // refer to its tables and the ones above to our own. Only
+  // the first entries of it are visible, given by visible.
+  const struct Parser *file;
+  Visible visible;
+  VarId var_base;
+  TypedefId typedef_base;
+  StructId struct_base;
+  uint16_t field_base;
+  uint32_t pos;
+  uint32_t lexed;
+  VarId var_size;
+  LabelId labels_size;
+  LabelId function_labels_start;
   uint16_t typedefs_size;
   uint16_t fields_size;
   uint16_t field_bufer_size;
   uint16_t structs_size;
   uint8_t scope;
+  // reported already, the first pass goes on after them
+  uint32_t errors;
 } Parser;
 
-AstId parse(const char *source, const Token *tokens, AstNode *ast_out, Parser *p);
-void print_ast(Parser *p, uint16_t node, int indent_level);
+// A function definition at the file scope, its body is
+// skipped by the first pass and parsed on its own later
+typedef struct {
+  VarId var;
+  uint32_t start;
+  uint32_t name_start;
+  uint32_t body_start; // of the '{'
+  uint32_t tokens; // of the body, in the recorded ones
+  uint32_t item; // index among the file scope nodes
+  Visible visible;
+  AstId body; // set, once it's merged
+  // the ids of its own, set with the body
+  VarId locals;
+  uint32_t local_count;
+  LabelId labels;
+  uint32_t label_count;
+} Function;
+
+struct Backend;
+
+void Parser_init(Parser *p, Interner *in, Preprocessor *pp,
+    Arena *arenas, const Parser *file);
+// The first pass, it stops after the body, that fills the window of the
+// recorded tokens, or at the end of the file, zero is for no window.
+// Returns false at the end.
+bool Parser_parse_file_scope(Parser *p, uint32_t window);
+// Runs both passes on the initialized parser, every
+// function is submitted to the back end, once it's parsed
+AstId parse(Parser *p, uint32_t threads, struct Backend *backend);
+void print_ast(FILE *out, Parser *p, AstId node, int indent_level);
+
+static inline Var *Parser_var(Parser *p, VarId id) {
+  if (id < p->var_base) return &p->file->vars[id];
+  return &p->vars[id - p->var_base];
+}
+
+static inline Typedef *Parser_typedef(Parser *p, TypedefId id) {
+  if (id < p->typedef_base) return &p->file->typedefs[id];
+  return &p->typedefs[id - p->typedef_base];
+}
+
+static inline Struct *Parser_struct(Parser *p, StructId id) {
+  if (id < p->struct_base) return &p->file->structs[id];
+  return &p->structs[id - p->struct_base];
+}
+
+static inline Token Parser_next_token(Parser *p) {
+  if (!p->replay) return Preprocessor_next(p->pp);
+  Token tok = *p->replay;
+  // stays at the terminator
+  if (tok.type) p->replay++;
+  return tok;
+}
+
+// Token k places after the current one
+static inline Token Parser_peek(Parser *p, uint32_t k) {
+  assert(k < TOKEN_RING);
+  while (p->pos + k >= p->lexed) {
+    p->ring[p->lexed++ & (TOKEN_RING - 1)] = Parser_next_token(p);
+  }
+  return p->ring[(p->pos + k) & (TOKEN_RING - 1)];
+}
+
+// Returns the current token and moves past it
+static inline Token Parser_advance(Parser *p) {
+  Token tok = Parser_peek(p, 0);
+  p->pos++;
+  return tok;
+}
+
+// Moves past the current token, if it's of the given type
+static inline bool Parser_accept(Parser *p, TokenType type) {
+  if (Parser_peek(p, 0).type != type) return false;
+  p->pos++;
+  return true;
+}
 
 AstId Parser_parse_expression(Parser *p);
+AstId Parser_parse_arguments(Parser *p);
 AstId Parser_parse_assignment(Parser *p);
 AstId Parser_parse_unary(Parser *p);
-AstId Parser_parse_conditional(Parser *p, uint16_t left);
+AstId Parser_parse_conditional(Parser *p, AstId left);
 AstId Parser_parse_declaration(Parser *p);
+AstId Parser_parse_function_body(Parser *p);
 AstId Parser_parse_statement(Parser *p);
 AstId Parser_parse_block(Parser *p);
 AstId Parser_create_expr(Parser *p, AstNode expr);
 AstId Parser_create_ident(Parser *p, Token source);
 
-LabelId Parser_push_label(Parser *p, Str name);
-LabelId Parser_resolve_label(Parser *p, Str name);
+LabelId Parser_push_label(Parser *p, SymId name);
+LabelId Parser_resolve_label(Parser *p, SymId name);
 VarId Parser_push_var(Parser *p, Var var);
-VarId Parser_resolve_var(Parser *p, Str name);
+// At the position in the source, on the stderr
+void Parser_error(Parser *p, uint32_t loc, const char *message);
+VarId Parser_resolve_var(Parser *p, SymId name);
+void Parser_begin_function(Parser *p);
+void Parser_end_function(Parser *p);
 void Parser_push_scope(Parser *p);
 void Parser_pop_scope(Parser *p);
 TypedefId Parser_push_typedef(Parser *p, Typedef td);
-TypedefId Parser_resolve_typedef(Parser *p, uint32_t start, uint16_t len);
+TypedefId Parser_resolve_typedef(Parser *p, SymId name);
 StructId Parser_push_struct(Parser *p, Struct s);
-StructId Parser_resolve_struct(Parser *p, uint32_t start, uint16_t len);
+StructId Parser_resolve_struct(Parser *p, SymId name);
 
 #endif
@@ -0,0 +1,132 @@
+#ifndef INCLUDE_PCH
+#define INCLUDE_PCH
+
+#include "arena.h"
+#include "driver.h"
+#include "intern.h"
+#include "parser.h"
+#include "preprocessor.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#define PCH_MAGIC "mcc-pch"
+#define PCH_VERSION 1
+
+// note: Every section is the content of an arena, starting
+// at a page boundary of the file, so it can be mapped in place
+// of the arena. The tables refer to each other by indices and
+// offsets, never by pointers, so nothing has to be relocated.
+typedef enum {
+  PCH_CHARS,
+  PCH_SYMBOLS,
+  PCH_INTERN_TABLES,
+  PCH_AST,
+  PCH_VARS,
+  PCH_BINDINGS,
+  PCH_FIELDS,
+  PCH_STRUCTS,
+  PCH_TYPEDEFS,
+  PCH_FUNCTIONS,
+  PCH_ITEMS,
+  PCH_TOKENS,
+  PCH_MACROS,
+  PCH_MACRO_TOKENS,
+  PCH_MACRO_INDEX,
+  PCH_SYMTAB,
+  // these two aren't mapped, but read in place
+  PCH_FILES,
+  PCH_PATHS,
+  PCH_SECTION_COUNT,
+} PchSection;
+
+typedef struct {
+  uint64_t offset;
+  uint64_t size;
+} PchRange;
+
+typedef enum {
+  // the empty main file and the one including the header,
+  // nothing that's left after the preprocessing is from them
+  PCH_FILE_NONE,
+  PCH_FILE_BUILTINS,
+  PCH_FILE_HEADER,
+} PchFileKind;
+
+// A file in the sources, the locations in the tables point into it
+typedef struct {
+  // FNV-1a of the whole mapping, the padding included
+  uint64_t hash;
+  uint32_t base;
+  uint32_t size;
+  // into the paths, the canonical one
+  uint32_t path;
+  uint32_t path_len;
+  // offset in the file
+  uint32_t guard;
+  uint32_t guard_len;
+  PchFileKind kind;
+  bool once;
+} PchFile;
+
+// A symbol table, its slots are in the symtab section
+typedef struct {
+  uint32_t slots; // byte offset
+  uint32_t bits;
+  uint32_t count;
+} PchSymTab;
+
+// The first page of the file
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  // the sizes of the records, the file can't be used,
+  // if they're different in this build
+  uint32_t layout;
+  uint32_t page;
+  PchRange sections[PCH_SECTION_COUNT];
+  uint32_t file_count;
+  // the header, that was precompiled
+  uint32_t prefix;
+  uint32_t source_end;
+  uint32_t intern_table; // byte offset
+  uint32_t intern_capacity;
+  uint32_t intern_count;
+  uint32_t macro_index_len;
+  uint32_t ast_size;
+  uint32_t ast_count;
+  VarId var_size;
+  uint16_t typedefs_size;
+  uint16_t fields_size;
+  uint16_t structs_size;
+  PchSymTab var_index;
+  PchSymTab typedef_index;
+  PchSymTab struct_index;
+  PchSymTab label_index;
+} PchHeader;
+
+// An opened precompiled header, shared by all the translation units
+typedef struct Pch {
+  int fd;
+  const uint8_t *data;
+  size_t size;
+  const PchHeader *header;
+  const PchFile *files;
+  const char *paths;
+  // the header cache ids of the files
+  uint32_t *headers;
+} Pch;
+
+// Parses the file scope of the header and writes the tables out
+void Pch_build(const Driver *d, const char *path, const char *header, Arenas *arenas);
+// Returns false, if the file can't be used, the reason is printed
+// to stderr. The files are checked against the hashes only here,
+// for the whole process.
+bool Pch_open(Pch *pch, const char *path);
+void Pch_close(Pch *pch);
+// Maps the tables in place of the ones of the translation unit,
+// has to be done after the init and before the begin
+void Pch_load(const Pch *pch, Interner *in, Preprocessor *pp, Parser *p);
+// The path of the header, that was precompiled
+Str Pch_prefix(const Pch *pch);
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef INCLUDE_PEEPHOLE
+#define INCLUDE_PEEPHOLE
+
+#include "x86.h"
+#include <stdint.h>
+#include <stdio.h>
+
+// In the order of the rules, see PEEPHOLE_RULES
+typedef enum {
+  PEEPHOLE_SELF_MOV,
+  PEEPHOLE_IDENTITY,
+  PEEPHOLE_DEAD_MOV,
+  PEEPHOLE_COPY_BACK,
+  PEEPHOLE_FORWARD,
+  PEEPHOLE_NARROW_COPY,
+  PEEPHOLE_RELOAD,
+  PEEPHOLE_STORE_BACK,
+  PEEPHOLE_DEAD_STORE,
+  PEEPHOLE_PUSH_POP,
+  PEEPHOLE_JUMP_NEXT,
+
+  PEEPHOLE_COUNT,
+} PeepholeRule;
+
+// The hits of every rule, summed up over the functions
+typedef struct {
+  uint64_t hits[PEEPHOLE_COUNT];
+} PeepholeStats;
+
+// Rewrites the code in place, it only gets shorter. The stats can be
+// shared by the threads, the hits of a function are added at once.
+void X86_peephole(X86Code *code, PeepholeStats *stats);
+void Peephole_print_stats(FILE *out, const PeepholeStats *stats);
+
+#endif
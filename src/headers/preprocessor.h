@@ -0,0 +1,188 @@
+#ifndef INCLUDE_PREPROCESSOR
+#define INCLUDE_PREPROCESSOR
+
+#include "arena.h"
+#include "driver.h"
+#include "intern.h"
+#include "symtab.h"
+#include "tokens.h"
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <time.h>
+
+#define MAX_INCLUDE_DEPTH 64
+#define MAX_CONDITIONALS 64
+#define MAX_EXPANSION_DEPTH 256
+#define MAX_MACRO_PARAMS 64
+
+typedef struct {
+  uint32_t base;
+  uint32_t size;
+  const char *data;
+  Str name; // for the diagnostics
+} SourceFile;
+
+// note: Every file of the translation unit gets its own range of
+// locations, a token start is the base of its file plus the offset.
+// The main file is first, so its locations are just the offsets.
+typedef struct {
+  SourceFile *files;
+  Arena *arena;
+  uint32_t count;
+  uint32_t end; // base of the next file
+} SourceMap;
+
+// For finding out, that the file changed
+typedef struct {
+  struct timespec mtime;
+  off_t size;
+  ino_t ino;
+} HeaderStamp;
+
+// A header file, it's mapped once for the whole process and shared
+// by all the translation units, so are the include guard and the
+// #pragma once, that are found in it
+typedef struct {
+  Source source;
+  HeaderStamp stamp;
+  // the macro of the include guard around the whole file
+  Str guard;
+  bool once;
+} Header;
+
+typedef uint32_t MacroId;
+
+typedef struct {
+  SymId name;
+  uint32_t tokens; // start in the macro tokens
+  uint32_t len;
+  uint8_t params;
+  bool function_like;
+  // the last parameter is __VA_ARGS__
+  bool variadic;
+  // while it's being expanded
+  bool disabled;
+} Macro;
+
+typedef enum {
+  COND_ACTIVE, // inside the branch, that's taken
+  COND_SEEKING, // no branch was taken yet
+  COND_DONE, // one was taken, skipping the rest
+} CondState;
+
+typedef enum {
+  // nothing was seen in the file yet
+  GUARD_START,
+  // inside the #ifndef at the start
+  GUARD_OPEN,
+  // after its #endif, nothing else can follow
+  GUARD_CLOSED,
+  GUARD_NONE,
+} GuardState;
+
+typedef struct {
+  Lexer lexer;
+  uint32_t header; // zero for the main file
+  // the conditionals, that were open before the file
+  uint32_t cond_base;
+  GuardState guard;
+  uint32_t guard_cond;
+  Token guard_name;
+  // token read ahead and put back
+  Token pending;
+} PpFile;
+
+// Tokens, that are read before the ones of the file,
+// a macro expansion or a line, that's being evaluated
+typedef struct {
+  const Token *tokens;
+  uint32_t pos;
+  uint32_t len;
+  MacroId macro;
+  // The reading stops at its end, instead of continuing
+  // with what's under it, it has to be popped explicitly
+  bool barrier;
+} PpContext;
+
+typedef struct {
+  uint32_t includes;
+  uint32_t guard_skips;
+  uint32_t once_skips;
+  uint32_t expansions;
+} PpStats;
+
+// note: Runs between the lexer and the parser, one token at a time.
+// The directives are handled, when the lexer returns a '#' at the
+// start of a line, the macros are expanded from a stack of contexts.
+// A macro is disabled, while its context is on the stack, and its name
+// found in there is painted, so it's never expanded later. A header
+// with an include guard or #pragma once is skipped, without being
+// read again, when it's included for the second time.
+typedef struct {
+  Interner *interner;
+  Arena *arenas;
+  SourceMap sources;
+  const char *main_path;
+  // the source, that includes the prefix header, when there's one
+  char prefix[PATH_MAX + 16];
+  const char **include_dirs;
+  uint32_t include_dir_count;
+  // header id to the index in the sources + 1
+  SymTab files;
+  Macro *macros;
+  // sym to the macro, zero if it's not defined
+  MacroId *macro_index;
+  uint32_t macro_index_len;
+  SymId sym_defined;
+  SymId sym_va_args;
+  PpFile files_stack[MAX_INCLUDE_DEPTH];
+  uint32_t file_count;
+  PpContext contexts[MAX_EXPANSION_DEPTH];
+  uint32_t context_count;
+  CondState conds[MAX_CONDITIONALS];
+  uint32_t cond_count;
+  // if the last token came from a context, for putting it back
+  bool from_context;
+  PpStats stats;
+} Preprocessor;
+
+void Preprocessor_init(Preprocessor *pp, Interner *in, Arena *arenas,
+    const char **include_dirs, uint32_t include_dir_count);
+// Starts reading the main file, the prefix header
+// is included before it, if it's not zero
+void Preprocessor_begin(Preprocessor *pp, Source source,
+    const char *filename, const char *prefix);
+// Returns the EOF token at the end
+Token Preprocessor_next(Preprocessor *pp);
+void Preprocessor_print_stats(FILE *out, const Preprocessor *pp);
+// Runs the preprocessor to the end
+void print_tokens(FILE *out, Preprocessor *pp);
+
+// Returns zero, if the file can't be opened
+uint32_t HeaderCache_open(const char *path, uint32_t len);
+Header HeaderCache_header(uint32_t id);
+Str HeaderCache_path(uint32_t id);
+void HeaderCache_set_guard(uint32_t id, Str guard, bool once);
+// Between the requests of the server
+void HeaderCache_refresh(void);
+// One past the last id, the headers after one are opened since
+uint32_t HeaderCache_count(void);
+
+// The text of a token at the location
+const char *SourceMap_text(const SourceMap *m, uint32_t loc);
+
+// Of a location, the line and the column count from one
+typedef struct {
+  Str file;
+  uint32_t line;
+  uint32_t column;
+} SourcePosition;
+
+// note: The lines are counted from the start of the file,
+// it's only for the diagnostics, so it doesn't have to be fast
+SourcePosition SourceMap_position(const SourceMap *m, uint32_t loc);
+
+#endif
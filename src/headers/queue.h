@@ -0,0 +1,38 @@
+#ifndef INCLUDE_QUEUE
+#define INCLUDE_QUEUE
+
+#include "arena.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#define CACHE_LINE 64
+
+typedef struct {
+  // the position, that the cell is ready for
+  uint32_t seq;
+  uint32_t value;
+} QueueCell;
+
+// note: Bounded multi-producer multi-consumer queue without locks.
+// Every cell has a sequence number, that tells if it's ready to be
+// written or read at a position, so the producers and consumers only
+// ever race on their own counter, which is claimed with a CAS.
+// The counters are on separate cache lines not to bounce between
+// the producers and the consumers.
+typedef struct {
+  QueueCell *cells;
+  uint32_t mask;
+  __attribute__((aligned(CACHE_LINE))) uint32_t tail;
+  __attribute__((aligned(CACHE_LINE))) uint32_t head;
+} Queue;
+
+// The capacity has to be a power of two
+void Queue_init(Queue *q, Arena *arena, uint32_t capacity);
+// Both return false, when the queue is full or empty
+bool Queue_try_push(Queue *q, uint32_t value);
+bool Queue_try_pop(Queue *q, uint32_t *value);
+// Yield, until they succeed
+void Queue_push(Queue *q, uint32_t value);
+uint32_t Queue_pop(Queue *q);
+
+#endif
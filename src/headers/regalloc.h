@@ -0,0 +1,53 @@
+#ifndef INCLUDE_REGALLOC
+#define INCLUDE_REGALLOC
+
+#include "arena.h"
+#include "inst.h"
+#include <stdint.h>
+#include <stdio.h>
+
+// In the order of their encoding
+typedef enum {
+  REG_RAX, REG_RCX, REG_RDX, REG_RBX, REG_RSP, REG_RBP, REG_RSI, REG_RDI,
+  REG_R8, REG_R9, REG_R10, REG_R11, REG_R12, REG_R13, REG_R14, REG_R15,
+
+  REG_COUNT,
+} Register;
+
+#define REG_NONE 0xff
+// note: rax, rcx and rdx are left to the back end, for the
+// divisions, the shift counts and the results of the calls
+#define REG_CALLER_SAVED (1u << REG_RSI | 1u << REG_RDI | 1u << REG_R8 \
+    | 1u << REG_R9 | 1u << REG_R10 | 1u << REG_R11)
+#define REG_CALLEE_SAVED (1u << REG_RBX | 1u << REG_R12 | 1u << REG_R13 \
+    | 1u << REG_R14 | 1u << REG_R15)
+
+// Where a value lives, a register below LOC_SLOT,
+// or the stack slot of the location minus LOC_SLOT
+#define LOC_SLOT REG_COUNT
+// The constants and the undefs, they're put into the code
+#define LOC_CONST UINT32_MAX
+// Of the instructions without a value, or with an unused one
+#define LOC_NONE (UINT32_MAX - 1)
+
+typedef struct {
+  uint32_t *locs; // of every instruction
+  uint32_t slot_count;
+  uint32_t callee_saved; // the mask of the ones, that are used
+  uint32_t pressure; // the most values, that are live at once
+} RegAlloc;
+
+// Over the functions, the peak is of the pressure, the ones
+// found in the cache don't go through the allocator
+typedef struct {
+  uint32_t peak;
+  uint64_t pressure;
+  uint64_t slots;
+  uint64_t functions;
+} RegAllocStats;
+
+// The stats can be shared by the threads, like the ones of the peephole
+void Ir_allocate(const Ir *ir, Arena *scratch, RegAlloc *ra, RegAllocStats *stats);
+void RegAlloc_print_stats(FILE *out, const RegAllocStats *stats);
+
+#endif
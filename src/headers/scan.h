@@ -0,0 +1,54 @@
+#ifndef INCLUDE_SCAN
+#define INCLUDE_SCAN
+
+#include <stdint.h>
+
+// Character classes, the bits are chosen so that the class
+// of a byte is CLASS_LOW[ch & 15] & CLASS_HIGH[ch >> 4],
+// which lets the AVX2 path classify 32 bytes with two shuffles
+typedef enum {
+  CLASS_SPACE_A = 1 << 0, // ' '
+  CLASS_SPACE_B = 1 << 1, // '\t' to '\r'
+  CLASS_DIGIT = 1 << 2,
+  CLASS_ALPHA_A = 1 << 3, // 'A' to 'O', 'a' to 'o'
+  CLASS_ALPHA_B = 1 << 4, // 'P' to 'Z', 'p' to 'z'
+  CLASS_UNDERSCORE = 1 << 5,
+
+  CLASS_SPACE = CLASS_SPACE_A | CLASS_SPACE_B,
+  CLASS_IDENT = CLASS_DIGIT | CLASS_ALPHA_A | CLASS_ALPHA_B | CLASS_UNDERSCORE,
+} CharClass;
+
+const uint8_t CLASS_LOW[16] = {
+  0x15, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c,
+  0x1c, 0x1e, 0x1a, 0x0a, 0x0a, 0x0a, 0x08, 0x28,
+};
+
+const uint8_t CLASS_HIGH[16] = {
+  0x02, 0x00, 0x01, 0x04, 0x08, 0x30, 0x08, 0x10,
+};
+
+typedef enum {
+  SCAN_SCALAR,
+  SCAN_SSE2,
+  SCAN_AVX2,
+  SCAN_COUNT,
+} ScanLevel;
+
+// Every function returns the first byte, where the scan stops,
+// the source has to be zero terminated
+typedef struct {
+  const char *(*space)(const char *ch);
+  const char *(*digits)(const char *ch);
+  const char *(*ident)(const char *ch);
+  // stops at '\n' or the end
+  const char *(*line_end)(const char *ch);
+  // stops at the '*' of "*/" or the end
+  const char *(*comment_end)(const char *ch);
+} Scanner;
+
+const char *SCAN_LEVEL_STR[SCAN_COUNT] = { "scalar", "sse2", "avx2" };
+
+ScanLevel scan_detect(void);
+void scan_select(ScanLevel level);
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef INCLUDE_SERVER
+#define INCLUDE_SERVER
+
+#include "driver.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define SERVER_MAGIC 0x7363636d // "mccs"
+#define SERVER_BACKLOG 16
+// Of the strings of a request
+#define SERVER_MAX_REQUEST (1 << 20)
+
+// Followed by the strings, the working directory of the client
+// and then the arguments, each one zero terminated. The standard
+// output and error of the client are passed with it, as SCM_RIGHTS.
+typedef struct {
+  uint32_t magic;
+  uint32_t argc;
+  uint32_t len;
+} ServerRequest;
+
+// note: The requests are run one at a time, each one in a child of
+// the server, as if it was started with the arguments in the directory
+// of the client and with its output. The workspaces and the headers
+// of the server are inherited by the children, the headers, that one
+// opens, are opened by the server too, for the next ones. The headers,
+// that changed, are mapped again before every request. The client only
+// waits for the exit status, the output goes straight to its own files.
+typedef struct {
+  int fd;
+  const char *path;
+  Workspace *workspaces;
+  uint32_t workspace_count;
+  // of every request in seconds, in the order they came
+  double *latencies;
+  uint32_t latency_count;
+  uint32_t latency_capacity;
+  bool running;
+} Server;
+
+// Serves until a --shutdown request, returns the exit status
+int Server_run(const char *path);
+// Forwards the arguments, returns the exit status of the request
+int Client_run(const char *path, int argc, const char **argv);
+
+#endif
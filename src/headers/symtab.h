@@ -0,0 +1,43 @@
+#ifndef INCLUDE_SYMTAB
+#define INCLUDE_SYMTAB
+
+#include "arena.h"
+#include "intern.h"
+#include <stdint.h>
+#include <stdio.h>
+
+#define SYMTAB_MIN_BITS 6
+
+typedef struct {
+  SymId name; // zero if empty
+  uint32_t value;
+} SymSlot;
+
+// Open addressing index from a symbol to an index into
+// one of the parser tables, the slots are allocated from
+// an arena, so a grown table just leaves the old one behind
+typedef struct {
+  SymSlot *slots;
+  Arena *arena;
+  uint32_t bits;
+  uint32_t count;
+  // statistics
+  uint64_t lookups;
+  uint64_t probes;
+  uint32_t max_probes;
+} SymTab;
+
+void SymTab_init(SymTab *t, Arena *arena);
+// Returns the slot of the name, if it's not there,
+// the name is inserted with zero value
+SymSlot *SymTab_entry(SymTab *t, SymId name);
+// Returns zero, if the name is not there
+uint32_t SymTab_get(SymTab *t, SymId name);
+// Same as above, but without the statistics,
+// so it can be used on a table shared by threads
+uint32_t SymTab_peek(const SymTab *t, SymId name);
+// Empties the table, but keeps the slots
+void SymTab_clear(SymTab *t);
+void SymTab_print_stats(FILE *out, const SymTab *t, const char *name);
+
+#endif
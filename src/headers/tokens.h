@@ -1,9 +1,10 @@
 #ifndef INCLUDE_TOKENS
 #define INCLUDE_TOKENS
 
+#include <stdbool.h>
 #include <stdint.h>
-
-#define MAX_TOKENS 256
+#include <stdio.h>
+#include "intern.h"
 
 #define IS_NUMERIC(ch) ((ch) >= '0' && (ch) <= '9')
 #define IS_ALPHA(ch) \
@@ -39,9 +40,14 @@ typedef enum {
   TOK_DOT, TOK_TILDA, TOK_COLON, TOK_SEMICOLON,
   TOK_COMMA, TOK_LPAREN, TOK_RPAREN, TOK_LBRACE,
   TOK_RBRACE, TOK_LSQUARE, TOK_RSQUARE, TOK_QUESTION,
+  TOK_HASH, TOK_DHASH,
 
   TOK_IDENT,
   TOK_DECIMAL,
+  TOK_STRING,
+  // Parameter of a macro, only in the macro bodies,
+  // the sym is the index of the parameter
+  TOK_PARAM,
 
 #define KEYWORDS_START TOK_BREAK
   // Other keywords
@@ -87,9 +93,12 @@ const char *TOKEN_TYPE_STR[TOK_COUNT] = {
   "TOK_DOT", "TOK_TILDA", "TOK_COLON", "TOK_SEMICOLON",
   "TOK_COMMA", "TOK_LPAREN", "TOK_RPAREN", "TOK_LBRACE",
   "TOK_RBRACE", "TOK_LSQUARE", "TOK_RSQUARE", "TOK_QUESTION",
+  "TOK_HASH", "TOK_DHASH",
 
   "TOK_IDENT",
   "TOK_DECIMAL",
+  "TOK_STRING",
+  "TOK_PARAM",
 
   "TOK_BREAK", "TOK_FOR", "TOK_WHILE", "TOK_GOTO", "TOK_SIZEOF",
   "TOK_CONTINUE", "TOK_IF", "TOK_DEFAULT", "TOK_IMAGINARY", "TOK_DO",
@@ -104,14 +113,42 @@ const char *TOKEN_TYPE_STR[TOK_COUNT] = {
 
 };
 
+typedef enum {
+  // the name of a macro, that can't be expanded anymore,
+  // because it was found inside its own expansion
+  TOKEN_NOEXPAND = 1 << 0,
+} TokenFlags;
+
 typedef struct {
   TokenType type;
   uint16_t len;
+  uint8_t flags;
+  // note: Location in the source map of the translation unit,
+  // where every file has its own range, see preprocessor.h
   uint32_t start;
+  SymId sym; // only identifiers
 } Token;
 
-void tokenize(const char *source, Token tokens_out[MAX_TOKENS]);
-void print_tokens(const Token *tokens);
+// note: The tokens are produced one at a time, when the parser
+// asks for them, so only the lookahead has to be kept in memory
+typedef struct {
+  Interner *interner;
+  const char *source;
+  const char *ch;
+  // added to the offsets in the source
+  uint32_t base;
+  // Inside a conditional, that's not compiled, the identifiers
+  // aren't interned and unknown characters are ignored
+  bool skipping;
+} Lexer;
+
+void Lexer_init(Lexer *l, Interner *in, const char *source, uint32_t base);
+Token Lexer_next(Lexer *l);
+// Skips the spaces and comments up to the end of the line,
+// returns true if there's nothing more on it
+bool Lexer_line_end(Lexer *l);
+// If the token is the first one on its line
+bool Lexer_line_start(const Lexer *l, Token tok);
 
 #endif
 
@@ -0,0 +1,79 @@
+#ifndef INCLUDE_WRITER
+#define INCLUDE_WRITER
+
+#include "common.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/uio.h>
+
+// Of the ones, that go to a file
+#define WRITER_BUFFER ((size_t)1 << 20)
+// The first one of the memory ones, it doubles from there
+#define WRITER_MEMORY 4096
+// The buffers in a call of the gather, the IOV_MAX of the linux
+#define WRITER_GATHER 1024
+
+// note: The output of the compiler goes through here, instead of the
+// stdio, so it's formatted by hand and written with a few calls. A
+// writer either goes to a file, through a fixed buffer, that's
+// reused, or stays in the memory, in a buffer, that grows, like the
+// ones of the functions, that are put together at the end. Those
+// are written from where they are, with the gather.
+typedef struct {
+  int fd; // -1 for the memory
+  char *data;
+  size_t len;
+  size_t cap;
+  // the whole output, in the place of the buffer, see Writer_map
+  char *map;
+  size_t map_len;
+  bool mapped; // of the file, the memory is written out otherwise
+} Writer;
+
+void Writer_file(Writer *w, int fd);
+void Writer_memory(Writer *w);
+void Writer_flush(Writer *w);
+// Flushes the file, the fd stays open
+void Writer_close(Writer *w);
+// Of the memory ones, the data is malloc'd and the writer is empty again
+char *Writer_take(Writer *w, size_t *len);
+// Writes the buffers as they are, after the buffered data
+void Writer_gather(Writer *w, const struct iovec *chunks, uint32_t count);
+// The memory for the whole output, before anything else is written,
+// it's the file itself, when it can be mapped, it's written by the close
+char *Writer_map(Writer *w, size_t len);
+// When the buffer is full, the file is flushed and the memory grows
+void Writer_write(Writer *w, const void *data, size_t len);
+void Writer_u64(Writer *w, uint64_t value);
+void Writer_i64(Writer *w, int64_t value);
+// Lowercase, without the 0x
+void Writer_hex(Writer *w, uint64_t value);
+
+static inline void Writer_bytes(Writer *w, const void *data, size_t len) {
+  if (w->cap - w->len < len) {
+    Writer_write(w, data, len);
+    return;
+  }
+  memcpy(w->data + w->len, data, len);
+  w->len += len;
+}
+
+static inline void Writer_char(Writer *w, char c) {
+  if (w->len == w->cap) {
+    Writer_write(w, &c, 1);
+    return;
+  }
+  w->data[w->len++] = c;
+}
+
+static inline void Writer_str(Writer *w, Str s) {
+  Writer_bytes(w, s.ptr, s.len);
+}
+
+static inline void Writer_cstr(Writer *w, const char *s) {
+  Writer_bytes(w, s, strlen(s));
+}
+
+#endif
@@ -0,0 +1,129 @@
+#ifndef INCLUDE_X86
+#define INCLUDE_X86
+
+#include "arena.h"
+#include "common.h"
+#include "intern.h"
+#include "regalloc.h"
+#include "writer.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef enum {
+  X86_LABEL, // a is the label, it's not an instruction
+  X86_MOV, X86_MOVSX, X86_MOVSXD, X86_MOVZX, X86_LEA,
+  X86_ADD, X86_OR, X86_AND, X86_SUB, X86_XOR, X86_CMP,
+  X86_TEST, X86_IMUL, X86_SHL, X86_SHR, X86_SAR,
+  X86_NEG, X86_NOT, X86_DIV, X86_IDIV, X86_CQO,
+  X86_SETCC, X86_JCC, X86_JMP, X86_CALL,
+  X86_PUSH, X86_POP, X86_LEAVE, X86_RET, X86_UD2,
+
+  X86_COUNT,
+} X86Op;
+
+// In the order of their encoding
+typedef enum {
+  CC_O, CC_NO, CC_B, CC_AE, CC_E, CC_NE, CC_BE, CC_A,
+  CC_S, CC_NS, CC_P, CC_NP, CC_L, CC_GE, CC_LE, CC_G,
+} X86Cond;
+
+typedef enum {
+  OPERAND_NONE,
+  OPERAND_REG,
+  OPERAND_IMM,
+  OPERAND_MEM, // at the base register, the scaled index and the displacement
+  OPERAND_GLOBAL, // of the symbol, relative to rip
+  OPERAND_LABEL, // in the code of the function
+  OPERAND_SYMBOL, // the target of a call
+} OperandKind;
+
+typedef struct {
+  uint8_t kind;
+  uint8_t size; // in bytes, of the registers and the memory
+  uint8_t reg; // or the base
+  // of the memory, the register plus one, and the log of the
+  // scale in the high bits, zero without an index
+  uint8_t index;
+  uint32_t sym; // of the globals and the symbols, the label otherwise
+  int64_t imm; // or the displacement
+} X86Operand;
+
+typedef struct {
+  uint8_t op;
+  uint8_t cc; // of the setcc and the jcc
+  X86Operand a, b;
+} X86Inst;
+
+// note: The code of a function, the way it's written in the
+// assembly, but with the operands kept apart, so it can be either
+// printed or encoded. The label of a block is its index shifted
+// left by one, the low bit marks the second one of the block.
+typedef struct {
+  const Interner *interner; // of the symbols
+  Str name;
+  X86Inst *insts;
+  uint32_t count;
+  uint32_t label_count;
+} X86Code;
+
+// note: The relocations are of the ELF for x86-64
+#define R_X86_64_PC32 2
+#define R_X86_64_PLT32 4
+
+typedef struct {
+  uint32_t offset;
+  uint32_t type;
+  SymId sym;
+  int32_t addend;
+} X86Reloc;
+
+// The machine code, it's in the scratch, like the relocations
+typedef struct {
+  uint8_t *bytes;
+  uint32_t len;
+  X86Reloc *relocs;
+  uint32_t reloc_count;
+} X86Machine;
+
+// The intel syntax, with the label and the global of the function
+void X86_print(Writer *out, const X86Code *code);
+// Picks the short jumps, wherever they reach, like the assemblers do
+void X86_encode(const X86Code *code, Arena *scratch, X86Machine *m);
+
+static inline X86Operand X86_reg(uint32_t reg, uint32_t size) {
+  return (X86Operand){ .kind = OPERAND_REG, .size = size, .reg = reg };
+}
+
+static inline X86Operand X86_imm(int64_t imm) {
+  return (X86Operand){ .kind = OPERAND_IMM, .imm = imm };
+}
+
+static inline X86Operand X86_mem(uint32_t base, int32_t disp, uint32_t size) {
+  return (X86Operand){ .kind = OPERAND_MEM, .size = size, .reg = base, .imm = disp };
+}
+
+// The index can't be rsp
+static inline X86Operand X86_indexed(uint32_t base, uint32_t index, uint32_t scale_log,
+    int32_t disp, uint32_t size) {
+  X86Operand o = X86_mem(base, disp, size);
+  o.index = (index + 1) | scale_log << 5;
+  return o;
+}
+
+static inline uint32_t X86Operand_index(const X86Operand *o) {
+  return (o->index & 31) - 1;
+}
+
+static inline X86Operand X86_global(SymId sym, uint32_t size) {
+  return (X86Operand){ .kind = OPERAND_GLOBAL, .size = size, .sym = sym };
+}
+
+static inline X86Operand X86_label(uint32_t label) {
+  return (X86Operand){ .kind = OPERAND_LABEL, .sym = label };
+}
+
+static inline X86Operand X86_symbol(SymId sym) {
+  return (X86Operand){ .kind = OPERAND_SYMBOL, .sym = sym };
+}
+
+#endif
@@ -0,0 +1,108 @@
+#include "intern.h"
+#include "arena.h"
+#include "common.h"
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+// FNV-1a
+static inline uint32_t hash_str(const char *str, uint32_t len) {
+  uint32_t hash = 2166136261u;
+  for (uint32_t i = 0; i < len; ++i) {
+    hash ^= (uint8_t)str[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+static InternSlot *Interner_alloc(Interner *in, uint32_t capacity) {
+  InternSlot *table = ARENA_PUSH(&in->tables, InternSlot, capacity);
+  memset(table, 0, sizeof(InternSlot) * capacity);
+  return table;
+}
+
+void Interner_init(Interner *in) {
+  *in = (Interner){0};
+  Arena_reserve(&in->chars, ARENA_RESERVE);
+  Arena_reserve(&in->symbols, ARENA_RESERVE);
+  Arena_reserve(&in->tables, ARENA_RESERVE);
+  Interner_reset(in);
+}
+
+// note: Keeps the pages committed, like Arena_reset,
+// the ids are the same, as with a new one
+void Interner_reset(Interner *in) {
+  Arena_reset(&in->chars);
+  Arena_reset(&in->symbols);
+  Arena_reset(&in->tables);
+  in->capacity = INTERNER_MIN_CAPACITY;
+  in->count = 1;
+  in->table = Interner_alloc(in, in->capacity);
+  *ARENA_PUSH(&in->symbols, Symbol, 1) = (Symbol){0};
+}
+
+void Interner_free(Interner *in) {
+  Arena_release(&in->chars);
+  Arena_release(&in->symbols);
+  Arena_release(&in->tables);
+  *in = (Interner){0};
+}
+
+static void Interner_grow(Interner *in) {
+  uint32_t capacity = in->capacity * 2;
+  InternSlot *table = Interner_alloc(in, capacity);
+  for (uint32_t i = 0; i < in->capacity; ++i) {
+    InternSlot slot = in->table[i];
+    if (!slot.sym) continue;
+    uint32_t index = slot.hash & (capacity - 1);
+    while (table[index].sym) index = (index + 1) & (capacity - 1);
+    table[index] = slot;
+  }
+  in->table = table;
+  in->capacity = capacity;
+}
+
+// Returns the slot with the string or the empty one, where it would go
+static inline uint32_t Interner_probe(const Interner *in, const char *str,
+    uint32_t len, uint32_t hash) {
+  const Symbol *symbols = (Symbol *)in->symbols.base;
+  const char *chars = (char *)in->chars.base;
+  uint32_t index = hash & (in->capacity - 1);
+  while (in->table[index].sym) {
+    InternSlot slot = in->table[index];
+    if (slot.hash == hash) {
+      Symbol s = symbols[slot.sym];
+      if (s.len == len && !memcmp(&chars[s.offset], str, len)) break;
+    }
+    index = (index + 1) & (in->capacity - 1);
+  }
+  return index;
+}
+
+SymId Interner_find(const Interner *in, const char *str, uint32_t len) {
+  return in->table[Interner_probe(in, str, len, hash_str(str, len))].sym;
+}
+
+SymId Interner_intern(Interner *in, const char *str, uint32_t len) {
+  uint32_t hash = hash_str(str, len);
+  uint32_t index = Interner_probe(in, str, len, hash);
+  if (in->table[index].sym) return in->table[index].sym;
+
+  const char *chars = (char *)in->chars.base;
+  SymId sym = in->count++;
+  char *copy = ARENA_PUSH(&in->chars, char, len);
+  memcpy(copy, str, len);
+  *ARENA_PUSH(&in->symbols, Symbol, 1) = (Symbol){
+    .offset = copy - chars,
+    .len = len,
+  };
+  in->table[index] = (InternSlot){ hash, sym };
+  // Keep the load factor under a half
+  if (in->count * 2 > in->capacity) Interner_grow(in);
+  return sym;
+}
+
+Str Interner_str(const Interner *in, SymId sym) {
+  Symbol s = ((Symbol *)in->symbols.base)[sym];
+  return (Str){ (char *)in->chars.base + s.offset, s.len };
+}
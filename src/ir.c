@@ -0,0 +1,218 @@
+#include "inst.h"
+#include "arena.h"
+#include "intern.h"
+#include "parser.h"
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define IDOM_NONE UINT32_MAX
+
+// note: "A Simple, Fast Dominance Algorithm" by Cooper et al.
+// The blocks are in the reverse postorder already, so their
+// indices are the order numbers it needs.
+void Ir_dominators(Ir *ir, Arena *scratch) {
+  Block *blocks = ir->blocks;
+  for (BlockId i = 1; i < ir->block_count; ++i) blocks[i].idom = IDOM_NONE;
+  blocks[0].idom = 0;
+  for (bool changed = true; changed;) {
+    changed = false;
+    for (BlockId i = 1; i < ir->block_count; ++i) {
+      const BlockId *preds = ir->preds + blocks[i].preds;
+      BlockId idom = IDOM_NONE;
+      for (uint32_t j = 0; j < blocks[i].pred_count; ++j) {
+        BlockId pred = preds[j];
+        if (blocks[pred].idom == IDOM_NONE) continue;
+        if (idom == IDOM_NONE) {
+          idom = pred;
+          continue;
+        }
+        // the intersection, by going up the closer one
+        while (pred != idom) {
+          while (pred > idom) pred = blocks[pred].idom;
+          while (idom > pred) idom = blocks[idom].idom;
+        }
+      }
+      if (blocks[i].idom == idom) continue;
+      blocks[i].idom = idom;
+      changed = true;
+    }
+  }
+
+  // The children, in the order of the blocks
+  for (BlockId i = 0; i < ir->block_count; ++i) blocks[i].dom_child = 0;
+  for (BlockId i = ir->block_count - 1; i > 0; --i) {
+    Block *idom = &blocks[blocks[i].idom];
+    blocks[i].dom_sibling = idom->dom_child;
+    idom->dom_child = i;
+  }
+  blocks[0].dom_sibling = 0;
+  // The numbers of a walk of the tree, a block dominates
+  // the ones, that are numbered inside of its range. The
+  // stack holds the block and the next child to visit.
+  BlockId *stack = ARENA_PUSH(scratch, BlockId, ir->block_count * 2);
+  uint32_t top = 0, number = 0;
+  stack[top++] = 0;
+  stack[top++] = blocks[0].dom_child;
+  blocks[0].dom_pre = number++;
+  while (top) {
+    BlockId child = stack[top - 1];
+    if (!child) {
+      blocks[stack[top - 2]].dom_post = number++;
+      top -= 2;
+      continue;
+    }
+    stack[top - 1] = blocks[child].dom_sibling;
+    blocks[child].dom_pre = number++;
+    stack[top++] = child;
+    stack[top++] = blocks[child].dom_child;
+  }
+}
+
+void Ir_verify(const Ir *ir) {
+  for (ValueId v = 1; v < ir->inst_count; ++v) {
+    const Inst *inst = &ir->insts[v];
+    ValueId buffer[2];
+    const ValueId *operands;
+    uint32_t count = Ir_operands(ir, inst, buffer, &operands);
+    const BlockId *preds = ir->preds + ir->blocks[inst->block].preds;
+    for (uint32_t i = 0; i < count; ++i) {
+      ValueId w = operands[i];
+      if (!w) continue;
+      BlockId def = ir->insts[w].block;
+      BlockId use = inst->type == INST_PHI ? preds[i] : inst->block;
+      if (def == use) assert(inst->type == INST_PHI || w < v);
+      else assert(Ir_dominates(ir, def, use));
+    }
+  }
+}
+
+bool Ir_fold(InstType op, DataType type, int64_t a, int64_t b, int64_t *result) {
+  bool is_unsigned = DataType_unsigned(type);
+  uint64_t x = a, y = b;
+  int64_t r;
+  // note: The signed overflow wraps, as it does in the code we emit
+  switch (op) {
+    case INST_ADD: r = x + y; break;
+    case INST_SUB: r = x - y; break;
+    case INST_MUL: r = x * y; break;
+    case INST_DIV:
+    case INST_MOD:
+      // the smallest one divided by minus one overflows
+      if (!b || (!is_unsigned && b == -1 && a == INT64_MIN >> (64 - DataType_size(type) * 8))) {
+        return false;
+      }
+      if (is_unsigned) r = op == INST_DIV ? x / y : x % y;
+      else r = op == INST_DIV ? a / b : a % b;
+      break;
+    case INST_SHL:
+    case INST_SHR:
+      // the count is checked against the type of the result
+      if (b < 0 || b >= DataType_size(type) * 8) return false;
+      if (op == INST_SHL) r = x << b;
+      else r = is_unsigned ? (int64_t)(x >> b) : a >> b;
+      break;
+    case INST_AND: r = a & b; break;
+    case INST_OR: r = a | b; break;
+    case INST_XOR: r = a ^ b; break;
+    case INST_EQ: *result = a == b; return true;
+    case INST_NE: *result = a != b; return true;
+    case INST_LT: *result = is_unsigned ? x < y : a < b; return true;
+    case INST_LE: *result = is_unsigned ? x <= y : a <= b; return true;
+    case INST_GT: *result = is_unsigned ? x > y : a > b; return true;
+    case INST_GE: *result = is_unsigned ? x >= y : a >= b; return true;
+    case INST_NEG: r = 0 - x; break;
+    case INST_NOT: r = ~a; break;
+    case INST_CAST: r = a; break;
+    default: return false;
+  }
+  *result = DataType_wrap(type, r);
+  return true;
+}
+
+static void print_value(FILE *out, ValueId value) {
+  if (value) fprintf(out, "t%u", value);
+  else fprintf(out, "_");
+}
+
+void print_ir(FILE *out, const Ir *ir, Str name) {
+  fprintf(out, "\n# %.*s:\n", name.len, name.ptr);
+  for (BlockId i = 0; i < ir->block_count; ++i) {
+    const Block *b = &ir->blocks[i];
+    fprintf(out, "# b%u:", i);
+    if (b->pred_count) {
+      fprintf(out, " preds");
+      for (uint32_t j = 0; j < b->pred_count; ++j) fprintf(out, " b%u", ir->preds[b->preds + j]);
+      fprintf(out, ", idom b%u", b->idom);
+    }
+    fputc('\n', out);
+    for (ValueId v = b->start; v < b->start + b->len; ++v) {
+      const Inst *inst = &ir->insts[v];
+      Str var;
+      fprintf(out, "#   ");
+      if (inst->type < INST_STORE || (inst->type == INST_CALL && inst->data_type != DATA_VOID)) {
+        fprintf(out, "t%u = ", v);
+      }
+      // note: The comparisons are printed with the type of the operands
+      DataType type = inst->type >= INST_EQ && inst->type <= INST_GE
+        ? ir->insts[inst->a].data_type : inst->data_type;
+      fprintf(out, "%s", INST_TYPE_NAME[inst->type]);
+      if (type) fprintf(out, " %s", DATA_TYPE_TO_STR[type]);
+      switch (inst->type) {
+        case INST_CONST:
+          fprintf(out, " %lld", (long long)Inst_const(*inst));
+          break;
+        case INST_PHI:
+          const BlockId *preds = ir->preds + b->preds;
+          for (uint32_t j = 0; j < inst->count; ++j) {
+            fprintf(out, "%s[", j ? ", " : " ");
+            print_value(out, ir->args[inst->b + j]);
+            fprintf(out, ", b%u]", preds[j]);
+          }
+          break;
+        case INST_LOAD:
+        case INST_STORE:
+        case INST_CALL:
+          var = Interner_str(ir->file->interner, ir->file->vars[inst->a].name);
+          fprintf(out, " %.*s", var.len, var.ptr);
+          if (inst->type == INST_STORE) {
+            fprintf(out, ", ");
+            print_value(out, inst->b);
+          } else if (inst->type == INST_CALL) {
+            fputc('(', out);
+            for (uint32_t j = 0; j < inst->count; ++j) {
+              if (j) fprintf(out, ", ");
+              print_value(out, ir->args[inst->b + j]);
+            }
+            fputc(')', out);
+          }
+          break;
+        case INST_JUMP:
+          fprintf(out, " b%u", b->succs[0]);
+          break;
+        case INST_BRANCH:
+          fputc(' ', out);
+          print_value(out, inst->a);
+          fprintf(out, ", b%u, b%u", b->succs[0], b->succs[1]);
+          break;
+        case INST_RET:
+          if (!inst->count) break;
+          fputc(' ', out);
+          print_value(out, inst->a);
+          break;
+        case INST_UNDEF:
+          break;
+        case INST_NEG: case INST_NOT: case INST_CAST:
+          fputc(' ', out);
+          print_value(out, inst->a);
+          break;
+        default:
+          fputc(' ', out);
+          print_value(out, inst->a);
+          fprintf(out, ", ");
+          print_value(out, inst->b);
+      }
+      fputc('\n', out);
+    }
+  }
+}
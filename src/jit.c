@@ -0,0 +1,157 @@
+#include "jit.h"
+#include "common.h"
+#include "intern.h"
+#include "object.h"
+#include "writer.h"
+#include "x86.h"
+#include <assert.h>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// jmp qword ptr [rip], with the address right after it
+static void Jit_stub(uint8_t *stub, void *target) {
+  static const uint8_t JMP[] = { 0xff, 0x25, 0, 0, 0, 0 };
+  memcpy(stub, JMP, sizeof(JMP));
+  uint64_t address = (uintptr_t)target;
+  memcpy(stub + sizeof(JMP), &address, sizeof(address));
+  memset(stub + sizeof(JMP) + sizeof(address), 0xcc, JIT_STUB - sizeof(JMP) - sizeof(address));
+}
+
+// note: The symbols, that aren't in the file, are looked up in the
+// process, that has the libc loaded already. The calls go through
+// a stub, the same one for every call of the symbol.
+bool Jit_load(Jit *jit, const Interner *in, const ObjectFunction *functions, uint32_t count,
+    const ObjectGlobal *globals, uint32_t global_count) {
+  *jit = (Jit){ .interner = in, .functions = functions, .count = count };
+  uint64_t text_len = 0, reloc_count = 0, data_len = 0;
+  for (uint32_t i = 0; i < count; ++i) {
+    const ObjectHeader *h = (const ObjectHeader *)functions[i].data;
+    text_len += h->code_len;
+    reloc_count += h->reloc_count;
+  }
+  for (uint32_t i = 0; i < global_count; ++i) {
+    data_len = (data_len + globals[i].size - 1) & ~(uint64_t)(globals[i].size - 1);
+    data_len += globals[i].size;
+  }
+  uint64_t stubs = (text_len + JIT_STUB - 1) & ~(uint64_t)(JIT_STUB - 1);
+  size_t page = sysconf(_SC_PAGESIZE);
+  jit->data = (stubs + JIT_STUB * reloc_count + page) / page * page;
+  jit->size = jit->data + (data_len + page - 1) / page * page;
+  jit->code = mmap(0, jit->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  assert(jit->code != MAP_FAILED);
+  jit->offsets = calloc(in->count, sizeof(uint32_t));
+  uint32_t *stub_offsets = calloc(in->count, sizeof(uint32_t));
+  assert(jit->offsets && stub_offsets);
+
+  // note: The mapping is zeroed, like the bss
+  uint64_t offset = jit->data;
+  for (uint32_t i = 0; i < global_count; ++i) {
+    offset = (offset + globals[i].size - 1) & ~(uint64_t)(globals[i].size - 1);
+    Str name = globals[i].name;
+    jit->offsets[Interner_find(in, name.ptr, name.len)] = offset + 1;
+    memcpy(jit->code + offset, &globals[i].value, globals[i].size);
+    offset += globals[i].size;
+  }
+
+  offset = 0;
+  for (uint32_t i = 0; i < count; ++i) {
+    const ObjectHeader *h = (const ObjectHeader *)functions[i].data;
+    Str name = functions[i].name;
+    jit->offsets[Interner_find(in, name.ptr, name.len)] = offset + 1;
+    memcpy(jit->code + offset, (const ObjectReloc *)(h + 1) + h->reloc_count, h->code_len);
+    offset += h->code_len;
+  }
+  offset = 0;
+  bool ok = true;
+  for (uint32_t i = 0; i < count && ok; ++i) {
+    const ObjectHeader *h = (const ObjectHeader *)functions[i].data;
+    const ObjectReloc *relocs = (const ObjectReloc *)(h + 1);
+    const char *names = (const char *)(relocs + h->reloc_count) + h->code_len;
+    for (uint32_t j = 0; j < h->reloc_count && ok; ++j) {
+      Str name = { names, relocs[j].name_len };
+      names += name.len;
+      SymId sym = Interner_find(in, name.ptr, name.len);
+      assert(sym);
+      uintptr_t target;
+      if (jit->offsets[sym]) {
+        target = (uintptr_t)jit->code + jit->offsets[sym] - 1;
+      } else {
+        char *cname = strndup(name.ptr, name.len);
+        assert(cname);
+        void *address = dlsym(RTLD_DEFAULT, cname);
+        free(cname);
+        if (!address) {
+          fprintf(stderr, "undefined symbol '%.*s'\n", name.len, name.ptr);
+          ok = false;
+          break;
+        }
+        target = (uintptr_t)address;
+        if (relocs[j].type == R_X86_64_PLT32) {
+          if (!stub_offsets[sym]) {
+            Jit_stub(jit->code + stubs, address);
+            stub_offsets[sym] = stubs + 1;
+            stubs += JIT_STUB;
+          }
+          target = (uintptr_t)jit->code + stub_offsets[sym] - 1;
+        }
+      }
+      uintptr_t place = (uintptr_t)jit->code + offset + relocs[j].offset;
+      int64_t value = (int64_t)(target - place) + relocs[j].addend;
+      if (value != (int32_t)value) {
+        fprintf(stderr, "symbol '%.*s' is out of reach\n", name.len, name.ptr);
+        ok = false;
+        break;
+      }
+      int32_t rel = value;
+      memcpy((void *)place, &rel, sizeof(rel));
+    }
+    offset += h->code_len;
+  }
+  free(stub_offsets);
+  int err = mprotect(jit->code, jit->data, PROT_READ | PROT_EXEC);
+  assert(!err);
+  return ok;
+}
+
+void *Jit_find(const Jit *jit, const char *name) {
+  SymId sym = Interner_find(jit->interner, name, strlen(name));
+  if (!sym || !jit->offsets[sym]) return 0;
+  return jit->code + jit->offsets[sym] - 1;
+}
+
+// note: A line for every function, the start and the size
+// in hex, without the 0x, and then the name
+void Jit_perf_map(const Jit *jit) {
+  char path[64];
+  snprintf(path, sizeof(path), "/tmp/perf-%d.map", (int)getpid());
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) return; // it's only for the profiling
+  Writer out;
+  Writer_file(&out, fd);
+  uint64_t offset = 0;
+  for (uint32_t i = 0; i < jit->count; ++i) {
+    const ObjectHeader *h = (const ObjectHeader *)jit->functions[i].data;
+    Writer_hex(&out, (uintptr_t)jit->code + offset);
+    Writer_char(&out, ' ');
+    Writer_hex(&out, h->code_len);
+    Writer_char(&out, ' ');
+    Writer_str(&out, jit->functions[i].name);
+    Writer_char(&out, '\n');
+    offset += h->code_len;
+  }
+  Writer_close(&out);
+  close(fd);
+}
+
+void Jit_free(Jit *jit) {
+  int err = munmap(jit->code, jit->size);
+  assert(!err);
+  free(jit->offsets);
+  *jit = (Jit){0};
+}
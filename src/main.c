@@ -1,56 +1,53 @@
+#define _DEFAULT_SOURCE
 #include <assert.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
 #include <stdlib.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <unistd.h>
 
+#include "arena.h"
 #include "ast.h"
 #include "common.h"
+#include "driver.h"
 #include "inst.h"
+#include "arena.c"
+#include "intern.c"
+#include "symtab.c"
+#include "scan.c"
 #include "tokenizer.c"
+#include "preprocessor.c"
+#include "ast.c"
 #include "tokens.h"
 #include "parser/parser.c"
 #include "parser/expression.c"
 #include "parser/statement.c"
 #include "parser/declaration.c"
+#include "parser/unit.c"
+#include "pch.c"
 #include "codegen.c"
-// #include "assembly.c"
+#include "ir.c"
+#include "regalloc.c"
+#include "writer.c"
+#include "x86.c"
+#include "assembly.c"
+#include "peephole.c"
+#include "object.c"
+#include "jit.c"
+#include "queue.c"
+#include "cache.c"
+#include "backend.c"
+#include "driver.c"
+#include "server.c"
 
 int main(int argc, const char *argv[]) {
-  assert(argc == 2);
-  const char *filename = argv[1];
-  printf("Reading file '%s'\n", filename);
-
-  int fd = open(filename, O_RDONLY);
-  assert(fd >= 0);
-
-  struct stat st;
-  assert(fstat(fd, &st) >= 0);
-
-  char *file = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
-  assert(file != MAP_FAILED);
-
-  printf("\nTokenizing:\n");
-  Token *tokens = malloc(sizeof(*tokens) * MAX_TOKENS);
-  tokenize(file, tokens);
-  print_tokens(tokens);
-
-  printf("\nParsing:\n");
-  Parser p;
-  AstNode *ast = malloc(sizeof(*ast) * MAX_AST_SIZE);
-  uint16_t index = parse(file, tokens, ast, &p);
-  print_ast(&p, index, 0);
-
-  // printf("\nCodegen:\n");
-  // Inst *insts = malloc(sizeof(*insts) * MAX_INSTRUCTIONS);
-  // codegen(ast, index, insts);
-  // print_insts(insts);
-
-  // printf("\nGenerating assembly:\n");
-  // generate_assembly(insts);
-
-  return 0;
+  if (argc == 3 && !strcmp(argv[1], "--server")) return Server_run(argv[2]);
+  // the path takes the place of the program name
+  if (argc > 2 && !strcmp(argv[1], "--connect")) return Client_run(argv[2], argc - 2, argv + 2);
+  return Driver_main(argc, argv, 0, 0);
 }
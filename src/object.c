@@ -0,0 +1,250 @@
+#include "object.h"
+#include "common.h"
+#include "intern.h"
+#include "writer.h"
+#include "x86.h"
+#include <assert.h>
+#include <elf.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+void Object_pack(const X86Machine *m, const Interner *in, char **data, size_t *len) {
+  size_t size = sizeof(ObjectHeader) + sizeof(ObjectReloc) * m->reloc_count + m->len;
+  for (uint32_t i = 0; i < m->reloc_count; ++i) size += Interner_str(in, m->relocs[i].sym).len;
+  char *out = malloc(size);
+  assert(out);
+  *(ObjectHeader *)out = (ObjectHeader){ m->len, m->reloc_count };
+  ObjectReloc *relocs = (ObjectReloc *)(out + sizeof(ObjectHeader));
+  char *code = (char *)(relocs + m->reloc_count);
+  memcpy(code, m->bytes, m->len);
+  char *names = code + m->len;
+  for (uint32_t i = 0; i < m->reloc_count; ++i) {
+    const X86Reloc *r = &m->relocs[i];
+    Str name = Interner_str(in, r->sym);
+    relocs[i] = (ObjectReloc){ r->offset, r->type, r->addend, name.len };
+    memcpy(names, name.ptr, name.len);
+    names += name.len;
+  }
+  *data = out;
+  *len = size;
+}
+
+enum {
+  SECTION_NULL,
+  SECTION_TEXT,
+  SECTION_DATA,
+  SECTION_BSS,
+  SECTION_RELA,
+  SECTION_SYMTAB,
+  SECTION_STRTAB,
+  SECTION_SHSTRTAB,
+  SECTION_NOTE,
+
+  SECTION_COUNT,
+};
+
+// The names in the shstrtab
+static const char SECTION_NAMES[] =
+  "\0.text\0.data\0.bss\0.rela.text\0.symtab\0.strtab\0.shstrtab\0.note.GNU-stack";
+static const uint32_t SECTION_NAME[SECTION_COUNT] = { 0, 1, 7, 13, 18, 29, 37, 45, 55 };
+
+typedef struct {
+  Elf64_Sym *symbols;
+  uint32_t symbol_count;
+  char *strings;
+  uint32_t strings_len;
+  // the symbol of every name of the interner, that has one
+  uint32_t *index;
+} ObjectSymbols;
+
+static uint32_t ObjectSymbols_add(ObjectSymbols *s, SymId sym, Str name, Elf64_Sym symbol) {
+  if (s->index[sym]) return s->index[sym];
+  symbol.st_name = s->strings_len;
+  memcpy(s->strings + s->strings_len, name.ptr, name.len);
+  s->strings_len += name.len;
+  s->strings[s->strings_len++] = 0;
+  s->symbols[s->symbol_count] = symbol;
+  return s->index[sym] = s->symbol_count++;
+}
+
+static void ObjectSymbols_global(ObjectSymbols *s, const Interner *in, const ObjectGlobal *g,
+    uint64_t offset) {
+  ObjectSymbols_add(s, Interner_find(in, g->name.ptr, g->name.len), g->name, (Elf64_Sym){
+    .st_info = ELF64_ST_INFO(g->local ? STB_LOCAL : STB_GLOBAL, STT_OBJECT),
+    .st_shndx = g->value ? SECTION_DATA : SECTION_BSS,
+    .st_value = offset,
+    .st_size = g->size,
+  });
+}
+
+// note: The sections go right after the header, in their order, and
+// their headers at the end, so the offsets are known up front. The
+// symbols of the functions and the globals come first, so the undefined
+// ones can't take their names, the static ones before all of them.
+void Object_write(Writer *out, const Interner *in, const ObjectFunction *functions,
+    uint32_t count, const ObjectGlobal *globals, uint32_t global_count) {
+  uint64_t text_len = 0, reloc_count = 0, names_len = 0;
+  for (uint32_t i = 0; i < count; ++i) {
+    const ObjectHeader *h = (const ObjectHeader *)functions[i].data;
+    text_len += h->code_len;
+    reloc_count += h->reloc_count;
+    names_len += functions[i].len + functions[i].name.len + 1;
+  }
+  // the offsets in their sections, aligned to their size
+  uint64_t data_len = 0, bss_len = 0;
+  uint64_t *global_offsets = malloc(sizeof(uint64_t) * (global_count + 1));
+  assert(global_offsets);
+  for (uint32_t i = 0; i < global_count; ++i) {
+    uint64_t *len = globals[i].value ? &data_len : &bss_len;
+    *len = (*len + globals[i].size - 1) & ~(uint64_t)(globals[i].size - 1);
+    global_offsets[i] = *len;
+    *len += globals[i].size;
+    names_len += globals[i].name.len + 1;
+  }
+  ObjectSymbols s = {
+    .symbols = calloc(2 + count + global_count + reloc_count, sizeof(Elf64_Sym)),
+    .strings = malloc(names_len + 1),
+    .index = calloc(in->count, sizeof(uint32_t)),
+  };
+  Elf64_Rela *relas = malloc(sizeof(Elf64_Rela) * (reloc_count + 1));
+  assert(s.symbols && s.strings && s.index && relas);
+  s.strings[s.strings_len++] = 0;
+  s.symbol_count = 1;
+  s.symbols[s.symbol_count++] = (Elf64_Sym){
+    .st_info = ELF64_ST_INFO(STB_LOCAL, STT_SECTION),
+    .st_shndx = SECTION_TEXT,
+  };
+  for (uint32_t i = 0; i < global_count; ++i) {
+    if (globals[i].local) ObjectSymbols_global(&s, in, &globals[i], global_offsets[i]);
+  }
+  uint32_t first_global = s.symbol_count;
+
+  uint64_t offset = 0;
+  for (uint32_t i = 0; i < count; ++i) {
+    const ObjectHeader *h = (const ObjectHeader *)functions[i].data;
+    Str name = functions[i].name;
+    ObjectSymbols_add(&s, Interner_find(in, name.ptr, name.len), name, (Elf64_Sym){
+      .st_info = ELF64_ST_INFO(STB_GLOBAL, STT_FUNC),
+      .st_shndx = SECTION_TEXT,
+      .st_value = offset,
+      .st_size = h->code_len,
+    });
+    offset += h->code_len;
+  }
+  for (uint32_t i = 0; i < global_count; ++i) {
+    if (!globals[i].local) ObjectSymbols_global(&s, in, &globals[i], global_offsets[i]);
+  }
+  offset = 0;
+  uint32_t rela_count = 0;
+  for (uint32_t i = 0; i < count; ++i) {
+    const ObjectHeader *h = (const ObjectHeader *)functions[i].data;
+    const ObjectReloc *relocs = (const ObjectReloc *)(h + 1);
+    const char *names = (const char *)(relocs + h->reloc_count) + h->code_len;
+    for (uint32_t j = 0; j < h->reloc_count; ++j) {
+      Str name = { names, relocs[j].name_len };
+      names += name.len;
+      SymId sym = Interner_find(in, name.ptr, name.len);
+      assert(sym);
+      uint32_t index = ObjectSymbols_add(&s, sym, name, (Elf64_Sym){
+        .st_info = ELF64_ST_INFO(STB_GLOBAL, STT_NOTYPE),
+        .st_shndx = SHN_UNDEF,
+      });
+      relas[rela_count++] = (Elf64_Rela){
+        .r_offset = offset + relocs[j].offset,
+        .r_info = ELF64_R_INFO(index, relocs[j].type),
+        .r_addend = relocs[j].addend,
+      };
+    }
+    offset += h->code_len;
+  }
+
+  Elf64_Shdr sections[SECTION_COUNT] = {
+    [SECTION_TEXT] = {
+      .sh_type = SHT_PROGBITS,
+      .sh_flags = SHF_ALLOC | SHF_EXECINSTR,
+      .sh_offset = (sizeof(Elf64_Ehdr) + 15) & ~(uint64_t)15,
+      .sh_size = text_len,
+      .sh_addralign = 16,
+    },
+    [SECTION_DATA] = {
+      .sh_type = SHT_PROGBITS,
+      .sh_flags = SHF_ALLOC | SHF_WRITE,
+      .sh_size = data_len,
+      .sh_addralign = 8,
+    },
+    // only its size, it takes no place in the file
+    [SECTION_BSS] = {
+      .sh_type = SHT_NOBITS,
+      .sh_flags = SHF_ALLOC | SHF_WRITE,
+      .sh_size = bss_len,
+      .sh_addralign = 8,
+    },
+    [SECTION_RELA] = {
+      .sh_type = SHT_RELA,
+      .sh_flags = SHF_INFO_LINK,
+      .sh_size = sizeof(Elf64_Rela) * rela_count,
+      .sh_link = SECTION_SYMTAB,
+      .sh_info = SECTION_TEXT,
+      .sh_addralign = 8,
+      .sh_entsize = sizeof(Elf64_Rela),
+    },
+    [SECTION_SYMTAB] = {
+      .sh_type = SHT_SYMTAB,
+      .sh_size = sizeof(Elf64_Sym) * s.symbol_count,
+      .sh_link = SECTION_STRTAB,
+      .sh_info = first_global,
+      .sh_addralign = 8,
+      .sh_entsize = sizeof(Elf64_Sym),
+    },
+    [SECTION_STRTAB] = { .sh_type = SHT_STRTAB, .sh_size = s.strings_len, .sh_addralign = 1 },
+    [SECTION_SHSTRTAB] = { .sh_type = SHT_STRTAB, .sh_size = sizeof(SECTION_NAMES), .sh_addralign = 1 },
+    // not an executable stack
+    [SECTION_NOTE] = { .sh_type = SHT_PROGBITS, .sh_addralign = 1 },
+  };
+  offset = sections[SECTION_TEXT].sh_offset;
+  for (uint32_t i = 1; i < SECTION_COUNT; ++i) {
+    uint64_t align = sections[i].sh_addralign;
+    sections[i].sh_name = SECTION_NAME[i];
+    sections[i].sh_offset = (offset + align - 1) / align * align;
+    offset = sections[i].sh_offset;
+    if (sections[i].sh_type != SHT_NOBITS) offset += sections[i].sh_size;
+  }
+  Elf64_Ehdr header = {
+    .e_ident = { ELFMAG0, ELFMAG1, ELFMAG2, ELFMAG3, ELFCLASS64, ELFDATA2LSB, EV_CURRENT },
+    .e_type = ET_REL,
+    .e_machine = EM_X86_64,
+    .e_version = EV_CURRENT,
+    .e_shoff = (offset + 7) & ~(uint64_t)7,
+    .e_ehsize = sizeof(Elf64_Ehdr),
+    .e_shentsize = sizeof(Elf64_Shdr),
+    .e_shnum = SECTION_COUNT,
+    .e_shstrndx = SECTION_SHSTRTAB,
+  };
+
+  char *file = Writer_map(out, header.e_shoff + sizeof(sections));
+  memset(file, 0, header.e_shoff);
+  memcpy(file, &header, sizeof(header));
+  char *text = file + sections[SECTION_TEXT].sh_offset;
+  for (uint32_t i = 0; i < count; ++i) {
+    const ObjectHeader *h = (const ObjectHeader *)functions[i].data;
+    memcpy(text, (const ObjectReloc *)(h + 1) + h->reloc_count, h->code_len);
+    text += h->code_len;
+  }
+  char *data = file + sections[SECTION_DATA].sh_offset;
+  for (uint32_t i = 0; i < global_count; ++i) {
+    // note: Little endian, like the target
+    if (globals[i].value) memcpy(data + global_offsets[i], &globals[i].value, globals[i].size);
+  }
+  memcpy(file + sections[SECTION_RELA].sh_offset, relas, sections[SECTION_RELA].sh_size);
+  memcpy(file + sections[SECTION_SYMTAB].sh_offset, s.symbols, sections[SECTION_SYMTAB].sh_size);
+  memcpy(file + sections[SECTION_STRTAB].sh_offset, s.strings, s.strings_len);
+  memcpy(file + sections[SECTION_SHSTRTAB].sh_offset, SECTION_NAMES, sizeof(SECTION_NAMES));
+  memcpy(file + header.e_shoff, sections, sizeof(sections));
+
+  free(s.symbols);
+  free(s.strings);
+  free(s.index);
+  free(relas);
+  free(global_offsets);
+}
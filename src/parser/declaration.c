@@ -27,37 +27,42 @@ typedef struct {
 } DeclSpecifier;
 
 DeclSpecifier Parser_parse_declaration_specifier(Parser *p);
+AstId Parser_parse_declarators(Parser *p, DeclSpecifier spec, Token tok);
 
 void Parser_parse_struct_fileds(Parser *p, uint16_t struct_index) {
   assert(struct_index != STRUCT_NOT_FOUND);
   uint16_t start = p->field_bufer_size;
   uint16_t len = 0;
-  while (p->tokens[p->pos].type != TOK_RBRACE) {
+  while (Parser_peek(p, 0).type != TOK_RBRACE) {
     DeclSpecifier spec = Parser_parse_declaration_specifier(p);
     // Disallowed in struct fields
     assert(spec.storage == STORAGE_NONE);
     assert(spec.flags ^ FLAG_INLINE);
     do {
-      Token ident = p->tokens[p->pos++];
+      Token ident = Parser_advance(p);
       assert(ident.type == TOK_IDENT);
-      assert(p->field_bufer_size < FIELD_BUFFER_SIZE);
-      uint16_t index = p->field_bufer_size++;
-      p->field_buffer[index] = (Field){
-        .start = ident.start,
-        .len = ident.len,
+      assert(p->field_bufer_size < UINT16_MAX);
+      p->field_bufer_size++;
+      *ARENA_PUSH(&p->arenas[ARENA_FIELD_BUFFER], Field, 1) = (Field){
+        .name = ident.sym,
         .type = spec.type,
         .struct_index = spec.struct_index,
         .flags = spec.flags,
       };
       len++;
-    } while (p->tokens[p->pos++].type == TOK_COMMA);
-    assert(p->tokens[p->pos - 1].type == TOK_SEMICOLON);
+    } while (Parser_accept(p, TOK_COMMA));
+    assert(Parser_advance(p).type == TOK_SEMICOLON);
   }
   p->pos++;
-  assert(p->fields_size + len < MAX_FIELDS);
-  memcpy(&p->fields[p->fields_size], &p->field_buffer[start], len * sizeof(Field));
-  p->structs[struct_index].fields_start = p->fields_size += len;
-  p->structs[struct_index].fields_len = len;
+  assert(p->fields_size + len < UINT16_MAX);
+  Field *fields = ARENA_PUSH(&p->arenas[ARENA_FIELDS], Field, len);
+  memcpy(fields, &p->field_buffer[start], len * sizeof(Field));
+  Parser_struct(p, struct_index)->fields_start = p->fields_size;
+  Parser_struct(p, struct_index)->fields_len = len;
+  p->fields_size += len;
+  // Release the fields of this struct from the buffer
+  p->field_bufer_size = start;
+  p->arenas[ARENA_FIELD_BUFFER].size = start * sizeof(Field);
 }
 
 
@@ -75,18 +80,18 @@ DeclSpecifier Parser_parse_declaration_specifier(Parser *p) {
     // TODO: I'm kinda dissatisfied with how this whole
     // function works, but I'm just gonna leave it
     // at least it takes less space than before
-    tok = p->tokens[p->pos];
+    tok = Parser_peek(p, 0);
     if (tok.type == TOK_IDENT) {
-      TokenType next = p->tokens[p->pos + 1].type;
-      if (next < DECL_SPEC_START && next != TOK_IDENT) break;
+      // With a type already, it's the declarator
+      if (dt != DATA_NONE || size || sign) break;
+      uint16_t td = Parser_resolve_typedef(p, tok.sym);
+      if (!td) break;
       p->pos++;
-      assert(dt == DATA_NONE);
-      uint16_t td = Parser_resolve_typedef(p, tok.start, tok.len);
-      typedef_flags |= p->typedefs[td].flags;
-      dt = p->typedefs[td].type;
-      struct_index = p->typedefs[td].struct_index;
-      if (next == TOK_IDENT) break;
-      else continue;
+      const Typedef *typedef_ = Parser_typedef(p, td);
+      typedef_flags |= typedef_->flags;
+      dt = typedef_->type;
+      struct_index = typedef_->struct_index;
+      continue;
     }
     if (tok.type < DECL_SPEC_START) break;
     p->pos++;
@@ -108,7 +113,7 @@ DeclSpecifier Parser_parse_declaration_specifier(Parser *p) {
       assert(dt == DATA_NONE);
       dt = DATA_STRUCT + (tok.type - TOK_STRUCT);
       StructType st = tok.type - TOK_STRUCT;
-      Token ident = p->tokens[p->pos++];
+      Token ident = Parser_advance(p);
       // Create anonymous
       if (ident.type == TOK_LBRACE) {
         p->pos++;
@@ -116,32 +121,32 @@ DeclSpecifier Parser_parse_declaration_specifier(Parser *p) {
         Parser_parse_struct_fileds(p, struct_index);
         continue;
       }
-      assert(ident.type = TOK_IDENT);
-      struct_index = Parser_resolve_struct(p, ident.start, ident.len);
+      assert(ident.type == TOK_IDENT);
+      struct_index = Parser_resolve_struct(p, ident.sym);
       // Initialize uninitialized
-      if (p->tokens[p->pos].type == TOK_LBRACE) {
+      if (Parser_peek(p, 0).type == TOK_LBRACE) {
         p->pos++;
-        if (struct_index == STRUCT_NOT_FOUND) {
+        // note: A definition in a function body can't change
+        // the frozen file scope, so it declares a new one
+        if (struct_index == STRUCT_NOT_FOUND || struct_index < p->struct_base) {
           struct_index = Parser_push_struct(p, (Struct){
-            .start = ident.start,
-            .len = ident.len,
+            .name = ident.sym,
             .type = st,
           });
-        } else assert(p->structs[struct_index].type == st);
+        } else assert(Parser_struct(p, struct_index)->type == st);
         Parser_parse_struct_fileds(p, struct_index);
         continue;
       }
       // Create uninitialized
       if (struct_index == STRUCT_NOT_FOUND) {
         struct_index = Parser_push_struct(p, (Struct){
-          .start = ident.start,
-          .len = ident.len,
+          .name = ident.sym,
           .type = st | STRUCT_UNINIT,
         });
         continue;
       }
       // Check if it's adequate type, if initialized
-      assert((p->structs[struct_index].type & 3) == st);
+      assert((Parser_struct(p, struct_index)->type & 3) == st);
       continue;
     }
     switch (tok.type) {
@@ -198,41 +203,42 @@ DeclSpecifier Parser_parse_declaration_specifier(Parser *p) {
   };
 }
 
-uint16_t Parser_parse_declaration(Parser *p) {
-  Token tok = p->tokens[p->pos];
-  TokenType next = p->tokens[p->pos].type;
-  // not a specifier and not a symbol, or
-  // symbol, but next is not a symbol or specifier
+AstId Parser_parse_declaration(Parser *p) {
+  Token tok = Parser_peek(p, 0);
+  // not a specifier and not a typedef name
   bool cond = tok.type != TOK_IDENT && tok.type < DECL_SPEC_START;
-  cond = cond || (tok.type == TOK_IDENT && next < DECL_SPEC_START && next != TOK_IDENT);
+  cond = cond || (tok.type == TOK_IDENT && !Parser_resolve_typedef(p, tok.sym));
   if (cond) return Parser_parse_statement(p);
 
   DeclSpecifier spec = Parser_parse_declaration_specifier(p);
   if (spec.storage == STORAGE_NONE) spec.storage = STORAGE_AUTO;
+  return Parser_parse_declarators(p, spec, tok);
+}
 
+// Everything after the specifier, returns zero for typedefs
+// and declarations without declarators
+AstId Parser_parse_declarators(Parser *p, DeclSpecifier spec, Token tok) {
   if (spec.storage == STORAGE_TYPEDEF) {
     do {
-      Token ident = p->tokens[p->pos++];
+      Token ident = Parser_advance(p);
       assert(ident.type == TOK_IDENT);
-      Typedef td = { ident.start, ident.len, spec.struct_index, spec.type, spec.flags };
+      Typedef td = { ident.sym, spec.struct_index, spec.type, spec.flags };
       Parser_push_typedef(p, td);
-    } while (p->tokens[p->pos++].type == TOK_COMMA);
-    assert(p->tokens[p->pos - 1].type == TOK_SEMICOLON);
+    } while (Parser_accept(p, TOK_COMMA));
+    assert(Parser_advance(p).type == TOK_SEMICOLON);
     return 0;
-    // Parser_parse_declaration(p);
   }
 
-  uint16_t first = 0;
-  uint16_t last = 0;
+  AstId first = 0;
+  AstId last = 0;
   VarId var_start = 0;
   uint16_t var_count = 0;
   do {
-    Token ident = p->tokens[p->pos++];
+    Token ident = Parser_advance(p);
     if (!first && ident.type == TOK_SEMICOLON) return 0;
     assert(ident.type == TOK_IDENT);
-    Str name = (Str){ &p->source[ident.start], ident.len };
-    uint16_t value = 0;
-    if(p->tokens[p->pos].type == TOK_EQ) {
+    AstId value = 0;
+    if(Parser_peek(p, 0).type == TOK_EQ) {
       p->pos++;
       value = Parser_parse_assignment(p);
     } else {
@@ -241,14 +247,14 @@ uint16_t Parser_parse_declaration(Parser *p) {
       });
     }
     VarId var = Parser_push_var(p, (Var){
-      .name = name,
+      .name = ident.sym,
       .usage = 0,
       .storage = spec.storage,
       .type = spec.type,
       .flags = spec.flags,
     });
     if (first) {
-      p->ast_out[last].next_sibling = value;
+      Ast_set_sibling(&p->ast, last, value);
       last = value; 
     } else {
       first = value;
@@ -256,8 +262,8 @@ uint16_t Parser_parse_declaration(Parser *p) {
       var_start = var;
     }
     var_count++;
-  } while (p->tokens[p->pos++].type == TOK_COMMA);
-  assert(p->tokens[p->pos - 1].type == TOK_SEMICOLON);
+  } while (Parser_accept(p, TOK_COMMA));
+  assert(Parser_advance(p).type == TOK_SEMICOLON);
   return Parser_create_expr(p, (AstNode){
     .type = AST_DECL,
     .start = tok.start,
@@ -2,12 +2,12 @@
 #include "parser.h"
 #include "tokens.h"
 
-uint16_t Parser_parse_primary(Parser *p) {
-  uint16_t index;
-  Token tok = p->tokens[p->pos++];
+AstId Parser_parse_primary(Parser *p) {
+  AstId index;
+  Token tok = Parser_advance(p);
   switch (tok.type) {
     case TOK_IDENT:
-      VarId var = Parser_resolve_var(p, (Str){ &p->source[tok.start], tok.len });
+      VarId var = Parser_resolve_var(p, tok.sym);
       assert(var);
       return Parser_create_expr(p, (AstNode){
         .type = AST_VAR,
@@ -16,9 +16,10 @@ uint16_t Parser_parse_primary(Parser *p) {
       });
     case TOK_DECIMAL:
       int64_t number = 0;
+      const char *text = SourceMap_text(p->sources, tok.start);
       for (uint16_t i = 0; i < tok.len; ++i) {
         number *= 10;
-        number += p->source[tok.start + i] - '0';
+        number += text[i] - '0';
       }
       return Parser_create_expr(p, (AstNode){
         .type = AST_INT,
@@ -27,37 +28,41 @@ uint16_t Parser_parse_primary(Parser *p) {
       });
     case TOK_LPAREN:
       index = Parser_parse_expression(p);
-      assert(p->tokens[p->pos++].type == TOK_RPAREN);
+      assert(Parser_advance(p).type == TOK_RPAREN);
       return index;
     default:
       assert(0);
   }
 }
 
-uint16_t Parser_parse_postfix(Parser *p) {
+AstId Parser_parse_postfix(Parser *p) {
   Token ident;
-  uint16_t right;
-  uint16_t left =  Parser_parse_primary(p);
+  AstId right;
+  AstId left =  Parser_parse_primary(p);
   while (1) {
-    Token tok = p->tokens[p->pos];
+    Token tok = Parser_peek(p, 0);
     AstType op = tok2operation[tok.type];
     if (op < AST_INDEX) break;
     if (op < AST_DOT) {
       p->pos++;
-      right = Parser_parse_expression(p);
       TokenType tt = op == AST_INDEX ? TOK_RSQUARE : TOK_RPAREN;
-      assert(p->tokens[p->pos].type == tt);
-      p->ast_out[left].next_sibling = right;
+      // a call without arguments
+      if (op == AST_CALL && Parser_peek(p, 0).type == tt) right = 0;
+      else if (op == AST_CALL) right = Parser_parse_arguments(p);
+      else right = Parser_parse_expression(p);
+      assert(Parser_peek(p, 0).type == tt);
+      Ast_set_sibling(&p->ast, left, right);
     } else if (op < AST_POST_INC) {
-      ident = p->tokens[++p->pos];
+      p->pos++;
+      ident = Parser_peek(p, 0);
       // TODO: get rid of that ident wrapping, when you get to structs
       assert(ident.type == TOK_IDENT);
       right = Parser_create_ident(p, ident);
-      p->ast_out[left].next_sibling = right;
+      Ast_set_sibling(&p->ast, left, right);
     }
     left = Parser_create_expr(p, (AstNode){
       .type = op,
-      .start = p->ast_out[left].start,
+      .start = Ast_start(&p->ast, left),
       .value.first_child = left,
     });
     p->pos++;
@@ -65,8 +70,8 @@ uint16_t Parser_parse_postfix(Parser *p) {
   return left;
 }
 
-uint16_t Parser_parse_unary(Parser *p) {
-  Token tok = p->tokens[p->pos];
+AstId Parser_parse_unary(Parser *p) {
+  Token tok = Parser_peek(p, 0);
   AstType op = 0;
   // TODO: make another lookup table or something
   switch (tok.type) {
@@ -101,7 +106,7 @@ uint16_t Parser_parse_unary(Parser *p) {
       return Parser_parse_postfix(p);
   }
   p->pos++;
-  uint16_t arg =  Parser_parse_unary(p);
+  AstId arg =  Parser_parse_unary(p);
   return Parser_create_expr(p, (AstNode){
     .type = op,
     .start = tok.start,
@@ -109,28 +114,29 @@ uint16_t Parser_parse_unary(Parser *p) {
   });
 }
 
-uint16_t Parser_parse_binary(Parser *p, uint8_t precedence, uint16_t left) {
-  uint16_t right;
-  // uint16_t left_last_child = 0;
+AstId Parser_parse_binary(Parser *p, uint8_t precedence, AstId left) {
+  AstId right;
+  // AstId left_last_child = 0;
   while (1) {
-    Token tok = p->tokens[p->pos];
+    Token tok = Parser_peek(p, 0);
     if (tok.type > TOK_IDENT) break;
     AstType op = tok2operation[tok.type];
     if (!op) break;
     uint8_t new_precedence = op2precedence[op];
     if (new_precedence < precedence) break;
     p->pos++;
-    right = Parser_parse_binary(p, new_precedence, Parser_parse_unary(p));
+    // the ones of the same precedence are left to this loop, left to right
+    right = Parser_parse_binary(p, new_precedence + 1, Parser_parse_unary(p));
     // Fow now don't combine
-    // if (p->ast_out[left].type == op) {
-    //   p->ast_out[left_last_child].next_sibling = right;
+    // if (Ast_kind(&p->ast, left) == op) {
+    //   Ast_set_sibling(&p->ast, left_last_child, right);
     //   break;
     // }
     // left_last_child = right;
-    p->ast_out[left].next_sibling = right;
+    Ast_set_sibling(&p->ast, left, right);
     left =  Parser_create_expr(p, (AstNode){
       .type = op,
-      .start = p->ast_out[left].start,
+      .start = Ast_start(&p->ast, left),
       .value.first_child = left,
     });
   }
@@ -138,50 +144,63 @@ uint16_t Parser_parse_binary(Parser *p, uint8_t precedence, uint16_t left) {
 }
 
 // note: the ? and : work like parens
-uint16_t Parser_parse_conditional(Parser *p, uint16_t left) {
-  uint16_t cond = Parser_parse_binary(p, 0, left);
-  if (p->tokens[p->pos].type != TOK_QUESTION) return cond;
+AstId Parser_parse_conditional(Parser *p, AstId left) {
+  AstId cond = Parser_parse_binary(p, 0, left);
+  if (Parser_peek(p, 0).type != TOK_QUESTION) return cond;
   p->pos++;
-  uint16_t then = Parser_parse_expression(p);
-  assert(p->tokens[p->pos++].type == TOK_COLON);
-  uint16_t els = Parser_parse_conditional(p, Parser_parse_unary(p));
+  AstId then = Parser_parse_expression(p);
+  assert(Parser_advance(p).type == TOK_COLON);
+  AstId els = Parser_parse_conditional(p, Parser_parse_unary(p));
 
-  p->ast_out[cond].next_sibling = then;
-  p->ast_out[then].next_sibling = els;
+  Ast_set_sibling(&p->ast, cond, then);
+  Ast_set_sibling(&p->ast, then, els);
   return Parser_create_expr(p, (AstNode){
     .type = AST_CONDITIONAL,
     .value.first_child = cond,
-    .start = p->ast_out[cond].start,
+    .start = Ast_start(&p->ast, cond),
   });
 }
 
 // TODO: combine assignments of the same type
-uint16_t Parser_parse_assignment(Parser *p) {
-  uint16_t right;
-  uint16_t left = Parser_parse_unary(p);
-  Token tok = p->tokens[p->pos];
+AstId Parser_parse_assignment(Parser *p) {
+  AstId right;
+  AstId left = Parser_parse_unary(p);
+  Token tok = Parser_peek(p, 0);
   if (tok.type > TOK_IDENT) return Parser_parse_conditional(p, left);
   AstType op = tok2operation[tok.type];
   if (op < AST_ASS) return Parser_parse_conditional(p, left);
   p->pos++;
   right = Parser_parse_assignment(p);
-  p->ast_out[left].next_sibling = right;
+  Ast_set_sibling(&p->ast, left, right);
   return Parser_create_expr(p, (AstNode){
     .type = op,
     .value.first_child = left,
-    .start = p->ast_out[left].start,
+    .start = Ast_start(&p->ast, left),
   });
 }
 
-uint16_t Parser_parse_expression(Parser *p) {
-  uint16_t first = Parser_parse_assignment(p);
-  uint16_t last = first;
-  while (p->tokens[p->pos].type == TOK_COMMA) {
+// The assignments linked as siblings, like the arguments of a call
+AstId Parser_parse_arguments(Parser *p) {
+  AstId first = Parser_parse_assignment(p);
+  AstId last = first;
+  while (Parser_peek(p, 0).type == TOK_COMMA) {
     p->pos++;
-    uint16_t next = Parser_parse_assignment(p);
-    p->ast_out[last].next_sibling = next;
+    AstId next = Parser_parse_assignment(p);
+    Ast_set_sibling(&p->ast, last, next);
     last = next;
   }
   return first;
 }
 
+// note: The comma operator gets its own node, as the sibling of an
+// operand is taken by the other operand of its parent
+AstId Parser_parse_expression(Parser *p) {
+  AstId first = Parser_parse_arguments(p);
+  if (!Ast_sibling(&p->ast, first)) return first;
+  return Parser_create_expr(p, (AstNode){
+    .type = AST_COMMA,
+    .value.first_child = first,
+    .start = Ast_start(&p->ast, first),
+  });
+}
+
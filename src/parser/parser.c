@@ -2,190 +2,254 @@
 #include "common.h"
 #include "tokens.h"
 #include "parser.h"
+#include "arena.h"
+#include "symtab.h"
 #include <assert.h>
+#include <inttypes.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <string.h>
 
 uint16_t Parser_push_struct(Parser *p, Struct s) {
-  assert(p->structs_size < MAX_STRUCTS);
-  if (s.len != 0) {
-    for (int i = 1; i < p->structs_size; ++i) {
-      if (p->structs[i].len != s.len) continue;
-      assert(strncmp(&p->source[p->structs[i].start], &p->source[s.start], s.len));
-    }
-  }
+  assert(p->structs_size < STRUCT_NOT_FOUND - 1);
   uint16_t index = p->structs_size++;
-  p->structs[index] = s;
+  if (s.name) {
+    SymSlot *slot = SymTab_entry(&p->struct_index, s.name);
+    assert(!slot->value);
+    slot->value = index + 1;
+  }
+  *ARENA_PUSH(&p->arenas[ARENA_STRUCTS], Struct, 1) = s;
   return index;
 }
 
 // returns index or STRUCT_NOT_FOUND
-uint16_t Parser_resolve_struct(Parser *p, uint32_t start, uint16_t len) {
-  for (uint16_t i = 0; i < p->structs_size; ++i) {
-    if (len != p->structs[i].len) continue;
-    if (!strncmp(&p->source[p->structs[i].start], &p->source[start], len)) return i;
+uint16_t Parser_resolve_struct(Parser *p, SymId name) {
+  uint32_t index = SymTab_get(&p->struct_index, name);
+  if (!index && p->file) {
+    index = SymTab_peek(&p->file->struct_index, name);
+    if (index > p->visible.structs) index = 0;
   }
-  return STRUCT_NOT_FOUND;
+  return index ? index - 1 : STRUCT_NOT_FOUND;
 }
 
 uint16_t Parser_push_typedef(Parser *p, Typedef td) {
-  assert(p->typedefs_size < MAX_TYPEDEFS);
-  for (int i = 1; i < p->typedefs_size; ++i) {
-    if (p->typedefs[i].len != td.len) continue;
-    assert(strncmp(&p->source[p->typedefs[i].start], &p->source[td.start], td.len));
-  }
+  assert(p->typedefs_size < UINT16_MAX);
   uint16_t index = p->typedefs_size++;
-  p->typedefs[index] = td;
+  SymSlot *slot = SymTab_entry(&p->typedef_index, td.name);
+  assert(!slot->value);
+  slot->value = index;
+  *ARENA_PUSH(&p->arenas[ARENA_TYPEDEFS], Typedef, 1) = td;
   return index;
 }
 
-uint16_t Parser_resolve_typedef(Parser *p, uint32_t start, uint16_t len) {
-  for (uint16_t i = 0; i < p->typedefs_size; ++i) {
-    if (len != p->typedefs[i].len) continue;
-    if (!strncmp(&p->source[p->typedefs[i].start], &p->source[start], len)) return i;
+uint16_t Parser_resolve_typedef(Parser *p, SymId name) {
+  TypedefId index = SymTab_get(&p->typedef_index, name);
+  if (!index && p->file) {
+    index = SymTab_peek(&p->file->typedef_index, name);
+    if (index >= p->visible.typedefs) index = 0;
   }
-  return 0;
+  return index;
+}
+
+static LabelId Parser_label_entry(Parser *p, SymId name) {
+  SymSlot *slot = SymTab_entry(&p->label_index, name);
+  if (slot->value) return slot->value;
+  assert(p->labels_size < UINT32_MAX);
+  slot->value = p->labels_size++;
+  *ARENA_PUSH(&p->arenas[ARENA_LABELS], Label, 1) = (Label){ name, false };
+  return slot->value;
 }
 
 // note: lable scope is per function
-uint16_t Parser_push_label(Parser *p, Str name) {
-  assert(p->labels_size < MAX_LABELS);
-  for (int i = 1; i < p->labels_size; ++i) {
-    if (p->labels[i].len != name.len) continue;
-    assert(strncmp(p->labels[i].ptr, name.ptr, name.len));
-  }
-  uint16_t index = p->labels_size++;
-  p->labels[index] = name;
+LabelId Parser_push_label(Parser *p, SymId name) {
+  LabelId index = Parser_label_entry(p, name);
+  assert(!p->labels[index].defined);
+  p->labels[index].defined = true;
   return index;
 }
 
-// TODO: per funciton labels
-uint16_t Parser_resolve_label(Parser *p, Str name) {
-  for (uint16_t i = p->labels_size - 1; i > 0; --i) {
-    if (name.len != p->labels[i].len) continue;
-    if (!strncmp(p->labels[i].ptr, name.ptr, name.len)) return i;
+// note: The label might be defined later in the function
+LabelId Parser_resolve_label(Parser *p, SymId name) {
+  return Parser_label_entry(p, name);
+}
+
+void Parser_begin_function(Parser *p) {
+  SymTab_clear(&p->label_index);
+  p->function_labels_start = p->labels_size;
+}
+
+void Parser_end_function(Parser *p) {
+  // TODO: error for goto to an undefined label
+  for (LabelId i = p->function_labels_start; i < p->labels_size; ++i) {
+    assert(p->labels[i].defined);
   }
-  return 0;
 }
 
 VarId Parser_push_var(Parser *p, Var var) {
-  assert(p->var_size < MAX_VARIABLES);
-  uint16_t index = p->var_size++;
-  // Check for variables in the scope with the same name
-  Scope *scope = &p->scopes[p->scope];
-  for (int i = scope->start; i < scope->start + scope->len; ++i) {
-    if (p->vars[i].name.len != var.name.len) continue;
-    assert(strncmp(p->vars[i].name.ptr, var.name.ptr, var.name.len));
-  }
-  p->vars[index] = var;
-  scope->len++;
+  assert(p->var_size < UINT32_MAX);
+  VarId index = p->var_size++;
+  SymSlot *slot = SymTab_entry(&p->var_index, var.name);
+  // The innermost var with the same name can't be in the same scope
+  assert(!slot->value || Parser_var(p, slot->value)->scope != p->scope);
+  var.shadow = slot->value;
+  var.scope = p->scope;
+  slot->value = index;
+  *ARENA_PUSH(&p->arenas[ARENA_VARS], Var, 1) = var;
+  *ARENA_PUSH(&p->arenas[ARENA_BINDINGS], VarId, 1) = index;
   return index;
 }
 
-uint16_t Parser_resolve_var(Parser *p, Str name) {
-  for (int i = p->scope; i >= 0; --i) {
-    Scope scope = p->scopes[i];
-    for (int i = scope.start + scope.len; i >= scope.start; --i) {
-      if (name.len != p->vars[i].name.len) continue;
-      if (strncmp(p->vars[i].name.ptr, name.ptr, name.len)) continue;
-      p->vars[i].usage++;
-      return i;
-    }
+void Parser_error(Parser *p, uint32_t loc, const char *message) {
+  SourcePosition pos = SourceMap_position(p->sources, loc);
+  fprintf(stderr, "%.*s:%u:%u: error: %s\n", pos.file.len, pos.file.ptr, pos.line, pos.column, message);
+  p->errors++;
+}
+
+VarId Parser_resolve_var(Parser *p, SymId name) {
+  VarId var = SymTab_get(&p->var_index, name);
+  if (!var && p->file) {
+    var = SymTab_peek(&p->file->var_index, name);
+    if (var >= p->visible.vars) return 0;
+    // note: The only write into the file scope, as the
+    // function bodies can be parsed at the same time
+    if (var) __atomic_fetch_add(&p->file->vars[var].usage, 1, __ATOMIC_RELAXED);
+    return var;
   }
-  return 0;
+  if (var) Parser_var(p, var)->usage++;
+  return var;
 }
 
 void Parser_push_scope(Parser *p) {
-  assert(p->scope++ < MAX_SCOPES);
-  p->scopes[p->scope] = (Scope){ p->var_size, 0 };
+  assert(++p->scope < MAX_SCOPES);
+  p->scopes[p->scope] = (Scope){ ARENA_LEN(&p->arenas[ARENA_BINDINGS], VarId) };
 }
 
+// note: The vars themselves stay, the ast refers to them,
+// only their bindings are dropped
 void Parser_pop_scope(Parser *p) {
-  assert(p->scope--);
+  assert(p->scope);
+  Arena *bindings = &p->arenas[ARENA_BINDINGS];
+  const VarId *stack = (VarId *)bindings->base;
+  uint32_t start = p->scopes[p->scope].start;
+  for (uint32_t i = ARENA_LEN(bindings, VarId); i > start; --i) {
+    const Var *var = Parser_var(p, stack[i - 1]);
+    SymTab_entry(&p->var_index, var->name)->value = var->shadow;
+  }
+  bindings->size = start * sizeof(VarId);
+  p->scope--;
 }
 
-uint16_t Parser_create_expr(Parser *p, AstNode expr) {
-  assert(p->ast_size < MAX_AST_SIZE);
-  uint16_t index = p->ast_size++;
-  p->ast_out[index] = expr;
-  return index;
+AstId Parser_create_expr(Parser *p, AstNode expr) {
+  return Ast_push(&p->ast, expr);
 }
 
-uint16_t Parser_create_ident(Parser *p, Token source) {
+AstId Parser_create_ident(Parser *p, Token source) {
   return Parser_create_expr(p, (AstNode){
     .type = AST_IDENT,
     .start = source.start,
-    .value.len = source.len,
+    .value.sym = source.sym,
   });
 }
 
-uint16_t parse(const char *source, const Token *tokens, AstNode *ast_out, Parser *p) {
+// With file set, the parser is for a function body, it gets only
+// its own entries, that are numbered after the ones of the file
+void Parser_init(Parser *p, Interner *in, Preprocessor *pp,
+    Arena *arenas, const Parser *file) {
   *p = (Parser){ 
-    .source = source,
-    .tokens = tokens,
-    .ast_out = ast_out,
+    .interner = in,
+    .pp = pp,
+    .arenas = arenas,
+    .vars = (Var *)arenas[ARENA_VARS].base,
+    .labels = (Label *)arenas[ARENA_LABELS].base,
+    .typedefs = (Typedef *)arenas[ARENA_TYPEDEFS].base,
+    .structs = (Struct *)arenas[ARENA_STRUCTS].base,
+    .fields = (Field *)arenas[ARENA_FIELDS].base,
+    .field_buffer = (Field *)arenas[ARENA_FIELD_BUFFER].base,
     .var_size = 1, // 0 means not found or invalid
-    .ast_size = 1, // leave the first empty, to use zero for no children
     .labels_size = 1, // same as above
+    .typedefs_size = 1, // same as above
   };
+  p->scopes[0] = (Scope){ 0 };
+  SymTab_init(&p->var_index, &arenas[ARENA_SYMTAB]);
+  SymTab_init(&p->typedef_index, &arenas[ARENA_SYMTAB]);
+  SymTab_init(&p->struct_index, &arenas[ARENA_SYMTAB]);
+  SymTab_init(&p->label_index, &arenas[ARENA_SYMTAB]);
+  Ast_init(&p->ast, &arenas[ARENA_AST]);
+  *ARENA_PUSH(&arenas[ARENA_LABELS], Label, 1) = (Label){0};
+
+  if (!file) {
+    p->sources = &pp->sources;
+    *ARENA_PUSH(&arenas[ARENA_VARS], Var, 1) = (Var){0};
+    *ARENA_PUSH(&arenas[ARENA_TYPEDEFS], Typedef, 1) = (Typedef){0};
+    return;
+  }
+  p->file = file;
+  p->sources = file->sources;
+  p->var_base = p->var_size = file->var_size;
+  p->typedef_base = p->typedefs_size = file->typedefs_size;
+  p->struct_base = p->structs_size = file->structs_size;
+  p->field_base = p->fields_size = file->fields_size;
+}
 
-  assert(tokens[0].type == TOK_INT);
-  assert(tokens[1].type == TOK_IDENT);
-  assert(!strncmp(&source[tokens[1].start], "main", 4));
-  assert(tokens[2].type == TOK_LPAREN);
-  assert(tokens[3].type == TOK_VOID);
-  assert(tokens[4].type == TOK_RPAREN);
-  assert(tokens[5].type == TOK_LBRACE);
-  p->pos = 6;
-
-  return Parser_parse_block(p);
+// Parses from the '{' to the matching '}'
+AstId Parser_parse_function_body(Parser *p) {
+  assert(Parser_advance(p).type == TOK_LBRACE);
+  Parser_begin_function(p);
+  Parser_push_scope(p);
+  AstId body = Parser_parse_block(p);
+  Parser_pop_scope(p);
+  Parser_end_function(p);
+  return body;
 }
 
-void print_ast(Parser *p, uint16_t node, int indent_level) {
+void print_ast(FILE *out, Parser *p, AstId node, int indent_level) {
+  AstCursor c = Ast_cursor(&p->ast, node);
   Str name;
-  while (1) {
-    AstNode expr = p->ast_out[node];
-    for (int i = 0; i < indent_level * 2; ++i) putchar(' ');
-    printf("%s ", AST_TYPE_STR[expr.type]);
-    switch (expr.type) {
+  do {
+    AstType type = c.kind;
+    for (int i = 0; i < indent_level * 2; ++i) fputc(' ', out);
+    fprintf(out, "%s ", AST_TYPE_STR[type]);
+    switch (type) {
       case AST_INT:
-        printf("%ld\n", expr.value.i64);
+        fprintf(out, "%" PRId64 "\n", AstCursor_int(&c));
         break;
       case AST_DECL:
-        putchar(10);
+        fputc(10, out);
+        struct AstValueDecl decl = AstCursor_decl(&c);
         int i = 0;
-        for (; i < (int)(expr.value.decl.var_count); i++) {
-          for (int i = 0; i < (indent_level + 1) * 2; ++i) putchar(' ');
-          Var var = p->vars[expr.value.decl.var_start + i];
-          printf("%s ", STORAGE_TO_STR[var.storage]);
-          if (var.flags & FLAG_CONST) printf("const ");
-          if (var.flags & FLAG_RESTRICT) printf("restrict ");
-          if (var.flags & FLAG_VOLATILE) printf("volatile ");
-          printf("%s %.*s, usage=%d\n", DATA_TYPE_TO_STR[var.type],
-              var.name.len, var.name.ptr, var.usage);
+        for (; i < (int)(decl.var_count); i++) {
+          for (int i = 0; i < (indent_level + 1) * 2; ++i) fputc(' ', out);
+          Var var = *Parser_var(p, decl.var_start + i);
+          fprintf(out, "%s ", STORAGE_TO_STR[var.storage]);
+          if (var.flags & FLAG_CONST) fprintf(out, "const ");
+          if (var.flags & FLAG_RESTRICT) fprintf(out, "restrict ");
+          if (var.flags & FLAG_VOLATILE) fprintf(out, "volatile ");
+          name = Interner_str(p->interner, var.name);
+          fprintf(out, "%s %.*s, usage=%d\n", DATA_TYPE_TO_STR[var.type],
+              name.len, name.ptr, var.usage);
         }
-        if (!expr.value.first_child) break;
-        print_ast(p, expr.value.first_child, indent_level + 1);
+        if (!decl.first_child) break;
+        print_ast(out, p, decl.first_child, indent_level + 1);
         break;
       case AST_VAR:
-        name = p->vars[expr.value.var].name;
-        printf("%.*s\n", name.len, name.ptr);
+        name = Interner_str(p->interner, Parser_var(p, AstCursor_payload(&c))->name);
+        fprintf(out, "%.*s\n", name.len, name.ptr);
         break;
       case AST_IDENT:
-        printf("%.*s\n", expr.value.len, &p->source[expr.start]);
+        name = Interner_str(p->interner, AstCursor_payload(&c));
+        fprintf(out, "%.*s\n", name.len, name.ptr);
         break;
       case AST_GOTO:
       case AST_LABEL:
-        name = p->labels[expr.value.label];
-        printf("%.*s\n", name.len, name.ptr);
+        name = Interner_str(p->interner, p->labels[AstCursor_payload(&c)].name);
+        fprintf(out, "%.*s\n", name.len, name.ptr);
         break;
       default:
-        putchar(10);
-        if (!expr.value.first_child) break;
-        print_ast(p, expr.value.first_child, indent_level + 1);
+        fputc(10, out);
+        AstId child = AstCursor_child_id(&c);
+        if (!child) break;
+        print_ast(out, p, child, indent_level + 1);
         break;
     }
-    if (!expr.next_sibling) break;
-    node = expr.next_sibling;
-  }
+  } while (AstCursor_next(&c));
 }
@@ -1,14 +1,14 @@
 #include "ast.h"
 #include "parser.h"
 
-uint16_t Parser_parse_block(Parser *p) {
-  uint16_t first = 0, last = 0;
-  while(p->tokens[p->pos].type != TOK_RBRACE) {
-    assert(p->tokens[p->pos].type);
-    uint16_t elem = Parser_parse_declaration(p);
+AstId Parser_parse_block(Parser *p) {
+  AstId first = 0, last = 0;
+  while(Parser_peek(p, 0).type != TOK_RBRACE) {
+    assert(Parser_peek(p, 0).type);
+    AstId elem = Parser_parse_declaration(p);
     if (!elem) continue; // declaration migth not create any nodes
     if (!first) first = elem;
-    else p->ast_out[last].next_sibling = elem;
+    else Ast_set_sibling(&p->ast, last, elem);
     last = elem;
   }
   p->pos++;
@@ -16,15 +16,15 @@ uint16_t Parser_parse_block(Parser *p) {
 }
 
 // TODO: slim it down, make lookup table
-uint16_t Parser_parse_statement(Parser *p) {
-  uint16_t inner = 0;
-  uint16_t last = 0;
-  Token tok = p->tokens[p->pos];
+AstId Parser_parse_statement(Parser *p) {
+  AstId inner = 0;
+  AstId last = 0;
+  Token tok = Parser_peek(p, 0);
   switch (tok.type) {
     case TOK_IDENT:
-      if (p->tokens[p->pos + 1].type != TOK_COLON) break;
+      if (Parser_peek(p, 1).type != TOK_COLON) break;
       p->pos += 2;
-      uint16_t label = Parser_push_label(p, (Str){ &p->source[tok.start], tok.len });
+      LabelId label = Parser_push_label(p, tok.sym);
       return Parser_create_expr(p, (AstNode){
         .type = AST_LABEL,
         .start = tok.start,
@@ -35,8 +35,8 @@ uint16_t Parser_parse_statement(Parser *p) {
       // constant expressions
       // https://rgambord.github.io/c99-doc/sections/6/6/index.html
       inner = Parser_parse_conditional(p, Parser_parse_unary(p));
-      assert(p->tokens[p->pos++].type == TOK_COLON);
-      p->ast_out[inner].next_sibling = Parser_parse_statement(p);
+      assert(Parser_advance(p).type == TOK_COLON);
+      Ast_set_sibling(&p->ast, inner, Parser_parse_statement(p));
       return Parser_create_expr(p, (AstNode){
         .type = AST_CASE,
         .start = tok.start,
@@ -44,7 +44,7 @@ uint16_t Parser_parse_statement(Parser *p) {
       });
     case TOK_DEFAULT:
       p->pos++;
-      assert(p->tokens[p->pos++].type == TOK_COLON);
+      assert(Parser_advance(p).type == TOK_COLON);
       inner = Parser_parse_statement(p);
       return Parser_create_expr(p, (AstNode){
         .type = AST_DEFAULT,
@@ -70,14 +70,14 @@ uint16_t Parser_parse_statement(Parser *p) {
       });
     case TOK_IF:
       p->pos++;
-      assert(p->tokens[p->pos++].type == TOK_LPAREN);
+      assert(Parser_advance(p).type == TOK_LPAREN);
       inner = Parser_parse_expression(p);
-      assert(p->tokens[p->pos++].type == TOK_RPAREN);
+      assert(Parser_advance(p).type == TOK_RPAREN);
       last = Parser_parse_statement(p);
-      p->ast_out[inner].next_sibling = last;
-      if (p->tokens[p->pos].type == TOK_ELSE) {
+      Ast_set_sibling(&p->ast, inner, last);
+      if (Parser_peek(p, 0).type == TOK_ELSE) {
         p->pos++;
-        p->ast_out[last].next_sibling = Parser_parse_statement(p);
+        Ast_set_sibling(&p->ast, last, Parser_parse_statement(p));
       }
       return Parser_create_expr(p, (AstNode){
         .type = AST_IF,
@@ -86,11 +86,11 @@ uint16_t Parser_parse_statement(Parser *p) {
       });
     case TOK_SWITCH:
       p->pos++;
-      assert(p->tokens[p->pos++].type == TOK_LPAREN);
+      assert(Parser_advance(p).type == TOK_LPAREN);
       inner = Parser_parse_expression(p);
-      assert(p->tokens[p->pos++].type == TOK_RPAREN);
+      assert(Parser_advance(p).type == TOK_RPAREN);
       last = Parser_parse_statement(p);
-      p->ast_out[inner].next_sibling = last;
+      Ast_set_sibling(&p->ast, inner, last);
       return Parser_create_expr(p, (AstNode){
         .type = AST_SWITCH,
         .start = tok.start,
@@ -98,11 +98,11 @@ uint16_t Parser_parse_statement(Parser *p) {
       });
     case TOK_WHILE:
       p->pos++;
-      assert(p->tokens[p->pos++].type == TOK_LPAREN);
+      assert(Parser_advance(p).type == TOK_LPAREN);
       inner = Parser_parse_expression(p);
-      assert(p->tokens[p->pos++].type == TOK_RPAREN);
+      assert(Parser_advance(p).type == TOK_RPAREN);
       last = Parser_parse_statement(p);
-      p->ast_out[inner].next_sibling = last;
+      Ast_set_sibling(&p->ast, inner, last);
       return Parser_create_expr(p, (AstNode){
         .type = AST_WHILE,
         .start = tok.start,
@@ -111,12 +111,12 @@ uint16_t Parser_parse_statement(Parser *p) {
     case TOK_DO:
       p->pos++;
       inner = Parser_parse_statement(p);
-      assert(p->tokens[p->pos++].type == TOK_WHILE);
-      assert(p->tokens[p->pos++].type == TOK_LPAREN);
+      assert(Parser_advance(p).type == TOK_WHILE);
+      assert(Parser_advance(p).type == TOK_LPAREN);
       last = Parser_parse_expression(p);
-      assert(p->tokens[p->pos++].type == TOK_RPAREN);
-      assert(p->tokens[p->pos++].type == TOK_SEMICOLON);
-      p->ast_out[inner].next_sibling = last;
+      assert(Parser_advance(p).type == TOK_RPAREN);
+      assert(Parser_advance(p).type == TOK_SEMICOLON);
+      Ast_set_sibling(&p->ast, inner, last);
       return Parser_create_expr(p, (AstNode){
         .type = AST_DO_WHILE,
         .start = tok.start,
@@ -124,44 +124,44 @@ uint16_t Parser_parse_statement(Parser *p) {
       });
     case TOK_FOR:
       p->pos++;
-      assert(p->tokens[p->pos++].type == TOK_LPAREN);
-      if (p->tokens[p->pos].type == TOK_SEMICOLON) {
+      assert(Parser_advance(p).type == TOK_LPAREN);
+      if (Parser_peek(p, 0).type == TOK_SEMICOLON) {
         inner = Parser_create_expr(p, (AstNode){
           .type = AST_EMPTY,
-          .start = p->tokens[p->pos].start,
+          .start = Parser_peek(p, 0).start,
           .value.first_child = 0,
         });
         p->pos++;
       } else {
         inner = Parser_parse_expression(p);
-        assert(p->tokens[p->pos++].type == TOK_SEMICOLON);
+        assert(Parser_advance(p).type == TOK_SEMICOLON);
       }
-      if (p->tokens[p->pos].type == TOK_SEMICOLON) {
+      if (Parser_peek(p, 0).type == TOK_SEMICOLON) {
         last = Parser_create_expr(p, (AstNode){
           .type = AST_EMPTY,
-          .start = p->tokens[p->pos].start,
+          .start = Parser_peek(p, 0).start,
           .value.first_child = 0,
         });
         p->pos++;
       } else {
         last = Parser_parse_expression(p);
-        assert(p->tokens[p->pos++].type == TOK_SEMICOLON);
+        assert(Parser_advance(p).type == TOK_SEMICOLON);
       }
-      p->ast_out[inner].next_sibling = last;
-      uint16_t elem;
-      if (p->tokens[p->pos].type == TOK_RPAREN) {
+      Ast_set_sibling(&p->ast, inner, last);
+      AstId elem;
+      if (Parser_peek(p, 0).type == TOK_RPAREN) {
         elem = Parser_create_expr(p, (AstNode){
           .type = AST_EMPTY,
-          .start = p->tokens[p->pos].start,
+          .start = Parser_peek(p, 0).start,
           .value.first_child = 0,
         });
         p->pos++;
       } else {
         elem = Parser_parse_expression(p);
-        assert(p->tokens[p->pos++].type == TOK_RPAREN);
+        assert(Parser_advance(p).type == TOK_RPAREN);
       }
-      p->ast_out[last].next_sibling = elem;
-      p->ast_out[elem].next_sibling = Parser_parse_statement(p);
+      Ast_set_sibling(&p->ast, last, elem);
+      Ast_set_sibling(&p->ast, elem, Parser_parse_statement(p));
       return Parser_create_expr(p, (AstNode){
         .type = AST_FOR,
         .start = tok.start,
@@ -169,10 +169,10 @@ uint16_t Parser_parse_statement(Parser *p) {
       });
     case TOK_GOTO:
       p->pos++;
-      Token ident = p->tokens[p->pos++];
-      assert(ident.type = TOK_IDENT);
-      assert(p->tokens[p->pos++].type == TOK_SEMICOLON);
-      label = Parser_resolve_label(p, (Str){ &p->source[ident.start], ident.len });
+      Token ident = Parser_advance(p);
+      assert(ident.type == TOK_IDENT);
+      assert(Parser_advance(p).type == TOK_SEMICOLON);
+      label = Parser_resolve_label(p, ident.sym);
       assert(label);
       return Parser_create_expr(p, (AstNode){
         .type = AST_GOTO,
@@ -181,7 +181,7 @@ uint16_t Parser_parse_statement(Parser *p) {
       });
     case TOK_CONTINUE:
       p->pos++;
-      assert(p->tokens[p->pos++].type == TOK_SEMICOLON);
+      assert(Parser_advance(p).type == TOK_SEMICOLON);
       return Parser_create_expr(p, (AstNode){
         .type = AST_CONTINUE,
         .start = tok.start,
@@ -189,16 +189,17 @@ uint16_t Parser_parse_statement(Parser *p) {
       });
     case TOK_BREAK:
       p->pos++;
-      assert(p->tokens[p->pos++].type == TOK_SEMICOLON);
+      assert(Parser_advance(p).type == TOK_SEMICOLON);
       return Parser_create_expr(p, (AstNode){
         .type = AST_BREAK,
         .start = tok.start,
         .value.first_child = inner,
       });
     case TOK_RETURN:
-      if (p->tokens[++p->pos].type != TOK_SEMICOLON) {
+      p->pos++;
+      if (Parser_peek(p, 0).type != TOK_SEMICOLON) {
         inner = Parser_parse_expression(p);
-        assert(p->tokens[p->pos].type == TOK_SEMICOLON);
+        assert(Parser_peek(p, 0).type == TOK_SEMICOLON);
       }
       p->pos++;
       return Parser_create_expr(p, (AstNode){
@@ -209,8 +210,8 @@ uint16_t Parser_parse_statement(Parser *p) {
     default:
       break;
   }
-  uint16_t expr = Parser_parse_expression(p);
-  assert(p->tokens[p->pos++].type == TOK_SEMICOLON);
+  AstId expr = Parser_parse_expression(p);
+  assert(Parser_advance(p).type == TOK_SEMICOLON);
   return expr;
 }
 
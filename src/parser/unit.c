@@ -0,0 +1,309 @@
+#include "ast.h"
+#include "backend.h"
+#include "arena.h"
+#include "common.h"
+#include "parser.h"
+#include "symtab.h"
+#include "tokens.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// The recorded tokens of the bodies, that are parsed at once, for every
+// worker, so they don't have to be kept for the whole file
+#define UNIT_WINDOW (1 << 14)
+
+// note: The file is parsed in two passes. The first one parses
+// the file scope and skips the function bodies by matching the
+// braces, their preprocessed tokens are recorded on the way.
+// The bodies are then parsed on the workers, each one by its own
+// parser, that looks up the file scope, when it doesn't find a
+// name in its own tables. They are merged in the source order.
+// The passes take turns over windows of the file, once the bodies
+// of one are merged, their tokens are dropped and the first pass
+// continues, it's the only one changing the file scope then.
+typedef struct {
+  Parser *file;
+  // note: A copy of the file parser after the first pass, for the
+  // workers to look up, the sizes of the real one change with
+  // every merge, while the other workers are reading them
+  Parser scope;
+  Function *functions;
+  const Token *tokens;
+  Backend *backend;
+  AstId *items;
+  uint32_t function_count;
+  uint32_t next_function;
+  // the functions before this one are merged already
+  uint32_t merged;
+  // note: One for each worker, they're kept for the whole
+  // file and reset between the bodies, taken like the
+  // workspaces of the driver, again for every window
+  Arenas *workspaces;
+  uint32_t next_workspace;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+} Unit;
+
+// Returns whether the list is empty, or only the void. The parameters
+// aren't taken yet, a prototype can still have them, as the arguments
+// are promoted without one anyway.
+static bool Parser_skip_parameters(Parser *p) {
+  assert(Parser_advance(p).type == TOK_LPAREN);
+  bool empty = Parser_peek(p, 0).type == TOK_RPAREN
+    || (Parser_peek(p, 0).type == TOK_VOID && Parser_peek(p, 1).type == TOK_RPAREN);
+  for (uint32_t depth = 1; depth && Parser_peek(p, 0).type;) {
+    Token tok = Parser_advance(p);
+    if (tok.type == TOK_LPAREN) depth++;
+    else if (tok.type == TOK_RPAREN) depth--;
+  }
+  return empty;
+}
+
+// The tokens are recorded, when there's an arena for them. Returns
+// false at the end of the file, with the body still open.
+static bool Parser_skip_body(Parser *p, Arena *tokens) {
+  for (uint32_t depth = 1; depth;) {
+    Token tok = Parser_advance(p);
+    if (!tok.type) return false;
+    if (tok.type == TOK_LBRACE) depth++;
+    else if (tok.type == TOK_RBRACE) depth--;
+    if (tokens) *ARENA_PUSH(tokens, Token, 1) = tok;
+  }
+  return true;
+}
+
+// The prototypes and the definition share the var of the file scope
+static VarId Parser_declare_function(Parser *p, DeclSpecifier spec, Token name) {
+  VarId var = SymTab_get(&p->var_index, name.sym);
+  if (var && Parser_var(p, var)->scope == p->scope) return var;
+  return Parser_push_var(p, (Var){
+    .name = name.sym,
+    .storage = spec.storage,
+    .type = spec.type,
+    .flags = spec.flags,
+    .struct_index = spec.struct_index,
+  });
+}
+
+static void Parser_function(Parser *p, DeclSpecifier spec, Token tok) {
+  Token name = Parser_advance(p);
+  bool empty = Parser_skip_parameters(p);
+  Token brace = Parser_advance(p);
+  if (brace.type != TOK_LBRACE) {
+    // a prototype, it only declares the function
+    if (brace.type == TOK_SEMICOLON) {
+      Parser_declare_function(p, spec, name);
+      return;
+    }
+    Parser_error(p, brace.type ? brace.start : name.start, "expected ';' or '{' after the parameters");
+    while (brace.type && brace.type != TOK_SEMICOLON) brace = Parser_advance(p);
+    return;
+  }
+  VarId existing = SymTab_get(&p->var_index, name.sym);
+  bool defined = existing && Parser_var(p, existing)->scope == p->scope
+    && (Parser_var(p, existing)->flags & FLAG_DEFINED);
+  if (!empty || defined) {
+    Parser_error(p, name.start, defined ? "redefinition of the function"
+        : "function parameters aren't supported yet");
+    if (!Parser_skip_body(p, 0)) Parser_error(p, brace.start, "the body isn't closed");
+    return;
+  }
+  // note: The body can come from a macro or a header, so
+  // its tokens are kept for the worker, that parses it
+  Arena *tokens = &p->arenas[ARENA_TOKENS];
+  uint32_t tokens_start = ARENA_LEN(tokens, Token);
+  *ARENA_PUSH(tokens, Token, 1) = brace;
+  if (!Parser_skip_body(p, tokens)) {
+    Parser_error(p, brace.start, "the body isn't closed");
+    tokens->size = tokens_start * sizeof(Token);
+    return;
+  }
+  // the lookahead of the worker stops here
+  *ARENA_PUSH(tokens, Token, 1) = (Token){0};
+
+  // It's visible in its own body
+  VarId var = Parser_declare_function(p, spec, name);
+  Parser_var(p, var)->flags |= FLAG_DEFINED;
+  Arena *items = &p->arenas[ARENA_ITEMS];
+  *ARENA_PUSH(&p->arenas[ARENA_FUNCTIONS], Function, 1) = (Function){
+    .var = var,
+    .start = tok.start,
+    .name_start = name.start,
+    .body_start = brace.start,
+    .tokens = tokens_start,
+    .item = ARENA_LEN(items, AstId),
+    .visible = { p->var_size, p->typedefs_size, p->structs_size },
+  };
+  *ARENA_PUSH(items, AstId, 1) = 0;
+}
+
+bool Parser_parse_file_scope(Parser *p, uint32_t window) {
+  Arena *items = &p->arenas[ARENA_ITEMS];
+  Arena *tokens = &p->arenas[ARENA_TOKENS];
+  while (Parser_peek(p, 0).type) {
+    if (window && ARENA_LEN(tokens, Token) >= window) return true;
+    Token tok = Parser_peek(p, 0);
+    DeclSpecifier spec = Parser_parse_declaration_specifier(p);
+    bool defined = spec.storage == STORAGE_NONE || spec.storage == STORAGE_STATIC;
+    if (spec.storage == STORAGE_NONE) spec.storage = STORAGE_EXTERN;
+    if (Parser_peek(p, 0).type == TOK_IDENT && Parser_peek(p, 1).type == TOK_LPAREN) {
+      Parser_function(p, spec, tok);
+      continue;
+    }
+    if (defined) spec.flags |= FLAG_DEFINED;
+    AstId decl = Parser_parse_declarators(p, spec, tok);
+    if (decl) *ARENA_PUSH(items, AstId, 1) = decl;
+  }
+  return false;
+}
+
+// Appends the tables of the body to the file ones
+// and its ast with the local ids relocated
+static void Unit_merge(Unit *u, uint32_t index, Parser *w, AstId body) {
+  Parser *p = u->file;
+  Function *f = &u->functions[index];
+  VarId var_shift = p->var_size - w->var_base;
+  StructId struct_shift = p->structs_size - w->struct_base;
+  uint16_t field_shift = p->fields_size - w->field_base;
+  LabelId label_shift = p->labels_size - 1;
+
+  for (StructId i = w->struct_base; i < w->structs_size; ++i) {
+    Struct s = *Parser_struct(w, i);
+    s.fields_start += field_shift;
+    *ARENA_PUSH(&p->arenas[ARENA_STRUCTS], Struct, 1) = s;
+  }
+  assert(p->structs_size + (w->structs_size - w->struct_base) < STRUCT_NOT_FOUND);
+  p->structs_size += w->structs_size - w->struct_base;
+  for (uint16_t i = 0; i < w->fields_size - w->field_base; ++i) {
+    Field field = w->fields[i];
+    if (field.struct_index >= w->struct_base) field.struct_index += struct_shift;
+    *ARENA_PUSH(&p->arenas[ARENA_FIELDS], Field, 1) = field;
+  }
+  assert(p->fields_size + (w->fields_size - w->field_base) < UINT16_MAX);
+  p->fields_size += w->fields_size - w->field_base;
+  f->locals = p->var_size;
+  f->local_count = w->var_size - w->var_base;
+  f->labels = p->labels_size;
+  f->label_count = w->labels_size - 1;
+  for (VarId i = w->var_base; i < w->var_size; ++i) {
+    Var var = *Parser_var(w, i);
+    if (var.struct_index >= w->struct_base) var.struct_index += struct_shift;
+    if (var.shadow >= w->var_base) var.shadow += var_shift;
+    *ARENA_PUSH(&p->arenas[ARENA_VARS], Var, 1) = var;
+  }
+  p->var_size += w->var_size - w->var_base;
+  for (LabelId i = 1; i < w->labels_size; ++i) {
+    *ARENA_PUSH(&p->arenas[ARENA_LABELS], Label, 1) = w->labels[i];
+  }
+  p->labels_size += w->labels_size - 1;
+
+  AstId shift = Ast_append(&p->ast, &w->ast, (AstRelocation){
+    .var_base = w->var_base,
+    .var_shift = var_shift,
+    .label_shift = label_shift,
+  });
+
+  AstId name = Ast_push(&p->ast, (AstNode){
+    .type = AST_VAR,
+    .start = f->name_start,
+    .value.var = f->var,
+  });
+  f->body = Ast_push(&p->ast, (AstNode){
+    .type = AST_COMPOUND,
+    .start = f->body_start,
+    .value.first_child = body ? body + shift : 0,
+  });
+  Ast_set_sibling(&p->ast, name, f->body);
+  u->items[f->item] = Ast_push(&p->ast, (AstNode){
+    .type = AST_FUNCTION,
+    .start = f->start,
+    .value.first_child = name,
+  });
+}
+
+static void *Unit_worker(void *arg) {
+  Unit *u = arg;
+  uint32_t index = __atomic_fetch_add(&u->next_workspace, 1, __ATOMIC_RELAXED);
+  Arenas *arenas = &u->workspaces[index];
+  if (!arenas->base) Arenas_init(arenas);
+  while (1) {
+    uint32_t i = __atomic_fetch_add(&u->next_function, 1, __ATOMIC_RELAXED);
+    if (i >= u->function_count) break;
+    const Function *f = &u->functions[i];
+
+    Parser w;
+    Parser_init(&w, u->scope.interner, 0, arenas->arenas, &u->scope);
+    w.visible = f->visible;
+    w.replay = u->tokens + f->tokens;
+    AstId body = Parser_parse_function_body(&w);
+
+    pthread_mutex_lock(&u->lock);
+    while (u->merged != i) pthread_cond_wait(&u->cond, &u->lock);
+    pthread_mutex_unlock(&u->lock);
+
+    Unit_merge(u, i, &w, body);
+    Backend_submit(u->backend, i);
+
+    pthread_mutex_lock(&u->lock);
+    u->merged++;
+    pthread_cond_broadcast(&u->cond);
+    pthread_mutex_unlock(&u->lock);
+    Arenas_reset(arenas);
+  }
+  return 0;
+}
+
+// Returns the first of the file scope nodes
+AstId parse(Parser *p, uint32_t threads, Backend *backend) {
+  Arena *arenas = p->arenas;
+  if (!threads) threads = 1;
+  Unit u = {
+    .file = p,
+    .functions = (Function *)arenas[ARENA_FUNCTIONS].base,
+    .items = (AstId *)arenas[ARENA_ITEMS].base,
+    .tokens = (Token *)arenas[ARENA_TOKENS].base,
+    .backend = backend,
+    .workspaces = calloc(threads, sizeof(Arenas)),
+  };
+  assert(u.workspaces);
+  pthread_mutex_init(&u.lock, 0);
+  pthread_cond_init(&u.cond, 0);
+  Backend_start(backend, p);
+  bool more = true;
+  while (more) {
+    more = Parser_parse_file_scope(p, UNIT_WINDOW * threads);
+    Backend_extend(backend);
+    u.scope = *p;
+    u.function_count = ARENA_LEN(&arenas[ARENA_FUNCTIONS], Function);
+    uint32_t workers_count = MIN(threads, u.function_count - u.merged);
+    pthread_t workers[threads];
+    u.next_workspace = 0;
+    for (uint32_t i = 1; i < workers_count; ++i) {
+      int err = pthread_create(&workers[i], 0, Unit_worker, &u);
+      assert(!err);
+    }
+    // the calling thread is the first worker
+    Unit_worker(&u);
+    for (uint32_t i = 1; i < workers_count; ++i) {
+      int err = pthread_join(workers[i], 0);
+      assert(!err);
+    }
+    // every worker took one past the last function
+    u.next_function = u.merged;
+    Arena_reset(&arenas[ARENA_TOKENS]);
+  }
+  pthread_mutex_destroy(&u.lock);
+  pthread_cond_destroy(&u.cond);
+  for (uint32_t i = 0; i < threads; ++i) {
+    if (u.workspaces[i].base) Arenas_free(&u.workspaces[i]);
+  }
+  free(u.workspaces);
+
+  uint32_t item_count = ARENA_LEN(&arenas[ARENA_ITEMS], AstId);
+  for (uint32_t i = 1; i < item_count; ++i) {
+    Ast_set_sibling(&p->ast, u.items[i - 1], u.items[i]);
+  }
+  return item_count ? u.items[0] : 0;
+}
@@ -0,0 +1,359 @@
+#include "pch.h"
+#include "arena.h"
+#include "common.h"
+#include "driver.h"
+#include "intern.h"
+#include "parser.h"
+#include "preprocessor.h"
+#include "symtab.h"
+#include <assert.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// The main file, while the header is precompiled
+const char PCH_MAIN[] = "";
+
+// The arena of every mapped section, the interner ones are separate
+const ArenaType PCH_ARENAS[PCH_SECTION_COUNT] = {
+  [PCH_AST] = ARENA_AST,
+  [PCH_VARS] = ARENA_VARS,
+  [PCH_BINDINGS] = ARENA_BINDINGS,
+  [PCH_FIELDS] = ARENA_FIELDS,
+  [PCH_STRUCTS] = ARENA_STRUCTS,
+  [PCH_TYPEDEFS] = ARENA_TYPEDEFS,
+  [PCH_FUNCTIONS] = ARENA_FUNCTIONS,
+  [PCH_ITEMS] = ARENA_ITEMS,
+  [PCH_TOKENS] = ARENA_TOKENS,
+  [PCH_MACROS] = ARENA_MACROS,
+  [PCH_MACRO_TOKENS] = ARENA_MACRO_TOKENS,
+  [PCH_MACRO_INDEX] = ARENA_MACRO_INDEX,
+  [PCH_SYMTAB] = ARENA_SYMTAB,
+};
+
+// FNV-1a
+static uint64_t pch_hash(const char *data, size_t size) {
+  uint64_t hash = 14695981039346656037u;
+  for (size_t i = 0; i < size; ++i) {
+    hash ^= (uint8_t)data[i];
+    hash *= 1099511628211u;
+  }
+  return hash;
+}
+
+// note: Not a real hash, just enough to catch a change of the records
+static uint32_t pch_layout(void) {
+  const size_t sizes[] = {
+    sizeof(PchHeader), sizeof(PchFile), sizeof(Symbol), sizeof(InternSlot),
+    sizeof(SymSlot), sizeof(Token), sizeof(Var), sizeof(Typedef),
+    sizeof(Struct), sizeof(Field), sizeof(Function), sizeof(Macro),
+  };
+  uint32_t layout = 0;
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+    layout = layout * 31 + sizes[i];
+  }
+  return layout;
+}
+
+static PchSymTab PchSymTab_from(const SymTab *t) {
+  return (PchSymTab){
+    .slots = (uint8_t *)t->slots - t->arena->base,
+    .bits = t->bits,
+    .count = t->count,
+  };
+}
+
+static SymTab PchSymTab_to(PchSymTab t, Arena *arena) {
+  return (SymTab){
+    .slots = (SymSlot *)(arena->base + t.slots),
+    .arena = arena,
+    .bits = t.bits,
+    .count = t.count,
+  };
+}
+
+static void pch_write_all(int fd, const void *data, size_t size, size_t offset) {
+  while (size) {
+    ssize_t written = pwrite(fd, data, size, offset);
+    assert(written > 0); // TODO: error for a failed write
+    data = (const uint8_t *)data + written;
+    size -= written;
+    offset += written;
+  }
+}
+
+static void Pch_write(const char *path, const Interner *in,
+    const Preprocessor *pp, const Parser *p) {
+  Arena *arenas = p->arenas;
+  PchHeader h = {
+    .magic = PCH_MAGIC,
+    .version = PCH_VERSION,
+    .layout = pch_layout(),
+    .page = sysconf(_SC_PAGESIZE),
+    .file_count = pp->sources.count,
+    .source_end = pp->sources.end,
+    .intern_table = (uint8_t *)in->table - in->tables.base,
+    .intern_capacity = in->capacity,
+    .intern_count = in->count,
+    .macro_index_len = pp->macro_index_len,
+    .ast_size = p->ast.size,
+    .ast_count = p->ast.count,
+    .var_size = p->var_size,
+    .typedefs_size = p->typedefs_size,
+    .fields_size = p->fields_size,
+    .structs_size = p->structs_size,
+    .var_index = PchSymTab_from(&p->var_index),
+    .typedef_index = PchSymTab_from(&p->typedef_index),
+    .struct_index = PchSymTab_from(&p->struct_index),
+    .label_index = PchSymTab_from(&p->label_index),
+  };
+
+  // The files are in the order of the sources, the
+  // headers are found through the table of the unit
+  Arena *scratch = &arenas[ARENA_SCRATCH];
+  PchFile *files = ARENA_PUSH(scratch, PchFile, h.file_count);
+  char *paths = (char *)(scratch->base + scratch->size);
+  for (uint32_t i = 0; i < h.file_count; ++i) {
+    SourceFile s = pp->sources.files[i];
+    files[i] = (PchFile){ .base = s.base, .size = s.size };
+    if (s.data != BUILTIN_MACROS) continue;
+    files[i].kind = PCH_FILE_BUILTINS;
+    files[i].hash = pch_hash(s.data, s.size);
+  }
+  for (uint32_t i = 0; i < 1u << pp->files.bits; ++i) {
+    SymSlot slot = pp->files.slots[i];
+    if (!slot.name) continue;
+    PchFile *f = &files[slot.value - 1];
+    Header header = HeaderCache_header(slot.name);
+    Str name = HeaderCache_path(slot.name);
+    f->kind = PCH_FILE_HEADER;
+    f->hash = pch_hash(header.source.data, f->size);
+    f->path = (char *)(scratch->base + scratch->size) - paths;
+    f->path_len = name.len;
+    char *copy = ARENA_PUSH(scratch, char, name.len + 1);
+    memcpy(copy, name.ptr, name.len);
+    copy[name.len] = 0;
+    if (header.guard.len) {
+      f->guard = header.guard.ptr - header.source.data;
+      f->guard_len = header.guard.len;
+    }
+    f->once = header.once;
+  }
+  // the first header is the one, that the prefix includes
+  while (h.prefix < h.file_count && files[h.prefix].kind != PCH_FILE_HEADER) h.prefix++;
+  assert(h.prefix < h.file_count);
+  if (!files[h.prefix].guard_len && !files[h.prefix].once) {
+    // note: The main file includes it again, it has to be skipped
+    fprintf(stderr, "'%s' needs an include guard or #pragma once\n",
+        paths + files[h.prefix].path);
+    assert(0); // TODO: error for a header without a guard
+  }
+
+  const void *data[PCH_SECTION_COUNT] = {
+    [PCH_CHARS] = in->chars.base,
+    [PCH_SYMBOLS] = in->symbols.base,
+    [PCH_INTERN_TABLES] = in->tables.base,
+    [PCH_FILES] = files,
+    [PCH_PATHS] = paths,
+  };
+  size_t sizes[PCH_SECTION_COUNT] = {
+    [PCH_CHARS] = in->chars.size,
+    [PCH_SYMBOLS] = in->symbols.size,
+    [PCH_INTERN_TABLES] = in->tables.size,
+    [PCH_FILES] = sizeof(PchFile) * h.file_count,
+    [PCH_PATHS] = (char *)(scratch->base + scratch->size) - paths,
+  };
+  for (int s = PCH_AST; s <= PCH_SYMTAB; ++s) {
+    data[s] = arenas[PCH_ARENAS[s]].base;
+    sizes[s] = arenas[PCH_ARENAS[s]].size;
+  }
+
+  // note: Written next to it and renamed, so a compile,
+  // that's mapping the old one, never sees a partial file
+  char tmp[PATH_MAX];
+  int n = snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+  assert(n < PATH_MAX);
+  int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  assert(fd >= 0); // TODO: error for an unwritable output
+  size_t offset = h.page;
+  for (int s = 0; s < PCH_SECTION_COUNT; ++s) {
+    h.sections[s] = (PchRange){ offset, sizes[s] };
+    pch_write_all(fd, data[s], sizes[s], offset);
+    offset += (sizes[s] + h.page - 1) / h.page * h.page;
+  }
+  pch_write_all(fd, &h, sizeof(h), 0);
+  // the last page is mapped whole
+  int err = ftruncate(fd, offset);
+  assert(!err);
+  err = close(fd);
+  assert(!err);
+  err = rename(tmp, path);
+  assert(!err);
+}
+
+void Pch_build(const Driver *d, const char *path, const char *header, Arenas *arenas) {
+  // note: The prefix is included from the empty main
+  // file, the path has to work from any directory
+  char real[PATH_MAX];
+  if (!realpath(header, real)) {
+    fprintf(stderr, "'%s' not found\n", header);
+    assert(0); // TODO: error for missing file
+  }
+  Interner in;
+  Interner_init(&in);
+  Preprocessor pp;
+  Preprocessor_init(&pp, &in, arenas->arenas, d->include_dirs, d->include_dir_count);
+  Parser p;
+  Parser_init(&p, &in, &pp, arenas->arenas, 0);
+  Preprocessor_begin(&pp, (Source){ PCH_MAIN, sizeof(PCH_MAIN) }, "", real);
+  Parser_parse_file_scope(&p, 0);
+  Pch_write(path, &in, &pp, &p);
+  Interner_free(&in);
+}
+
+static bool Pch_reject(Pch *pch, const char *path, const char *reason, const char *file) {
+  fprintf(stderr, "precompiled header '%s' not used: %s%s\n", path, reason, file);
+  Pch_close(pch);
+  return false;
+}
+
+bool Pch_open(Pch *pch, const char *path) {
+  *pch = (Pch){ .fd = open(path, O_RDONLY) };
+  if (pch->fd < 0) return Pch_reject(pch, path, "can't be opened", "");
+  struct stat st;
+  int err = fstat(pch->fd, &st);
+  assert(err >= 0);
+  if ((size_t)st.st_size < sizeof(PchHeader)) return Pch_reject(pch, path, "too small", "");
+  pch->size = st.st_size;
+  pch->data = mmap(0, pch->size, PROT_READ, MAP_PRIVATE, pch->fd, 0);
+  assert(pch->data != MAP_FAILED);
+
+  const PchHeader *h = pch->header = (const PchHeader *)pch->data;
+  if (memcmp(h->magic, PCH_MAGIC, sizeof(PCH_MAGIC)) || h->version != PCH_VERSION
+      || h->layout != pch_layout()) {
+    return Pch_reject(pch, path, "made by another version", "");
+  }
+  if (h->page != sysconf(_SC_PAGESIZE)) return Pch_reject(pch, path, "other page size", "");
+  for (int s = 0; s < PCH_SECTION_COUNT; ++s) {
+    PchRange r = h->sections[s];
+    if (r.offset % h->page || r.offset + r.size > pch->size || r.size > ARENA_RESERVE) {
+      return Pch_reject(pch, path, "corrupted", "");
+    }
+  }
+  pch->files = (const PchFile *)(pch->data + h->sections[PCH_FILES].offset);
+  pch->paths = (const char *)(pch->data + h->sections[PCH_PATHS].offset);
+  pch->headers = calloc(h->file_count, sizeof(uint32_t));
+  assert(pch->headers);
+
+  for (uint32_t i = 0; i < h->file_count; ++i) {
+    const PchFile *f = &pch->files[i];
+    if (f->kind == PCH_FILE_BUILTINS && (f->size != sizeof(BUILTIN_MACROS)
+        || f->hash != pch_hash(BUILTIN_MACROS, f->size))) {
+      return Pch_reject(pch, path, "the builtin macros changed", "");
+    }
+    if (f->kind != PCH_FILE_HEADER) continue;
+    const char *name = pch->paths + f->path;
+    uint32_t id = pch->headers[i] = HeaderCache_open(name, f->path_len);
+    if (!id) return Pch_reject(pch, path, "missing ", name);
+    Source source = HeaderCache_header(id).source;
+    if (source.size != f->size || pch_hash(source.data, f->size) != f->hash) {
+      return Pch_reject(pch, path, "changed ", name);
+    }
+  }
+  // The guards are known without reading the headers again
+  for (uint32_t i = 0; i < h->file_count; ++i) {
+    const PchFile *f = &pch->files[i];
+    if (f->kind != PCH_FILE_HEADER) continue;
+    Source source = HeaderCache_header(pch->headers[i]).source;
+    Str guard = { f->guard_len ? source.data + f->guard : 0, f->guard_len };
+    HeaderCache_set_guard(pch->headers[i], guard, f->once);
+  }
+  return true;
+}
+
+void Pch_close(Pch *pch) {
+  if (pch->data) {
+    int err = munmap((void *)pch->data, pch->size);
+    assert(!err);
+  }
+  if (pch->fd >= 0) close(pch->fd);
+  free(pch->headers);
+  *pch = (Pch){ .fd = -1 };
+}
+
+Str Pch_prefix(const Pch *pch) {
+  const PchFile *f = &pch->files[pch->header->prefix];
+  return (Str){ pch->paths + f->path, f->path_len };
+}
+
+// note: The pages are private, the unit writes to its own copies
+// of them, while the untouched ones are shared with the page cache
+static void Pch_map(const Pch *pch, PchSection s, Arena *arena) {
+  PchRange r = pch->header->sections[s];
+  size_t page = pch->header->page;
+  size_t size = (r.size + page - 1) / page * page;
+  if (size) {
+    void *mapped = mmap(arena->base, size, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_FIXED, pch->fd, r.offset);
+    assert(mapped != MAP_FAILED);
+  }
+  arena->size = r.size;
+  arena->committed = MAX(arena->committed, size);
+}
+
+void Pch_load(const Pch *pch, Interner *in, Preprocessor *pp, Parser *p) {
+  const PchHeader *h = pch->header;
+  Arena *arenas = p->arenas;
+  Pch_map(pch, PCH_CHARS, &in->chars);
+  Pch_map(pch, PCH_SYMBOLS, &in->symbols);
+  Pch_map(pch, PCH_INTERN_TABLES, &in->tables);
+  in->table = (InternSlot *)(in->tables.base + h->intern_table);
+  in->capacity = h->intern_capacity;
+  in->count = h->intern_count;
+  for (int s = PCH_AST; s <= PCH_SYMTAB; ++s) Pch_map(pch, s, &arenas[PCH_ARENAS[s]]);
+
+  // note: The sources are the only pointers, to the
+  // files mapped by this process, so they're made again
+  Arena_reset(pp->sources.arena);
+  for (uint32_t i = 0; i < h->file_count; ++i) {
+    const PchFile *f = &pch->files[i];
+    const char *data = 0;
+    Str name = STR("");
+    if (f->kind == PCH_FILE_HEADER) {
+      data = HeaderCache_header(pch->headers[i]).source.data;
+      name = HeaderCache_path(pch->headers[i]);
+    } else if (f->kind == PCH_FILE_BUILTINS) {
+      data = BUILTIN_MACROS;
+      name = STR("<built-in>");
+    }
+    *ARENA_PUSH(pp->sources.arena, SourceFile, 1) = (SourceFile){ f->base, f->size, data, name };
+  }
+  pp->sources.count = h->file_count;
+  pp->sources.end = h->source_end;
+  // the ids of the headers are different in every process
+  SymTab_init(&pp->files, &arenas[ARENA_SYMTAB]);
+  for (uint32_t i = 0; i < h->file_count; ++i) {
+    if (pch->files[i].kind != PCH_FILE_HEADER) continue;
+    SymTab_entry(&pp->files, pch->headers[i])->value = i + 1;
+  }
+  pp->macro_index_len = h->macro_index_len;
+  pp->sym_defined = Interner_intern(in, "defined", CSTR_LEN("defined"));
+  pp->sym_va_args = Interner_intern(in, "__VA_ARGS__", CSTR_LEN("__VA_ARGS__"));
+
+  p->var_size = h->var_size;
+  p->typedefs_size = h->typedefs_size;
+  p->fields_size = h->fields_size;
+  p->structs_size = h->structs_size;
+  p->var_index = PchSymTab_to(h->var_index, &arenas[ARENA_SYMTAB]);
+  p->typedef_index = PchSymTab_to(h->typedef_index, &arenas[ARENA_SYMTAB]);
+  p->struct_index = PchSymTab_to(h->struct_index, &arenas[ARENA_SYMTAB]);
+  p->label_index = PchSymTab_to(h->label_index, &arenas[ARENA_SYMTAB]);
+  p->ast.size = h->ast_size;
+  p->ast.count = h->ast_count;
+}
@@ -0,0 +1,287 @@
+#include "peephole.h"
+#include "regalloc.h"
+#include "x86.h"
+#include <assert.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// The passes over a function, a rewrite can make another one possible
+#define PEEPHOLE_PASSES 4
+
+static bool X86Operand_equal(const X86Operand *a, const X86Operand *b) {
+  return a->kind == b->kind && a->size == b->size && a->reg == b->reg
+    && a->index == b->index && a->sym == b->sym && a->imm == b->imm;
+}
+
+// Of the register, as itself or in the address
+static bool X86Operand_reads(const X86Operand *o, uint32_t reg) {
+  if (o->kind == OPERAND_REG) return o->reg == reg;
+  if (o->kind != OPERAND_MEM) return false;
+  return o->reg == reg || (o->index && X86Operand_index(o) == reg);
+}
+
+static inline bool X86Operand_reg64(const X86Operand *o) {
+  return o->kind == OPERAND_REG && o->size == 8;
+}
+
+// Of the stack, that the push and the pop move
+static inline bool X86Operand_stack(const X86Operand *o) {
+  return X86Operand_reads(o, REG_RSP);
+}
+
+static inline bool X86Inst_reads_flags(const X86Inst *inst) {
+  return inst->op == X86_JCC || inst->op == X86_SETCC;
+}
+
+// The ones, that only write their first operand
+static inline bool X86Inst_writes(const X86Inst *inst) {
+  switch (inst->op) {
+    case X86_MOV: case X86_MOVSX: case X86_MOVSXD: case X86_MOVZX: case X86_LEA: case X86_POP:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// The instructions, that are looked at for the next use of a register
+#define PEEPHOLE_LOOKAHEAD 8
+
+// note: The register isn't read, before it's written again. It's only
+// known for sure up to the end of the block, as the other blocks and
+// the calls aren't followed, and the division uses rax and rdx on its own.
+static bool Peephole_dead(const X86Inst *rest, uint32_t rest_len, uint32_t reg) {
+  for (uint32_t i = 0; i < rest_len && i < PEEPHOLE_LOOKAHEAD; ++i) {
+    const X86Inst *inst = &rest[i];
+    switch (inst->op) {
+      case X86_LABEL: case X86_JMP: case X86_JCC: case X86_CALL: case X86_RET: case X86_LEAVE:
+      case X86_DIV: case X86_IDIV: case X86_CQO: case X86_UD2:
+        return false;
+      default:
+        break;
+    }
+    bool whole = inst->a.kind == OPERAND_REG && inst->a.reg == reg && inst->a.size >= 4;
+    // the xor of itself is the zero, it doesn't read it
+    if (whole && inst->op == X86_XOR && X86Operand_equal(&inst->a, &inst->b)) return true;
+    if (X86Operand_reads(&inst->b, reg)) return false;
+    if (whole && X86Inst_writes(inst)) return true;
+    if (X86Operand_reads(&inst->a, reg)) return false;
+  }
+  return false;
+}
+
+// note: Every rule looks at a window of one or two instructions, and
+// the one after it. It writes the replacement, that's never longer
+// than the window, and returns its length, or -1, if it doesn't apply.
+// The flags are only ever read right after the cmp or the test, that
+// set them, so an instruction can go, unless a jcc or a setcc follows.
+typedef int (*PeepholeRewrite)(const X86Inst *w, const X86Inst *rest, uint32_t rest_len, X86Inst *out);
+
+// mov r, r of the 64 bits, the 32 bit one clears the upper half
+static int Peephole_self_mov(const X86Inst *w, const X86Inst *rest, uint32_t rest_len, X86Inst *out) {
+  (void)rest;
+  (void)rest_len;
+  (void)out;
+  return X86Operand_reg64(&w->a) && X86Operand_equal(&w->a, &w->b) ? 0 : -1;
+}
+
+// add r, 0 and the like, of the 64 bits, that don't change the value
+static int Peephole_identity(const X86Inst *w, const X86Inst *rest, uint32_t rest_len, X86Inst *out) {
+  (void)out;
+  if (!X86Operand_reg64(&w->a) || w->b.kind != OPERAND_IMM) return -1;
+  if (rest_len && X86Inst_reads_flags(rest)) return -1;
+  int64_t c = w->b.imm;
+  switch (w->op) {
+    case X86_ADD: case X86_SUB: case X86_OR: case X86_XOR:
+    case X86_SHL: case X86_SHR: case X86_SAR:
+      return c ? -1 : 0;
+    case X86_AND:
+      return c == -1 ? 0 : -1;
+    case X86_IMUL:
+      return c == 1 ? 0 : -1;
+    default:
+      return -1;
+  }
+}
+
+// A register written twice, without a read in between
+static int Peephole_dead_mov(const X86Inst *w, const X86Inst *rest, uint32_t rest_len, X86Inst *out) {
+  (void)rest;
+  (void)rest_len;
+  const X86Inst *second = &w[1];
+  if (w->a.kind != OPERAND_REG || second->op != X86_MOV || second->a.kind != OPERAND_REG) return -1;
+  // the partial ones keep the rest of the register
+  if (second->a.reg != w->a.reg || second->a.size < 4 || X86Operand_reads(&second->b, w->a.reg)) return -1;
+  out[0] = *second;
+  return 1;
+}
+
+// mov a, b and then mov b, a, it's the same already
+static int Peephole_copy_back(const X86Inst *w, const X86Inst *rest, uint32_t rest_len, X86Inst *out) {
+  (void)rest;
+  (void)rest_len;
+  if (!X86Operand_reg64(&w->a) || !X86Operand_reg64(&w->b)) return -1;
+  if (!X86Operand_equal(&w->a, &w[1].b) || !X86Operand_equal(&w->b, &w[1].a)) return -1;
+  out[0] = *w;
+  return 1;
+}
+
+// A temporary, that's only moved to another register, the value is
+// made there instead. The upper half of the 32 bit ones is cleared.
+static int Peephole_forward(const X86Inst *w, const X86Inst *rest, uint32_t rest_len, X86Inst *out) {
+  const X86Inst *mov = &w[1];
+  if (!X86Inst_writes(w) || w->op == X86_POP || w->a.kind != OPERAND_REG || w->a.size < 4) return -1;
+  if (!X86Operand_reg64(&mov->a) || !X86Operand_reg64(&mov->b) || mov->b.reg != w->a.reg) return -1;
+  if (mov->a.reg == w->a.reg || !Peephole_dead(rest, rest_len, w->a.reg)) return -1;
+  out[0] = *w;
+  out[0].a.reg = mov->a.reg;
+  return 1;
+}
+
+// mov a, b and then the extension of a from the 32 bits
+static int Peephole_narrow_copy(const X86Inst *w, const X86Inst *rest, uint32_t rest_len, X86Inst *out) {
+  (void)rest;
+  (void)rest_len;
+  const X86Inst *ext = &w[1];
+  if (!X86Operand_reg64(&w->a) || !X86Operand_reg64(&w->b)) return -1;
+  if (ext->a.kind != OPERAND_REG || ext->a.size != 4 || !X86Operand_equal(&ext->a, &ext->b)) return -1;
+  if (ext->a.reg != w->a.reg) return -1;
+  out[0] = *ext;
+  out[0].b.reg = w->b.reg;
+  return 1;
+}
+
+// The store and the load of the same place, the value is still there
+static int Peephole_reload(const X86Inst *w, const X86Inst *rest, uint32_t rest_len, X86Inst *out) {
+  (void)rest;
+  (void)rest_len;
+  const X86Inst *load = &w[1];
+  if (w->a.kind != OPERAND_MEM || !X86Operand_reg64(&w->b) || !X86Operand_reg64(&load->a)) return -1;
+  if (!X86Operand_equal(&w->a, &load->b)) return -1;
+  out[0] = *w;
+  if (load->a.reg == w->b.reg) return 1;
+  out[1] = (X86Inst){ .op = X86_MOV, .a = load->a, .b = w->b };
+  return 2;
+}
+
+// The value loaded from a place is stored back to it
+static int Peephole_store_back(const X86Inst *w, const X86Inst *rest, uint32_t rest_len, X86Inst *out) {
+  (void)rest;
+  (void)rest_len;
+  const X86Inst *store = &w[1];
+  if (!X86Operand_reg64(&w->a) || w->b.kind != OPERAND_MEM) return -1;
+  if (!X86Operand_equal(&w->a, &store->b) || !X86Operand_equal(&w->b, &store->a)) return -1;
+  out[0] = *w;
+  return 1;
+}
+
+// Two stores to the same place, the second one doesn't read it
+static int Peephole_dead_store(const X86Inst *w, const X86Inst *rest, uint32_t rest_len, X86Inst *out) {
+  (void)rest;
+  (void)rest_len;
+  const X86Inst *second = &w[1];
+  if (w->a.kind != OPERAND_MEM || !X86Operand_equal(&w->a, &second->a)) return -1;
+  if (second->b.kind != OPERAND_REG && second->b.kind != OPERAND_IMM) return -1;
+  out[0] = *second;
+  return 1;
+}
+
+// The push and the pop of the copies of the phis and the arguments
+static int Peephole_push_pop(const X86Inst *w, const X86Inst *rest, uint32_t rest_len, X86Inst *out) {
+  (void)rest;
+  (void)rest_len;
+  const X86Operand *from = &w->a, *to = &w[1].a;
+  if (X86Operand_stack(from) || X86Operand_stack(to)) return -1;
+  // there's no move from memory to memory
+  if (to->kind != OPERAND_REG && from->kind != OPERAND_REG) return -1;
+  if (to->kind == OPERAND_REG && from->kind == OPERAND_REG && to->reg == from->reg) return 0;
+  X86Operand a = *to, b = *from;
+  a.size = 8;
+  if (b.kind != OPERAND_IMM) b.size = 8;
+  out[0] = (X86Inst){ .op = X86_MOV, .a = a, .b = b };
+  return 1;
+}
+
+// A jump to the label, that follows it
+static int Peephole_jump_next(const X86Inst *w, const X86Inst *rest, uint32_t rest_len, X86Inst *out) {
+  (void)rest;
+  (void)rest_len;
+  if (w->a.sym != w[1].a.sym) return -1;
+  out[0] = w[1];
+  return 1;
+}
+
+typedef struct {
+  const char *name;
+  // of the window, X86_COUNT, when it's only one instruction
+  uint8_t first, second;
+  PeepholeRewrite rewrite;
+} PeepholeEntry;
+
+// note: The window is matched by the ops, then the rewrite checks
+// the operands. The first one, that applies, is taken.
+static const PeepholeEntry PEEPHOLE_RULES[PEEPHOLE_COUNT] = {
+  [PEEPHOLE_SELF_MOV] = { "self mov", X86_MOV, X86_COUNT, Peephole_self_mov },
+  [PEEPHOLE_IDENTITY] = { "identity", X86_COUNT, X86_COUNT, Peephole_identity },
+  [PEEPHOLE_DEAD_MOV] = { "dead mov", X86_MOV, X86_MOV, Peephole_dead_mov },
+  [PEEPHOLE_COPY_BACK] = { "copy back", X86_MOV, X86_MOV, Peephole_copy_back },
+  [PEEPHOLE_FORWARD] = { "forward", X86_COUNT, X86_MOV, Peephole_forward },
+  [PEEPHOLE_NARROW_COPY] = { "narrow copy", X86_MOV, X86_MOV, Peephole_narrow_copy },
+  [PEEPHOLE_RELOAD] = { "reload", X86_MOV, X86_MOV, Peephole_reload },
+  [PEEPHOLE_STORE_BACK] = { "store back", X86_MOV, X86_MOV, Peephole_store_back },
+  [PEEPHOLE_DEAD_STORE] = { "dead store", X86_MOV, X86_MOV, Peephole_dead_store },
+  [PEEPHOLE_PUSH_POP] = { "push pop", X86_PUSH, X86_POP, Peephole_push_pop },
+  [PEEPHOLE_JUMP_NEXT] = { "jump next", X86_JMP, X86_LABEL, Peephole_jump_next },
+};
+
+// X86_COUNT matches any op
+static inline bool Peephole_op(uint8_t pattern, uint8_t op) {
+  return pattern == X86_COUNT || pattern == op;
+}
+
+void X86_peephole(X86Code *code, PeepholeStats *stats) {
+  uint32_t hits[PEEPHOLE_COUNT] = {0};
+  X86Inst *insts = code->insts;
+  bool changed = true;
+  for (uint32_t pass = 0; pass < PEEPHOLE_PASSES && changed; ++pass) {
+    changed = false;
+    uint32_t n = code->count, len = 0;
+    for (uint32_t i = 0; i < n;) {
+      X86Inst out[2];
+      int out_len = -1;
+      uint32_t window = 0, rule = 0;
+      for (; rule < PEEPHOLE_COUNT && out_len < 0; ++rule) {
+        const PeepholeEntry *e = &PEEPHOLE_RULES[rule];
+        window = e->second == X86_COUNT ? 1 : 2;
+        if (i + window > n || !Peephole_op(e->first, insts[i].op)) continue;
+        if (window == 2 && !Peephole_op(e->second, insts[i + 1].op)) continue;
+        // the labels only go with the rules, that name them
+        if (insts[i].op == X86_LABEL && e->first != X86_LABEL) continue;
+        out_len = e->rewrite(&insts[i], &insts[i + window], n - i - window, out);
+      }
+      if (out_len < 0) {
+        insts[len++] = insts[i++];
+        continue;
+      }
+      hits[rule - 1]++;
+      changed = true;
+      assert((uint32_t)out_len <= window);
+      for (int j = 0; j < out_len; ++j) insts[len++] = out[j];
+      i += window;
+    }
+    code->count = len;
+  }
+  if (!stats) return;
+  for (uint32_t i = 0; i < PEEPHOLE_COUNT; ++i) {
+    if (hits[i]) __atomic_fetch_add(&stats->hits[i], hits[i], __ATOMIC_RELAXED);
+  }
+}
+
+void Peephole_print_stats(FILE *out, const PeepholeStats *stats) {
+  fprintf(out, "peephole:");
+  for (uint32_t i = 0; i < PEEPHOLE_COUNT; ++i) {
+    fprintf(out, "%s %s %" PRIu64, i ? "," : "", PEEPHOLE_RULES[i].name, stats->hits[i]);
+  }
+  fprintf(out, "\n");
+}
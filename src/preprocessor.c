@@ -0,0 +1,922 @@
+#include "preprocessor.h"
+#include "arena.h"
+#include "ast.h"
+#include "common.h"
+#include "driver.h"
+#include "intern.h"
+#include "symtab.h"
+#include "tokens.h"
+#include <assert.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+typedef enum {
+  DIRECTIVE_NONE,
+  DIRECTIVE_DEFINE,
+  DIRECTIVE_UNDEF,
+  DIRECTIVE_INCLUDE,
+  DIRECTIVE_IF,
+  DIRECTIVE_IFDEF,
+  DIRECTIVE_IFNDEF,
+  DIRECTIVE_ELIF,
+  DIRECTIVE_ELSE,
+  DIRECTIVE_ENDIF,
+  DIRECTIVE_PRAGMA,
+  DIRECTIVE_ERROR,
+  DIRECTIVE_WARNING,
+  DIRECTIVE_LINE,
+  DIRECTIVE_COUNT,
+} Directive;
+
+const Str DIRECTIVE_NAMES[DIRECTIVE_COUNT] = {
+  [DIRECTIVE_DEFINE] = STR("define"),
+  [DIRECTIVE_UNDEF] = STR("undef"),
+  [DIRECTIVE_INCLUDE] = STR("include"),
+  [DIRECTIVE_IF] = STR("if"),
+  [DIRECTIVE_IFDEF] = STR("ifdef"),
+  [DIRECTIVE_IFNDEF] = STR("ifndef"),
+  [DIRECTIVE_ELIF] = STR("elif"),
+  [DIRECTIVE_ELSE] = STR("else"),
+  [DIRECTIVE_ENDIF] = STR("endif"),
+  [DIRECTIVE_PRAGMA] = STR("pragma"),
+  [DIRECTIVE_ERROR] = STR("error"),
+  [DIRECTIVE_WARNING] = STR("warning"),
+  [DIRECTIVE_LINE] = STR("line"),
+};
+
+// Read before the main file
+const char BUILTIN_MACROS[] =
+  "#define __STDC__ 1\n"
+  "#define __STDC_VERSION__ 199901L\n"
+  "#define __STDC_HOSTED__ 1\n"
+  "#define __mcc__ 1\n";
+
+// note: Shared by all the threads, the headers are mapped, when
+// they're first included and stay for the life of the process.
+// The paths are interned, so the id of a path indexes the headers.
+typedef struct {
+  pthread_mutex_t lock;
+  bool ready;
+  Interner paths;
+  Arena headers;
+} HeaderCache;
+
+static HeaderCache header_cache = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+// Returns zero, if the file can't be opened, the path has to be
+// zero terminated, len is without the terminator
+static HeaderStamp header_stamp(const char *path) {
+  struct stat st;
+  if (stat(path, &st) < 0) return (HeaderStamp){0};
+  return (HeaderStamp){ st.st_mtim, st.st_size, st.st_ino };
+}
+
+uint32_t HeaderCache_open(const char *path, uint32_t len) {
+  HeaderCache *c = &header_cache;
+  pthread_mutex_lock(&c->lock);
+  if (!c->ready) {
+    Interner_init(&c->paths);
+    Arena_reserve(&c->headers, ARENA_RESERVE);
+    c->ready = true;
+  }
+  SymId id = Interner_find(&c->paths, path, len);
+  // note: It's there without the source, if it was removed
+  if (!id || !((Header *)c->headers.base)[id].source.data) {
+    Source source = map_source(path);
+    if (source.data) {
+      if (!id) id = Interner_intern(&c->paths, path, len);
+      while (ARENA_LEN(&c->headers, Header) <= id) {
+        *ARENA_PUSH(&c->headers, Header, 1) = (Header){0};
+      }
+      ((Header *)c->headers.base)[id] = (Header){
+        .source = source,
+        .stamp = header_stamp(path),
+      };
+    } else id = 0;
+  }
+  pthread_mutex_unlock(&c->lock);
+  return id;
+}
+
+// note: The headers, that changed since they were mapped,
+// are mapped again and what was found in them is forgotten.
+// Nothing can be reading them, while it's running.
+void HeaderCache_refresh(void) {
+  HeaderCache *c = &header_cache;
+  pthread_mutex_lock(&c->lock);
+  uint32_t count = c->ready ? ARENA_LEN(&c->headers, Header) : 0;
+  for (uint32_t id = 1; id < count; ++id) {
+    Header *h = &((Header *)c->headers.base)[id];
+    Str name = Interner_str(&c->paths, id);
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%.*s", name.len, name.ptr);
+    HeaderStamp stamp = header_stamp(path);
+    if (!memcmp(&stamp, &h->stamp, sizeof(stamp))) continue;
+    if (h->source.data) unmap_source(h->source);
+    *h = (Header){0};
+    Source source = map_source(path);
+    if (source.data) *h = (Header){ .source = source, .stamp = header_stamp(path) };
+  }
+  pthread_mutex_unlock(&c->lock);
+}
+
+uint32_t HeaderCache_count(void) {
+  pthread_mutex_lock(&header_cache.lock);
+  uint32_t count = header_cache.ready ? ARENA_LEN(&header_cache.headers, Header) : 1;
+  pthread_mutex_unlock(&header_cache.lock);
+  return count;
+}
+
+static inline Header *HeaderCache_get(uint32_t id) {
+  return &((Header *)header_cache.headers.base)[id];
+}
+
+Header HeaderCache_header(uint32_t id) {
+  pthread_mutex_lock(&header_cache.lock);
+  Header h = *HeaderCache_get(id);
+  pthread_mutex_unlock(&header_cache.lock);
+  return h;
+}
+
+Str HeaderCache_path(uint32_t id) {
+  pthread_mutex_lock(&header_cache.lock);
+  Str path = Interner_str(&header_cache.paths, id);
+  pthread_mutex_unlock(&header_cache.lock);
+  return path;
+}
+
+// What's already known about the header is kept
+void HeaderCache_set_guard(uint32_t id, Str guard, bool once) {
+  pthread_mutex_lock(&header_cache.lock);
+  Header *h = HeaderCache_get(id);
+  if (!h->guard.len) h->guard = guard;
+  h->once |= once;
+  pthread_mutex_unlock(&header_cache.lock);
+}
+
+static const SourceFile *SourceMap_file(const SourceMap *m, uint32_t loc) {
+  // most of the tokens are in the main file
+  const SourceFile *files = m->files;
+  if (loc < files[0].size) return &files[0];
+  uint32_t low = 1, high = m->count;
+  while (high - low > 1) {
+    uint32_t mid = (low + high) / 2;
+    if (files[mid].base <= loc) low = mid;
+    else high = mid;
+  }
+  assert(loc - files[low].base < files[low].size);
+  return &files[low];
+}
+
+const char *SourceMap_text(const SourceMap *m, uint32_t loc) {
+  const SourceFile *file = SourceMap_file(m, loc);
+  return file->data + (loc - file->base);
+}
+
+SourcePosition SourceMap_position(const SourceMap *m, uint32_t loc) {
+  const SourceFile *file = SourceMap_file(m, loc);
+  SourcePosition pos = { file->name, 1, 1 };
+  for (const char *ch = file->data; ch < file->data + (loc - file->base); ++ch) {
+    if (*ch == '\n') {
+      pos.line++;
+      pos.column = 1;
+    } else {
+      pos.column++;
+    }
+  }
+  return pos;
+}
+
+static uint32_t SourceMap_add(SourceMap *m, const char *data, uint32_t size, Str name) {
+  uint32_t base = m->end;
+  assert(base + (uint64_t)size < UINT32_MAX);
+  *ARENA_PUSH(m->arena, SourceFile, 1) = (SourceFile){ base, size, data, name };
+  m->count++;
+  m->end += size;
+  return base;
+}
+
+static inline MacroId Preprocessor_macro(const Preprocessor *pp, SymId sym) {
+  return sym < pp->macro_index_len ? pp->macro_index[sym] : 0;
+}
+
+static void Preprocessor_set_macro(Preprocessor *pp, SymId sym, MacroId macro) {
+  Arena *index = &pp->arenas[ARENA_MACRO_INDEX];
+  if (sym >= pp->macro_index_len) {
+    uint32_t len = sym + 1;
+    MacroId *added = ARENA_PUSH(index, MacroId, len - pp->macro_index_len);
+    memset(added, 0, sizeof(MacroId) * (len - pp->macro_index_len));
+    pp->macro_index_len = len;
+  }
+  pp->macro_index[sym] = macro;
+}
+
+static void Preprocessor_push_file(Preprocessor *pp, const char *data,
+    uint32_t base, uint32_t header) {
+  assert(pp->file_count < MAX_INCLUDE_DEPTH);
+  PpFile *f = &pp->files_stack[pp->file_count++];
+  *f = (PpFile){
+    .header = header,
+    .cond_base = pp->cond_count,
+    .guard = header ? GUARD_START : GUARD_NONE,
+  };
+  Lexer_init(&f->lexer, pp->interner, data, base);
+}
+
+void Preprocessor_init(Preprocessor *pp, Interner *in, Arena *arenas,
+    const char **include_dirs, uint32_t include_dir_count) {
+  *pp = (Preprocessor){
+    .interner = in,
+    .arenas = arenas,
+    .sources = {
+      .files = (SourceFile *)arenas[ARENA_SOURCES].base,
+      .arena = &arenas[ARENA_SOURCES],
+    },
+    .include_dirs = include_dirs,
+    .include_dir_count = include_dir_count,
+    .macros = (Macro *)arenas[ARENA_MACROS].base,
+    .macro_index = (MacroId *)arenas[ARENA_MACRO_INDEX].base,
+  };
+  SymTab_init(&pp->files, &arenas[ARENA_SYMTAB]);
+  // zero is no macro
+  *ARENA_PUSH(&arenas[ARENA_MACROS], Macro, 1) = (Macro){0};
+  pp->sym_defined = Interner_intern(in, "defined", CSTR_LEN("defined"));
+  pp->sym_va_args = Interner_intern(in, "__VA_ARGS__", CSTR_LEN("__VA_ARGS__"));
+}
+
+// note: The main file isn't a header, it's not shared, its path is
+// only needed for the directory. When a precompiled header is loaded,
+// its files are in the sources already, including the builtins.
+void Preprocessor_begin(Preprocessor *pp, Source source,
+    const char *filename, const char *prefix) {
+  bool loaded = pp->sources.count;
+  pp->main_path = filename;
+  Str name = { filename, strlen(filename) };
+  uint32_t base = SourceMap_add(&pp->sources, source.data, source.size, name);
+  Preprocessor_push_file(pp, source.data, base, 0);
+  if (prefix) {
+    int len = snprintf(pp->prefix, sizeof(pp->prefix), "#include \"%s\"\n", prefix);
+    assert(len < (int)sizeof(pp->prefix));
+    base = SourceMap_add(&pp->sources, pp->prefix, len + 1, STR("<prefix>"));
+    Preprocessor_push_file(pp, pp->prefix, base, 0);
+  }
+  if (loaded) return;
+  base = SourceMap_add(&pp->sources, BUILTIN_MACROS, sizeof(BUILTIN_MACROS), STR("<built-in>"));
+  Preprocessor_push_file(pp, BUILTIN_MACROS, base, 0);
+}
+
+static inline Str Preprocessor_text(const Preprocessor *pp, Token tok) {
+  return (Str){ SourceMap_text(&pp->sources, tok.start), tok.len };
+}
+
+static Directive Preprocessor_directive(const Preprocessor *pp, Token name) {
+  if (name.type != TOK_IDENT && name.type < KEYWORDS_START) return DIRECTIVE_NONE;
+  Str text = Preprocessor_text(pp, name);
+  for (int i = 1; i < DIRECTIVE_COUNT; ++i) {
+    Str d = DIRECTIVE_NAMES[i];
+    if (d.len == text.len && !memcmp(d.ptr, text.ptr, d.len)) return i;
+  }
+  return DIRECTIVE_NONE;
+}
+
+static inline PpFile *Preprocessor_file(Preprocessor *pp) {
+  return &pp->files_stack[pp->file_count - 1];
+}
+
+static void Preprocessor_push_context(Preprocessor *pp, const Token *tokens,
+    uint32_t len, MacroId macro, bool barrier) {
+  assert(pp->context_count < MAX_EXPANSION_DEPTH);
+  pp->contexts[pp->context_count++] = (PpContext){
+    .tokens = tokens,
+    .len = len,
+    .macro = macro,
+    .barrier = barrier,
+  };
+  if (macro) pp->macros[macro].disabled = true;
+}
+
+static void Preprocessor_pop_context(Preprocessor *pp) {
+  PpContext *c = &pp->contexts[--pp->context_count];
+  if (c->macro) pp->macros[c->macro].disabled = false;
+}
+
+static void Preprocessor_pop_cond(Preprocessor *pp) {
+  PpFile *f = Preprocessor_file(pp);
+  assert(pp->cond_count > f->cond_base); // TODO: error for #endif without #if
+  pp->cond_count--;
+  if (f->guard == GUARD_OPEN && pp->cond_count == f->guard_cond) f->guard = GUARD_CLOSED;
+}
+
+// An #else or #elif of the guard means, it's not a guard
+static void Preprocessor_branch(Preprocessor *pp) {
+  PpFile *f = Preprocessor_file(pp);
+  assert(pp->cond_count > f->cond_base); // TODO: error for #else without #if
+  if (f->guard == GUARD_OPEN && pp->cond_count - 1 == f->guard_cond) f->guard = GUARD_NONE;
+}
+
+static void Preprocessor_pop_file(Preprocessor *pp) {
+  PpFile *f = Preprocessor_file(pp);
+  // TODO: error for unterminated conditional
+  assert(pp->cond_count == f->cond_base);
+  if (f->guard == GUARD_CLOSED) {
+    HeaderCache_set_guard(f->header, Preprocessor_text(pp, f->guard_name), false);
+  }
+  pp->file_count--;
+}
+
+// Reads the rest of the directive line into the expansion arena
+static uint32_t Preprocessor_line(Preprocessor *pp, Token **tokens) {
+  Lexer *l = &Preprocessor_file(pp)->lexer;
+  Arena *expansion = &pp->arenas[ARENA_EXPANSION];
+  *tokens = (Token *)(expansion->base + expansion->size);
+  uint32_t len = 0;
+  while (!Lexer_line_end(l)) {
+    *ARENA_PUSH(expansion, Token, 1) = Lexer_next(l);
+    len++;
+  }
+  return len;
+}
+
+static Token Preprocessor_ident(Preprocessor *pp) {
+  Lexer *l = &Preprocessor_file(pp)->lexer;
+  assert(!Lexer_line_end(l));
+  Token name = Lexer_next(l);
+  // TODO: keywords as macro names
+  assert(name.type == TOK_IDENT);
+  return name;
+}
+
+static void Preprocessor_define(Preprocessor *pp) {
+  Lexer *l = &Preprocessor_file(pp)->lexer;
+  Token name = Preprocessor_ident(pp);
+  Macro m = { .name = name.sym };
+  SymId params[MAX_MACRO_PARAMS];
+
+  // There can't be a space between the name and the '('
+  if (*l->ch == '(') {
+    m.function_like = true;
+    Lexer_next(l);
+    Token tok = Lexer_next(l);
+    while (tok.type != TOK_RPAREN) {
+      assert(m.params < MAX_MACRO_PARAMS);
+      if (tok.type == TOK_DOT) {
+        assert(Lexer_next(l).type == TOK_DOT && Lexer_next(l).type == TOK_DOT);
+        m.variadic = true;
+        params[m.params++] = pp->sym_va_args;
+        assert((tok = Lexer_next(l)).type == TOK_RPAREN);
+        break;
+      }
+      assert(tok.type == TOK_IDENT);
+      params[m.params++] = tok.sym;
+      tok = Lexer_next(l);
+      if (tok.type == TOK_COMMA) tok = Lexer_next(l);
+      else assert(tok.type == TOK_RPAREN);
+    }
+  }
+
+  Arena *tokens = &pp->arenas[ARENA_MACRO_TOKENS];
+  m.tokens = ARENA_LEN(tokens, Token);
+  while (!Lexer_line_end(l)) {
+    Token tok = Lexer_next(l);
+    // TODO: stringizing and token pasting
+    assert(tok.type != TOK_DHASH && (tok.type != TOK_HASH || !m.function_like));
+    for (uint8_t i = 0; i < m.params && tok.type == TOK_IDENT; ++i) {
+      if (params[i] != tok.sym) continue;
+      tok.type = TOK_PARAM;
+      tok.sym = i;
+    }
+    *ARENA_PUSH(tokens, Token, 1) = tok;
+    m.len++;
+  }
+
+  // note: A redefinition just replaces it
+  MacroId id = ARENA_LEN(&pp->arenas[ARENA_MACROS], Macro);
+  *ARENA_PUSH(&pp->arenas[ARENA_MACROS], Macro, 1) = m;
+  Preprocessor_set_macro(pp, m.name, id);
+}
+
+static bool Preprocessor_include_file(Preprocessor *pp, const char *path) {
+  // note: The same header can be reached by different paths,
+  // it has to be a single one for the guards and #pragma once
+  char real[PATH_MAX];
+  if (!realpath(path, real)) return false;
+  uint32_t header = HeaderCache_open(real, strlen(real));
+  if (!header) return false;
+  pp->stats.includes++;
+  uint32_t local = SymTab_get(&pp->files, header);
+
+  Header h = HeaderCache_header(header);
+  if (local && h.once) {
+    pp->stats.once_skips++;
+    return true;
+  }
+  if (h.guard.len) {
+    SymId guard = Interner_find(pp->interner, h.guard.ptr, h.guard.len);
+    if (guard && Preprocessor_macro(pp, guard)) {
+      pp->stats.guard_skips++;
+      return true;
+    }
+  }
+
+  uint32_t base;
+  if (local) base = pp->sources.files[local - 1].base;
+  else {
+    base = SourceMap_add(&pp->sources, h.source.data, h.source.size, HeaderCache_path(header));
+    SymTab_entry(&pp->files, header)->value = pp->sources.count;
+  }
+  Preprocessor_push_file(pp, h.source.data, base, header);
+  return true;
+}
+
+// The directory of the file, that's being read
+static Str Preprocessor_dir(const Preprocessor *pp) {
+  Str path = STR("");
+  for (uint32_t i = pp->file_count; i-- > 0;) {
+    const PpFile *f = &pp->files_stack[i];
+    if (f->header) {
+      path = HeaderCache_path(f->header);
+      break;
+    }
+    if (!i) path = (Str){ pp->main_path, strlen(pp->main_path) };
+  }
+  while (path.len && path.ptr[path.len - 1] != '/') path.len--;
+  return path;
+}
+
+static void Preprocessor_include(Preprocessor *pp) {
+  Lexer *l = &Preprocessor_file(pp)->lexer;
+  assert(!Lexer_line_end(l));
+  Str name;
+  bool quoted = *l->ch == '"';
+  if (*l->ch == '<') {
+    const char *end = l->ch + 1;
+    while (*end != '>') {
+      assert(*end && *end != '\n'); // TODO: error for unterminated header name
+      end++;
+    }
+    name = (Str){ l->ch + 1, end - l->ch - 1 };
+    l->ch = end + 1;
+  } else {
+    // TODO: #include with macros
+    Token tok = Lexer_next(l);
+    assert(tok.type == TOK_STRING);
+    name = Preprocessor_text(pp, tok);
+    name.ptr++;
+    name.len -= 2;
+  }
+  assert(Lexer_line_end(l));
+
+  char path[PATH_MAX];
+  int len;
+  if (name.len && name.ptr[0] == '/') {
+    len = snprintf(path, sizeof(path), "%.*s", name.len, name.ptr);
+    assert(len < PATH_MAX);
+    if (Preprocessor_include_file(pp, path)) return;
+  } else if (quoted) {
+    Str dir = Preprocessor_dir(pp);
+    len = snprintf(path, sizeof(path), "%.*s%.*s", dir.len, dir.ptr, name.len, name.ptr);
+    assert(len < PATH_MAX);
+    if (Preprocessor_include_file(pp, path)) return;
+  }
+  for (uint32_t i = 0; i < pp->include_dir_count; ++i) {
+    len = snprintf(path, sizeof(path), "%s/%.*s", pp->include_dirs[i], name.len, name.ptr);
+    assert(len < PATH_MAX);
+    if (Preprocessor_include_file(pp, path)) return;
+  }
+  fprintf(stderr, "'%.*s' not found\n", name.len, name.ptr);
+  assert(0); // TODO: error for missing header
+}
+
+static Token Preprocessor_read(Preprocessor *pp);
+Token Preprocessor_expand_next(Preprocessor *pp);
+
+// Constant expression of #if and #elif
+typedef struct {
+  Preprocessor *pp;
+  Token tok;
+  int64_t value; // of the current token, if it's a number
+} PpEval;
+
+static void PpEval_advance(PpEval *e) {
+  Preprocessor *pp = e->pp;
+  Token tok = Preprocessor_expand_next(pp);
+  e->value = 0;
+  if (tok.type == TOK_IDENT && tok.sym == pp->sym_defined) {
+    // note: The operand is read without expansion
+    Token name = Preprocessor_read(pp);
+    bool paren = name.type == TOK_LPAREN;
+    if (paren) name = Preprocessor_read(pp);
+    assert(name.type == TOK_IDENT || name.type >= KEYWORDS_START);
+    if (paren) assert(Preprocessor_read(pp).type == TOK_RPAREN);
+    e->value = name.type == TOK_IDENT && Preprocessor_macro(pp, name.sym);
+    tok.type = TOK_DECIMAL;
+  } else if (tok.type == TOK_DECIMAL) {
+    Str text = Preprocessor_text(pp, tok);
+    // the leading zero makes it octal
+    int64_t base = text.ptr[0] == '0' ? 8 : 10;
+    for (uint32_t i = 0; i < text.len; ++i) {
+      assert(text.ptr[i] - '0' < base); // TODO: error for an invalid octal digit
+      e->value = e->value * base + text.ptr[i] - '0';
+    }
+  } else if (tok.type == TOK_IDENT || tok.type >= KEYWORDS_START) {
+    // the identifiers left after the expansion are zero
+    tok.type = TOK_DECIMAL;
+  }
+  e->tok = tok;
+}
+
+static int64_t PpEval_conditional(PpEval *e);
+
+static int64_t PpEval_unary(PpEval *e) {
+  Token tok = e->tok;
+  int64_t value = e->value;
+  PpEval_advance(e);
+  switch (tok.type) {
+    case TOK_DECIMAL: {
+      // note: The lexer splits the rest of the number off, the x of
+      // 0x1f goes with the digits after it, and the suffixes, like
+      // the L of 199901L, are on their own
+      bool hex = false;
+      if (e->tok.type == TOK_DECIMAL && e->tok.start == tok.start + tok.len
+          && tok.len == 1 && !value && Preprocessor_text(e->pp, tok).ptr[0] == '0') {
+        Str text = Preprocessor_text(e->pp, e->tok);
+        hex = text.ptr[0] == 'x' || text.ptr[0] == 'X';
+      }
+      while (e->tok.type == TOK_DECIMAL && e->tok.start == tok.start + tok.len) {
+        Str text = Preprocessor_text(e->pp, e->tok);
+        uint32_t i = 0;
+        if (hex) {
+          for (i = 1; i < text.len && strchr("0123456789abcdefABCDEF", text.ptr[i]); ++i) {
+            char ch = text.ptr[i] | 0x20;
+            value = value * 16 + (ch <= '9' ? ch - '0' : ch - 'a' + 10);
+          }
+          assert(i > 1); // TODO: error for 0x without the digits
+          hex = false;
+        }
+        for (; i < text.len; ++i) assert(strchr("uUlL", text.ptr[i])); // TODO: error for an invalid suffix
+        tok = e->tok;
+        PpEval_advance(e);
+      }
+      return value;
+    }
+    case TOK_LPAREN:
+      value = PpEval_conditional(e);
+      assert(e->tok.type == TOK_RPAREN);
+      PpEval_advance(e);
+      return value;
+    case TOK_NOT: return !PpEval_unary(e);
+    case TOK_TILDA: return ~PpEval_unary(e);
+    case TOK_MINUS: return -PpEval_unary(e);
+    case TOK_PLUS: return PpEval_unary(e);
+    default:
+      assert(0); // TODO: error for invalid expression
+  }
+}
+
+static int64_t PpEval_binary(PpEval *e, uint8_t min_precedence) {
+  int64_t left = PpEval_unary(e);
+  while (e->tok.type < TOK_IDENT) {
+    AstType op = tok2operation[e->tok.type];
+    if (op < AST_MUL || op >= AST_ASS) break;
+    uint8_t precedence = op2precedence[op];
+    if (precedence < min_precedence) break;
+    PpEval_advance(e);
+    int64_t right = PpEval_binary(e, precedence + 1);
+    switch (op) {
+      case AST_MUL: left *= right; break;
+      // note: Both sides are always evaluated, so 0 && 1 / 0 has to work
+      case AST_DIV: left = right ? left / right : 0; break;
+      case AST_MOD: left = right ? left % right : 0; break;
+      case AST_ADD: left += right; break;
+      case AST_SUB: left -= right; break;
+      case AST_LSFT: left <<= right; break;
+      case AST_RSFT: left >>= right; break;
+      case AST_LT: left = left < right; break;
+      case AST_LE: left = left <= right; break;
+      case AST_GT: left = left > right; break;
+      case AST_GE: left = left >= right; break;
+      case AST_EQ: left = left == right; break;
+      case AST_NE: left = left != right; break;
+      case AST_BAND: left &= right; break;
+      case AST_BXOR: left ^= right; break;
+      case AST_BOR: left |= right; break;
+      case AST_LAND: left = left && right; break;
+      case AST_LOR: left = left || right; break;
+      default: assert(0);
+    }
+  }
+  return left;
+}
+
+static int64_t PpEval_conditional(PpEval *e) {
+  int64_t cond = PpEval_binary(e, 1);
+  if (e->tok.type != TOK_QUESTION) return cond;
+  PpEval_advance(e);
+  int64_t a = PpEval_conditional(e);
+  assert(e->tok.type == TOK_COLON);
+  PpEval_advance(e);
+  int64_t b = PpEval_conditional(e);
+  return cond ? a : b;
+}
+
+static bool Preprocessor_eval(Preprocessor *pp, const Token *tokens, uint32_t len) {
+  Preprocessor_push_context(pp, tokens, len, 0, true);
+  PpEval e = { .pp = pp };
+  PpEval_advance(&e);
+  int64_t value = PpEval_conditional(&e);
+  assert(!e.tok.type); // TODO: error for garbage after the expression
+  Preprocessor_pop_context(pp);
+  return value != 0;
+}
+
+// The name of the guard in #if !defined(NAME) or #if !defined NAME
+static bool Preprocessor_guard_pattern(const Token *tokens, uint32_t len) {
+  if (len == 3) {
+    return tokens[0].type == TOK_NOT && tokens[1].type == TOK_IDENT &&
+      tokens[2].type == TOK_IDENT;
+  }
+  return len == 5 && tokens[0].type == TOK_NOT && tokens[1].type == TOK_IDENT &&
+    tokens[2].type == TOK_LPAREN && tokens[3].type == TOK_IDENT &&
+    tokens[4].type == TOK_RPAREN;
+}
+
+// Skips the lines up to the branch, that's taken, or the #endif
+static void Preprocessor_skip(Preprocessor *pp) {
+  Lexer *l = &Preprocessor_file(pp)->lexer;
+  l->skipping = true;
+  uint32_t depth = 0;
+  while (1) {
+    Token tok = Lexer_next(l);
+    assert(tok.type); // TODO: error for unterminated conditional
+    if (tok.type != TOK_HASH || !Lexer_line_start(l, tok) || Lexer_line_end(l)) continue;
+    Directive d = Preprocessor_directive(pp, Lexer_next(l));
+    if (d == DIRECTIVE_IF || d == DIRECTIVE_IFDEF || d == DIRECTIVE_IFNDEF) depth++;
+    else if (d == DIRECTIVE_ENDIF && depth) depth--;
+    else if (d == DIRECTIVE_ENDIF) {
+      Preprocessor_pop_cond(pp);
+      break;
+    } else if (d == DIRECTIVE_ELSE && !depth) {
+      Preprocessor_branch(pp);
+      if (pp->conds[pp->cond_count - 1] != COND_SEEKING) continue;
+      pp->conds[pp->cond_count - 1] = COND_ACTIVE;
+      break;
+    } else if (d == DIRECTIVE_ELIF && !depth) {
+      Preprocessor_branch(pp);
+      if (pp->conds[pp->cond_count - 1] != COND_SEEKING) continue;
+      l->skipping = false;
+      Token *tokens;
+      uint32_t len = Preprocessor_line(pp, &tokens);
+      if (Preprocessor_eval(pp, tokens, len)) {
+        pp->conds[pp->cond_count - 1] = COND_ACTIVE;
+        break;
+      }
+      l->skipping = true;
+    }
+  }
+  l->skipping = false;
+}
+
+static void Preprocessor_push_cond(Preprocessor *pp, bool taken) {
+  assert(pp->cond_count < MAX_CONDITIONALS);
+  pp->conds[pp->cond_count++] = taken ? COND_ACTIVE : COND_SEEKING;
+  if (!taken) Preprocessor_skip(pp);
+}
+
+// After the '#' at the start of a line
+static void Preprocessor_run_directive(Preprocessor *pp) {
+  PpFile *f = Preprocessor_file(pp);
+  Lexer *l = &f->lexer;
+  bool first = f->guard == GUARD_START;
+  if (f->guard != GUARD_OPEN) f->guard = GUARD_NONE;
+  if (Lexer_line_end(l)) return;
+
+  Token name = Lexer_next(l);
+  Directive d = Preprocessor_directive(pp, name);
+  Token *tokens;
+  uint32_t len;
+  switch (d) {
+    case DIRECTIVE_DEFINE:
+      Preprocessor_define(pp);
+      break;
+    case DIRECTIVE_UNDEF:
+      Preprocessor_set_macro(pp, Preprocessor_ident(pp).sym, 0);
+      break;
+    case DIRECTIVE_INCLUDE:
+      Preprocessor_include(pp);
+      return;
+    case DIRECTIVE_IFDEF:
+    case DIRECTIVE_IFNDEF:
+      name = Preprocessor_ident(pp);
+      assert(Lexer_line_end(l));
+      if (first && d == DIRECTIVE_IFNDEF) {
+        f->guard = GUARD_OPEN;
+        f->guard_cond = pp->cond_count;
+        f->guard_name = name;
+      }
+      Preprocessor_push_cond(pp, !Preprocessor_macro(pp, name.sym) == (d == DIRECTIVE_IFNDEF));
+      return;
+    case DIRECTIVE_IF:
+      len = Preprocessor_line(pp, &tokens);
+      if (first && Preprocessor_guard_pattern(tokens, len) && tokens[1].sym == pp->sym_defined) {
+        f->guard = GUARD_OPEN;
+        f->guard_cond = pp->cond_count;
+        f->guard_name = tokens[len == 3 ? 2 : 3];
+      }
+      Preprocessor_push_cond(pp, Preprocessor_eval(pp, tokens, len));
+      return;
+    case DIRECTIVE_ELIF:
+    case DIRECTIVE_ELSE:
+      // The branch before was taken, the rest is skipped
+      Preprocessor_branch(pp);
+      pp->conds[pp->cond_count - 1] = COND_DONE;
+      Preprocessor_skip(pp);
+      return;
+    case DIRECTIVE_ENDIF:
+      Preprocessor_pop_cond(pp);
+      break;
+    case DIRECTIVE_PRAGMA:
+      len = Preprocessor_line(pp, &tokens);
+      if (len == 1 && tokens[0].type == TOK_IDENT) {
+        Str text = Preprocessor_text(pp, tokens[0]);
+        if (f->header && text.len == 4 && !memcmp(text.ptr, "once", 4)) {
+          HeaderCache_set_guard(f->header, (Str){0}, true);
+        }
+      }
+      // note: The other ones are ignored
+      return;
+    case DIRECTIVE_ERROR:
+    case DIRECTIVE_WARNING:
+      len = Preprocessor_line(pp, &tokens);
+      const char *start = SourceMap_text(&pp->sources, name.start);
+      fprintf(stderr, "#%.*s\n", (int)(l->ch - start), start);
+      // TODO: proper errors
+      assert(d == DIRECTIVE_WARNING);
+      return;
+    case DIRECTIVE_LINE:
+      // TODO: #line
+      Preprocessor_line(pp, &tokens);
+      return;
+    default:
+      assert(0); // TODO: error for unknown directive
+  }
+  assert(Lexer_line_end(l));
+}
+
+// The next token without the macro expansion
+static Token Preprocessor_read(Preprocessor *pp) {
+  while (1) {
+    if (pp->context_count) {
+      PpContext *c = &pp->contexts[pp->context_count - 1];
+      pp->from_context = true;
+      if (c->pos < c->len) return c->tokens[c->pos++];
+      if (c->barrier) return (Token){0};
+      Preprocessor_pop_context(pp);
+      continue;
+    }
+    pp->from_context = false;
+    PpFile *f = Preprocessor_file(pp);
+    if (f->pending.type) {
+      Token tok = f->pending;
+      f->pending.type = TOK_NONE;
+      return tok;
+    }
+    Token tok = Lexer_next(&f->lexer);
+    if (tok.type == TOK_HASH && Lexer_line_start(&f->lexer, tok)) {
+      Preprocessor_run_directive(pp);
+      continue;
+    }
+    if (!tok.type && pp->file_count > 1) {
+      Preprocessor_pop_file(pp);
+      continue;
+    }
+    if (f->guard != GUARD_OPEN) f->guard = GUARD_NONE;
+    return tok;
+  }
+}
+
+static void Preprocessor_unread(Preprocessor *pp, Token tok) {
+  if (!tok.type) return;
+  if (pp->from_context) pp->contexts[pp->context_count - 1].pos--;
+  else Preprocessor_file(pp)->pending = tok;
+}
+
+typedef struct {
+  uint32_t start;
+  uint32_t len;
+} PpArg;
+
+// note: The arguments are collected and expanded in their own arena,
+// the invocations inside of them use it too, but they give it back,
+// before the next token of the outer argument is added. Only the
+// result is copied into the expansions, where the contexts point.
+// After the '(' of the invocation
+static void Preprocessor_expand_function(Preprocessor *pp, MacroId id) {
+  Macro *m = &pp->macros[id];
+  Arena *expansion = &pp->arenas[ARENA_MACRO_ARGS];
+  const Token *tokens = (Token *)expansion->base;
+  size_t mark = expansion->size;
+  PpArg args[MAX_MACRO_PARAMS];
+  uint32_t arg_count = 0;
+  uint32_t depth = 0;
+  args[0].start = ARENA_LEN(expansion, Token);
+  while (1) {
+    Token tok = Preprocessor_read(pp);
+    assert(tok.type); // TODO: error for unterminated invocation
+    if (tok.type == TOK_LPAREN) depth++;
+    else if (tok.type == TOK_RPAREN && !depth) break;
+    else if (tok.type == TOK_RPAREN) depth--;
+    else if (tok.type == TOK_COMMA && !depth &&
+        !(m->variadic && arg_count + 1 >= m->params)) {
+      args[arg_count].len = ARENA_LEN(expansion, Token) - args[arg_count].start;
+      assert(++arg_count < MAX_MACRO_PARAMS);
+      args[arg_count].start = ARENA_LEN(expansion, Token);
+      continue;
+    }
+    *ARENA_PUSH(expansion, Token, 1) = tok;
+  }
+  args[arg_count].len = ARENA_LEN(expansion, Token) - args[arg_count].start;
+  arg_count++;
+  if (!m->params && arg_count == 1 && !args[0].len) arg_count = 0;
+  // the variable arguments can be left out
+  if (m->variadic && arg_count + 1 == m->params) {
+    args[arg_count++] = (PpArg){ ARENA_LEN(expansion, Token), 0 };
+  }
+  assert(arg_count == m->params); // TODO: error for wrong argument count
+
+  // note: The arguments are fully expanded on their own first
+  PpArg expanded[MAX_MACRO_PARAMS];
+  for (uint32_t i = 0; i < arg_count; ++i) {
+    Preprocessor_push_context(pp, tokens + args[i].start, args[i].len, 0, true);
+    expanded[i].start = ARENA_LEN(expansion, Token);
+    Token tok;
+    while ((tok = Preprocessor_expand_next(pp)).type) *ARENA_PUSH(expansion, Token, 1) = tok;
+    expanded[i].len = ARENA_LEN(expansion, Token) - expanded[i].start;
+    Preprocessor_pop_context(pp);
+  }
+
+  Arena *result = &pp->arenas[ARENA_EXPANSION];
+  uint32_t start = ARENA_LEN(result, Token);
+  const Token *body = (Token *)pp->arenas[ARENA_MACRO_TOKENS].base + m->tokens;
+  for (uint32_t i = 0; i < m->len; ++i) {
+    if (body[i].type != TOK_PARAM) {
+      *ARENA_PUSH(result, Token, 1) = body[i];
+      continue;
+    }
+    PpArg arg = expanded[body[i].sym];
+    memcpy(ARENA_PUSH(result, Token, arg.len), tokens + arg.start, sizeof(Token) * arg.len);
+  }
+  expansion->size = mark;
+  Preprocessor_push_context(pp, (Token *)result->base + start,
+      ARENA_LEN(result, Token) - start, id, false);
+}
+
+Token Preprocessor_expand_next(Preprocessor *pp) {
+  while (1) {
+    Token tok = Preprocessor_read(pp);
+    if (tok.type != TOK_IDENT || tok.flags & TOKEN_NOEXPAND) return tok;
+    MacroId id = Preprocessor_macro(pp, tok.sym);
+    if (!id) return tok;
+    Macro *m = &pp->macros[id];
+    if (m->disabled) {
+      tok.flags |= TOKEN_NOEXPAND;
+      return tok;
+    }
+    if (m->function_like) {
+      Token next = Preprocessor_read(pp);
+      if (next.type != TOK_LPAREN) {
+        Preprocessor_unread(pp, next);
+        return tok;
+      }
+      Preprocessor_expand_function(pp, id);
+    } else {
+      const Token *body = (Token *)pp->arenas[ARENA_MACRO_TOKENS].base + m->tokens;
+      Preprocessor_push_context(pp, body, m->len, id, false);
+    }
+    pp->stats.expansions++;
+  }
+}
+
+Token Preprocessor_next(Preprocessor *pp) {
+  // nothing refers to the expansions anymore
+  if (!pp->context_count) Arena_reset(&pp->arenas[ARENA_EXPANSION]);
+  return Preprocessor_expand_next(pp);
+}
+
+void Preprocessor_print_stats(FILE *out, const Preprocessor *pp) {
+  const PpStats *s = &pp->stats;
+  // without the main file and the builtins
+  fprintf(out, "preprocessor: %u headers, %u includes, %u skipped by guards, "
+      "%u by #pragma once, %u expansions\n", pp->files.count, s->includes,
+      s->guard_skips, s->once_skips, s->expansions);
+}
+
+void print_tokens(FILE *out, Preprocessor *pp) {
+  Token tok;
+  while ((tok = Preprocessor_next(pp)).type) {
+    fprintf(out, "% 3d:%02d %s\n", tok.start, tok.len, TOKEN_TYPE_STR[tok.type]);
+  }
+}
@@ -0,0 +1,70 @@
+#include "queue.h"
+#include "arena.h"
+#include <assert.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+void Queue_init(Queue *q, Arena *arena, uint32_t capacity) {
+  assert(capacity && !(capacity & (capacity - 1)));
+  *q = (Queue){
+    .cells = ARENA_PUSH(arena, QueueCell, capacity),
+    .mask = capacity - 1,
+  };
+  for (uint32_t i = 0; i < capacity; ++i) q->cells[i].seq = i;
+}
+
+bool Queue_try_push(Queue *q, uint32_t value) {
+  uint32_t pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+  QueueCell *cell;
+  while (1) {
+    cell = &q->cells[pos & q->mask];
+    uint32_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+    int32_t diff = (int32_t)(seq - pos);
+    if (diff < 0) return false;
+    // someone else took the position, try the next one
+    if (diff > 0) {
+      pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+      continue;
+    }
+    if (__atomic_compare_exchange_n(&q->tail, &pos, pos + 1, true,
+        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+  }
+  cell->value = value;
+  // publishes the value and everything written before the push
+  __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+bool Queue_try_pop(Queue *q, uint32_t *value) {
+  uint32_t pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+  QueueCell *cell;
+  while (1) {
+    cell = &q->cells[pos & q->mask];
+    uint32_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+    int32_t diff = (int32_t)(seq - (pos + 1));
+    if (diff < 0) return false;
+    if (diff > 0) {
+      pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+      continue;
+    }
+    if (__atomic_compare_exchange_n(&q->head, &pos, pos + 1, true,
+        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+  }
+  *value = cell->value;
+  // the cell is free for the push one lap later
+  __atomic_store_n(&cell->seq, pos + q->mask + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+// note: A full queue is the backpressure, the producer gives
+// up its time slice, until a consumer makes room
+void Queue_push(Queue *q, uint32_t value) {
+  while (!Queue_try_push(q, value)) sched_yield();
+}
+
+uint32_t Queue_pop(Queue *q) {
+  uint32_t value;
+  while (!Queue_try_pop(q, &value)) sched_yield();
+  return value;
+}
@@ -0,0 +1,305 @@
+#include "regalloc.h"
+#include "arena.h"
+#include "inst.h"
+#include <assert.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// note: "Linear Scan Register Allocation" by Poletto and Sarkar, on
+// the SSA form. The position of an instruction is its index, so the
+// blocks are laid out in their order, and every value gets a single
+// interval, from its definition to its last use. The operands of a
+// phi are used at the end of the predecessor, where they're copied.
+// The intervals start in the order of the values already, so there's
+// no sorting, and a step looks at the few active ones only.
+
+// The caller saved ones come first, they don't need to be saved
+static const uint8_t ALLOC_ORDER[] = {
+  REG_RSI, REG_RDI, REG_R8, REG_R9, REG_R10, REG_R11,
+  REG_RBX, REG_R12, REG_R13, REG_R14, REG_R15,
+};
+#define ALLOC_COUNT (sizeof(ALLOC_ORDER) / sizeof(ALLOC_ORDER[0]))
+// Of the arguments of the calls, the ones we don't allocate are left out
+static const uint8_t ARG_HINTS[] = { REG_RDI, REG_RSI, REG_NONE, REG_NONE, REG_R8, REG_R9 };
+
+typedef struct {
+  const Ir *ir;
+  uint32_t *locs;
+  uint32_t *end; // the position of the last use
+  uint32_t *calls; // the number of the calls before the position
+  ValueId *phi_of; // a phi, that uses the value, zero for none
+  uint8_t *hints; // the argument registers, that the values go to
+  // the ones in the registers, sorted by their end
+  ValueId active[ALLOC_COUNT];
+  uint32_t active_count;
+  uint32_t free; // the mask of the registers
+  // the stack slots, that can be reused, in the order they were
+  // released, with the positions where it happened
+  uint32_t *free_slots;
+  uint32_t *released_at;
+  uint32_t slot_head;
+  uint32_t slot_tail;
+  // the spilled values, linked by their end
+  ValueId *release;
+  ValueId *release_next;
+} Allocator;
+
+static inline uint32_t Ir_terminator(const Ir *ir, BlockId block) {
+  return ir->blocks[block].start + ir->blocks[block].len - 1;
+}
+
+// note: A value, that's live at the head of a loop, has to live to the
+// end of the last block, that jumps back there. The heads are the targets
+// of the edges, that go back in the order, which catches the irreducible
+// ones too. The heads after the start of an interval and before its end
+// are found with a sparse table of their loop ends, a value is extended
+// until it covers all of them, that's once for the nested loops.
+static void Allocator_loops(Allocator *a, Arena *scratch) {
+  const Ir *ir = a->ir;
+  uint32_t *loop_end = ARENA_PUSH(scratch, uint32_t, (ir->block_count + 1) & ~1u);
+  for (BlockId i = 0; i < ir->block_count; ++i) loop_end[i] = 0;
+  uint32_t head_count = 0;
+  for (BlockId i = 0; i < ir->block_count; ++i) {
+    const Block *b = &ir->blocks[i];
+    for (uint32_t j = 0; j < b->succ_count; ++j) {
+      BlockId head = b->succs[j];
+      if (head > i) continue;
+      if (!loop_end[head]) head_count++;
+      if (loop_end[head] < Ir_terminator(ir, i)) loop_end[head] = Ir_terminator(ir, i);
+    }
+  }
+  if (!head_count) return;
+
+  // the number of the heads up to the block, and their positions
+  uint32_t *head_upto = ARENA_PUSH(scratch, uint32_t, (ir->block_count + 1) & ~1u);
+  uint32_t *head_start = ARENA_PUSH(scratch, uint32_t, (head_count + 1) & ~1u);
+  uint32_t levels = 1;
+  while (1u << levels <= head_count) levels++;
+  uint32_t *table = ARENA_PUSH(scratch, uint32_t, (levels * head_count + 1) & ~1u);
+  uint32_t count = 0;
+  for (BlockId i = 0; i < ir->block_count; ++i) {
+    if (loop_end[i]) {
+      head_start[count] = ir->blocks[i].start;
+      table[count++] = loop_end[i];
+    }
+    head_upto[i] = count;
+  }
+  for (uint32_t l = 1; l < levels; ++l) {
+    uint32_t *prev = table + (l - 1) * head_count, *row = table + l * head_count;
+    for (uint32_t k = 0; k + (1u << l) <= head_count; ++k) {
+      uint32_t x = prev[k], y = prev[k + (1u << (l - 1))];
+      row[k] = x > y ? x : y;
+    }
+  }
+
+  uint32_t first = 0; // the first head after the value
+  for (ValueId v = 1; v < ir->inst_count; ++v) {
+    while (first < head_count && head_start[first] <= v) first++;
+    if (a->locs[v] == LOC_CONST || !Inst_has_value(&ir->insts[v])) continue;
+    while (1) {
+      uint32_t last = head_upto[ir->insts[a->end[v]].block];
+      if (last <= first) break;
+      uint32_t l = 31 - __builtin_clz(last - first);
+      uint32_t x = table[l * head_count + first], y = table[l * head_count + last - (1u << l)];
+      if (x < y) x = y;
+      if (x <= a->end[v]) break;
+      a->end[v] = x;
+    }
+  }
+}
+
+// The ends of the intervals and the hints
+static void Allocator_intervals(Allocator *a, Arena *scratch) {
+  const Ir *ir = a->ir;
+  uint32_t n = ir->inst_count;
+  a->calls[0] = 0;
+  for (ValueId v = 0; v < n; ++v) {
+    const Inst *inst = &ir->insts[v];
+    a->end[v] = v;
+    a->phi_of[v] = 0;
+    a->hints[v] = REG_NONE;
+    a->calls[v + 1] = a->calls[v] + (inst->type == INST_CALL);
+    if (inst->type == INST_CONST || inst->type == INST_UNDEF) a->locs[v] = LOC_CONST;
+    else a->locs[v] = LOC_NONE;
+  }
+  // the placeholder reads as a zero
+  a->locs[0] = LOC_CONST;
+  for (ValueId v = 1; v < n; ++v) {
+    const Inst *inst = &ir->insts[v];
+    ValueId buffer[2];
+    const ValueId *operands;
+    uint32_t count = Ir_operands(ir, inst, buffer, &operands);
+    const BlockId *preds = ir->preds + ir->blocks[inst->block].preds;
+    for (uint32_t i = 0; i < count; ++i) {
+      ValueId w = operands[i];
+      uint32_t use = v;
+      if (inst->type == INST_PHI) {
+        use = Ir_terminator(ir, preds[i]);
+        a->phi_of[w] = v;
+      }
+      if (a->end[w] < use) a->end[w] = use;
+    }
+  }
+  Allocator_loops(a, scratch);
+
+  // the arguments, that aren't used after the call
+  for (ValueId v = 1; v < n; ++v) {
+    const Inst *inst = &ir->insts[v];
+    if (inst->type != INST_CALL) continue;
+    for (uint32_t i = 0; i < inst->count && i < sizeof(ARG_HINTS); ++i) {
+      ValueId w = ir->args[inst->b + i];
+      if (a->end[w] == v) a->hints[w] = ARG_HINTS[i];
+    }
+  }
+}
+
+// The register, that would save a copy
+static uint8_t Allocator_hint(const Allocator *a, ValueId v) {
+  const Ir *ir = a->ir;
+  const Inst *inst = &ir->insts[v];
+  if (a->hints[v] != REG_NONE) return a->hints[v];
+  // the phi and its operands, the copy on the edge goes away
+  ValueId phi = a->phi_of[v];
+  if (phi && phi < v && a->locs[phi] < LOC_SLOT) return a->locs[phi];
+  if (inst->type == INST_PHI) {
+    for (uint32_t i = 0; i < inst->count; ++i) {
+      ValueId w = ir->args[inst->b + i];
+      if (w < v && a->locs[w] < LOC_SLOT) return a->locs[w];
+    }
+    return REG_NONE;
+  }
+  // the result goes where the first operand was, when it ends here
+  if (inst->type >= INST_ADD && inst->type <= INST_CAST) {
+    ValueId w = inst->a;
+    if (a->end[w] == v && a->locs[w] < LOC_SLOT) return a->locs[w];
+  }
+  return REG_NONE;
+}
+
+// note: A value, that's spilled later, started before some of the slots
+// were released, only the ones, that were free at its start, can be used.
+// The latest one goes to the values, that are just starting, and the
+// oldest one to the older values.
+static void Allocator_spill(Allocator *a, RegAlloc *ra, ValueId v) {
+  uint32_t slot;
+  if (a->slot_head < a->slot_tail && a->released_at[a->slot_tail - 1] <= v) {
+    slot = a->free_slots[--a->slot_tail];
+  } else if (a->slot_head < a->slot_tail && a->released_at[a->slot_head] <= v) {
+    slot = a->free_slots[a->slot_head++];
+  } else {
+    slot = ra->slot_count++;
+  }
+  a->locs[v] = LOC_SLOT + slot;
+  a->release_next[v] = a->release[a->end[v]];
+  a->release[a->end[v]] = v;
+}
+
+static void Allocator_activate(Allocator *a, ValueId v) {
+  uint32_t i = a->active_count++;
+  for (; i && a->end[a->active[i - 1]] > a->end[v]; --i) a->active[i] = a->active[i - 1];
+  a->active[i] = v;
+}
+
+// note: Before any of them is spilled, the operands, that end at a
+// value, aren't live there anymore, like they're given up below
+static uint32_t Allocator_pressure(const Allocator *a, Arena *scratch) {
+  const Ir *ir = a->ir;
+  uint32_t n = ir->inst_count;
+  uint32_t *ending = ARENA_PUSH(scratch, uint32_t, (n + 1) & ~1u);
+  for (ValueId v = 0; v < n; ++v) ending[v] = 0;
+  uint32_t live = 0, peak = 0;
+  for (ValueId v = 1; v < n; ++v) {
+    live -= ending[v];
+    if (a->locs[v] == LOC_CONST || !Inst_has_value(&ir->insts[v]) || a->end[v] == v) continue;
+    ending[a->end[v]]++;
+    if (++live > peak) peak = live;
+  }
+  return peak;
+}
+
+void Ir_allocate(const Ir *ir, Arena *scratch, RegAlloc *ra, RegAllocStats *stats) {
+  uint32_t n = ir->inst_count;
+  uint32_t padded = (n + 2) & ~1u;
+  Allocator a = {
+    .ir = ir,
+    .locs = ARENA_PUSH(scratch, uint32_t, padded),
+    .end = ARENA_PUSH(scratch, uint32_t, padded),
+    .calls = ARENA_PUSH(scratch, uint32_t, padded),
+    .phi_of = ARENA_PUSH(scratch, ValueId, padded),
+    .hints = ARENA_PUSH(scratch, uint8_t, (n + 7) & ~7u),
+    .free = REG_CALLER_SAVED | REG_CALLEE_SAVED,
+    .free_slots = ARENA_PUSH(scratch, uint32_t, padded),
+    .released_at = ARENA_PUSH(scratch, uint32_t, padded),
+    .release = ARENA_PUSH(scratch, ValueId, padded),
+    .release_next = ARENA_PUSH(scratch, ValueId, padded),
+  };
+  *ra = (RegAlloc){ .locs = a.locs };
+  Allocator_intervals(&a, scratch);
+  if (stats) ra->pressure = Allocator_pressure(&a, scratch);
+  for (ValueId v = 0; v < n; ++v) a.release[v] = 0;
+
+  ValueId released = 0;
+  for (ValueId v = 1; v < n; ++v) {
+    if (a.locs[v] == LOC_CONST || !Inst_has_value(&ir->insts[v])) continue;
+    // note: The operands are read before the result is written,
+    // so the ones, that end here, give their place to it
+    while (a.active_count && a.end[a.active[0]] <= v) {
+      a.free |= 1u << a.locs[a.active[0]];
+      a.active_count--;
+      for (uint32_t i = 0; i < a.active_count; ++i) a.active[i] = a.active[i + 1];
+    }
+    for (; released <= v; ++released) {
+      for (ValueId w = a.release[released]; w; w = a.release_next[w]) {
+        a.released_at[a.slot_tail] = released;
+        a.free_slots[a.slot_tail++] = a.locs[w] - LOC_SLOT;
+      }
+    }
+    if (a.end[v] == v) continue;
+
+    // the ones, that live across a call, can't be in a caller saved one
+    bool across = a.calls[a.end[v]] - a.calls[v + 1] != 0;
+    uint32_t allowed = across ? REG_CALLEE_SAVED : REG_CALLER_SAVED | REG_CALLEE_SAVED;
+    uint32_t free = a.free & allowed;
+    uint8_t reg = Allocator_hint(&a, v);
+    if (reg == REG_NONE || !(free >> reg & 1)) {
+      reg = REG_NONE;
+      for (uint32_t i = 0; i < ALLOC_COUNT && reg == REG_NONE; ++i) {
+        if (free >> ALLOC_ORDER[i] & 1) reg = ALLOC_ORDER[i];
+      }
+    }
+    if (reg == REG_NONE) {
+      // the one, that ends last, goes to the stack
+      uint32_t i = a.active_count;
+      while (i && !(allowed >> a.locs[a.active[i - 1]] & 1)) i--;
+      if (!i || a.end[a.active[i - 1]] <= a.end[v]) {
+        Allocator_spill(&a, ra, v);
+        continue;
+      }
+      ValueId spilled = a.active[i - 1];
+      reg = a.locs[spilled];
+      Allocator_spill(&a, ra, spilled);
+      a.active_count--;
+      for (i--; i < a.active_count; ++i) a.active[i] = a.active[i + 1];
+    } else {
+      a.free &= ~(1u << reg);
+    }
+    a.locs[v] = reg;
+    Allocator_activate(&a, v);
+    if (REG_CALLEE_SAVED >> reg & 1) ra->callee_saved |= 1u << reg;
+  }
+  if (!stats) return;
+  uint32_t peak = __atomic_load_n(&stats->peak, __ATOMIC_RELAXED);
+  while (peak < ra->pressure && !__atomic_compare_exchange_n(&stats->peak, &peak,
+      ra->pressure, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+  __atomic_fetch_add(&stats->pressure, ra->pressure, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&stats->slots, ra->slot_count, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&stats->functions, 1, __ATOMIC_RELAXED);
+}
+
+void RegAlloc_print_stats(FILE *out, const RegAllocStats *stats) {
+  fprintf(out, "regalloc: %" PRIu64 " functions, peak pressure %u, %.1f on average, %"
+      PRIu64 " spill slots\n", stats->functions, stats->peak,
+      stats->functions ? (double)stats->pressure / stats->functions : 0.0, stats->slots);
+}
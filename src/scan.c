@@ -0,0 +1,242 @@
+#include "scan.h"
+#include <assert.h>
+#include <stdint.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#define ALWAYS_INLINE __attribute__((always_inline)) inline
+#endif
+
+uint8_t char_class[256];
+Scanner scan;
+
+const char *scalar_space(const char *ch) {
+  while (char_class[(uint8_t)*ch] & CLASS_SPACE) ch++;
+  return ch;
+}
+
+const char *scalar_digits(const char *ch) {
+  while (char_class[(uint8_t)*ch] & CLASS_DIGIT) ch++;
+  return ch;
+}
+
+const char *scalar_ident(const char *ch) {
+  while (char_class[(uint8_t)*ch] & CLASS_IDENT) ch++;
+  return ch;
+}
+
+const char *scalar_line_end(const char *ch) {
+  while (*ch && *ch != '\n') ch++;
+  return ch;
+}
+
+const char *scalar_comment_end(const char *ch) {
+  while (*ch && !(ch[0] == '*' && ch[1] == '/')) ch++;
+  return ch;
+}
+
+#if defined(__x86_64__)
+
+// note: A load never crosses a page boundary, unaligned loads
+// are used, unless the block would end on the next page, then
+// it's loaded aligned and the bytes before ch are shifted out.
+// Because of that reading past the terminator is always safe.
+#define PAGE_SIZE_MIN 4096
+
+// Returns a mask of the bytes, where the scan should stop
+typedef __m128i (*Sse2Stop)(__m128i v);
+
+static ALWAYS_INLINE const char *sse2_scan(const char *ch, Sse2Stop stop) {
+  while (1) {
+    uint32_t bits;
+    if (((uintptr_t)ch & (PAGE_SIZE_MIN - 1)) > PAGE_SIZE_MIN - 16) {
+      uintptr_t offset = (uintptr_t)ch & 15;
+      const char *block = ch - offset;
+      bits = (uint32_t)_mm_movemask_epi8(stop(_mm_load_si128((const __m128i *)block))) >> offset;
+      if (bits) return ch + __builtin_ctz(bits);
+      ch = block + 16;
+      continue;
+    }
+    bits = _mm_movemask_epi8(stop(_mm_loadu_si128((const __m128i *)ch)));
+    if (bits) return ch + __builtin_ctz(bits);
+    ch += 16;
+  }
+}
+
+// Unsigned lo <= v <= hi for every byte
+static ALWAYS_INLINE __m128i sse2_range(__m128i v, char lo, char hi) {
+  __m128i x = _mm_sub_epi8(v, _mm_set1_epi8(lo));
+  x = _mm_subs_epu8(x, _mm_set1_epi8(hi - lo));
+  return _mm_cmpeq_epi8(x, _mm_setzero_si128());
+}
+
+static ALWAYS_INLINE __m128i sse2_not(__m128i v) {
+  return _mm_xor_si128(v, _mm_set1_epi8(-1));
+}
+
+static ALWAYS_INLINE __m128i sse2_stop_space(__m128i v) {
+  __m128i space = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+      sse2_range(v, '\t', '\r'));
+  return sse2_not(space);
+}
+
+static ALWAYS_INLINE __m128i sse2_stop_digits(__m128i v) {
+  return sse2_not(sse2_range(v, '0', '9'));
+}
+
+static ALWAYS_INLINE __m128i sse2_stop_ident(__m128i v) {
+  __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+  __m128i ident = _mm_or_si128(sse2_range(lower, 'a', 'z'), sse2_range(v, '0', '9'));
+  ident = _mm_or_si128(ident, _mm_cmpeq_epi8(v, _mm_set1_epi8('_')));
+  return sse2_not(ident);
+}
+
+static ALWAYS_INLINE __m128i sse2_stop_line_end(__m128i v) {
+  return _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')),
+      _mm_cmpeq_epi8(v, _mm_setzero_si128()));
+}
+
+static ALWAYS_INLINE __m128i sse2_stop_star(__m128i v) {
+  return _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('*')),
+      _mm_cmpeq_epi8(v, _mm_setzero_si128()));
+}
+
+const char *sse2_space(const char *ch) {
+  return sse2_scan(ch, sse2_stop_space);
+}
+
+const char *sse2_digits(const char *ch) {
+  return sse2_scan(ch, sse2_stop_digits);
+}
+
+const char *sse2_ident(const char *ch) {
+  return sse2_scan(ch, sse2_stop_ident);
+}
+
+const char *sse2_line_end(const char *ch) {
+  return sse2_scan(ch, sse2_stop_line_end);
+}
+
+const char *sse2_comment_end(const char *ch) {
+  while (1) {
+    ch = sse2_scan(ch, sse2_stop_star);
+    if (!*ch || ch[1] == '/') return ch;
+    ch++;
+  }
+}
+
+typedef __m256i (*Avx2Stop)(__m256i v);
+
+static TARGET_AVX2 ALWAYS_INLINE const char *avx2_scan(const char *ch, Avx2Stop stop) {
+  while (1) {
+    uint32_t bits;
+    if (((uintptr_t)ch & (PAGE_SIZE_MIN - 1)) > PAGE_SIZE_MIN - 32) {
+      uintptr_t offset = (uintptr_t)ch & 31;
+      const char *block = ch - offset;
+      bits = (uint32_t)_mm256_movemask_epi8(stop(_mm256_load_si256((const __m256i *)block))) >> offset;
+      if (bits) return ch + __builtin_ctz(bits);
+      ch = block + 32;
+      continue;
+    }
+    bits = _mm256_movemask_epi8(stop(_mm256_loadu_si256((const __m256i *)ch)));
+    if (bits) return ch + __builtin_ctz(bits);
+    ch += 32;
+  }
+}
+
+// Looks up the class of every byte in CLASS_LOW and CLASS_HIGH
+// and returns a mask of the bytes, that are not in the class
+static TARGET_AVX2 ALWAYS_INLINE __m256i avx2_stop_class(__m256i v, uint8_t class) {
+  __m256i low_table = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)CLASS_LOW));
+  __m256i high_table = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)CLASS_HIGH));
+  __m256i nibble = _mm256_set1_epi8(0x0f);
+  __m256i low = _mm256_shuffle_epi8(low_table, _mm256_and_si256(v, nibble));
+  __m256i high = _mm256_shuffle_epi8(high_table,
+      _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble));
+  __m256i cls = _mm256_and_si256(_mm256_and_si256(low, high), _mm256_set1_epi8(class));
+  return _mm256_cmpeq_epi8(cls, _mm256_setzero_si256());
+}
+
+static TARGET_AVX2 ALWAYS_INLINE __m256i avx2_stop_space(__m256i v) {
+  return avx2_stop_class(v, CLASS_SPACE);
+}
+
+static TARGET_AVX2 ALWAYS_INLINE __m256i avx2_stop_digits(__m256i v) {
+  return avx2_stop_class(v, CLASS_DIGIT);
+}
+
+static TARGET_AVX2 ALWAYS_INLINE __m256i avx2_stop_ident(__m256i v) {
+  return avx2_stop_class(v, CLASS_IDENT);
+}
+
+static TARGET_AVX2 ALWAYS_INLINE __m256i avx2_stop_line_end(__m256i v) {
+  return _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')),
+      _mm256_cmpeq_epi8(v, _mm256_setzero_si256()));
+}
+
+static TARGET_AVX2 ALWAYS_INLINE __m256i avx2_stop_star(__m256i v) {
+  return _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('*')),
+      _mm256_cmpeq_epi8(v, _mm256_setzero_si256()));
+}
+
+TARGET_AVX2 const char *avx2_space(const char *ch) {
+  return avx2_scan(ch, avx2_stop_space);
+}
+
+TARGET_AVX2 const char *avx2_digits(const char *ch) {
+  return avx2_scan(ch, avx2_stop_digits);
+}
+
+TARGET_AVX2 const char *avx2_ident(const char *ch) {
+  return avx2_scan(ch, avx2_stop_ident);
+}
+
+TARGET_AVX2 const char *avx2_line_end(const char *ch) {
+  return avx2_scan(ch, avx2_stop_line_end);
+}
+
+TARGET_AVX2 const char *avx2_comment_end(const char *ch) {
+  while (1) {
+    ch = avx2_scan(ch, avx2_stop_star);
+    if (!*ch || ch[1] == '/') return ch;
+    ch++;
+  }
+}
+
+#endif
+
+const Scanner SCANNERS[SCAN_COUNT] = {
+  [SCAN_SCALAR] = {
+    scalar_space, scalar_digits, scalar_ident,
+    scalar_line_end, scalar_comment_end,
+  },
+#if defined(__x86_64__)
+  [SCAN_SSE2] = {
+    sse2_space, sse2_digits, sse2_ident,
+    sse2_line_end, sse2_comment_end,
+  },
+  [SCAN_AVX2] = {
+    avx2_space, avx2_digits, avx2_ident,
+    avx2_line_end, avx2_comment_end,
+  },
+#endif
+};
+
+ScanLevel scan_detect(void) {
+#if defined(__x86_64__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) return SCAN_AVX2;
+  return SCAN_SSE2;
+#else
+  return SCAN_SCALAR;
+#endif
+}
+
+void scan_select(ScanLevel level) {
+  assert(level < SCAN_COUNT && SCANNERS[level].space);
+  for (int i = 0; i < 256; ++i) {
+    char_class[i] = i < 128 ? CLASS_LOW[i & 15] & CLASS_HIGH[i >> 4] : 0;
+  }
+  scan = SCANNERS[level];
+}
@@ -0,0 +1,313 @@
+#include "server.h"
+#include "driver.h"
+#include "preprocessor.h"
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static bool socket_address(struct sockaddr_un *addr, const char *path) {
+  *addr = (struct sockaddr_un){ .sun_family = AF_UNIX };
+  if (strlen(path) >= sizeof(addr->sun_path)) {
+    fprintf(stderr, "socket path '%s' is too long\n", path);
+    return false;
+  }
+  strcpy(addr->sun_path, path);
+  return true;
+}
+
+static bool read_all(int fd, void *data, size_t len) {
+  while (len) {
+    ssize_t n = read(fd, data, len);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    data = (uint8_t *)data + n;
+    len -= n;
+  }
+  return true;
+}
+
+static bool write_all(int fd, const void *data, size_t len) {
+  while (len) {
+    ssize_t n = write(fd, data, len);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    data = (const uint8_t *)data + n;
+    len -= n;
+  }
+  return true;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+static void Server_print_stats(const Server *s, FILE *out) {
+  uint32_t count = s->latency_count;
+  fprintf(out, "server: %u requests", count);
+  if (!count) {
+    fprintf(out, "\n");
+    return;
+  }
+  double *sorted = malloc(sizeof(double) * count);
+  assert(sorted);
+  memcpy(sorted, s->latencies, sizeof(double) * count);
+  qsort(sorted, count, sizeof(double), compare_doubles);
+  // nearest rank
+  const uint32_t percentiles[] = { 50, 90, 99 };
+  for (uint32_t i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); ++i) {
+    uint32_t rank = (percentiles[i] * count + 99) / 100;
+    fprintf(out, ", p%u %.3f ms", percentiles[i], sorted[rank - 1] * 1e3);
+  }
+  fprintf(out, ", max %.3f ms\n", sorted[count - 1] * 1e3);
+  free(sorted);
+}
+
+// note: Every request is compiled in a child, so an assert or an exit
+// of the compiler only ends that one, and nothing it does is left for
+// the next one. It inherits the workspaces and the headers of the
+// server. The paths of the headers, that it opened, come back over a
+// pipe, for the server to open them too, so the next child gets them.
+static int Server_compile(Server *s, int argc, const char **argv,
+    const char *cwd, int out, int err) {
+  int pipe_fds[2];
+  int res = pipe(pipe_fds);
+  assert(!res);
+  uint32_t known = HeaderCache_count();
+  fflush(stdout);
+  fflush(stderr);
+  pid_t pid = fork();
+  assert(pid >= 0);
+  if (!pid) {
+    close(pipe_fds[0]);
+    if (chdir(cwd)) {
+      dprintf(err, "can't change to '%s'\n", cwd);
+      _exit(1);
+    }
+    if (dup2(out, STDOUT_FILENO) < 0 || dup2(err, STDERR_FILENO) < 0) _exit(1);
+    int status = Driver_main(argc, argv, s->workspaces, s->workspace_count);
+    fflush(stdout);
+    fflush(stderr);
+    for (uint32_t id = known; id < HeaderCache_count(); ++id) {
+      Str path = HeaderCache_path(id);
+      if (!write_all(pipe_fds[1], path.ptr, path.len) || !write_all(pipe_fds[1], "", 1)) break;
+    }
+    _exit(status);
+  }
+  close(pipe_fds[1]);
+  // note: Read before the wait, the child blocks on a full pipe
+  char *paths = 0;
+  size_t len = 0, capacity = 0;
+  while (1) {
+    if (len == capacity) {
+      capacity = capacity ? capacity * 2 : PATH_MAX;
+      paths = realloc(paths, capacity);
+      assert(paths);
+    }
+    ssize_t n = read(pipe_fds[0], paths + len, capacity - len);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) break;
+    len += n;
+  }
+  close(pipe_fds[0]);
+  int status;
+  while (waitpid(pid, &status, 0) < 0) assert(errno == EINTR);
+  // the last one is cut short, if the child didn't finish it
+  for (size_t start = 0, i = 0; i < len; ++i) {
+    if (paths[i]) continue;
+    HeaderCache_open(paths + start, i - start);
+    start = i + 1;
+  }
+  free(paths);
+  if (WIFEXITED(status)) return WEXITSTATUS(status);
+  dprintf(err, "the compiler was killed by signal %d\n", WTERMSIG(status));
+  return 128 + WTERMSIG(status);
+}
+
+// Runs in the directory of the client, with its output
+static int Server_request(Server *s, int argc, const char **argv,
+    const char *cwd, int out, int err) {
+  if (argc == 2 && !strcmp(argv[1], "--server-stats")) {
+    FILE *file = fdopen(dup(out), "w");
+    assert(file);
+    Server_print_stats(s, file);
+    int res = fclose(file);
+    assert(!res);
+    return 0;
+  }
+  if (argc == 2 && !strcmp(argv[1], "--shutdown")) {
+    s->running = false;
+    return 0;
+  }
+  // note: The program would run in the server, with its
+  // environment and limits, instead of the client's ones
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--run")) continue;
+    dprintf(err, "--run isn't served, run it without the server\n");
+    return 1;
+  }
+  HeaderCache_refresh();
+  return Server_compile(s, argc, argv, cwd, out, err);
+}
+
+// Returns false, if the request is malformed
+static bool Server_handle(Server *s, int client) {
+  ServerRequest req;
+  int fds[2];
+  char control[CMSG_SPACE(sizeof(fds))];
+  struct iovec iov = { &req, sizeof(req) };
+  struct msghdr msg = {
+    .msg_iov = &iov,
+    .msg_iovlen = 1,
+    .msg_control = control,
+    .msg_controllen = sizeof(control),
+  };
+  ssize_t n = recvmsg(client, &msg, MSG_WAITALL);
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  if (n != sizeof(req) || !cmsg || cmsg->cmsg_type != SCM_RIGHTS
+      || cmsg->cmsg_len != CMSG_LEN(sizeof(fds))) {
+    return false;
+  }
+  memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+  double start = time_now();
+
+  char *strings = 0;
+  const char **argv = 0;
+  bool ok = req.magic == SERVER_MAGIC && req.len <= SERVER_MAX_REQUEST && req.argc
+      && (strings = malloc(req.len + 1)) && read_all(client, strings, req.len);
+  if (ok) {
+    // the cwd and then the arguments
+    strings[req.len] = 0;
+    argv = calloc(req.argc + 1, sizeof(char *));
+    assert(argv);
+    const char *str = strings + strlen(strings) + 1;
+    for (uint32_t i = 0; i < req.argc && ok; ++i) {
+      ok = str < strings + req.len;
+      argv[i] = str;
+      str += strlen(str) + 1;
+    }
+  }
+  int32_t status = 1;
+  if (ok) status = Server_request(s, req.argc, argv, strings, fds[0], fds[1]);
+  close(fds[0]);
+  close(fds[1]);
+  free(argv);
+  free(strings);
+  if (!ok) return false;
+
+  if (s->latency_count == s->latency_capacity) {
+    s->latency_capacity = s->latency_capacity ? s->latency_capacity * 2 : 256;
+    s->latencies = realloc(s->latencies, sizeof(double) * s->latency_capacity);
+    assert(s->latencies);
+  }
+  s->latencies[s->latency_count++] = time_now() - start;
+  write_all(client, &status, sizeof(status));
+  return true;
+}
+
+int Server_run(const char *path) {
+  Server s = { .path = path, .running = true };
+  struct sockaddr_un addr;
+  if (!socket_address(&addr, path)) return 1;
+  // a client, that's gone, isn't an error of the server
+  signal(SIGPIPE, SIG_IGN);
+  s.fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  assert(s.fd >= 0);
+  // note: Left behind by a server, that didn't shut down
+  unlink(path);
+  if (bind(s.fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(s.fd, SERVER_BACKLOG) < 0) {
+    fprintf(stderr, "can't listen on '%s': %s\n", path, strerror(errno));
+    return 1;
+  }
+  if (!scan.space) scan_select(scan_detect());
+  s.workspace_count = sysconf(_SC_NPROCESSORS_ONLN);
+  s.workspaces = calloc(s.workspace_count, sizeof(Workspace));
+  assert(s.workspaces);
+  // made once, for the children to inherit them
+  for (uint32_t i = 0; i < s.workspace_count; ++i) {
+    Arenas_init(&s.workspaces[i].arenas);
+    Interner_init(&s.workspaces[i].interner);
+    s.workspaces[i].ready = true;
+  }
+
+  while (s.running) {
+    int client = accept(s.fd, 0, 0);
+    if (client < 0) {
+      assert(errno == EINTR || errno == ECONNABORTED);
+      continue;
+    }
+    if (!Server_handle(&s, client)) fprintf(stderr, "malformed request\n");
+    close(client);
+  }
+
+  close(s.fd);
+  unlink(path);
+  Server_print_stats(&s, stderr);
+  for (uint32_t i = 0; i < s.workspace_count; ++i) {
+    if (!s.workspaces[i].ready) continue;
+    Arenas_free(&s.workspaces[i].arenas);
+    Interner_free(&s.workspaces[i].interner);
+  }
+  free(s.workspaces);
+  free(s.latencies);
+  return 0;
+}
+
+int Client_run(const char *path, int argc, const char **argv) {
+  struct sockaddr_un addr;
+  if (!socket_address(&addr, path)) return 1;
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  assert(fd >= 0);
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    fprintf(stderr, "can't connect to '%s': %s\n", path, strerror(errno));
+    return 1;
+  }
+
+  char cwd[PATH_MAX];
+  assert(getcwd(cwd, sizeof(cwd)));
+  size_t len = strlen(cwd) + 1;
+  for (int i = 0; i < argc; ++i) len += strlen(argv[i]) + 1;
+  assert(len <= SERVER_MAX_REQUEST);
+  char *strings = malloc(len), *str = strings;
+  assert(strings);
+  str = stpcpy(str, cwd) + 1;
+  for (int i = 0; i < argc; ++i) str = stpcpy(str, argv[i]) + 1;
+
+  ServerRequest req = { SERVER_MAGIC, argc, len };
+  int fds[2] = { STDOUT_FILENO, STDERR_FILENO };
+  char control[CMSG_SPACE(sizeof(fds))] = {0};
+  struct iovec iov = { &req, sizeof(req) };
+  struct msghdr msg = {
+    .msg_iov = &iov,
+    .msg_iovlen = 1,
+    .msg_control = control,
+    .msg_controllen = sizeof(control),
+  };
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+  // our output goes to the files, not to the socket
+  fflush(stdout);
+  fflush(stderr);
+  bool sent = sendmsg(fd, &msg, 0) == sizeof(req) && write_all(fd, strings, len);
+  free(strings);
+
+  int32_t status;
+  if (!sent || !read_all(fd, &status, sizeof(status))) {
+    fprintf(stderr, "the server at '%s' closed the connection\n", path);
+    status = 1;
+  }
+  close(fd);
+  return status;
+}
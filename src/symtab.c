@@ -0,0 +1,92 @@
+#include "symtab.h"
+#include "arena.h"
+#include <assert.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// Fibonacci hashing, the ids are dense, so we need to spread them
+static inline uint32_t SymTab_hash(const SymTab *t, SymId name) {
+  return (name * 2654435769u) >> (32 - t->bits);
+}
+
+static SymSlot *SymTab_alloc(SymTab *t, uint32_t bits) {
+  SymSlot *slots = ARENA_PUSH(t->arena, SymSlot, 1 << bits);
+  memset(slots, 0, sizeof(SymSlot) << bits);
+  return slots;
+}
+
+void SymTab_init(SymTab *t, Arena *arena) {
+  *t = (SymTab){
+    .arena = arena,
+    .bits = SYMTAB_MIN_BITS,
+  };
+  t->slots = SymTab_alloc(t, t->bits);
+}
+
+static void SymTab_grow(SymTab *t) {
+  SymSlot *old = t->slots;
+  uint32_t old_capacity = 1 << t->bits;
+  t->bits++;
+  t->slots = SymTab_alloc(t, t->bits);
+  uint32_t mask = (1 << t->bits) - 1;
+  for (uint32_t i = 0; i < old_capacity; ++i) {
+    if (!old[i].name) continue;
+    uint32_t index = SymTab_hash(t, old[i].name);
+    while (t->slots[index].name) index = (index + 1) & mask;
+    t->slots[index] = old[i];
+  }
+}
+
+static inline SymSlot *SymTab_find(SymTab *t, SymId name) {
+  uint32_t mask = (1 << t->bits) - 1;
+  uint32_t index = SymTab_hash(t, name);
+  uint32_t probes = 1;
+  while (t->slots[index].name && t->slots[index].name != name) {
+    index = (index + 1) & mask;
+    probes++;
+  }
+  t->lookups++;
+  t->probes += probes;
+  if (probes > t->max_probes) t->max_probes = probes;
+  return &t->slots[index];
+}
+
+SymSlot *SymTab_entry(SymTab *t, SymId name) {
+  assert(name);
+  SymSlot *slot = SymTab_find(t, name);
+  if (slot->name) return slot;
+  // Keep the load factor under a half
+  if ((t->count + 1) * 2 > (1u << t->bits)) {
+    SymTab_grow(t);
+    slot = SymTab_find(t, name);
+  }
+  t->count++;
+  *slot = (SymSlot){ name, 0 };
+  return slot;
+}
+
+uint32_t SymTab_peek(const SymTab *t, SymId name) {
+  uint32_t mask = (1 << t->bits) - 1;
+  uint32_t index = SymTab_hash(t, name);
+  while (t->slots[index].name && t->slots[index].name != name) {
+    index = (index + 1) & mask;
+  }
+  return t->slots[index].value;
+}
+
+uint32_t SymTab_get(SymTab *t, SymId name) {
+  return SymTab_find(t, name)->value;
+}
+
+void SymTab_clear(SymTab *t) {
+  memset(t->slots, 0, sizeof(SymSlot) << t->bits);
+  t->count = 0;
+}
+
+void SymTab_print_stats(FILE *out, const SymTab *t, const char *name) {
+  double avg = t->lookups ? (double)t->probes / t->lookups : 0;
+  fprintf(out, "%s: %u entries, %u slots, %" PRIu64 " lookups, %.2f probes/lookup, max %u\n",
+      name, t->count, 1u << t->bits, t->lookups, avg, t->max_probes);
+}
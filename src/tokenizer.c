@@ -1,5 +1,10 @@
 #include "common.h"
 #include "tokens.h"
+#include "arena.h"
+#include "keywords.h"
+#include "keyword_hash.h"
+#include "scan.h"
+#include "intern.h"
 #include <stdint.h>
 #include <assert.h>
 #include <string.h>
@@ -14,6 +19,7 @@ TokenType ch2token[128] = {
   [';'] = TOK_SEMICOLON, [','] = TOK_COMMA, ['('] = TOK_LPAREN,
   [')'] = TOK_RPAREN, ['{'] = TOK_LBRACE, ['}'] = TOK_RBRACE,
   ['['] = TOK_LSQUARE, [']'] = TOK_RSQUARE, ['?'] = TOK_QUESTION,
+  ['#'] = TOK_HASH,
 };
 
 typedef struct {
@@ -32,78 +38,48 @@ OptionTokenType multiple_tokens[TOK_ARROW][2] = {
   [TOK_STAR]    = {{ '=', TOK_STAR_EQ },    {0}},
   [TOK_SLASH]   = {{ '=', TOK_SLASH_EQ },   {0}},
   [TOK_PERCENT] = {{ '=', TOK_PERCENT_EQ }, {0}},
-  [TOK_HAT]     = {{ '=', TOK_DPLUS },      {0}},
-  [TOK_OR]      = {{ '|', TOK_DOR },        { '=', TOK_DEQ }},
+  [TOK_HAT]     = {{ '=', TOK_HAT_EQ },     {0}},
+  [TOK_OR]      = {{ '|', TOK_DOR },        { '=', TOK_OR_EQ }},
 
 };
 
-// A very simple solution for now 
-// https://rgambord.github.io/c99-doc/sections/8/1/2/index.html
-Str keywords[] = {
-  [TOK_AUTO - KEYWORDS_START] = STR("auto"),
-  [TOK_ENUM - KEYWORDS_START] = STR("enum"),
-  [TOK_RESTRICT - KEYWORDS_START] = STR("restrict"),
-  [TOK_UNSIGNED - KEYWORDS_START] = STR("unsigned"),
-  [TOK_BREAK - KEYWORDS_START] = STR("break"),
-  [TOK_EXTERN - KEYWORDS_START] = STR("extern"),
-  [TOK_RETURN - KEYWORDS_START] = STR("return"),
-  [TOK_VOID - KEYWORDS_START] = STR("void"),
-  [TOK_CASE - KEYWORDS_START] = STR("case"),
-  [TOK_FLOAT - KEYWORDS_START] = STR("float"),
-  [TOK_SHORT - KEYWORDS_START] = STR("short"),
-  [TOK_VOLATILE - KEYWORDS_START] = STR("volatile"),
-  [TOK_CHAR - KEYWORDS_START] = STR("char"),
-  [TOK_FOR - KEYWORDS_START] = STR("for"),
-  [TOK_SIGNED - KEYWORDS_START] = STR("signed"),
-  [TOK_WHILE - KEYWORDS_START] = STR("while"),
-  [TOK_CONST - KEYWORDS_START] = STR("const"),
-  [TOK_GOTO - KEYWORDS_START] = STR("goto"),
-  [TOK_SIZEOF - KEYWORDS_START] = STR("sizeof"),
-  [TOK_BOOL - KEYWORDS_START] = STR("_Bool"),
-  [TOK_CONTINUE - KEYWORDS_START] = STR("continue"),
-  [TOK_IF - KEYWORDS_START] = STR("if"),
-  [TOK_STATIC - KEYWORDS_START] = STR("static"),
-  [TOK_COMPLEX - KEYWORDS_START] = STR("_Complex"),
-  [TOK_DEFAULT - KEYWORDS_START] = STR("default"),
-  [TOK_INLINE - KEYWORDS_START] = STR("inline"),
-  [TOK_STRUCT - KEYWORDS_START] = STR("struct"),
-  [TOK_IMAGINARY - KEYWORDS_START] = STR("_Imaginary"),
-  [TOK_DO - KEYWORDS_START] = STR("do"),
-  [TOK_INT - KEYWORDS_START] = STR("int"),
-  [TOK_SWITCH - KEYWORDS_START] = STR("switch"),
-  [TOK_DOUBLE - KEYWORDS_START] = STR("double"),
-  [TOK_LONG - KEYWORDS_START] = STR("long"),
-  [TOK_TYPEDEF - KEYWORDS_START] = STR("typedef"),
-  [TOK_ELSE - KEYWORDS_START] = STR("else"),
-  [TOK_REGISTER - KEYWORDS_START] = STR("register"),
-  [TOK_UNION - KEYWORDS_START] = STR("union"),
-};
-const uint32_t KEYWORD_COUNT = sizeof(keywords) / sizeof(*keywords);
 
-void tokenize(const char *source, Token tokens_out[MAX_TOKENS]) {
-  const char *ch = source;
-  int tokens_len = 0;
+void Lexer_init(Lexer *l, Interner *in, const char *source, uint32_t base) {
+  if (!scan.space) scan_select(scan_detect());
+  *l = (Lexer){
+    .interner = in,
+    .source = source,
+    .ch = source,
+    .base = base,
+  };
+}
+
+// Returns the EOF token at the end, every time it's called after
+Token Lexer_next(Lexer *l) {
+  const char *source = l->source;
+  const char *ch = l->ch;
+  Token tok = {0};
 
-  // for every token
   while (*ch) {
-    while (*ch == ' ' || *ch == '\n' || *ch == '\t') ch++;
+    // Most of the time it's just a single space
+    if (char_class[(uint8_t)*ch] & CLASS_SPACE) ch = scan.space(ch + 1);
 
     if (*ch == '/' && ch[1] == '/') {
-      ch += 2;
-      while (*ch != '\n') {
-        if (*ch == '\0') return;
-        ch++;
-      }
+      ch = scan.line_end(ch + 2);
+      if (!*ch) break;
       ch++;
       continue;
     }
 
-    if (*ch == '/' && ch[1] == '*') {
+    // line splice
+    if (*ch == '\\' && ch[1] == '\n') {
       ch += 2;
-      while (*ch != '*' && ch[1] != '/') {
-        assert(*ch); // TODO: error/warning EOF before end of comment
-        ch++;
-      }
+      continue;
+    }
+
+    if (*ch == '/' && ch[1] == '*') {
+      ch = scan.comment_end(ch + 2);
+      assert(*ch); // TODO: error/warning EOF before end of comment
       ch += 2;
       continue;
     }
@@ -122,7 +98,10 @@ void tokenize(const char *source, Token tokens_out[MAX_TOKENS]) {
           len = 2;
         }
       }
-      if (tt == TOK_MINUS && ch[1] == '-') {
+      if (tt == TOK_HASH && ch[1] == '#') {
+        tt = TOK_DHASH;
+        len = 2;
+      } else if (tt == TOK_MINUS && ch[1] == '-') {
         tt = TOK_DMINUS;
         len = 2;
       } else if (tt == TOK_LSFT && ch[2] == '=') {
@@ -132,47 +111,87 @@ void tokenize(const char *source, Token tokens_out[MAX_TOKENS]) {
         tt = TOK_RSF_EQ;
         len = 3;
       }
-      assert(tokens_len < MAX_TOKENS);
-      tokens_out[tokens_len++] = (Token){ tt, len, ch - source };
+      tok = (Token){ tt, len, 0, l->base + (ch - source), 0 };
       ch += len;
-      continue;
+      break;
+    }
+
+    if (*ch == '"') {
+      const char *start = ch++;
+      while (*ch != '"') {
+        if (*ch == '\\' && ch[1]) ch++;
+        // TODO: error for unterminated string
+        else if (!*ch || *ch == '\n') {
+          assert(l->skipping);
+          break;
+        }
+        ch++;
+      }
+      if (*ch == '"') ch++;
+      tok = (Token){ TOK_STRING, ch - start, 0, l->base + (start - source), 0 };
+      break;
     }
 
     // strings
     // negative numbers, different literals
     if (IS_NUMERIC(*ch)) {
       const char *start = ch++;
-      while (IS_NUMERIC(*ch)) ch++;
-      assert(tokens_len < MAX_TOKENS);
-      tokens_out[tokens_len++] = (Token){ TOK_DECIMAL, ch - start, start - source };
-      continue;
+      if (char_class[(uint8_t)*ch] & CLASS_DIGIT) ch = scan.digits(ch + 1);
+      tok = (Token){ TOK_DECIMAL, ch - start, 0, l->base + (start - source), 0 };
+      break;
     }
 
     if (*ch == '_' || IS_ALPHA(*ch)) {
       const char *start = ch++;
-      while (*ch == '_' || IS_ALPHA(*ch) || IS_NUMERIC(*ch)) ch++;
+      if (char_class[(uint8_t)*ch] & CLASS_IDENT) ch = scan.ident(ch + 1);
 
       uint32_t len = ch - start;
-      TokenType tt = TOK_IDENT;
-      for (uint32_t i = 0; i < KEYWORD_COUNT; ++i) {
-        if (keywords[i].len != len) continue;
-        if (strncmp(keywords[i].ptr, start, len)) continue;
-        tt = KEYWORDS_START + i;
-        break;
+      TokenType tt = keyword_slots[KEYWORD_HASH(start[0], start[len - 1], len,
+          KEYWORD_HASH_MUL_FIRST, KEYWORD_HASH_MUL_LAST, KEYWORD_HASH_BITS)];
+      // Only one candidate, the hash is perfect
+      if (!tt) tt = TOK_IDENT;
+      else {
+        Str kw = keywords[tt - KEYWORDS_START];
+        if (kw.len != len || memcmp(kw.ptr, start, len)) tt = TOK_IDENT;
       }
-      assert(tokens_len < MAX_TOKENS);
-      tokens_out[tokens_len++] = (Token){ tt, len, start - source };
+      SymId sym = 0;
+      if (tt == TOK_IDENT && !l->skipping) sym = Interner_intern(l->interner, start, len);
+      tok = (Token){ tt, len, 0, l->base + (start - source), sym };
+      break;
+    }
+
+    // TODO: char literals
+    if (*ch && l->skipping) {
+      ch++;
       continue;
     }
+    // TODO: error on unexpected characters
+    assert(!*ch);
   }
-  // EOF token
-  assert(tokens_len < MAX_TOKENS);
-  tokens_out[tokens_len++] = (Token){0};
+  l->ch = ch;
+  return tok;
 }
 
-void print_tokens(const Token *tokens) {
-  while (tokens->type) {
-    printf("% 3d:%02d %s\n", tokens->start, tokens->len, TOKEN_TYPE_STR[tokens->type]);
-    tokens++;
+bool Lexer_line_end(Lexer *l) {
+  const char *ch = l->ch;
+  while (1) {
+    if (*ch == ' ' || *ch == '\t' || *ch == '\r' || *ch == '\f' || *ch == '\v') ch++;
+    else if (*ch == '\\' && ch[1] == '\n') ch += 2;
+    else if (*ch == '/' && ch[1] == '/') ch = scan.line_end(ch + 2);
+    else if (*ch == '/' && ch[1] == '*') {
+      // note: A comment is a single space, even over many lines
+      ch = scan.comment_end(ch + 2);
+      assert(*ch); // TODO: error/warning EOF before end of comment
+      ch += 2;
+    } else break;
   }
+  l->ch = ch;
+  return *ch == '\n' || !*ch;
+}
+
+// TODO: a comment before the token
+bool Lexer_line_start(const Lexer *l, Token tok) {
+  const char *ch = l->source + (tok.start - l->base);
+  while (ch > l->source && (ch[-1] == ' ' || ch[-1] == '\t')) ch--;
+  return ch == l->source || ch[-1] == '\n';
 }
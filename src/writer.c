@@ -0,0 +1,144 @@
+#include "writer.h"
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+void Writer_file(Writer *w, int fd) {
+  *w = (Writer){ .fd = fd, .data = malloc(WRITER_BUFFER), .cap = WRITER_BUFFER };
+  assert(w->data);
+}
+
+void Writer_memory(Writer *w) {
+  *w = (Writer){ .fd = -1 };
+}
+
+static void write_out(int fd, const char *data, size_t len) {
+  while (len) {
+    ssize_t n = write(fd, data, len);
+    if (n < 0 && errno == EINTR) continue;
+    assert(n > 0); // TODO: error for a failed write
+    data += n;
+    len -= n;
+  }
+}
+
+void Writer_flush(Writer *w) {
+  if (w->fd < 0) return;
+  write_out(w->fd, w->data, w->len);
+  w->len = 0;
+}
+
+void Writer_write(Writer *w, const void *data, size_t len) {
+  if (w->fd < 0) {
+    size_t cap = w->cap ? w->cap : WRITER_MEMORY;
+    while (cap - w->len < len) cap *= 2;
+    w->data = realloc(w->data, cap);
+    assert(w->data);
+    w->cap = cap;
+  } else {
+    Writer_flush(w);
+    // it wouldn't be any shorter through the buffer
+    if (len >= w->cap) {
+      write_out(w->fd, data, len);
+      return;
+    }
+  }
+  memcpy(w->data + w->len, data, len);
+  w->len += len;
+}
+
+void Writer_close(Writer *w) {
+  if (w->map && w->mapped) {
+    int err = munmap(w->map, w->map_len);
+    assert(!err);
+  } else if (w->map) {
+    write_out(w->fd, w->map, w->map_len);
+    free(w->map);
+  }
+  Writer_flush(w);
+  free(w->data);
+  *w = (Writer){ .fd = -1 };
+}
+
+char *Writer_take(Writer *w, size_t *len) {
+  assert(w->fd < 0);
+  char *data = w->data;
+  *len = w->len;
+  *w = (Writer){ .fd = -1 };
+  return data;
+}
+
+void Writer_gather(Writer *w, const struct iovec *chunks, uint32_t count) {
+  if (w->fd < 0) {
+    for (uint32_t i = 0; i < count; ++i) Writer_bytes(w, chunks[i].iov_base, chunks[i].iov_len);
+    return;
+  }
+  Writer_flush(w);
+  struct iovec iov[WRITER_GATHER];
+  while (count) {
+    uint32_t n = count < WRITER_GATHER ? count : WRITER_GATHER;
+    memcpy(iov, chunks, sizeof(struct iovec) * n);
+    chunks += n;
+    count -= n;
+    // a short write leaves the rest of the vector
+    struct iovec *next = iov;
+    while (n) {
+      ssize_t written = writev(w->fd, next, n);
+      if (written < 0 && errno == EINTR) continue;
+      assert(written >= 0); // TODO: error for a failed write
+      for (; n && (size_t)written >= next->iov_len; --n) written -= next++->iov_len;
+      if (!n) break;
+      next->iov_base = (char *)next->iov_base + written;
+      next->iov_len -= written;
+    }
+  }
+}
+
+char *Writer_map(Writer *w, size_t len) {
+  assert(w->fd >= 0 && !w->len && !w->map);
+  w->map_len = len;
+  struct stat st;
+  // note: The pipes and the terminals can't be mapped, and
+  // an empty mapping isn't allowed, it goes through the memory
+  if (len && !fstat(w->fd, &st) && S_ISREG(st.st_mode) && !lseek(w->fd, 0, SEEK_CUR)
+      && !ftruncate(w->fd, len)) {
+    w->map = mmap(0, len, PROT_READ | PROT_WRITE, MAP_SHARED, w->fd, 0);
+    w->mapped = w->map != MAP_FAILED;
+    if (w->mapped) return w->map;
+  }
+  w->map = malloc(len ? len : 1);
+  assert(w->map);
+  return w->map;
+}
+
+void Writer_u64(Writer *w, uint64_t value) {
+  char digits[20];
+  uint32_t i = sizeof(digits);
+  do {
+    digits[--i] = '0' + value % 10;
+    value /= 10;
+  } while (value);
+  Writer_bytes(w, digits + i, sizeof(digits) - i);
+}
+
+void Writer_i64(Writer *w, int64_t value) {
+  if (value < 0) Writer_char(w, '-');
+  // the negation of the smallest one only fits unsigned
+  Writer_u64(w, value < 0 ? -(uint64_t)value : (uint64_t)value);
+}
+
+void Writer_hex(Writer *w, uint64_t value) {
+  char digits[16];
+  uint32_t i = sizeof(digits);
+  do {
+    digits[--i] = "0123456789abcdef"[value & 15];
+    value >>= 4;
+  } while (value);
+  Writer_bytes(w, digits + i, sizeof(digits) - i);
+}
@@ -0,0 +1,421 @@
+#include "x86.h"
+#include "arena.h"
+#include "common.h"
+#include "intern.h"
+#include "regalloc.h"
+#include "writer.h"
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+#define NAME(s) { s, CSTR_LEN(s) }
+
+// By the log of the size
+static const Str REG_NAMES[4][REG_COUNT] = {
+  { NAME("al"), NAME("cl"), NAME("dl"), NAME("bl"), NAME("spl"), NAME("bpl"), NAME("sil"), NAME("dil"),
+    NAME("r8b"), NAME("r9b"), NAME("r10b"), NAME("r11b"), NAME("r12b"), NAME("r13b"), NAME("r14b"), NAME("r15b") },
+  { NAME("ax"), NAME("cx"), NAME("dx"), NAME("bx"), NAME("sp"), NAME("bp"), NAME("si"), NAME("di"),
+    NAME("r8w"), NAME("r9w"), NAME("r10w"), NAME("r11w"), NAME("r12w"), NAME("r13w"), NAME("r14w"), NAME("r15w") },
+  { NAME("eax"), NAME("ecx"), NAME("edx"), NAME("ebx"), NAME("esp"), NAME("ebp"), NAME("esi"), NAME("edi"),
+    NAME("r8d"), NAME("r9d"), NAME("r10d"), NAME("r11d"), NAME("r12d"), NAME("r13d"), NAME("r14d"), NAME("r15d") },
+  { NAME("rax"), NAME("rcx"), NAME("rdx"), NAME("rbx"), NAME("rsp"), NAME("rbp"), NAME("rsi"), NAME("rdi"),
+    NAME("r8"), NAME("r9"), NAME("r10"), NAME("r11"), NAME("r12"), NAME("r13"), NAME("r14"), NAME("r15") },
+};
+static const uint8_t SIZE_LOG[9] = { [1] = 0, [2] = 1, [4] = 2, [8] = 3 };
+// With the ptr, that follows
+static const Str SIZE_NAME[9] = {
+  [1] = NAME("byte ptr ["), [2] = NAME("word ptr ["), [4] = NAME("dword ptr ["), [8] = NAME("qword ptr ["),
+};
+static const Str CC_NAMES[16] = {
+  NAME("o"), NAME("no"), NAME("b"), NAME("ae"), NAME("e"), NAME("ne"), NAME("be"), NAME("a"),
+  NAME("s"), NAME("ns"), NAME("p"), NAME("np"), NAME("l"), NAME("ge"), NAME("le"), NAME("g"),
+};
+// With the indent
+static const Str X86_NAMES[X86_COUNT] = {
+  [X86_MOV] = NAME("  mov"), [X86_MOVSX] = NAME("  movsx"), [X86_MOVSXD] = NAME("  movsxd"),
+  [X86_MOVZX] = NAME("  movzx"), [X86_LEA] = NAME("  lea"), [X86_ADD] = NAME("  add"),
+  [X86_OR] = NAME("  or"), [X86_AND] = NAME("  and"), [X86_SUB] = NAME("  sub"),
+  [X86_XOR] = NAME("  xor"), [X86_CMP] = NAME("  cmp"), [X86_TEST] = NAME("  test"),
+  [X86_IMUL] = NAME("  imul"), [X86_SHL] = NAME("  shl"), [X86_SHR] = NAME("  shr"),
+  [X86_SAR] = NAME("  sar"), [X86_NEG] = NAME("  neg"), [X86_NOT] = NAME("  not"),
+  [X86_DIV] = NAME("  div"), [X86_IDIV] = NAME("  idiv"), [X86_CQO] = NAME("  cqo"),
+  [X86_SETCC] = NAME("  set"), [X86_JCC] = NAME("  j"), [X86_JMP] = NAME("  jmp"),
+  [X86_CALL] = NAME("  call"), [X86_PUSH] = NAME("  push"), [X86_POP] = NAME("  pop"),
+  [X86_LEAVE] = NAME("  leave"), [X86_RET] = NAME("  ret"), [X86_UD2] = NAME("  ud2"),
+};
+
+static void X86_print_label(Writer *out, const X86Code *code, uint32_t label) {
+  Writer_bytes(out, ".L", 2);
+  Writer_str(out, code->name);
+  Writer_char(out, '.');
+  Writer_u64(out, label >> 1);
+  if (label & 1) Writer_bytes(out, ".else", 5);
+}
+
+static void X86_print_operand(Writer *out, const X86Code *code, const X86Operand *o) {
+  switch (o->kind) {
+    case OPERAND_REG:
+      Writer_str(out, REG_NAMES[SIZE_LOG[o->size]][o->reg]);
+      break;
+    case OPERAND_IMM:
+      Writer_i64(out, o->imm);
+      break;
+    case OPERAND_MEM:
+      Writer_str(out, SIZE_NAME[o->size]);
+      Writer_str(out, REG_NAMES[3][o->reg]);
+      if (o->index) {
+        Writer_bytes(out, " + ", 3);
+        Writer_str(out, REG_NAMES[3][X86Operand_index(o)]);
+        if (o->index >> 5) {
+          Writer_char(out, '*');
+          Writer_char(out, '0' + (1 << (o->index >> 5)));
+        }
+      }
+      if (o->imm) {
+        Writer_bytes(out, o->imm < 0 ? " - " : " + ", 3);
+        Writer_u64(out, o->imm < 0 ? -(uint64_t)o->imm : (uint64_t)o->imm);
+      }
+      Writer_char(out, ']');
+      break;
+    case OPERAND_GLOBAL:
+      Writer_str(out, SIZE_NAME[o->size]);
+      Writer_bytes(out, "rip + ", 6);
+      Writer_str(out, Interner_str(code->interner, o->sym));
+      Writer_char(out, ']');
+      break;
+    case OPERAND_LABEL:
+      X86_print_label(out, code, o->sym);
+      break;
+    case OPERAND_SYMBOL:
+      Writer_str(out, Interner_str(code->interner, o->sym));
+      break;
+    default:
+      assert(0);
+  }
+}
+
+void X86_print(Writer *out, const X86Code *code) {
+  Writer_bytes(out, "\n.global ", 9);
+  Writer_str(out, code->name);
+  Writer_char(out, '\n');
+  Writer_str(out, code->name);
+  Writer_bytes(out, ":\n", 2);
+  for (uint32_t i = 0; i < code->count; ++i) {
+    const X86Inst *inst = &code->insts[i];
+    if (inst->op == X86_LABEL) {
+      X86_print_label(out, code, inst->a.sym);
+      Writer_bytes(out, ":\n", 2);
+      continue;
+    }
+    Writer_str(out, X86_NAMES[inst->op]);
+    if (inst->op == X86_SETCC || inst->op == X86_JCC) Writer_str(out, CC_NAMES[inst->cc]);
+    if (inst->a.kind) {
+      Writer_char(out, ' ');
+      X86_print_operand(out, code, &inst->a);
+    }
+    if (inst->b.kind) {
+      Writer_bytes(out, ", ", 2);
+      X86_print_operand(out, code, &inst->b);
+    }
+    Writer_char(out, '\n');
+  }
+}
+
+// The longest one, that we make, is the move of a 64 bit immediate
+#define X86_MAX_LEN 16
+
+// The extensions of the opcodes 0x80 to 0x83, and the base of the others
+static const uint8_t ALU_GROUP[X86_COUNT] = {
+  [X86_ADD] = 0, [X86_OR] = 1, [X86_AND] = 4, [X86_SUB] = 5, [X86_XOR] = 6, [X86_CMP] = 7,
+};
+static const uint8_t SHIFT_GROUP[X86_COUNT] = { [X86_SHL] = 4, [X86_SHR] = 5, [X86_SAR] = 7 };
+static const uint8_t UNARY_GROUP[X86_COUNT] = {
+  [X86_NOT] = 2, [X86_NEG] = 3, [X86_DIV] = 6, [X86_IDIV] = 7,
+};
+
+typedef struct {
+  uint8_t *p; // the next byte
+  uint8_t *start; // of the instruction
+  X86Reloc *reloc; // its type stays zero without one
+} Encoder;
+
+static inline bool fits8(int64_t value) {
+  return value == (int8_t)value;
+}
+
+static void Encoder_imm(Encoder *e, int64_t value, uint32_t len) {
+  for (uint32_t i = 0; i < len; ++i) *e->p++ = (uint8_t)(value >> i * 8);
+}
+
+// Spl, bpl, sil and dil need a rex, the others would be ah to bh
+static inline bool X86_byte_reg(const X86Operand *o) {
+  return o->kind == OPERAND_REG && o->size == 1 && o->reg >= 4 && o->reg < 8;
+}
+
+// note: The prefixes, the opcode and the addressing of the rm operand.
+// The reg is the register of the other operand, or the extension of
+// the opcode. The size is the one of the operation, eight sets the
+// rex.w, two needs the prefix. A relocation of a global is relative
+// to its end, so it's moved by the immediate, that follows.
+static void Encoder_rm(Encoder *e, uint32_t size, const uint8_t *opcode, uint32_t opcode_len,
+    const X86Operand *reg_operand, uint32_t reg, const X86Operand *rm, uint32_t imm_len) {
+  if (size == 2) *e->p++ = 0x66;
+  if (reg_operand) reg = reg_operand->reg;
+  uint8_t rex = (size == 8) << 3 | (reg >> 3) << 2;
+  if (rm->kind == OPERAND_REG || rm->kind == OPERAND_MEM) rex |= rm->reg >> 3;
+  if (rm->kind == OPERAND_MEM && rm->index) rex |= X86Operand_index(rm) >> 3 << 1;
+  if (rex || X86_byte_reg(rm) || (reg_operand && X86_byte_reg(reg_operand))) *e->p++ = 0x40 | rex;
+  memcpy(e->p, opcode, opcode_len);
+  e->p += opcode_len;
+  reg &= 7;
+  if (rm->kind == OPERAND_REG) {
+    *e->p++ = 0xc0 | reg << 3 | (rm->reg & 7);
+  } else if (rm->kind == OPERAND_GLOBAL) {
+    *e->p++ = reg << 3 | 5;
+    *e->reloc = (X86Reloc){
+      .offset = e->p - e->start,
+      .type = R_X86_64_PC32,
+      .sym = rm->sym,
+      .addend = -4 - (int32_t)imm_len,
+    };
+    Encoder_imm(e, 0, 4);
+  } else {
+    assert(rm->kind == OPERAND_MEM);
+    uint32_t base = rm->reg & 7;
+    // rbp and r13 can't go without a displacement
+    uint32_t mod = !rm->imm && base != 5 ? 0 : fits8(rm->imm) ? 1 : 2;
+    if (rm->index) {
+      *e->p++ = mod << 6 | reg << 3 | 4;
+      *e->p++ = (rm->index >> 5) << 6 | (X86Operand_index(rm) & 7) << 3 | base;
+    } else {
+      *e->p++ = mod << 6 | reg << 3 | base;
+      // rsp and r12 need the sib
+      if (base == 4) *e->p++ = 0x24;
+    }
+    if (mod) Encoder_imm(e, rm->imm, mod == 1 ? 1 : 4);
+  }
+}
+
+static inline void Encoder_op(Encoder *e, uint32_t size, uint8_t opcode,
+    const X86Operand *reg_operand, uint32_t reg, const X86Operand *rm, uint32_t imm_len) {
+  Encoder_rm(e, size, &opcode, 1, reg_operand, reg, rm, imm_len);
+}
+
+// With the opcode plus the register
+static void Encoder_short(Encoder *e, uint32_t size, uint8_t opcode, const X86Operand *reg) {
+  if (size == 2) *e->p++ = 0x66;
+  uint8_t rex = (size == 8) << 3 | reg->reg >> 3;
+  if (rex || X86_byte_reg(reg)) *e->p++ = 0x40 | rex;
+  *e->p++ = opcode + (reg->reg & 7);
+}
+
+static void Encoder_alu(Encoder *e, const X86Inst *inst) {
+  const X86Operand *a = &inst->a, *b = &inst->b;
+  uint32_t group = ALU_GROUP[inst->op], size = a->size, byte = size == 1;
+  if (b->kind == OPERAND_IMM) {
+    uint32_t len = byte || fits8(b->imm) ? 1 : size == 2 ? 2 : 4;
+    if (a->kind == OPERAND_REG && a->reg == REG_RAX && (byte || len > 1)) {
+      // the short one of the accumulator
+      if (size == 2) *e->p++ = 0x66;
+      if (size == 8) *e->p++ = 0x48;
+      *e->p++ = group << 3 | (4 + !byte);
+    } else {
+      Encoder_op(e, size, byte ? 0x80 : len == 1 ? 0x83 : 0x81, 0, group, a, len);
+    }
+    Encoder_imm(e, b->imm, len);
+  } else if (b->kind == OPERAND_REG) {
+    Encoder_op(e, size, group << 3 | (1 - byte), b, 0, a, 0);
+  } else {
+    Encoder_op(e, size, group << 3 | (3 - byte), a, 0, b, 0);
+  }
+}
+
+static void Encoder_mov(Encoder *e, const X86Inst *inst) {
+  const X86Operand *a = &inst->a, *b = &inst->b;
+  uint32_t size = a->size, byte = size == 1;
+  if (b->kind == OPERAND_IMM) {
+    if (a->kind == OPERAND_REG && (size != 8 || b->imm != (int32_t)b->imm)) {
+      Encoder_short(e, size, byte ? 0xb0 : 0xb8, a);
+      Encoder_imm(e, b->imm, size);
+    } else {
+      uint32_t len = size < 4 ? size : 4;
+      Encoder_op(e, size, byte ? 0xc6 : 0xc7, 0, 0, a, len);
+      Encoder_imm(e, b->imm, len);
+    }
+  } else if (b->kind == OPERAND_REG) {
+    Encoder_op(e, size, 0x89 - byte, b, 0, a, 0);
+  } else {
+    Encoder_op(e, size, 0x8b - byte, a, 0, b, 0);
+  }
+}
+
+// Returns the length, the jumps are near ones, when they have to be
+static uint32_t X86_encode_inst(const X86Inst *inst, uint8_t *out, X86Reloc *reloc, int32_t rel, bool near) {
+  Encoder e = { .p = out, .start = out, .reloc = reloc };
+  const X86Operand *a = &inst->a, *b = &inst->b;
+  uint8_t opcode[2];
+  reloc->type = 0;
+  switch (inst->op) {
+    case X86_MOV:
+      Encoder_mov(&e, inst);
+      break;
+    case X86_MOVSX: case X86_MOVZX:
+      opcode[0] = 0x0f;
+      opcode[1] = (inst->op == X86_MOVSX ? 0xbe : 0xb6) + (b->size == 2);
+      Encoder_rm(&e, a->size, opcode, 2, a, 0, b, 0);
+      break;
+    case X86_MOVSXD:
+      Encoder_op(&e, 8, 0x63, a, 0, b, 0);
+      break;
+    case X86_LEA:
+      Encoder_op(&e, a->size, 0x8d, a, 0, b, 0);
+      break;
+    case X86_ADD: case X86_OR: case X86_AND: case X86_SUB: case X86_XOR: case X86_CMP:
+      Encoder_alu(&e, inst);
+      break;
+    case X86_TEST:
+      assert(b->kind == OPERAND_REG);
+      Encoder_op(&e, a->size, a->size == 1 ? 0x84 : 0x85, b, 0, a, 0);
+      break;
+    case X86_IMUL:
+      if (b->kind == OPERAND_IMM) {
+        uint32_t len = fits8(b->imm) ? 1 : a->size == 2 ? 2 : 4;
+        Encoder_op(&e, a->size, len == 1 ? 0x6b : 0x69, a, 0, a, len);
+        Encoder_imm(&e, b->imm, len);
+      } else {
+        opcode[0] = 0x0f;
+        opcode[1] = 0xaf;
+        Encoder_rm(&e, a->size, opcode, 2, a, 0, b, 0);
+      }
+      break;
+    case X86_SHL: case X86_SHR: case X86_SAR:
+      // the ones of the bytes are one less
+      if (b->kind == OPERAND_REG) {
+        Encoder_op(&e, a->size, 0xd3 - (a->size == 1), 0, SHIFT_GROUP[inst->op], a, 0);
+      } else if (b->imm == 1) {
+        Encoder_op(&e, a->size, 0xd1 - (a->size == 1), 0, SHIFT_GROUP[inst->op], a, 0);
+      } else {
+        Encoder_op(&e, a->size, 0xc1 - (a->size == 1), 0, SHIFT_GROUP[inst->op], a, 1);
+        Encoder_imm(&e, b->imm, 1);
+      }
+      break;
+    case X86_NEG: case X86_NOT: case X86_DIV: case X86_IDIV:
+      Encoder_op(&e, a->size, a->size == 1 ? 0xf6 : 0xf7, 0, UNARY_GROUP[inst->op], a, 0);
+      break;
+    case X86_CQO:
+      *e.p++ = 0x48;
+      *e.p++ = 0x99;
+      break;
+    case X86_SETCC:
+      opcode[0] = 0x0f;
+      opcode[1] = 0x90 + inst->cc;
+      Encoder_rm(&e, 1, opcode, 2, 0, 0, a, 0);
+      break;
+    case X86_JCC:
+      if (near) {
+        *e.p++ = 0x0f;
+        *e.p++ = 0x80 + inst->cc;
+        Encoder_imm(&e, rel, 4);
+      } else {
+        *e.p++ = 0x70 + inst->cc;
+        *e.p++ = (uint8_t)rel;
+      }
+      break;
+    case X86_JMP:
+      *e.p++ = near ? 0xe9 : 0xeb;
+      Encoder_imm(&e, rel, near ? 4 : 1);
+      break;
+    case X86_CALL:
+      *e.p++ = 0xe8;
+      *reloc = (X86Reloc){ .offset = 1, .type = R_X86_64_PLT32, .sym = a->sym, .addend = -4 };
+      Encoder_imm(&e, 0, 4);
+      break;
+    case X86_PUSH: case X86_POP:
+      if (a->kind == OPERAND_REG) {
+        Encoder_short(&e, 4, inst->op == X86_PUSH ? 0x50 : 0x58, a);
+      } else if (a->kind == OPERAND_IMM) {
+        *e.p++ = fits8(a->imm) ? 0x6a : 0x68;
+        Encoder_imm(&e, a->imm, fits8(a->imm) ? 1 : 4);
+      } else {
+        // they're of the 64 bits without the rex.w
+        Encoder_op(&e, 4, inst->op == X86_PUSH ? 0xff : 0x8f, 0, inst->op == X86_PUSH ? 6 : 0, a, 0);
+      }
+      break;
+    case X86_LEAVE:
+      *e.p++ = 0xc9;
+      break;
+    case X86_RET:
+      *e.p++ = 0xc3;
+      break;
+    case X86_UD2:
+      *e.p++ = 0x0f;
+      *e.p++ = 0x0b;
+      break;
+    default:
+      assert(0);
+  }
+  assert(e.p - out <= X86_MAX_LEN);
+  return e.p - out;
+}
+
+static inline bool X86_jump(const X86Inst *inst) {
+  return inst->op == X86_JMP || inst->op == X86_JCC;
+}
+
+// note: Every jump starts as a short one, and the ones, that
+// don't reach, grow, until nothing changes. A jump only ever
+// grows, so it ends. The sizes of the others don't depend on
+// the labels, they're measured once.
+void X86_encode(const X86Code *code, Arena *scratch, X86Machine *m) {
+  uint32_t n = code->count;
+  uint32_t *offsets = ARENA_PUSH(scratch, uint32_t, (n + 2) & ~1u);
+  uint32_t *labels = ARENA_PUSH(scratch, uint32_t, (code->label_count + 1) & ~1u);
+  uint8_t *lens = ARENA_PUSH(scratch, uint8_t, (n + 7) & ~7u);
+  uint8_t buffer[X86_MAX_LEN];
+  X86Reloc reloc;
+  uint32_t reloc_count = 0;
+  for (uint32_t i = 0; i < n; ++i) {
+    const X86Inst *inst = &code->insts[i];
+    if (inst->op == X86_LABEL || X86_jump(inst)) {
+      lens[i] = inst->op == X86_LABEL ? 0 : 2;
+      continue;
+    }
+    lens[i] = X86_encode_inst(inst, buffer, &reloc, 0, false);
+    reloc_count += reloc.type != 0;
+  }
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    uint32_t offset = 0;
+    for (uint32_t i = 0; i < n; ++i) {
+      offsets[i] = offset;
+      if (code->insts[i].op == X86_LABEL) labels[code->insts[i].a.sym] = offset;
+      offset += lens[i];
+    }
+    offsets[n] = offset;
+    for (uint32_t i = 0; i < n; ++i) {
+      const X86Inst *inst = &code->insts[i];
+      if (!X86_jump(inst) || lens[i] != 2) continue;
+      int64_t rel = (int64_t)labels[inst->a.sym] - offsets[i + 1];
+      if (fits8(rel)) continue;
+      lens[i] = inst->op == X86_JMP ? 5 : 6;
+      changed = true;
+    }
+  }
+  *m = (X86Machine){
+    .bytes = ARENA_PUSH(scratch, uint8_t, (offsets[n] + 7) & ~7u),
+    .len = offsets[n],
+    .relocs = ARENA_PUSH(scratch, X86Reloc, reloc_count),
+  };
+  for (uint32_t i = 0; i < n; ++i) {
+    const X86Inst *inst = &code->insts[i];
+    if (inst->op == X86_LABEL) continue;
+    bool jump = X86_jump(inst);
+    int32_t rel = jump ? (int32_t)(labels[inst->a.sym] - offsets[i + 1]) : 0;
+    uint32_t len = X86_encode_inst(inst, m->bytes + offsets[i], &reloc, rel, jump && lens[i] > 2);
+    assert(len == lens[i]);
+    if (!reloc.type) continue;
+    reloc.offset += offsets[i];
+    m->relocs[m->reloc_count++] = reloc;
+  }
+}
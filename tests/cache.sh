@@ -0,0 +1,53 @@
+#!/bin/sh
+# Every program of the tests/codegen, the tests/pressure and the tests/tiles
+# is compiled without the cache, then into an empty one and again with it
+# warm, as the object and as the assembly. The cold one has to miss every
+# function and the warm one has to hit them all, the output of the three
+# has to be the same.
+# After one function of a program changes, only that one misses.
+cd "$(dirname "$0")/.."
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+fails=0
+count=0
+
+# The hits and the misses of the --stats of the compile
+cached() {
+  ./out/main --stats --cache "$tmp/cache" "$@" 2>&1 > /dev/null \
+    | sed -n 's|^cache: \([0-9]*\) hits, \([0-9]*\) misses.*|\1 \2|p'
+}
+
+for file in tests/codegen/*.c tests/pressure/*.c tests/tiles/*.c; do
+  count=$((count + 1))
+  rm -rf "$tmp/cache"
+  # the object and the assembly are kept apart
+  for ext in o s; do
+    flag=$([ $ext = s ] && echo -S)
+    ./out/main $flag -o "$tmp/plain.$ext" "$file" > /dev/null
+    set -- $(cached $flag -o "$tmp/cold.$ext" "$file")
+    hits=$1 misses=$2
+    set -- $(cached $flag -o "$tmp/warm.$ext" "$file")
+    if [ "$hits" != 0 ] || [ "${misses:-0}" = 0 ] || [ "$1" != "$misses" ] || [ "$2" != 0 ]; then
+      echo "$file: .$ext, cold $hits hits and $misses misses, warm $1 hits and $2 misses"
+      fails=$((fails + 1))
+    fi
+    if ! cmp -s "$tmp/plain.$ext" "$tmp/cold.$ext" || ! cmp -s "$tmp/plain.$ext" "$tmp/warm.$ext"; then
+      echo "$file: the .$ext differs with the cache"
+      fails=$((fails + 1))
+    fi
+  done
+done
+
+# one of the three functions changes
+count=$((count + 1))
+rm -rf "$tmp/cache"
+sed 's/int x = 41;/int x = 42;/' tests/codegen/nested_loops.c > "$tmp/changed.c"
+cached -o "$tmp/cold.o" tests/codegen/nested_loops.c > /dev/null
+./out/main -o "$tmp/plain.o" "$tmp/changed.c" > /dev/null
+set -- $(cached -o "$tmp/warm.o" "$tmp/changed.c")
+if [ "$1 $2" != "3 1" ] || ! cmp -s "$tmp/plain.o" "$tmp/warm.o"; then
+  echo "$tmp/changed.c: $1 hits and $2 misses, expected 3 and 1, with the same object"
+  fails=$((fails + 1))
+fi
+echo "$count programs, $fails failed"
+[ "$fails" = 0 ]
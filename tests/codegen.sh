@@ -0,0 +1,36 @@
+#!/bin/sh
+# Compiles every program of the tests/codegen, the tests/pressure and the
+# tests/tiles with the mcc, as the assembly, as the object and through the
+# --run, and with the gcc, their exit statuses have to match.
+# A program, that loops forever, is stopped after the timeout.
+cd "$(dirname "$0")/.."
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+fails=0
+count=0
+for file in tests/codegen/*.c tests/pressure/*.c tests/tiles/*.c; do
+  count=$((count + 1))
+  gcc -w -o "$tmp/expected" "$file" || { echo "$file: gcc failed"; fails=$((fails + 1)); continue; }
+  timeout 10 "$tmp/expected"
+  expected=$?
+  if timeout 10 ./out/main -S -o "$tmp/out.s" "$file" > /dev/null && gcc -o "$tmp/actual" "$tmp/out.s"; then
+    timeout 10 "$tmp/actual"
+    actual=$?
+  else
+    actual="a compile error"
+  fi
+  if timeout 10 ./out/main -o "$tmp/out.o" "$file" > /dev/null && gcc -o "$tmp/object" "$tmp/out.o"; then
+    timeout 10 "$tmp/object"
+    object=$?
+  else
+    object="a compile error"
+  fi
+  timeout 10 ./out/main --run "$file" > /dev/null 2>&1
+  run=$?
+  if [ "$actual" != "$expected" ] || [ "$object" != "$expected" ] || [ "$run" != "$expected" ]; then
+    echo "$file: expected $expected, got $actual, $object with the object and $run with the --run"
+    fails=$((fails + 1))
+  fi
+done
+echo "$count programs, $fails failed"
+[ "$fails" = 0 ]
@@ -0,0 +1,54 @@
+// The break and the continue, out of the nested loops and the switches
+int skip() {
+  int s = 0;
+  int i;
+  for (i = 0; i < 50; i++) {
+    if (i % 3 == 0) continue;
+    if (i > 40) break;
+    s += i;
+  }
+  return s + i;
+}
+int inner() {
+  int s = 0;
+  int i = 0;
+  while (1) {
+    int j;
+    i++;
+    if (i > 9) break;
+    for (j = 0; j < 10; j++) {
+      if (j == i) break;
+      if ((i + j) & 1) continue;
+      s = s * 7 + j;
+      s = s & 4095;
+    }
+  }
+  return s;
+}
+int cases() {
+  int s = 0;
+  int i;
+  for (i = 0; i < 12; i++) {
+    switch (i & 3) {
+      case 0: continue;
+      case 1: s += 5; break;
+      case 2: s = s * 2;
+      default: s -= 1;
+    }
+    s += i;
+  }
+  return s;
+}
+int dowhile() {
+  int n = 0;
+  int k = 100;
+  do {
+    k -= 7;
+    if (k & 1) continue;
+    n++;
+  } while (k > 0);
+  return n * 10 + k;
+}
+int main(void) {
+  return (skip() + inner() + cases() * 3 + dowhile()) & 255;
+}
@@ -0,0 +1,25 @@
+// The comma operator, the value is the last one, and the ones before it
+// are evaluated for their side effects, in the order of the source
+int seed() {
+  return 4;
+}
+int last() {
+  int x = 5, y = 7;
+  return (x, y);
+}
+int effects() {
+  int a = seed();
+  int b = 0;
+  int c = (b = a * 3, a = a + 1, a + b);
+  return (a, b, c) + (a = 2, a * 10);
+}
+int loop() {
+  int i, j, total = 0;
+  for (i = 0, j = 10; i < j; i++, j--) total = total * 3 + i - j;
+  return total;
+}
+int main(void) {
+  int r = 0;
+  r = r + last(), r = r * 3 + effects();
+  return (r + loop()) & 255;
+}
@@ -0,0 +1,44 @@
+// The constant conditions drop the branches and the loops, that are
+// never taken, along with the blocks after them
+int folded() {
+  int x6 = 9;
+  int x7 = 12;
+  int r = 1;
+  int i;
+  if (x7 & (x6 - x6)) {
+    for (i = 0; i < 3; i++) r += i;
+  } else {
+    r = r + 4;
+  }
+  while (x6 * 0) r = r * 100;
+  if (1 || x7) r += 2;
+  if (0 && x7) r = 0;
+  return r;
+}
+int dead_loops() {
+  int r = 3;
+  int i = 0;
+  if (0) {
+    while (i < 10) {
+      if (i == 4) break;
+      i++;
+      continue;
+    }
+    r = i;
+  }
+  for (; 0;) r++;
+  do r += 2; while (0);
+  return r + i;
+}
+int after_return() {
+  int r = 8;
+  int i;
+  for (i = 0; i < 4; i++) {
+    if (i == 2) return r + i;
+    r = r * 3;
+  }
+  return 0;
+}
+int main(void) {
+  return folded() * 16 + dead_loops() + after_return();
+}
@@ -0,0 +1,2 @@
+// note: It used to loop forever, reading the i through the dead loop
+int main(void){ int y = 5; int i; if (0) { for (i = 0; i < 3; i = i + 1) {} } return y; }
@@ -0,0 +1,19 @@
+// The globals, the zero ones go to the bss, the others to the data
+int g;
+int h = 5;
+long big = 1 << 20;
+static short s = -3 * 4;
+static int z;
+unsigned char c = 300;
+int d = sizeof h + (0 && h);
+extern int e;
+int bump() {
+  z++;
+  g = g + 7;
+  return z;
+}
+int main(void) {
+  int i;
+  for (i = 0; i < 5; i++) bump();
+  return g + h + (big >> 18) + s + z + c + d;
+}
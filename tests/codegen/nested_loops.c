@@ -0,0 +1,39 @@
+// Nested loops, the phis of the inner ones use the ones of the outer
+int triangle() {
+  int total = 0;
+  int i;
+  int j;
+  for (i = 0; i < 20; i++) {
+    for (j = 0; j <= i; j++) total += i * j + 1;
+  }
+  return total;
+}
+int three() {
+  int n = 0;
+  int a = 0;
+  while (a < 6) {
+    int b = a;
+    do {
+      int c;
+      for (c = b; c > 0; c = c - 2) n = n * 3 + c;
+      n = n & 65535;
+      b++;
+    } while (b < 8);
+    a++;
+  }
+  return n;
+}
+int unchanged() {
+  // the x goes around both of the loops unchanged
+  int x = 41;
+  int y = 0;
+  int i;
+  int j;
+  for (i = 0; i < 5; i++) {
+    for (j = 0; j < 5; j++) y += x;
+  }
+  return y + x;
+}
+int main(void) {
+  return (triangle() ^ three() ^ unchanged()) & 255;
+}
@@ -0,0 +1,17 @@
+// The prototypes declare the functions of the libc, with or without the
+// parameters, and the ones defined later in the file, or again before
+// the definition
+int abs(int value);
+int atoi();
+int later(void);
+int seed(void);
+int seed(void);
+int seed(void) {
+  return -9;
+}
+int main(void) {
+  return (abs(seed()) + later()) & 255;
+}
+int later(void) {
+  return abs(-40) + seed() * 2;
+}
@@ -0,0 +1,27 @@
+// Straight-line code, the locals are only values in the ssa
+int mix() {
+  int a = 7;
+  int b = a * 3 - 4;
+  long c = b;
+  unsigned u = 4000000000;
+  short s = -300;
+  unsigned char uc = 250;
+  c = c << 20;
+  c = c / 5 + (c % 11);
+  u = u + b;
+  uc = uc + 10;
+  s = s * 3;
+  return (c >> 12) ^ (u >> 24) ^ s ^ uc;
+}
+int swap() {
+  int x = 3;
+  int y = 11;
+  int t = x;
+  x = y;
+  y = t;
+  x = x * 16 + y;
+  return x - (x >> 2) + (x & 6);
+}
+int main(void) {
+  return (mix() + swap() * 3) & 255;
+}
@@ -0,0 +1,24 @@
+#!/bin/sh
+# Every program of the tests/errors has to fail to compile, with exactly
+# the errors of its "// error: " lines, as line:column: message
+cd "$(dirname "$0")/.."
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+fails=0
+count=0
+for file in tests/errors/*.c; do
+  count=$((count + 1))
+  sed -n 's|^// error: |'"$file"':|p' "$file" > "$tmp/expected"
+  if ./out/main -S -o "$tmp/out.s" "$file" > /dev/null 2> "$tmp/stderr"; then
+    echo "$file: compiled without an error"
+    fails=$((fails + 1))
+    continue
+  fi
+  sed -n 's|: error: |: |p' "$tmp/stderr" > "$tmp/actual"
+  if ! diff -u "$tmp/expected" "$tmp/actual"; then
+    echo "$file: the errors differ"
+    fails=$((fails + 1))
+  fi
+done
+echo "$count programs, $fails failed"
+[ "$fails" = 0 ]
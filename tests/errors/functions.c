@@ -0,0 +1,16 @@
+// error: 4:5: function parameters aren't supported yet
+// error: 10:5: redefinition of the function
+// error: 13:18: expected ';' or '{' after the parameters
+int add(int a, int b) {
+  return a + b;
+}
+int one(void) {
+  return 1;
+}
+int one(void) {
+  return 2;
+}
+int broken(void) return 3;
+int main(void) {
+  return one();
+}
@@ -0,0 +1,4 @@
+// error: 3:16: the body isn't closed
+int seed(void);
+int main(void) {
+  return seed();
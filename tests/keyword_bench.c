@@ -0,0 +1,96 @@
+// The lookup of the keywords, the perfect hash, that gen_keywords.c makes,
+// against the linear strncmp over the list, that it replaced, best of the
+// runs, on the words of a keyword heavy source. Both have to agree on
+// every word, the lexer finds them the same way.
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "arena.c"
+#include "intern.c"
+#include "scan.c"
+#include "tokenizer.c"
+
+#define RUNS 30
+#define WORD_COUNT (1 << 22)
+
+// Roughly the mix of a declaration heavy C source, half of them keywords
+static const char *const WORDS[] = {
+  "int", "i", "for", "unsigned", "count", "return", "const", "char", "ptr",
+  "if", "else", "while", "static", "struct", "node", "void", "sizeof", "len",
+  "break", "size_t", "switch", "case", "default", "long", "uint32_t", "x",
+  "typedef", "enum", "extern", "volatile", "goto", "do", "inline", "short",
+  "signed", "double", "float", "continue", "restrict", "_Bool", "register",
+  "union", "auto", "value", "next", "result", "buffer", "index", "p", "n",
+};
+
+#define COUNT(array) (sizeof(array) / sizeof(array[0]))
+
+static double now(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static TokenType linear(const char *start, uint32_t len) {
+  for (uint32_t i = 0; i < KEYWORD_COUNT; ++i) {
+    if (keywords[i].len != len) continue;
+    if (strncmp(keywords[i].ptr, start, len)) continue;
+    return KEYWORDS_START + i;
+  }
+  return TOK_IDENT;
+}
+
+// The same, as the one of Lexer_next
+static TokenType hashed(const char *start, uint32_t len) {
+  TokenType tt = keyword_slots[KEYWORD_HASH(start[0], start[len - 1], len,
+      KEYWORD_HASH_MUL_FIRST, KEYWORD_HASH_MUL_LAST, KEYWORD_HASH_BITS)];
+  if (!tt) return TOK_IDENT;
+  Str kw = keywords[tt - KEYWORDS_START];
+  if (kw.len != len || memcmp(kw.ptr, start, len)) return TOK_IDENT;
+  return tt;
+}
+
+static Str words[WORD_COUNT];
+
+static double bench(const char *name, TokenType (*lookup)(const char *, uint32_t)) {
+  double best = 1e9;
+  uint64_t found = 0;
+  for (int run = 0; run < RUNS; ++run) {
+    found = 0;
+    double start = now();
+    for (uint32_t i = 0; i < WORD_COUNT; ++i) found += lookup(words[i].ptr, words[i].len) != TOK_IDENT;
+    best = MIN(best, now() - start);
+  }
+  printf("%s: %.2f ns/word, %lu keywords\n", name, best / WORD_COUNT * 1e9, (unsigned long)found);
+  return best;
+}
+
+int main(void) {
+  srand(1);
+  for (uint32_t i = 0; i < WORD_COUNT; ++i) {
+    const char *word = WORDS[rand() % COUNT(WORDS)];
+    words[i] = (Str){ word, strlen(word) };
+  }
+  uint32_t fails = 0;
+  for (uint32_t i = 0; i < COUNT(WORDS); ++i) {
+    uint32_t len = strlen(WORDS[i]);
+    if (linear(WORDS[i], len) == hashed(WORDS[i], len)) continue;
+    printf("FAIL '%s': %s linearly, %s hashed\n", WORDS[i],
+        TOKEN_TYPE_STR[linear(WORDS[i], len)], TOKEN_TYPE_STR[hashed(WORDS[i], len)]);
+    fails++;
+  }
+  for (uint32_t i = 0; i < KEYWORD_COUNT; ++i) {
+    // the holes of the list
+    if (!keywords[i].len) continue;
+    if (hashed(keywords[i].ptr, keywords[i].len) == KEYWORDS_START + i) continue;
+    printf("FAIL '%.*s' isn't found hashed\n", keywords[i].len, keywords[i].ptr);
+    fails++;
+  }
+  double slow = bench("linear strncmp", linear);
+  double fast = bench("perfect hash", hashed);
+  printf("keywords: %.1fx faster hashed, %u failed\n", slow / fast, fails);
+  return fails != 0;
+}
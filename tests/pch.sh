@@ -0,0 +1,55 @@
+#!/bin/sh
+# The precompiled header of the tests/pch/prefix.h is emitted, and the
+# programs have to compile to the same output with it, as without it.
+# Once a header, that it's made of, changes, it isn't used anymore, and
+# the programs get the new header. A touch alone doesn't change it.
+cd "$(dirname "$0")/.."
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+cp tests/pch/* "$tmp"
+mcc=$PWD/out/main
+cd "$tmp"
+fails=0
+fail() {
+  echo "pch: $1"
+  fails=$((fails + 1))
+}
+
+# Compiles the file with it, it has to be used
+with() {
+  "$mcc" --stats --pch prefix.pch "$@" > stats 2> stderr || fail "$* failed with it"
+  grep -q "^pch: '.*prefix.h', " stats || fail "$* didn't use it: $(cat stderr)"
+}
+
+"$mcc" --emit-pch prefix.pch prefix.h > /dev/null || fail "the emit failed"
+for file in main.c other.c; do
+  with -S -o with.s "$file"
+  "$mcc" -S -o without.s "$file" > /dev/null
+  cmp -s with.s without.s || fail "$file has another assembly with it"
+done
+
+# both at once, sharing it
+"$mcc" main.c other.c > /dev/null 2>&1
+mv main.o main.expected.o
+mv other.o other.expected.o
+"$mcc" -j 2 --pch prefix.pch main.c other.c > /dev/null 2> stderr || fail "-j 2 failed with it"
+grep "not used" stderr && fail "-j 2 didn't use it"
+cmp -s main.o main.expected.o && cmp -s other.o other.expected.o || fail "-j 2 has other objects with it"
+
+touch inner.h prefix.h
+with -S -o with.s main.c
+
+sed 's/BASE 3/BASE 4/' inner.h > inner.new
+mv inner.new inner.h
+"$mcc" --run main.c > /dev/null 2>&1
+expected=$?
+"$mcc" --pch prefix.pch --run main.c > /dev/null 2> stderr
+actual=$?
+grep -q "not used: changed .*/inner.h" stderr || fail "the changed inner.h wasn't noticed: $(cat stderr)"
+[ "$actual" = "$expected" ] || fail "expected $expected with the changed inner.h, got $actual"
+
+"$mcc" --emit-pch prefix.pch prefix.h > /dev/null || fail "the emit again failed"
+with -S -o with.s main.c
+
+echo "pch: $fails failed"
+[ "$fails" = 0 ]
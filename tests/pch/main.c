@@ -0,0 +1,6 @@
+#include "prefix.h"
+
+int main() {
+  number n = TWICE(BASE) + shared;
+  return n + helper();
+}
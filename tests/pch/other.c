@@ -0,0 +1,5 @@
+#include "prefix.h"
+
+int main() {
+  return TWICE(helper()) + shared;
+}
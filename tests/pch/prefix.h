@@ -0,0 +1,10 @@
+// The prefix header, it's precompiled by the tests/pch.sh
+#ifndef PREFIX_H
+#define PREFIX_H
+#include "inner.h"
+#define TWICE(x) ((x) * 2)
+typedef int number;
+struct pair { int a; int b; };
+number shared = 5;
+number helper() { return BASE + 1; }
+#endif
@@ -0,0 +1,194 @@
+// Every rule of the peephole has a small input, that it has to fire on,
+// by its hit counter, and the code has to leave the same registers and
+// memory behind, before and after the rewrite, that's never longer. The
+// input goes between the loads of the registers from a state, at the rdi,
+// and their stores back to it, the rbp points into the state for the
+// stores of the input.
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "arena.c"
+#include "intern.c"
+#include "peephole.c"
+#include "writer.c"
+#include "x86.c"
+
+#define INSTS_MAX 64
+#define STATE_LEN 32
+
+// The ones of the inputs, the rdi, the rbp and the rsp are the harness
+static const uint8_t REGS[] = {
+  REG_RAX, REG_RCX, REG_RDX, REG_RBX, REG_RSI, REG_R8, REG_R9, REG_R10,
+};
+
+#define COUNT(array) (sizeof(array) / sizeof(array[0]))
+
+static X86Inst insts[INSTS_MAX];
+static uint32_t count;
+
+static void emit(X86Op op, X86Operand a, X86Operand b) {
+  assert(count < INSTS_MAX);
+  insts[count++] = (X86Inst){ .op = op, .a = a, .b = b };
+}
+
+static X86Operand none(void) {
+  return (X86Operand){0};
+}
+
+static X86Operand reg(uint32_t reg) {
+  return X86_reg(reg, 8);
+}
+
+static X86Operand slot(int32_t index) {
+  return X86_mem(REG_RBP, -8 * index, 8);
+}
+
+static void self_mov(void) {
+  emit(X86_MOV, reg(REG_RAX), reg(REG_RAX));
+}
+
+static void identity(void) {
+  emit(X86_ADD, reg(REG_RCX), X86_imm(0));
+  emit(X86_IMUL, reg(REG_RDX), X86_imm(1));
+}
+
+static void dead_mov(void) {
+  emit(X86_MOV, reg(REG_RAX), reg(REG_RCX));
+  emit(X86_MOV, reg(REG_RAX), reg(REG_RDX));
+}
+
+static void copy_back(void) {
+  emit(X86_MOV, reg(REG_RAX), reg(REG_RCX));
+  emit(X86_MOV, reg(REG_RCX), reg(REG_RAX));
+}
+
+// the rax is written again, before anything reads it
+static void forward(void) {
+  emit(X86_LEA, reg(REG_RAX), X86_indexed(REG_RCX, REG_RDX, 2, 3, 8));
+  emit(X86_MOV, reg(REG_RSI), reg(REG_RAX));
+  emit(X86_XOR, X86_reg(REG_RAX, 4), X86_reg(REG_RAX, 4));
+}
+
+static void narrow_copy(void) {
+  emit(X86_MOV, reg(REG_RAX), reg(REG_RCX));
+  emit(X86_MOV, X86_reg(REG_RAX, 4), X86_reg(REG_RAX, 4));
+}
+
+static void reload(void) {
+  emit(X86_MOV, slot(1), reg(REG_RAX));
+  emit(X86_MOV, reg(REG_RCX), slot(1));
+}
+
+static void store_back(void) {
+  emit(X86_MOV, reg(REG_RAX), slot(2));
+  emit(X86_MOV, slot(2), reg(REG_RAX));
+}
+
+static void dead_store(void) {
+  emit(X86_MOV, slot(3), reg(REG_RAX));
+  emit(X86_MOV, slot(3), X86_imm(-5));
+}
+
+static void push_pop(void) {
+  emit(X86_PUSH, reg(REG_RCX), none());
+  emit(X86_POP, reg(REG_R8), none());
+}
+
+static void jump_next(void) {
+  emit(X86_JMP, X86_label(0), none());
+  emit(X86_LABEL, X86_label(0), none());
+}
+
+static void (*const INPUTS[PEEPHOLE_COUNT])(void) = {
+  [PEEPHOLE_SELF_MOV] = self_mov,
+  [PEEPHOLE_IDENTITY] = identity,
+  [PEEPHOLE_DEAD_MOV] = dead_mov,
+  [PEEPHOLE_COPY_BACK] = copy_back,
+  [PEEPHOLE_FORWARD] = forward,
+  [PEEPHOLE_NARROW_COPY] = narrow_copy,
+  [PEEPHOLE_RELOAD] = reload,
+  [PEEPHOLE_STORE_BACK] = store_back,
+  [PEEPHOLE_DEAD_STORE] = dead_store,
+  [PEEPHOLE_PUSH_POP] = push_pop,
+  [PEEPHOLE_JUMP_NEXT] = jump_next,
+};
+
+// Without an input, it's only the harness, that nothing may fire on
+static void harness(void (*input)(void)) {
+  count = 0;
+  emit(X86_PUSH, reg(REG_RBX), none());
+  emit(X86_PUSH, reg(REG_RBP), none());
+  emit(X86_LEA, reg(REG_RBP), X86_mem(REG_RDI, 8 * STATE_LEN, 8));
+  for (uint32_t i = 0; i < COUNT(REGS); ++i) emit(X86_MOV, reg(REGS[i]), X86_mem(REG_RDI, 8 * REGS[i], 8));
+  if (input) input();
+  for (uint32_t i = 0; i < COUNT(REGS); ++i) emit(X86_MOV, X86_mem(REG_RDI, 8 * REGS[i], 8), reg(REGS[i]));
+  emit(X86_POP, reg(REG_RBP), none());
+  emit(X86_POP, reg(REG_RBX), none());
+  emit(X86_RET, none(), none());
+}
+
+static void run(const X86Code *code, Arena *scratch, uint64_t *state) {
+  X86Machine m;
+  X86_encode(code, scratch, &m);
+  size_t page = sysconf(_SC_PAGESIZE);
+  uint8_t *p = mmap(0, page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  assert(p != MAP_FAILED && m.len <= page);
+  memcpy(p, m.bytes, m.len);
+  assert(!mprotect(p, page, PROT_READ | PROT_EXEC));
+  ((void (*)(uint64_t *))p)(state);
+  assert(!munmap(p, page));
+  Arena_reset(scratch);
+}
+
+static uint32_t check(const char *name, void (*input)(void), PeepholeRule rule, Arena *scratch) {
+  harness(input);
+  X86Inst before[INSTS_MAX];
+  memcpy(before, insts, sizeof(X86Inst) * count);
+  X86Code original = { .insts = before, .count = count, .label_count = 2 };
+  X86Code rewritten = { .insts = insts, .count = count, .label_count = 2 };
+  PeepholeStats stats = {0};
+  X86_peephole(&rewritten, &stats);
+  uint64_t hits = 0;
+  for (uint32_t i = 0; i < PEEPHOLE_COUNT; ++i) hits += stats.hits[i];
+
+  // the state at the rdi, the slots are below the end of it
+  uint64_t expected[STATE_LEN], actual[STATE_LEN];
+  for (uint32_t i = 0; i < STATE_LEN; ++i) {
+    expected[i] = actual[i] = (uint64_t)rand() << 40 ^ (uint64_t)rand() << 20 ^ rand();
+  }
+  run(&original, scratch, expected);
+  run(&rewritten, scratch, actual);
+
+  uint32_t fails = 0;
+  if (input ? !stats.hits[rule] : hits != 0) {
+    printf("FAIL %s: %" PRIu64 " hits of its rule, %" PRIu64 " in all\n",
+        name, input ? stats.hits[rule] : 0, hits);
+    fails++;
+  }
+  if (rewritten.count > original.count) {
+    printf("FAIL %s: %u instructions, it was %u\n", name, rewritten.count, original.count);
+    fails++;
+  }
+  if (memcmp(expected, actual, sizeof(expected))) {
+    printf("FAIL %s: the state differs\n", name);
+    fails++;
+  }
+  return fails != 0;
+}
+
+int main(void) {
+  Arena scratch;
+  Arena_reserve(&scratch, ARENA_RESERVE);
+  srand(1);
+  uint32_t fails = check("the harness", 0, 0, &scratch);
+  for (uint32_t rule = 0; rule < PEEPHOLE_COUNT; ++rule) {
+    fails += check(PEEPHOLE_RULES[rule].name, INPUTS[rule], rule, &scratch);
+  }
+  printf("peephole: %u rules, %u failed\n", PEEPHOLE_COUNT, fails);
+  Arena_release(&scratch);
+  return fails != 0;
+}
@@ -0,0 +1,31 @@
+#!/bin/sh
+# Compiles every program of the tests/preprocessor with the mcc, as the
+# assembly and through the --run, and with the gcc, with the headers of
+# the tests/preprocessor/include on the -I, their exit statuses have to
+# match. The headers can only be included once, by their guards.
+cd "$(dirname "$0")/.."
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+include=tests/preprocessor/include
+fails=0
+count=0
+for file in tests/preprocessor/*.c; do
+  count=$((count + 1))
+  gcc -w -I "$include" -o "$tmp/expected" "$file" || { echo "$file: gcc failed"; fails=$((fails + 1)); continue; }
+  "$tmp/expected"
+  expected=$?
+  if ./out/main -I "$include" -S -o "$tmp/out.s" "$file" > /dev/null && gcc -o "$tmp/actual" "$tmp/out.s"; then
+    "$tmp/actual"
+    actual=$?
+  else
+    actual="a compile error"
+  fi
+  ./out/main -I "$include" --run "$file" > /dev/null 2>&1
+  run=$?
+  if [ "$actual" != "$expected" ] || [ "$run" != "$expected" ]; then
+    echo "$file: expected $expected, got $actual, and $run with the --run"
+    fails=$((fails + 1))
+  fi
+done
+echo "$count programs, $fails failed"
+[ "$fails" = 0 ]
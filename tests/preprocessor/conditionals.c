@@ -0,0 +1,43 @@
+#define LEVEL 2
+#define FLAGS 0x14
+
+#if LEVEL == 1
+int level = 10;
+#elif LEVEL == 2
+int level = 20;
+#elif LEVEL == 2
+int level = 30;
+#else
+int level = 40;
+#endif
+
+#if defined(MISSING) || !defined LEVEL
+int defined_ = 1;
+#elif (FLAGS & 0x4) && FLAGS >> 4 == 1 && 0XFFul == 255
+int defined_ = 2;
+#else
+int defined_ = 3;
+#endif
+
+#if 0
+#if 1
+int nested = 1;
+#else
+#error skipped
+#endif
+#elif 199901L > 0 || 1 ? 010 == 8 && 0 == 00 : 0
+int nested = 2;
+#else
+int nested = 3;
+#endif
+
+#undef LEVEL
+#ifdef LEVEL
+int undefined = 1;
+#elif -1 < 0 && ~0 == -1 && 7 / 2 == 3 && 7 % 4 == 3
+int undefined = 2;
+#endif
+
+int main() {
+  return level + defined_ * 3 + nested * 5 + undefined * 7;
+}
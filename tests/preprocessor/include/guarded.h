@@ -0,0 +1,6 @@
+// A second definition would be an error, the guard keeps it to one
+#ifndef GUARDED_H
+#define GUARDED_H
+int guarded() { return 5; }
+#include "nested/sibling.h"
+#endif
@@ -0,0 +1,5 @@
+// Found next to the header, that includes it, not through the -I
+#ifndef SIBLING_H
+#define SIBLING_H
+#define SIBLING 11
+#endif
@@ -0,0 +1,11 @@
+// The headers come from the -I tests/preprocessor/include
+#include "guarded.h"
+#include <guarded.h>
+#include "once.h"
+#include <once.h>
+#include "nested/sibling.h"
+#include "guarded.h"
+
+int main() {
+  return guarded() + once() * 2 + SIBLING * 3;
+}
@@ -0,0 +1,14 @@
+#define FIRST(first, ...) first
+#define REST(first, ...) (__VA_ARGS__)
+#define ALL(...) (__VA_ARGS__)
+#define SQUARE(x) ((x) * (x))
+#define APPLY(f, ...) f(__VA_ARGS__)
+
+int main() {
+  int a = FIRST(3, 4, 5);
+  int b = REST(3, 4, 5);
+  int c = ALL(1, 2, 9);
+  int d = APPLY(SQUARE, 6);
+  int e = FIRST(SQUARE(2), ignored);
+  return a + b * 2 + c * 3 + d + e * 4;
+}
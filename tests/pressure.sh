@@ -0,0 +1,18 @@
+#!/bin/sh
+# The peak register pressure of every program of the tests/pressure, from
+# the --stats, has to be the one in its "// peak pressure: " line
+cd "$(dirname "$0")/.."
+fails=0
+count=0
+for file in tests/pressure/*.c; do
+  count=$((count + 1))
+  expected=$(sed -n 's|^// peak pressure: \([0-9]*\).*|\1|p' "$file")
+  actual=$(./out/main --stats -S -o /dev/null "$file" | sed -n 's|.*peak pressure \([0-9]*\),.*|\1|p')
+  echo "$file: peak pressure $actual"
+  if [ "$actual" != "$expected" ]; then
+    echo "$file: expected $expected"
+    fails=$((fails + 1))
+  fi
+done
+echo "$count programs, $fails failed"
+[ "$fails" = 0 ]
@@ -0,0 +1,14 @@
+// A balanced tree of the binary expressions, the operands
+// take one more register at every level
+// peak pressure: 6
+int seed() {
+  return 3;
+}
+int balanced() {
+  int a = seed() + 1;
+  int b = seed() + 2;
+  return (((((a + 0) ^ (b + 1)) & ((a + 2) & (b + 3))) | (((a + 4) - (b + 5)) | ((a + 6) | (b + 7)))) - ((((a + 8) + (b + 9)) ^ ((a + 10) ^ (b + 11))) - (((a + 12) & (b + 13)) - ((a + 14) - (b + 15)))));
+}
+int main(void) {
+  return balanced() & 255;
+}
@@ -0,0 +1,57 @@
+// More values go around the loop, than there are registers for them,
+// some of them are spilled
+// peak pressure: 16
+int seed() {
+  return 3;
+}
+int carried() {
+  int v0 = seed() + 1;
+  int v1 = seed() + 2;
+  int v2 = seed() + 3;
+  int v3 = seed() + 4;
+  int v4 = seed() + 5;
+  int v5 = seed() + 6;
+  int v6 = seed() + 7;
+  int v7 = seed() + 8;
+  int v8 = seed() + 9;
+  int v9 = seed() + 10;
+  int v10 = seed() + 11;
+  int v11 = seed() + 12;
+  int v12 = seed() + 13;
+  int v13 = seed() + 14;
+  int i;
+  for (i = 0; i < 10; i++) {
+    v0 = v0 * 3 + v1;
+    v1 = v1 * 3 + v2;
+    v2 = v2 * 3 + v3;
+    v3 = v3 * 3 + v4;
+    v4 = v4 * 3 + v5;
+    v5 = v5 * 3 + v6;
+    v6 = v6 * 3 + v7;
+    v7 = v7 * 3 + v8;
+    v8 = v8 * 3 + v9;
+    v9 = v9 * 3 + v10;
+    v10 = v10 * 3 + v11;
+    v11 = v11 * 3 + v12;
+    v12 = v12 * 3 + v13;
+    v13 = v13 * 3 + v0;
+    v0 = v0 & 65535;
+    v1 = v1 & 65535;
+    v2 = v2 & 65535;
+    v3 = v3 & 65535;
+    v4 = v4 & 65535;
+    v5 = v5 & 65535;
+    v6 = v6 & 65535;
+    v7 = v7 & 65535;
+    v8 = v8 & 65535;
+    v9 = v9 & 65535;
+    v10 = v10 & 65535;
+    v11 = v11 & 65535;
+    v12 = v12 & 65535;
+    v13 = v13 & 65535;
+  }
+  return v0 ^ v1 ^ v2 ^ v3 ^ v4 ^ v5 ^ v6 ^ v7 ^ v8 ^ v9 ^ v10 ^ v11 ^ v12 ^ v13;
+}
+int main(void) {
+  return carried() & 255;
+}
@@ -0,0 +1,27 @@
+// The chains of the binary expressions, that lean to one side, the
+// deeper operand goes first, so only one more value is live at a time
+// peak pressure: 6, it was 19 in the order of the source
+int seed() {
+  return 3;
+}
+int right() {
+  int a = seed() + 3;
+  int b = seed() + 5;
+  int c = seed() + 7;
+  int d = seed() + 11;
+  int x = ((a + 0) + ((b + 1) - ((c + 2) ^ ((d + 3) | ((a + 4) & ((b + 5) * ((c + 6) + ((d + 7) - ((a + 8) ^ ((b + 9) | ((c + 10) & ((d + 11) * ((a + 12) + ((b + 13) - ((c + 14) ^ ((d + 15) | (a + 16)))))))))))))))));
+  int y = ((x + 0) + ((b + 1) - ((d + 2) ^ ((x + 3) | ((b + 4) & ((d + 5) * ((x + 6) + ((b + 7) - ((d + 8) ^ ((x + 9) | ((b + 10) & ((d + 11) * ((x + 12) + ((b + 13) - ((d + 14) ^ ((x + 15) | (b + 16)))))))))))))))));
+  return x ^ y;
+}
+int left() {
+  int a = seed() + 3;
+  int b = seed() + 5;
+  int c = seed() + 7;
+  int d = seed() + 11;
+  int x = (((((((((((((((((a + 16) | (d + 15)) ^ (c + 14)) - (b + 13)) + (a + 12)) * (d + 11)) & (c + 10)) | (b + 9)) ^ (a + 8)) - (d + 7)) + (c + 6)) * (b + 5)) & (a + 4)) | (d + 3)) ^ (c + 2)) - (b + 1)) + (a + 0));
+  int y = (((((((((((((((((b + 16) | (x + 15)) ^ (d + 14)) - (b + 13)) + (x + 12)) * (d + 11)) & (b + 10)) | (x + 9)) ^ (d + 8)) - (b + 7)) + (x + 6)) * (d + 5)) & (b + 4)) | (x + 3)) ^ (d + 2)) - (b + 1)) + (x + 0));
+  return x ^ y;
+}
+int main(void) {
+  return (right() + left()) & 255;
+}
@@ -0,0 +1,84 @@
+// The throughput of the lexer at every scan level, best of the runs, on a
+// comment heavy source with long identifiers and on short identifiers
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "arena.c"
+#include "intern.c"
+#include "scan.c"
+#include "tokenizer.c"
+
+#define RUNS 30
+
+static double now(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static char *long_source(size_t *len) {
+  static const char LINE[] =
+      "/*\n"
+      " * Adds the next sample to the running total and counts it, the average\n"
+      " * is only computed at the end, once all of the samples have been seen\n"
+      " */\n"
+      "  /* the running total of the samples, kept in the wide type */\n"
+      "  accumulated_sample_total_value = accumulated_sample_total_value + next_sample_value_1234;\n"
+      "  // and the count of them, for the average computed at the end\n"
+      "\t\tnumber_of_processed_samples_so_far = number_of_processed_samples_so_far + 1;\n";
+  size_t count = 10900000 / CSTR_LEN(LINE);
+  char *s = malloc(count * CSTR_LEN(LINE) + 1);
+  for (size_t i = 0; i < count; ++i) memcpy(s + i * CSTR_LEN(LINE), LINE, CSTR_LEN(LINE));
+  *len = count * CSTR_LEN(LINE);
+  s[*len] = 0;
+  return s;
+}
+
+static char *short_source(size_t *len) {
+  size_t count = 2000000;
+  char *s = malloc(count * 4 + 1);
+  for (size_t i = 0; i < count; ++i) {
+    s[i * 4] = 'a' + i % 26;
+    s[i * 4 + 1] = 'a' + i / 26 % 26;
+    s[i * 4 + 2] = i % 7 ? ' ' : '\n';
+    s[i * 4 + 3] = ' ';
+  }
+  *len = count * 4;
+  s[*len] = 0;
+  return s;
+}
+
+static void bench(const char *name, const char *source, size_t len) {
+  Interner in;
+  Interner_init(&in);
+  for (ScanLevel level = SCAN_SCALAR; level <= scan_detect(); ++level) {
+    scan_select(level);
+    double best = 1e9;
+    uint64_t tokens = 0;
+    for (int run = 0; run < RUNS; ++run) {
+      Lexer l;
+      Lexer_init(&l, &in, source, 0);
+      tokens = 0;
+      double start = now();
+      while (Lexer_next(&l).type != TOK_NONE) tokens++;
+      best = MIN(best, now() - start);
+    }
+    printf("%s %s: %.0f MB/s, %lu tokens\n", name, SCAN_LEVEL_STR[level],
+        len / best / 1e6, (unsigned long)tokens);
+  }
+  Interner_free(&in);
+}
+
+int main(void) {
+  size_t len;
+  char *source = long_source(&len);
+  bench("long", source, len);
+  free(source);
+  source = short_source(&len);
+  bench("short", source, len);
+  free(source);
+  return 0;
+}
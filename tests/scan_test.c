@@ -0,0 +1,113 @@
+// The token stream of every scan level has to be the same as the scalar
+// one, with the runs straddling the 16 and 32 byte blocks, at every
+// alignment, and with the source ending right before an unmapped page
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "arena.c"
+#include "intern.c"
+#include "scan.c"
+#include "tokenizer.c"
+
+#define SOURCE_MAX 2048
+#define TOKENS_MAX 2048
+
+// around the block sizes
+static const uint32_t LENS[] = { 1, 2, 15, 16, 17, 31, 32, 33, 47, 48, 63, 64, 65 };
+#define LEN() LENS[rand() % (sizeof(LENS) / sizeof(LENS[0]))]
+
+static uint32_t repeat(char *out, const char *chars, uint32_t len) {
+  uint32_t n = strlen(chars);
+  for (uint32_t i = 0; i < len; ++i) out[i] = chars[rand() % n];
+  return len;
+}
+
+static uint32_t generate(char *out) {
+  uint32_t len = 0;
+  while (len < SOURCE_MAX - 256) {
+    char *p = out + len;
+    switch (rand() % 7) {
+      case 0: len += repeat(p, " \t\r\n\v\f", LEN()); break;
+      case 1: len += repeat(p, "0123456789", LEN()); break;
+      case 2:
+        p[0] = "_aZp"[rand() % 4];
+        len += 1 + repeat(p + 1, "_azAZpP09oO", LEN() - 1);
+        break;
+      case 3:
+        len += repeat(p, "//", 2);
+        len += repeat(p + 2, "ab */\t*", LEN());
+        out[len++] = '\n';
+        break;
+      case 4:
+        memcpy(p, "/*", 2);
+        len += 2 + repeat(p + 2, "ab\n *", LEN());
+        memcpy(out + len, "*/", 2);
+        len += 2;
+        break;
+      case 5: len += repeat(p, "+-*;(){}<>=!&|", 1 + rand() % 3); break;
+      case 6: out[len++] = ' '; break;
+    }
+  }
+  // a run up to the terminator
+  len += repeat(out + len, "abc", LEN());
+  out[len] = 0;
+  return len;
+}
+
+static uint32_t lex(Interner *in, const char *source, Token *tokens) {
+  Lexer l;
+  Lexer_init(&l, in, source, 0);
+  uint32_t n = 0;
+  do {
+    assert(n < TOKENS_MAX);
+    tokens[n] = Lexer_next(&l);
+  } while (tokens[n++].type != TOK_NONE);
+  return n;
+}
+
+static bool same(const Token *a, const Token *b, uint32_t n) {
+  for (uint32_t i = 0; i < n; ++i) {
+    if (a[i].type != b[i].type || a[i].len != b[i].len || a[i].start != b[i].start) return false;
+    if (a[i].sym != b[i].sym) return false;
+  }
+  return true;
+}
+
+int main(void) {
+  ScanLevel top = scan_detect();
+  size_t page = sysconf(_SC_PAGESIZE);
+  // the last page is left unmapped
+  uint8_t *pages = mmap(0, page * 3, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  assert(pages != MAP_FAILED);
+  assert(!mprotect(pages + page * 2, page, PROT_NONE));
+  Interner in;
+  Interner_init(&in);
+  static char source[SOURCE_MAX];
+  static Token expected[TOKENS_MAX], tokens[TOKENS_MAX];
+  uint32_t checks = 0, fails = 0;
+  for (uint32_t seed = 0; seed < 200; ++seed) {
+    srand(seed);
+    uint32_t len = generate(source);
+    // 64 alignments, then 64 ends right before the unmapped page
+    for (uint32_t place = 0; place < 128; ++place) {
+      char *at = place < 64 ? (char *)pages + place : (char *)pages + page * 2 - len - 1 - (place - 64);
+      memcpy(at, source, len + 1);
+      scan_select(SCAN_SCALAR);
+      uint32_t n = lex(&in, at, expected);
+      for (ScanLevel level = SCAN_SCALAR + 1; level <= top; ++level) {
+        scan_select(level);
+        uint32_t m = lex(&in, at, tokens);
+        checks++;
+        if (m != n || !same(expected, tokens, n)) {
+          if (fails++ < 5) printf("FAIL %s seed %u place %u\n", SCAN_LEVEL_STR[level], seed, place);
+        }
+      }
+    }
+  }
+  printf("scan: %u checks up to %s, %u failed\n", checks, SCAN_LEVEL_STR[top], fails);
+  return fails != 0;
+}
@@ -0,0 +1,73 @@
+#!/bin/sh
+# The programs of the corpora are compiled by a server and directly, their
+# outputs, the logs and the exit statuses have to be the same, also for
+# the ones of the tests/errors. A header, that changes between requests,
+# is read again, a request, that crashes the compiler, doesn't take the
+# server down, and --run is rejected.
+cd "$(dirname "$0")/.."
+tmp=$(mktemp -d)
+socket="$tmp/socket"
+./out/main --server "$socket" 2> "$tmp/server.log" &
+server=$!
+trap 'kill $server 2> /dev/null; rm -rf "$tmp"' EXIT
+for i in $(seq 50); do
+  [ -S "$socket" ] && break
+  sleep 0.1
+done
+fails=0
+count=0
+fail() {
+  echo "server: $1"
+  fails=$((fails + 1))
+}
+
+# Runs the arguments both ways, with the outputs named after the way
+same() {
+  name=$1
+  shift
+  ./out/main "$@" -o "$tmp/direct.$name" > "$tmp/direct.out" 2> "$tmp/direct.err"
+  direct=$?
+  ./out/main --connect "$socket" "$@" -o "$tmp/served.$name" > "$tmp/served.out" 2> "$tmp/served.err"
+  served=$?
+  count=$((count + 1))
+  sed -i "s|$tmp/served|$tmp/direct|" "$tmp/served.out" "$tmp/served.err"
+  if [ $direct != $served ]; then
+    fail "$*: exit status $served, it's $direct directly"
+  elif ! cmp -s "$tmp/direct.out" "$tmp/served.out" || ! cmp -s "$tmp/direct.err" "$tmp/served.err"; then
+    fail "$*: the log differs"
+  elif [ $direct = 0 ] && ! cmp -s "$tmp/direct.$name" "$tmp/served.$name"; then
+    fail "$*: the .$name differs"
+  fi
+}
+
+for file in tests/codegen/*.c tests/pressure/*.c tests/tiles/*.c; do
+  same o "$file"
+  same s -S "$file"
+done
+for file in tests/errors/*.c; do
+  same s -S "$file"
+done
+for file in tests/preprocessor/*.c; do
+  same o -I tests/preprocessor/include "$file"
+done
+
+cp -r tests/preprocessor/include "$tmp/include"
+same o -I "$tmp/include" tests/preprocessor/includes.c
+# a new file, like the editors write it
+sed 's/return 7;/return 7 * 2 + 1;/' tests/preprocessor/include/once.h > "$tmp/once.h"
+mv "$tmp/once.h" "$tmp/include/once.h"
+same o -I "$tmp/include" tests/preprocessor/includes.c
+
+printf 'int main() {\n  goto nowhere;\n}\n' > "$tmp/crash.c"
+./out/main --connect "$socket" -S -o "$tmp/crash.s" "$tmp/crash.c" > /dev/null 2>&1 \
+  && fail "the crash compiled"
+same o tests/codegen/straight.c
+
+./out/main --connect "$socket" --run tests/codegen/straight.c > /dev/null 2> "$tmp/run.err" \
+  && fail "--run was served"
+grep -q "^--run isn't served" "$tmp/run.err" || fail "--run: $(cat "$tmp/run.err")"
+
+./out/main --connect "$socket" --shutdown || fail "the shutdown failed"
+wait $server || fail "the server failed: $(cat "$tmp/server.log")"
+echo "server: $count requests, $fails failed"
+[ "$fails" = 0 ]
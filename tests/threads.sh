@@ -0,0 +1,52 @@
+#!/bin/sh
+# A generated file of many functions, that spans several windows of the
+# parser at every thread count, is compiled with -j 1, 2, 4 and 8, as the
+# object, as the assembly and with the --cache, all of them have to be
+# byte-identical, and the program has to return what the gcc one does.
+# The functions have their own structs, labels and shadowed locals, that
+# get new ids, when they're merged, and the globals between them change
+# what's visible to the next ones.
+cd "$(dirname "$0")/.."
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+fails=0
+fail() {
+  echo "threads: $1"
+  fails=$((fails + 1))
+}
+
+awk 'BEGIN {
+  n = 1500
+  for (i = 0; i < n; i++) {
+    if (i % 7 == 0) printf "int g%d = %d;\n", i, i % 13
+    printf "int f%d(void) {\n", i
+    printf "  struct s%d { int a; int b; } unused;\n", i % 5
+    printf "  int a = %d;\n  int b = 0;\n  int k;\n", i % 11
+    printf "  for (k = 0; k < 3; k++) {\n    int a = k * 2;\n    b += a;\n  }\n"
+    printf "  if (b > %d) goto done;\n  b = b + a;\ndone:\n", i % 9
+    if (i) printf "  b = b + f%d();\n", int(i * 7 / 9)
+    printf "  return (b + g%d) & 1023;\n}\n", i - i % 7
+  }
+  printf "int main(void) {\n  int sum = 0;\n"
+  for (i = n - 1; i >= 0; i -= 97) printf "  sum = sum ^ f%d();\n", i
+  printf "  return sum & 255;\n}\n"
+}' > "$tmp/many.c"
+
+gcc -w -o "$tmp/expected" "$tmp/many.c"
+"$tmp/expected"
+expected=$?
+for j in 1 2 4 8; do
+  ./out/main -j $j -o "$tmp/$j.o" "$tmp/many.c" > /dev/null || fail "-j $j failed"
+  ./out/main -j $j -S -o "$tmp/$j.s" "$tmp/many.c" > /dev/null || fail "-j $j -S failed"
+  ./out/main -j $j --cache "$tmp/cache" -o "$tmp/cached.$j.o" "$tmp/many.c" > /dev/null \
+    || fail "-j $j --cache failed"
+  cmp -s "$tmp/1.o" "$tmp/$j.o" || fail "-j $j has another object than -j 1"
+  cmp -s "$tmp/1.s" "$tmp/$j.s" || fail "-j $j has another assembly than -j 1"
+  cmp -s "$tmp/1.o" "$tmp/cached.$j.o" || fail "-j $j has another object with the --cache"
+done
+gcc -o "$tmp/actual" "$tmp/1.o"
+"$tmp/actual"
+actual=$?
+[ "$actual" = "$expected" ] || fail "expected $expected, got $actual"
+echo "threads: -j 1, 2, 4 and 8, $fails failed"
+[ "$fails" = 0 ]
@@ -0,0 +1,34 @@
+#!/bin/sh
+# Every program of the tests/tiles has to select its tiles: each of its
+# "// selects: " patterns has to be in its assembly, and none of its
+# "// not: " ones. They're extended regular expressions, of the grep.
+cd "$(dirname "$0")/.."
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+fails=0
+count=0
+for file in tests/tiles/*.c; do
+  count=$((count + 1))
+  if ! ./out/main -S -o "$tmp/out.s" "$file" > /dev/null; then
+    echo "$file: a compile error"
+    fails=$((fails + 1))
+    continue
+  fi
+  failed=0
+  sed -n 's|^// selects: ||p' "$file" > "$tmp/selects"
+  while read -r pattern; do
+    grep -qE "$pattern" "$tmp/out.s" && continue
+    printf "%s: no '%s'\n" "$file" "$pattern"
+    failed=1
+  done < "$tmp/selects"
+  sed -n 's|^// not: ||p' "$file" > "$tmp/nots"
+  while read -r pattern; do
+    grep -qE "$pattern" "$tmp/out.s" || continue
+    printf "%s: '%s' in %s\n" "$file" "$pattern" "$(grep -E "$pattern" "$tmp/out.s" | head -1)"
+    failed=1
+  done < "$tmp/nots"
+  echo "$file: $(grep -c '^  ' "$tmp/out.s") instructions"
+  fails=$((fails + failed))
+done
+echo "$count programs, $fails failed"
+[ "$fails" = 0 ]
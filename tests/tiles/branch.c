@@ -0,0 +1,36 @@
+// The comparisons, that only the branch right after them uses, set the
+// flags for the jump, without the setcc and the test of its result
+// selects: cmp r[a-z0-9]*, [0-9]+
+// selects: cmp r[a-z0-9]*, r[a-z0-9]*
+// selects: test (r[a-z0-9]*), \1
+// selects: j(l|le|g|ge|e|ne) 
+// not: set
+int seed() {
+  return 9;
+}
+int count() {
+  int n = seed();
+  int total = 0;
+  int i = 0;
+  while (i < n) {
+    if (i == 3) total = total + 100;
+    if (i >= 7) total = total + 10;
+    total = total + i;
+    i = i + 1;
+  }
+  return total;
+}
+int compare() {
+  int a = seed();
+  int b = seed() - 4;
+  int r = 0;
+  if (a > b) r = r + 1;
+  if (a <= b) r = r + 2;
+  if (a != b) r = r + 4;
+  if (5 < a) r = r + 8;
+  if (b) r = r + 16;
+  return r;
+}
+int main(void) {
+  return (count() + compare()) & 255;
+}
@@ -0,0 +1,32 @@
+// The adds into another register, and the multiplications by 3, 5 and 9
+// selects: lea r[a-z0-9]*, qword ptr \[r[a-z0-9]* \+ 12\]
+// selects: lea r[a-z0-9]*, qword ptr \[r[a-z0-9]* - 1000\]
+// selects: lea r[a-z0-9]*, qword ptr \[r[a-z0-9]* \+ r[a-z0-9]*\]
+// selects: lea r[a-z0-9]*, qword ptr \[(r[a-z0-9]*) \+ \1\*[248]\]
+int seed() {
+  return 7;
+}
+int offsets() {
+  int a = seed();
+  int b = a + 12;
+  int c = a - 1000;
+  int d = b + 100000;
+  return a ^ b ^ c ^ d;
+}
+int sums() {
+  long a = seed();
+  long b = seed() * 11;
+  long c = a + b;
+  long d = c + a;
+  return (a ^ b ^ c ^ d) & 255;
+}
+int multiples() {
+  int a = seed();
+  int b = a * 3;
+  int c = a * 5;
+  int d = a * 9;
+  return a + (b ^ c ^ d);
+}
+int main(void) {
+  return (offsets() + sums() + multiples()) & 255;
+}
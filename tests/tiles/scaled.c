@@ -0,0 +1,28 @@
+// The shifts and the multiplications by 2, 4 and 8, that go into the
+// scaled index of the add, instead of their own instructions
+// selects: lea r[a-z0-9]*, qword ptr \[r[a-z0-9]* \+ r[a-z0-9]*\*2\]
+// selects: lea r[a-z0-9]*, qword ptr \[r[a-z0-9]* \+ r[a-z0-9]*\*4\]
+// selects: lea r[a-z0-9]*, qword ptr \[r[a-z0-9]* \+ r[a-z0-9]*\*8\]
+// not: (shl|imul) 
+int seed() {
+  return 5;
+}
+int shifts() {
+  int base = seed() + 100;
+  int i = seed() + 1;
+  int a = base + (i << 1);
+  int b = base + (i << 2);
+  int c = (i << 3) + base;
+  return a ^ b ^ c;
+}
+long multiplications() {
+  long base = seed() + 1000;
+  long i = seed() - 2;
+  long a = base + i * 2;
+  long b = base + i * 4;
+  long c = i * 8 + base;
+  return a + b + c;
+}
+int main(void) {
+  return (shifts() + multiplications()) & 255;
+}
@@ -0,0 +1,16 @@
+#!/bin/sh
+# The encoder has to give the bytes and the relocations of the assembler,
+# for the function of the out/x86_test, see tests/x86_test.c
+cd "$(dirname "$0")/.."
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+./out/x86_test "$dir/encoded" || exit 1
+as -o "$dir/assembled.o" "$dir/encoded.s" || exit 1
+# without the header, that has the name of the file
+objdump -dr "$dir/encoded.o" | tail -n +4 > "$dir/encoded.dump"
+objdump -dr "$dir/assembled.o" | tail -n +4 > "$dir/assembled.dump"
+if ! diff -u "$dir/assembled.dump" "$dir/encoded.dump"; then
+  echo "x86: the encoding differs from the one of the as"
+  exit 1
+fi
+echo "x86: $(grep -c '^ ' "$dir/encoded.dump") lines, the same as the ones of the as"
@@ -0,0 +1,245 @@
+// The encoder against the assembler: a function of every form, that the
+// encoder has, is written both as the assembly and as the object, and the
+// tests/x86.sh compares the objdump of the two. The registers go through
+// all sixteen, for the rex, the bases through rsp, rbp, r12 and r13, for
+// the sib and the displacements, and the globals and the calls make the
+// relocations.
+#define _DEFAULT_SOURCE
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "arena.c"
+#include "intern.c"
+#include "object.c"
+#include "writer.c"
+#include "x86.c"
+
+#define INSTS_MAX 8192
+
+static const uint32_t SIZES[] = { 1, 2, 4, 8 };
+static const int32_t DISPS[] = { 0, 8, -128, 127, 128, -129, 0x12345678, -0x1000 };
+static const int64_t IMMS[] = { 1, -1, 127, -128, 128, 0x7fff, 0x12345678, -0x80000000ll };
+
+#define COUNT(array) (sizeof(array) / sizeof(array[0]))
+
+static X86Code code;
+
+static void emit(X86Op op, X86Operand a, X86Operand b) {
+  assert(code.count < INSTS_MAX);
+  code.insts[code.count++] = (X86Inst){ .op = op, .a = a, .b = b };
+}
+
+static void cond(X86Op op, uint32_t cc, X86Operand a) {
+  assert(code.count < INSTS_MAX);
+  code.insts[code.count++] = (X86Inst){ .op = op, .cc = cc, .a = a };
+}
+
+static void label(uint32_t label) {
+  emit(X86_LABEL, X86_label(label), (X86Operand){0});
+}
+
+static X86Operand none(void) {
+  return (X86Operand){0};
+}
+
+static void registers(void) {
+  for (uint32_t s = 0; s < COUNT(SIZES); ++s) {
+    uint32_t size = SIZES[s];
+    for (uint32_t r = 0; r < REG_COUNT; ++r) {
+      X86Operand a = X86_reg(r, size), b = X86_reg(REG_COUNT - 1 - r, size);
+      emit(X86_MOV, a, b);
+      emit(X86_ADD, a, b);
+      emit(X86_XOR, b, a);
+      emit(X86_TEST, a, b);
+      emit(X86_CMP, a, X86_imm(1));
+      emit(X86_SUB, a, X86_imm(size == 1 ? -2 : 0x1234));
+      emit(X86_NEG, a, none());
+      emit(X86_SHL, a, X86_imm(1));
+      emit(X86_SAR, a, X86_imm(3));
+      emit(X86_SHR, a, X86_reg(REG_RCX, 1));
+      if (size == 1) {
+        for (uint32_t cc = 0; cc < 16; ++cc) cond(X86_SETCC, cc, a);
+        continue;
+      }
+      emit(X86_IMUL, a, b);
+      emit(X86_IMUL, a, X86_imm(5));
+      emit(X86_IMUL, a, X86_imm(1000));
+      emit(X86_MOVSX, a, X86_reg(r, 1));
+      emit(X86_MOVZX, a, X86_reg(REG_COUNT - 1 - r, 1));
+      if (size > 2) {
+        emit(X86_MOVSX, a, X86_reg(r, 2));
+        emit(X86_MOVZX, a, X86_reg(r, 2));
+      }
+    }
+  }
+  for (uint32_t r = 0; r < REG_COUNT; ++r) {
+    emit(X86_MOVSXD, X86_reg(r, 8), X86_reg(REG_COUNT - 1 - r, 4));
+    emit(X86_NOT, X86_reg(r, 8), none());
+    emit(X86_DIV, X86_reg(r, 4), none());
+    emit(X86_IDIV, X86_reg(r, 8), none());
+    emit(X86_PUSH, X86_reg(r, 8), none());
+    emit(X86_POP, X86_reg(r, 8), none());
+  }
+}
+
+static void immediates(void) {
+  for (uint32_t i = 0; i < COUNT(IMMS); ++i) {
+    int64_t imm = IMMS[i];
+    // the accumulator has the short ones
+    emit(X86_ADD, X86_reg(REG_RAX, 8), X86_imm(imm));
+    emit(X86_AND, X86_reg(REG_RAX, 4), X86_imm(imm));
+    emit(X86_OR, X86_reg(REG_R11, 8), X86_imm(imm));
+    emit(X86_CMP, X86_reg(REG_RSI, 4), X86_imm(imm));
+    emit(X86_MOV, X86_reg(REG_RDX, 4), X86_imm(imm));
+    emit(X86_MOV, X86_reg(REG_R9, 8), X86_imm(imm));
+    emit(X86_IMUL, X86_reg(REG_R14, 8), X86_imm(imm));
+    emit(X86_PUSH, X86_imm(imm), none());
+  }
+  emit(X86_ADD, X86_reg(REG_RAX, 1), X86_imm(5));
+  emit(X86_ADD, X86_reg(REG_RAX, 2), X86_imm(0x1234));
+  emit(X86_MOV, X86_reg(REG_RAX, 8), X86_imm(0x123456789abcdefll));
+  emit(X86_MOV, X86_reg(REG_R15, 8), X86_imm(0xffffffffll));
+  emit(X86_MOV, X86_reg(REG_R12, 2), X86_imm(-2));
+  emit(X86_MOV, X86_reg(REG_RDI, 1), X86_imm(7));
+}
+
+static void memory(void) {
+  for (uint32_t base = 0; base < REG_COUNT; ++base) {
+    for (uint32_t d = 0; d < COUNT(DISPS); ++d) {
+      int32_t disp = DISPS[d];
+      uint32_t reg = (base + 3) % REG_COUNT;
+      emit(X86_MOV, X86_mem(base, disp, 8), X86_reg(reg, 8));
+      emit(X86_MOV, X86_reg(reg, 4), X86_mem(base, disp, 4));
+      emit(X86_MOV, X86_mem(base, disp, 1), X86_reg(reg, 1));
+      emit(X86_MOV, X86_mem(base, disp, 2), X86_imm(-3));
+      emit(X86_MOV, X86_mem(base, disp, 8), X86_imm(0x12345));
+      emit(X86_ADD, X86_mem(base, disp, 4), X86_imm(1));
+      emit(X86_CMP, X86_mem(base, disp, 1), X86_imm(9));
+      emit(X86_SUB, X86_reg(reg, 8), X86_mem(base, disp, 8));
+      emit(X86_LEA, X86_reg(reg, 8), X86_mem(base, disp, 8));
+      emit(X86_MOVZX, X86_reg(reg, 4), X86_mem(base, disp, 1));
+      emit(X86_MOVSX, X86_reg(reg, 8), X86_mem(base, disp, 2));
+      emit(X86_MOVSXD, X86_reg(reg, 8), X86_mem(base, disp, 4));
+      emit(X86_IMUL, X86_reg(reg, 4), X86_mem(base, disp, 4));
+      emit(X86_SHL, X86_mem(base, disp, 8), X86_imm(2));
+      emit(X86_IDIV, X86_mem(base, disp, 8), none());
+      emit(X86_PUSH, X86_mem(base, disp, 8), none());
+      emit(X86_POP, X86_mem(base, disp, 8), none());
+      cond(X86_SETCC, CC_L, X86_mem(base, disp, 1));
+    }
+    for (uint32_t index = 0; index < REG_COUNT; ++index) {
+      if (index == REG_RSP) continue;
+      for (uint32_t scale = 0; scale < 4; ++scale) {
+        emit(X86_LEA, X86_reg(index, 8), X86_indexed(base, index, scale, 0, 8));
+        emit(X86_MOV, X86_reg(base, 4), X86_indexed(base, index, scale, -8, 4));
+        emit(X86_MOV, X86_indexed(base, index, scale, 0x1000, 8), X86_reg(index, 8));
+      }
+    }
+  }
+}
+
+// The displacement of a global is relative to the end, after the immediate
+static void relocations(Interner *in) {
+  SymId global = Interner_intern(in, "counter", CSTR_LEN("counter"));
+  SymId symbol = Interner_intern(in, "callee", CSTR_LEN("callee"));
+  for (uint32_t s = 0; s < COUNT(SIZES); ++s) {
+    uint32_t size = SIZES[s];
+    emit(X86_MOV, X86_reg(REG_R10, size), X86_global(global, size));
+    emit(X86_MOV, X86_global(global, size), X86_reg(REG_RSI, size));
+    emit(X86_ADD, X86_global(global, size), X86_imm(1));
+    emit(X86_CMP, X86_global(global, size), X86_imm(size == 1 ? 100 : 1000));
+    emit(X86_MOV, X86_global(global, size), X86_imm(-5));
+  }
+  emit(X86_LEA, X86_reg(REG_RAX, 8), X86_global(global, 8));
+  emit(X86_SHL, X86_global(global, 4), X86_imm(3));
+  emit(X86_CALL, X86_symbol(symbol), none());
+  emit(X86_CALL, X86_symbol(global), none());
+}
+
+// The short ones, and the near ones, around the filler
+static void jumps(void) {
+  label(0);
+  cond(X86_JCC, CC_E, X86_label(2));
+  emit(X86_JMP, X86_label(1), none());
+  label(1);
+  cond(X86_JCC, CC_NE, X86_label(0));
+  for (uint32_t cc = 0; cc < 16; ++cc) cond(X86_JCC, cc, X86_label(3));
+  emit(X86_JMP, X86_label(3), none());
+  label(2);
+  for (uint32_t i = 0; i < 40; ++i) emit(X86_MOV, X86_mem(REG_RBP, -8 * i, 8), X86_imm(i));
+  label(3);
+  for (uint32_t cc = 0; cc < 16; ++cc) cond(X86_JCC, cc, X86_label(0));
+  emit(X86_JMP, X86_label(0), none());
+  emit(X86_JMP, X86_label(2), none());
+  emit(X86_CQO, none(), none());
+  emit(X86_LEAVE, none(), none());
+  emit(X86_RET, none(), none());
+  emit(X86_UD2, none(), none());
+}
+
+static int open_output(const char *prefix, const char *extension) {
+  char path[256];
+  assert(snprintf(path, sizeof(path), "%s.%s", prefix, extension) < (int)sizeof(path));
+  int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    perror(path);
+    exit(1);
+  }
+  return fd;
+}
+
+int main(int argc, char **argv) {
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s <prefix of the .s and the .o>\n", argv[0]);
+    return 1;
+  }
+  Interner in;
+  Interner_init(&in);
+  Arena scratch;
+  Arena_reserve(&scratch, ARENA_RESERVE);
+  Str name = { "encoded", CSTR_LEN("encoded") };
+  Interner_intern(&in, name.ptr, name.len);
+  code = (X86Code){
+    .interner = &in,
+    .name = name,
+    .insts = malloc(sizeof(X86Inst) * INSTS_MAX),
+    .label_count = 4,
+  };
+  assert(code.insts);
+  registers();
+  immediates();
+  memory();
+  relocations(&in);
+  jumps();
+
+  Writer out;
+  int fd = open_output(argv[1], "s");
+  Writer_file(&out, fd);
+  Writer_cstr(&out, ".intel_syntax noprefix\n");
+  X86_print(&out, &code);
+  Writer_cstr(&out, "\n.section .note.GNU-stack,\"\",@progbits\n");
+  Writer_close(&out);
+  close(fd);
+
+  X86Machine m;
+  X86_encode(&code, &scratch, &m);
+  char *data;
+  size_t len;
+  Object_pack(&m, &in, &data, &len);
+  ObjectFunction function = { .name = name, .data = data, .len = len };
+  fd = open_output(argv[1], "o");
+  Writer_file(&out, fd);
+  Object_write(&out, &in, &function, 1, 0, 0);
+  Writer_close(&out);
+  close(fd);
+
+  printf("%u instructions, %u bytes, %u relocations\n", code.count, m.len, m.reloc_count);
+  free(data);
+  free(code.insts);
+  Arena_release(&scratch);
+  Interner_free(&in);
+  return 0;
+}